@@ -5,7 +5,7 @@ __author__ = 'Barry Drake'
 
 
 import ctypes as ct
-from typing import Any, Iterable, Optional, Tuple, Iterator
+from typing import Any, Iterable, List, Optional, Tuple, Iterator
 import numpy as np
 import sys as _sys
 import os as _os
@@ -34,6 +34,22 @@ _str_t = ct.c_char_p
 # The ctypes type of pointers to a native objects.
 _AStarNN = ct.c_void_p
 _AStarIndex = ct.c_void_p
+_AStarBoundedIndex = ct.c_void_p
+_AStarVersionedIndex = ct.c_void_p
+_AStarIndexSnapshot = ct.c_void_p
+_ProbeCursor = ct.c_void_p
+_AStarPartitionedIndex = ct.c_void_p
+_AStarServer = ct.c_void_p
+_AStarClient = ct.c_void_p
+_SharedIndex = ct.c_void_p
+_ShardMap = ct.c_void_p
+_ShardCoordinator = ct.c_void_p
+_LatticeCodec = ct.c_void_p
+_SparseAStarNN = ct.c_void_p
+_E8NN = ct.c_void_p
+_E8Index = ct.c_void_p
+_VectorTransform = ct.c_void_p
+_ProbeProfile = ct.c_void_p
 
 # The ctypes type of Error code.
 _Error_t = ct.c_uint
@@ -51,7 +67,10 @@ _HashCode_t = _uint64_t
 _HashVector_t = np.ctypeslib.ndpointer(dtype=_HashCode_t)
 
 # The ctypes type of the number of dimensions.
-_Dim_t = _uint16_t
+_Dim_t = _uint32_t
+
+# The ctypes type of an array of dimension indices.
+_DimVector_t = np.ctypeslib.ndpointer(dtype=np.uint32)
 
 # The ctypes type of lattice point 'k' value.
 _K_t = _uint64_t
@@ -261,38 +280,231 @@ def _register_all():
     _register('AStar_cvector_to_lattice_point', _Dim_t, _Distance_t, _CVector_t, _Vector_t)
 
     _register('AStarNN_new', _Dim_t, _Distance_t, _NumShells_t, _Ptr(_AStarNN))
+    _register('AStarNN_new_transformed', _VectorTransform, _Distance_t, _NumShells_t, _Ptr(_AStarNN))
     _register('AStarNN_delete', _AStarNN)
     _register('AStarNN_dim', _AStarNN, _Ptr(_Dim_t))
+    _register('AStarNN_input_dim', _AStarNN, _Ptr(_Dim_t))
     _register('AStarNN_packing_radius', _AStarNN, _Ptr(_Distance_t))
     _register('AStarNN_scale', _AStarNN, _Ptr(_Distance_t))
     _register('AStarNN_num_shells', _AStarNN, _Ptr(_NumShells_t))
     _register('AStarNN_num_probes', _AStarNN, _Ptr(_NumProbes_t))
+    _register('AStarNN_num_orbits', _AStarNN, _Ptr(_size_t))
+    _register('AStarNN_orbits', _AStarNN, np.ctypeslib.ndpointer(dtype=np.uint32))
+    _register('AStarNN_set_orbits', _AStarNN, np.ctypeslib.ndpointer(dtype=np.uint32), _size_t)
     _register('AStarNN_nearest_callback', _AStarNN, _Vector_t, _AStarNN_Callback_t)
     _register('AStarNN_delaunay_callback', _AStarNN, _Vector_t, _AStarNN_Callback_t)
     _register('AStarNN_extended_callback', _AStarNN, _Vector_t, _AStarNN_Callback_t)
     _register('AStarNN_nearest_hash', _AStarNN, _Vector_t, _HashVector_t)
     _register('AStarNN_delaunay_hash', _AStarNN, _Vector_t, _HashVector_t)
     _register('AStarNN_extended_hash', _AStarNN, _Vector_t, _HashVector_t)
+    _register('AStarNN_nearest_hash_margin', _AStarNN, _Vector_t, _Ptr(_HashCode_t), _Ptr(_Distance_t))
+    _register('AStarNN_nearest_hash_margins', _AStarNN, _Vector_t, _Ptr(_HashCode_t),
+              _Ptr(_Distance_t), _Ptr(_Distance_t), _Ptr(_Distance_t))
+    _register('AStarNN_extended_nearest_hash', _AStarNN, _Vector_t, _HashVector_t, _Ptr(_HashCode_t))
+    _register('AStarNN_adaptive_hash', _AStarNN, _Vector_t, _Distance_t, _HashVector_t, _Ptr(_size_t))
     _register('AStarNN_nearest_cvector', _AStarNN, _Vector_t, _CVector_t)
     _register('AStarNN_delaunay_cvector', _AStarNN, _Vector_t, _CVector_t)
     _register('AStarNN_extended_cvector', _AStarNN, _Vector_t, _CVector_t)
+    _register('AStarNN_to_lattice_space', _AStarNN, _Vector_t, _Vector_t)
 
     _register('AStarIndex_size_t_new', _Dim_t, _Distance_t, _NumShells_t, _Ptr(_AStarIndex))
+    _register('AStarIndex_size_t_new_transformed', _VectorTransform, _Distance_t, _NumShells_t, _Ptr(_AStarIndex))
+    _register('AStarIndex_size_t_new_arena', _Dim_t, _Distance_t, _NumShells_t, _size_t, _Ptr(_AStarIndex))
     _register('AStarIndex_size_t_delete', _AStarIndex)
     _register('AStarIndex_size_t_dim', _AStarIndex, _Ptr(_Dim_t))
+    _register('AStarIndex_size_t_input_dim', _AStarIndex, _Ptr(_Dim_t))
     _register('AStarIndex_size_t_packing_radius', _AStarIndex, _Ptr(_Distance_t))
     _register('AStarIndex_size_t_scale', _AStarIndex, _Ptr(_Distance_t))
     _register('AStarIndex_size_t_num_shells', _AStarIndex, _Ptr(_NumShells_t))
     _register('AStarIndex_size_t_num_probes', _AStarIndex, _Ptr(_NumProbes_t))
+    _register('AStarIndex_size_t_num_orbits', _AStarIndex, _Ptr(_size_t))
+    _register('AStarIndex_size_t_orbits', _AStarIndex, np.ctypeslib.ndpointer(dtype=np.uint32))
+    _register('AStarIndex_size_t_set_orbits', _AStarIndex, np.ctypeslib.ndpointer(dtype=np.uint32), _size_t)
     _register('AStarIndex_size_t_num_hashes', _AStarIndex, _Ptr(_size_t))
     _register('AStarIndex_size_t_num_elements', _AStarIndex, _Ptr(_size_t))
+    _register('AStarIndex_size_t_bytes_allocated', _AStarIndex, _Ptr(_size_t))
+    _register('AStarIndex_size_t_bucket_size_histogram', _AStarIndex, _size_t, _size_t_vector_t)
     _register('AStarIndex_size_t_put', _AStarIndex, _Vector_t, _size_t)
     _register('AStarIndex_size_t_clear', _AStarIndex)
+    _register('AStarIndex_size_t_compact', _AStarIndex, _Ptr(_size_t))
+    _register('AStarIndex_size_t_compact_step', _AStarIndex, _size_t, _Ptr(ct.c_int), _Ptr(_size_t))
     _register('AStarIndex_size_t_clear_by_vector', _AStarIndex, _Vector_t)
+    _register('AStarIndex_size_t_put_tracked', _AStarIndex, _Vector_t, _size_t, _Ptr(_HashCode_t), _Ptr(_Distance_t))
+    _register('AStarIndex_size_t_update', _AStarIndex, _size_t, _Vector_t, _Vector_t, _Ptr(_HashCode_t),
+              _Ptr(_Distance_t), _Ptr(ct.c_int))
     _register('AStarIndex_size_t_put_all', _AStarIndex, _Vector_t, _size_t, _Ptr(_size_t))
     _register('AStarIndex_size_t_count', _AStarIndex, _Vector_t, _Ptr(_size_t))
     _register('AStarIndex_size_t_get_callback', _AStarIndex, _Vector_t, _AStarNN_Callback_t)
     _register('AStarIndex_size_t_get_elems', _AStarIndex, _Vector_t, _size_t, _Ptr(_size_t), _size_t_vector_t)
+    _register('AStarIndex_size_t_get_elems_nearest', _AStarIndex, _Vector_t, _size_t, _Ptr(_size_t),
+              _size_t_vector_t, _Ptr(_HashCode_t))
+    _register('AStarIndex_size_t_put_hash', _AStarIndex, _HashCode_t, _size_t)
+    _register('AStarIndex_size_t_count_adaptive', _AStarIndex, _Vector_t, _Distance_t, _Ptr(_size_t))
+    _register('AStarIndex_size_t_get_elems_adaptive', _AStarIndex, _Vector_t, _Distance_t, _size_t, _Ptr(_size_t),
+              _size_t_vector_t, _Ptr(_size_t))
+    _register('AStarIndex_size_t_put_batch', _AStarIndex, _Vector_t, _size_t, _size_t_vector_t, _size_t)
+    _register('AStarIndex_size_t_count_batch', _AStarIndex, _Vector_t, _size_t, _size_t, _size_t, _size_t_vector_t)
+    _register('AStarIndex_size_t_get_elems_batch', _AStarIndex, _Vector_t, _size_t, _size_t, _size_t,
+              _size_t_vector_t, _size_t_vector_t)
+    _register('AStarIndex_size_t_merge', _AStarIndex, _AStarIndex, _size_t)
+    _register('AStarIndex_size_t_merge_all', _AStarIndex, _Ptr(_AStarIndex), _size_t, _size_t)
+    _register('AStarIndex_size_t_publish_shared', _AStarIndex, _str_t, _Ptr(_uint64_t))
+    _register('AStarIndex_size_t_publish_shared_all', _Ptr(_AStarIndex), _size_t, _str_t, _Ptr(_uint64_t))
+    _register('AStarIndex_size_t_to_memfd', _AStarIndex, _Ptr(ct.c_int))
+
+    _register('AStarBoundedIndex_size_t_new', _Dim_t, _Distance_t, _NumShells_t, _size_t, _Ptr(_AStarBoundedIndex))
+    _register('AStarBoundedIndex_size_t_delete', _AStarBoundedIndex)
+    _register('AStarBoundedIndex_size_t_num_hashes', _AStarBoundedIndex, _Ptr(_size_t))
+    _register('AStarBoundedIndex_size_t_num_elements', _AStarBoundedIndex, _Ptr(_size_t))
+    _register('AStarBoundedIndex_size_t_bytes_allocated', _AStarBoundedIndex, _Ptr(_size_t))
+    _register('AStarBoundedIndex_size_t_set_budget', _AStarBoundedIndex, _size_t)
+    _register('AStarBoundedIndex_size_t_counters', _AStarBoundedIndex,
+              _Ptr(_size_t), _Ptr(_size_t), _Ptr(_size_t), _Ptr(_size_t))
+    _register('AStarBoundedIndex_size_t_clear', _AStarBoundedIndex)
+    _register('AStarBoundedIndex_size_t_put', _AStarBoundedIndex, _Vector_t, _size_t)
+    _register('AStarBoundedIndex_size_t_put_all', _AStarBoundedIndex, _Vector_t, _size_t, _Ptr(_size_t))
+    _register('AStarBoundedIndex_size_t_count', _AStarBoundedIndex, _Vector_t, _Ptr(_size_t))
+    _register('AStarBoundedIndex_size_t_get_elems', _AStarBoundedIndex, _Vector_t, _size_t, _Ptr(_size_t),
+              _size_t_vector_t)
+
+    _register('AStarVersionedIndex_size_t_new', _Dim_t, _Distance_t, _NumShells_t, _Ptr(_AStarVersionedIndex))
+    _register('AStarVersionedIndex_size_t_delete', _AStarVersionedIndex)
+    _register('AStarVersionedIndex_size_t_num_hashes', _AStarVersionedIndex, _Ptr(_size_t))
+    _register('AStarVersionedIndex_size_t_num_elements', _AStarVersionedIndex, _Ptr(_size_t))
+    _register('AStarVersionedIndex_size_t_pages_copied', _AStarVersionedIndex, _Ptr(_size_t))
+    _register('AStarVersionedIndex_size_t_hashes_copied', _AStarVersionedIndex, _Ptr(_size_t))
+    _register('AStarVersionedIndex_size_t_clear', _AStarVersionedIndex)
+    _register('AStarVersionedIndex_size_t_clear_by_vector', _AStarVersionedIndex, _Vector_t)
+    _register('AStarVersionedIndex_size_t_put', _AStarVersionedIndex, _Vector_t, _size_t)
+    _register('AStarVersionedIndex_size_t_put_all', _AStarVersionedIndex, _Vector_t, _size_t, _Ptr(_size_t))
+    _register('AStarVersionedIndex_size_t_count', _AStarVersionedIndex, _Vector_t, _Ptr(_size_t))
+    _register('AStarVersionedIndex_size_t_get_elems', _AStarVersionedIndex, _Vector_t, _size_t, _Ptr(_size_t),
+              _size_t_vector_t)
+    _register('AStarVersionedIndex_size_t_snapshot', _AStarVersionedIndex, _Ptr(_AStarIndexSnapshot))
+
+    _register('AStarIndexSnapshot_size_t_delete', _AStarIndexSnapshot)
+    _register('AStarIndexSnapshot_size_t_num_hashes', _AStarIndexSnapshot, _Ptr(_size_t))
+    _register('AStarIndexSnapshot_size_t_num_elements', _AStarIndexSnapshot, _Ptr(_size_t))
+    _register('AStarIndexSnapshot_size_t_count', _AStarIndexSnapshot, _Vector_t, _Ptr(_size_t))
+    _register('AStarIndexSnapshot_size_t_get_elems', _AStarIndexSnapshot, _Vector_t, _size_t, _Ptr(_size_t),
+              _size_t_vector_t)
+
+    _register('AStarPartitionedIndex_size_t_new', _Dim_t, _Distance_t, _NumShells_t, _size_t,
+              _Ptr(_AStarPartitionedIndex))
+    _register('AStarPartitionedIndex_size_t_delete', _AStarPartitionedIndex)
+    _register('AStarPartitionedIndex_size_t_num_partitions', _AStarPartitionedIndex, _Ptr(_size_t))
+    _register('AStarPartitionedIndex_size_t_num_hashes', _AStarPartitionedIndex, _Ptr(_size_t))
+    _register('AStarPartitionedIndex_size_t_num_elements', _AStarPartitionedIndex, _Ptr(_size_t))
+    _register('AStarPartitionedIndex_size_t_clear', _AStarPartitionedIndex)
+    _register('AStarPartitionedIndex_size_t_put', _AStarPartitionedIndex, _Vector_t, _size_t)
+    _register('AStarPartitionedIndex_size_t_count', _AStarPartitionedIndex, _Vector_t, _Ptr(_size_t))
+    _register('AStarPartitionedIndex_size_t_get_elems', _AStarPartitionedIndex, _Vector_t, _size_t, _Ptr(_size_t),
+              _size_t_vector_t)
+    _register('AStarPartitionedIndex_size_t_ingest', _AStarPartitionedIndex, _Vector_t, _size_t, _size_t_vector_t,
+              _size_t, _size_t, _size_t, np.ctypeslib.ndpointer(dtype=np.uint64))
+
+    _register('ProbeCursor_new', _AStarNN, _Ptr(_ProbeCursor))
+    _register('ProbeCursor_delete', _ProbeCursor)
+    _register('ProbeCursor_start', _ProbeCursor, _Vector_t)
+    _register('ProbeCursor_next', _ProbeCursor, _size_t, _HashVector_t, _CVector_t, _Ptr(_size_t))
+    _register('ProbeCursor_remaining', _ProbeCursor, _Ptr(_size_t))
+
+    _register('AStarServer_size_t_new', _Dim_t, _Distance_t, _NumShells_t, _Vector_t, _size_t, ct.c_void_p, _size_t,
+              _Ptr(_AStarServer))
+    _register('AStarServer_size_t_delete', _AStarServer)
+    _register('AStarServer_size_t_start', _AStarServer, _str_t, _size_t)
+    _register('AStarServer_size_t_stop', _AStarServer)
+    _register('AStarServer_size_t_counters', _AStarServer, _Ptr(_size_t), _Ptr(_size_t))
+    _register('AStarServer_size_t_prune_counters', _AStarServer, _Ptr(_size_t), _Ptr(_size_t))
+    _register('AStarServer_size_t_requantize', _AStarServer, _Distance_t, _NumShells_t)
+    _register('AStarServer_size_t_num_hashes', _AStarServer, _Ptr(_size_t))
+
+    _register('AStarClient_connect', _str_t, _Ptr(_AStarClient))
+    _register('AStarClient_close', _AStarClient)
+    _register('AStarClient_info', _AStarClient, _Ptr(_uint32_t), _Ptr(_size_t), _Ptr(_size_t))
+    _register('AStarClient_nearest_hash', _AStarClient, _Vector_t, _size_t, _HashVector_t)
+    _register('AStarClient_extended_hash', _AStarClient, _Vector_t, _size_t, _HashVector_t)
+    _register('AStarClient_candidates', _AStarClient, _Vector_t, _size_t, _size_t_vector_t, _Ptr(_size_t))
+    _register('AStarClient_knn', _AStarClient, _Vector_t, _size_t, _uint32_t, _size_t_vector_t, _Ptr(_size_t))
+    _register('AStarClient_results', _AStarClient, _size_t_vector_t, _Ptr(_Distance_t))
+
+    _register('SharedIndex_attach', _str_t, _Ptr(_SharedIndex))
+    _register('SharedIndex_attach_fd', ct.c_int, _Ptr(_SharedIndex))
+    _register('SharedIndex_unlink', _str_t)
+    _register('SharedIndex_delete', _SharedIndex)
+    _register('SharedIndex_dim', _SharedIndex, _Ptr(_uint32_t))
+    _register('SharedIndex_generation', _SharedIndex, _Ptr(_uint64_t))
+    _register('SharedIndex_stale', _SharedIndex, _Ptr(ct.c_int))
+    _register('SharedIndex_refresh', _SharedIndex, _Ptr(ct.c_int))
+    _register('SharedIndex_num_hashes', _SharedIndex, _Ptr(_size_t))
+    _register('SharedIndex_num_elements', _SharedIndex, _Ptr(_size_t))
+    _register('SharedIndex_count', _SharedIndex, _Vector_t, _Ptr(_size_t))
+    _register('SharedIndex_get_elems', _SharedIndex, _Vector_t, _size_t, _Ptr(_size_t), _size_t_vector_t)
+
+    _register('LatticeCodec_new', _Dim_t, _Distance_t, ct.c_uint, ct.c_void_p, _Ptr(_LatticeCodec))
+    _register('LatticeCodec_delete', _LatticeCodec)
+    _register('LatticeCodec_code_size', _LatticeCodec, _Ptr(_size_t))
+    _register('LatticeCodec_encode', _LatticeCodec, _Vector_t, _size_t, _size_t, np.ctypeslib.ndpointer(dtype=np.uint8))
+    _register('LatticeCodec_encode_stats', _LatticeCodec, _Vector_t, _size_t, _size_t, np.ctypeslib.ndpointer(dtype=np.uint8),
+              _Ptr(_size_t), _Ptr(_double_t), _Ptr(_double_t))
+    _register('LatticeCodec_decode', _LatticeCodec, np.ctypeslib.ndpointer(dtype=np.uint8), _size_t, _size_t, _Vector_t)
+
+    _register('SparseAStarNN_new', _Dim_t, _Distance_t, _Ptr(_SparseAStarNN))
+    _register('SparseAStarNN_delete', _SparseAStarNN)
+    _register('SparseAStarNN_nearest_hash', _SparseAStarNN, _size_t, _DimVector_t, _Vector_t, _Ptr(_HashCode_t))
+    _register('SparseAStarNN_nearest_cvector', _SparseAStarNN, _size_t, _DimVector_t, _Vector_t, _CVector_t,
+              _Ptr(_int32_t), _Ptr(_int32_t), _Ptr(_K_t))
+    _register('SparseAStarNN_nearest_hashes', _SparseAStarNN, _size_t, np.ctypeslib.ndpointer(dtype=_size_t),
+              _DimVector_t, _Vector_t, _size_t, _HashVector_t)
+
+    _register('E8NN_new', _Dim_t, _Distance_t, _NumShells_t, _Ptr(_E8NN))
+    _register('E8NN_delete', _E8NN)
+    _register('E8NN_num_probes', _E8NN, _Ptr(_size_t))
+    _register('E8NN_nearest_hash', _E8NN, _Vector_t, _Ptr(_HashCode_t))
+    _register('E8NN_nearest_point', _E8NN, _Vector_t, _CVector_t)
+    _register('E8NN_extended_hash', _E8NN, _Vector_t, _HashVector_t)
+
+    _register('E8Index_size_t_new', _Dim_t, _Distance_t, _NumShells_t, _Ptr(_E8Index))
+    _register('E8Index_size_t_delete', _E8Index)
+    _register('E8Index_size_t_num_probes', _E8Index, _Ptr(_size_t))
+    _register('E8Index_size_t_num_hashes', _E8Index, _Ptr(_size_t))
+    _register('E8Index_size_t_bytes_allocated', _E8Index, _Ptr(_size_t))
+    _register('E8Index_size_t_put', _E8Index, _Vector_t, _size_t)
+    _register('E8Index_size_t_count', _E8Index, _Vector_t, _Ptr(_size_t))
+    _register('E8Index_size_t_get_elems', _E8Index, _Vector_t, _size_t, _Ptr(_size_t), np.ctypeslib.ndpointer(dtype=_size_t))
+
+    _register('VectorTransform_new_diagonal', _Dim_t, ct.c_void_p, ct.c_void_p, _Ptr(_VectorTransform))
+    _register('VectorTransform_new_whitening', _Dim_t, _Dim_t, ct.c_void_p, _Vector_t, _Ptr(_VectorTransform))
+    _register('VectorTransform_fit_diagonal', _Dim_t, _Vector_t, _size_t, _size_t, _Ptr(_VectorTransform))
+    _register('VectorTransform_fit_whitening', _Dim_t, _Dim_t, _Vector_t, _size_t, _double_t, _size_t,
+              _Ptr(_VectorTransform))
+    _register('VectorTransform_delete', _VectorTransform)
+    _register('VectorTransform_dims', _VectorTransform, _Ptr(_Dim_t), _Ptr(_Dim_t), _Ptr(ct.c_int))
+    _register('VectorTransform_params', _VectorTransform, _Vector_t, _Vector_t)
+    _register('VectorTransform_apply', _VectorTransform, _Vector_t, _size_t, _size_t, _Vector_t)
+
+    _register('ProbeProfile_new', _AStarNN, _Ptr(_ProbeProfile))
+    _register('ProbeProfile_delete', _ProbeProfile)
+    _register('ProbeProfile_num_orbits', _ProbeProfile, _Ptr(_size_t))
+    _register('ProbeProfile_record', _ProbeProfile, _Vector_t, _size_t, _Vector_t, np.ctypeslib.ndpointer(dtype=_size_t),
+              _size_t, _size_t)
+    _register('ProbeProfile_counts', _ProbeProfile, _Ptr(_uint64_t), _Ptr(_uint64_t), _Ptr(_uint64_t))
+    _register('ProbeProfile_hits', _ProbeProfile, np.ctypeslib.ndpointer(dtype=np.uint64))
+    _register('ProbeProfile_select_orbits', _ProbeProfile, _double_t, _size_t, np.ctypeslib.ndpointer(dtype=np.uint32),
+              _Ptr(_size_t))
+    _register('ProbeProfile_clear', _ProbeProfile)
+
+    _register('ShardMap_new', _Dim_t, _Distance_t, _NumShells_t, _size_t, _size_t, _Ptr(_ShardMap))
+    _register('ShardMap_delete', _ShardMap)
+    _register('ShardMap_assign', _ShardMap, _Vector_t, _size_t, _size_t_vector_t)
+
+    _register('ShardCoordinator_size_t_new', _Dim_t, _Distance_t, _NumShells_t, _size_t, _Ptr(_str_t), _size_t,
+              _Ptr(_ShardCoordinator))
+    _register('ShardCoordinator_size_t_delete', _ShardCoordinator)
+    _register('ShardCoordinator_size_t_knn', _ShardCoordinator, _Vector_t, _size_t, _uint32_t, _size_t_vector_t,
+              _Ptr(_size_t))
+    _register('ShardCoordinator_size_t_results', _ShardCoordinator, _size_t_vector_t, _Ptr(_Distance_t))
+    _register('ShardCoordinator_size_t_num_shard_requests', _ShardCoordinator, _Ptr(_size_t))
 
     # methods for testing purposes only
     _register('TESTING_round_up', _double_t, ret=_CElem_t)
@@ -391,7 +603,8 @@ class AStarNN:
     determining a lattice point remainder value, and getting important values.
     """
 
-    def __init__(self, dim: int, packing_radius: float, num_shells: int):
+    def __init__(self, dim: int, packing_radius: float, num_shells: int,
+                 transform: Optional['VectorTransform'] = None):
         """
         :param dim: dimensionality of vectors that we process.
             This is a positive integer.
@@ -399,14 +612,26 @@ class AStarNN:
             fitting within a voronoi cell. This is a positive floating point number.
         :param num_shells: how many extended shells to use in extended queries.
             This is a non-negative integer.
+        :param transform: optional VectorTransform (of dim dimensional vectors) applied to
+            each vector as it is mapped to the lattice, which then has the transform's
+            output_dim dimensions.
         """
         self._native_AStarNN = _AStarNN()
         self._dim = dim
+        self._input_dim = dim
         self._callback_cache = None
         self._callback_id = None
 
-        ret = _dll().AStarNN_new(dim, packing_radius, num_shells, self._native_AStarNN)
-        ret.check()
+        if transform is None:
+            ret = _dll().AStarNN_new(dim, packing_radius, num_shells, self._native_AStarNN)
+            ret.check()
+        else:
+            if transform.input_dim != dim:
+                raise AStarException(_Error_invalid_dim)
+            ret = _dll().AStarNN_new_transformed(transform._native_VectorTransform, packing_radius, num_shells,
+                                                 self._native_AStarNN)
+            ret.check()
+            self._dim = transform.output_dim
 
         scale = _Distance_t()
         ret = _dll().AStarNN_scale(self._native_AStarNN, scale)
@@ -429,6 +654,14 @@ class AStarNN:
         # return dim.value
         return self._dim
 
+    @property
+    def input_dim(self) -> int:
+        """
+        :return: the dimensionality of the vectors given to queries, which is dim unless
+            there is a transform.
+        """
+        return self._input_dim
+
     @property
     def packing_radius(self) -> float:
         """
@@ -470,15 +703,36 @@ class AStarNN:
         ret.check()
         return int(num_probes.value)
 
+    def orbits(self) -> np.ndarray:
+        """
+        :return: the orbits (blocks of dim + 1 probes) walked by extended queries, in order.
+        """
+        num_orbits = _size_t()
+        ret = _dll().AStarNN_num_orbits(self._native_AStarNN, num_orbits)
+        ret.check()
+        orbits = np.empty(num_orbits.value, dtype=np.uint32)
+        ret = _dll().AStarNN_orbits(self._native_AStarNN, orbits)
+        ret.check()
+        return orbits
+
+    def set_orbits(self, orbits):
+        """
+        Walk only the given orbits in extended queries, in the given order, e.g. as chosen by
+        ProbeProfile.select_orbits. The first must be orbit 0 (the Delaunay cell vertices).
+        Not to be called during queries.
+        """
+        orbits = np.ascontiguousarray(orbits, dtype=np.uint32)
+        ret = _dll().AStarNN_set_orbits(self._native_AStarNN, orbits, len(orbits))
+        ret.check()
+
     def to_lattice_space(self, v) -> np.ndarray:
         """
         Return the vector when v is mapped from the quantisation space into the lattice representation space.
+        If the hasher has a transform, v is an input vector (of input_dim elements), transformed as it is mapped.
         """
-        dim = self._dim
-        v_array = _make_array(_VElem_t, v, dim)
-        scale = self._scale
-        v_out = np.empty(dim + 1, dtype=_VElem_t)
-        ret = _dll().AStar_to_lattice_space(dim, scale, v_array, v_out)
+        v_array = _make_array(_VElem_t, v, self._input_dim)
+        v_out = np.empty(self._dim + 1, dtype=_VElem_t)
+        ret = _dll().AStarNN_to_lattice_space(self._native_AStarNN, v_array, v_out)
         ret.check()
         return v_out
 
@@ -543,6 +797,62 @@ class AStarNN:
         ret.check()
         return hashes.item()
 
+    def nearest_hash_margin(self, vector) -> Tuple[int, float]:
+        """
+        Return the hash code of the lattice point nearest to the given vector, and the
+        distance from the vector to the edge of the lattice point's Voronoi cell. Any
+        vector within that distance has the same nearest hash code.
+        """
+        self._check_dim(vector)
+        hash_code = _HashCode_t()
+        margin = _Distance_t()
+        ret = _dll().AStarNN_nearest_hash_margin(self._native_AStarNN, vector, hash_code, margin)
+        ret.check()
+        return int(hash_code.value), float(margin.value)
+
+    def nearest_hash_margins(self, vector) -> Tuple[int, float, float, float]:
+        """
+        Return the hash code of the lattice point nearest to the given vector, and where the
+        vector lies in the lattice: (hash code, distance to the lattice point, distance to the
+        edge of its Voronoi cell, distance to the edge of the containing Delaunay cell).
+        """
+        self._check_dim(vector)
+        hash_code = _HashCode_t()
+        distance = _Distance_t()
+        cell_margin = _Distance_t()
+        delaunay_margin = _Distance_t()
+        ret = _dll().AStarNN_nearest_hash_margins(self._native_AStarNN, vector, hash_code,
+                                                  distance, cell_margin, delaunay_margin)
+        ret.check()
+        return int(hash_code.value), float(distance.value), float(cell_margin.value), float(delaunay_margin.value)
+
+    def extended_nearest_hash(self, vector) -> Tuple[np.ndarray, int]:
+        """
+        Return the extended hash codes (as per extended_hash) and the nearest hash code
+        (as per nearest_hash) of the given vector, for the cost of one decode.
+        The first self.dim + 1 extended hash codes are the Delaunay hash codes.
+        """
+        self._check_dim(vector)
+        hashes = np.empty(self.num_probes, dtype=_HashCode_t)
+        nearest = _HashCode_t()
+        ret = _dll().AStarNN_extended_nearest_hash(self._native_AStarNN, vector, hashes, nearest)
+        ret.check()
+        return hashes, int(nearest.value)
+
+    def adaptive_hash(self, vector, radius: float) -> np.ndarray:
+        """
+        Return the fewest hash codes that are sure to include that of every vector within
+        radius of the given vector: the nearest hash code if that ball is inside its Voronoi
+        cell, else the dim + 1 Delaunay hash codes if it is inside the Delaunay cell, else
+        (with no such guarantee) the extended hash codes.
+        """
+        self._check_dim(vector)
+        hashes = np.empty(self.num_probes, dtype=_HashCode_t)
+        count = _size_t()
+        ret = _dll().AStarNN_adaptive_hash(self._native_AStarNN, vector, radius, hashes, count)
+        ret.check()
+        return hashes[:count.value]
+
     def delaunay_hash(self, vector) -> np.ndarray:
         """
         Return the hash codes of the lattice point that are the vertices of the Delaunay cell containing
@@ -661,7 +971,7 @@ class AStarNN:
         """
         Raise an exception if the given vector is not of the appropriate dimensionality.
         """
-        if len(vector) != self._dim:
+        if len(vector) != self._input_dim:
             raise AStarException(_Error_invalid_dim)
 
     def _check_dimp(self, vector):
@@ -700,7 +1010,8 @@ class AStarIndex:
     An AStarIndex can only store objects of type size_t, and does not store the inserted vectors.
     """
 
-    def __init__(self, dim: int, packing_radius: float, num_shells: int):
+    def __init__(self, dim: int, packing_radius: float, num_shells: int,
+                 transform: Optional['VectorTransform'] = None, arena_chunk_size: int = 0):
         """
         :param dim: dimensionality of vectors that we process.
             This is a positive integer.
@@ -708,13 +1019,36 @@ class AStarIndex:
             fitting within a voronoi cell. This is a positive floating point number.
         :param num_shells: how many extended shells to use in extended queries.
             This is a non-negative integer.
+        :param transform: optional VectorTransform (of dim dimensional vectors) applied to
+            each vector as it is inserted or queried (see AStarNN); the lattice then has the
+            transform's output_dim dimensions, and insert_tracked/update margins are in the
+            transformed space.
+        :param arena_chunk_size: if positive, the index storage is taken from its own arena in
+            chunks of (at least) this many bytes, and is all released at once when the index is
+            deleted, in constant time; but memory released by clear, compact etc. is only
+            returned then. Not with a transform.
         """
         self._native_AStarIndex = _AStarIndex()
         self._dim = dim
+        self._input_dim = dim
         self._packing_radius = packing_radius
 
-        ret = _dll().AStarIndex_size_t_new(dim, packing_radius, num_shells, self._native_AStarIndex)
-        ret.check()
+        if arena_chunk_size > 0:
+            if transform is not None:
+                raise ValueError('an arena index cannot have a transform')
+            ret = _dll().AStarIndex_size_t_new_arena(dim, packing_radius, num_shells, arena_chunk_size,
+                                                     self._native_AStarIndex)
+            ret.check()
+        elif transform is None:
+            ret = _dll().AStarIndex_size_t_new(dim, packing_radius, num_shells, self._native_AStarIndex)
+            ret.check()
+        else:
+            if transform.input_dim != dim:
+                raise AStarException(_Error_invalid_dim)
+            ret = _dll().AStarIndex_size_t_new_transformed(transform._native_VectorTransform, packing_radius,
+                                                           num_shells, self._native_AStarIndex)
+            ret.check()
+            self._dim = transform.output_dim
 
     def __del__(self):
         ret = _dll().AStarIndex_size_t_delete(self._native_AStarIndex)
@@ -728,6 +1062,14 @@ class AStarIndex:
         """
         return self._dim
 
+    @property
+    def input_dim(self) -> int:
+        """
+        :return: the dimensionality of the vectors inserted and queried, which is dim unless
+            there is a transform.
+        """
+        return self._input_dim
+
     @property
     def packing_radius(self) -> float:
         """
@@ -755,6 +1097,27 @@ class AStarIndex:
         ret.check()
         return int(num_probes.value)
 
+    def orbits(self) -> np.ndarray:
+        """
+        :return: the orbits (blocks of dim + 1 probes) walked by queries, in order.
+        """
+        num_orbits = _size_t()
+        ret = _dll().AStarIndex_size_t_num_orbits(self._native_AStarIndex, num_orbits)
+        ret.check()
+        orbits = np.empty(num_orbits.value, dtype=np.uint32)
+        ret = _dll().AStarIndex_size_t_orbits(self._native_AStarIndex, orbits)
+        ret.check()
+        return orbits
+
+    def set_orbits(self, orbits):
+        """
+        Walk only the given orbits in queries, in the given order, e.g. as chosen by
+        ProbeProfile.select_orbits (see AStarNN.set_orbits). The elements are kept.
+        """
+        orbits = np.ascontiguousarray(orbits, dtype=np.uint32)
+        ret = _dll().AStarIndex_size_t_set_orbits(self._native_AStarIndex, orbits, len(orbits))
+        ret.check()
+
     def num_hashes(self) -> int:
         """
         :return: number of hash codes used in the index.
@@ -773,6 +1136,28 @@ class AStarIndex:
         ret.check()
         return int(value.value)
 
+    def bytes_allocated(self) -> int:
+        """
+        :return: number of bytes of native memory currently allocated for index storage
+            (for an arena index, reserved by its arena).
+        """
+        value = _size_t()
+        ret = _dll().AStarIndex_size_t_bytes_allocated(self._native_AStarIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def bucket_size_histogram(self, num_bins: int = 17) -> np.ndarray:
+        """
+        Count the hash codes of the index by their number of elements.
+        :param num_bins: number of histogram bins (positive).
+        :return: an array, h, where h[i] is the number of hash codes holding i elements,
+            except that h[num_bins - 1] also counts all hash codes with more elements.
+        """
+        histogram = np.zeros(num_bins, dtype=_size_t)
+        ret = _dll().AStarIndex_size_t_bucket_size_histogram(self._native_AStarIndex, num_bins, histogram)
+        ret.check()
+        return histogram
+
     def clear(self):
         """
         Remove all elements from the index.
@@ -785,25 +1170,82 @@ class AStarIndex:
         Remove elements from the index with hash code equal to that of the given vector.
         :param query_vector: a vector of the right dimensionality
         """
-        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        query_array = _make_array(_VElem_t, query_vector, self._input_dim)
         ret = _dll().AStarIndex_size_t_clear_by_vector(self._native_AStarIndex, query_array)
         ret.check()
 
+    def compact(self) -> int:
+        """
+        Release memory left behind by removed elements, by shrinking element lists
+        and rebuilding the hash table at the size needed.
+        :return: the (estimated) number of bytes released.
+        """
+        value = _size_t()
+        ret = _dll().AStarIndex_size_t_compact(self._native_AStarIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def compact_step(self, max_buckets: int) -> Tuple[bool, int]:
+        """
+        Perform a bounded step of compaction, visiting at most max_buckets hash table slots.
+        Repeated calls work through the whole index; the last step of a pass rebuilds the hash table.
+        :param max_buckets: maximum number of hash table slots to process (positive).
+        :return: (done, bytes) where done is True when the pass is finished and bytes is the
+            (estimated) number of bytes released by this step.
+        """
+        done = ct.c_int()
+        value = _size_t()
+        ret = _dll().AStarIndex_size_t_compact_step(self._native_AStarIndex, max_buckets, done, value)
+        ret.check()
+        return bool(done.value), int(value.value)
+
     def insert(self, vector, value):
         """
         :param vector: a vector of the right dimensionality
         :param value: an integer (size_t)
         """
-        array = _make_array(_VElem_t, vector, self._dim)
+        array = _make_array(_VElem_t, vector, self._input_dim)
         ret = _dll().AStarIndex_size_t_put(self._native_AStarIndex, array, value)
         ret.check()
 
+    def insert_tracked(self, vector, value) -> Tuple[int, float]:
+        """
+        Insert a value whose vector will move a little at a time (see 'update').
+        :param vector: a vector of the right dimensionality
+        :param value: an integer (size_t)
+        :return: the state to keep for the value: (hash code, cell margin)
+        """
+        array = _make_array(_VElem_t, vector, self._input_dim)
+        hash_code = _HashCode_t()
+        margin = _Distance_t()
+        ret = _dll().AStarIndex_size_t_put_tracked(self._native_AStarIndex, array, value, hash_code, margin)
+        ret.check()
+        return int(hash_code.value), float(margin.value)
+
+    def update(self, value, old_vector, new_vector, state: Tuple[int, float]) -> Tuple[bool, Tuple[int, float]]:
+        """
+        Re-index a value whose vector moved from old_vector to new_vector. The new vector is
+        only hashed once the value's total movement exceeds the margin of its cell.
+        :param value: an integer (size_t)
+        :param state: the value's state, from insert_tracked or the last update
+        :return: (whether the value moved to another hash code, the new state)
+        """
+        old_array = _make_array(_VElem_t, old_vector, self._input_dim)
+        new_array = _make_array(_VElem_t, new_vector, self._input_dim)
+        hash_code = _HashCode_t(state[0])
+        margin = _Distance_t(state[1])
+        moved = ct.c_int()
+        ret = _dll().AStarIndex_size_t_update(self._native_AStarIndex, value, old_array, new_array,
+                                              hash_code, margin, moved)
+        ret.check()
+        return bool(moved.value), (int(hash_code.value), float(margin.value))
+
     def candidates(self, query_vector) -> np.ndarray:
         """
         :param query_vector: a vector of the right dimensionality
         :return: an array of integer (size_t)
         """
-        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        query_array = _make_array(_VElem_t, query_vector, self._input_dim)
         size = self._num_candidates(query_array)
         elems = np.empty(size, dtype=_size_t)
         out_count = _size_t()
@@ -816,9 +1258,166 @@ class AStarIndex:
         :param query_vector: a vector of the right dimensionality
         :return: number of items to be retrieved by the key
         """
-        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        query_array = _make_array(_VElem_t, query_vector, self._input_dim)
         return self._num_candidates(query_array)
 
+    def candidates_and_hash(self, query_vector, max_size: int = 64) -> Tuple[np.ndarray, int]:
+        """
+        As per candidates, and also return the hash code that 'insert' would use for the
+        query vector, for the cost of one decode. E.g. to look for duplicates of a vector
+        and then, if there are none, add it with insert_hash.
+        :param query_vector: a vector of the right dimensionality
+        :param max_size: the expected number of candidates; the query is repeated if there are more
+        :return: (an array of integer (size_t), the hash code)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._input_dim)
+        while True:
+            elems = np.empty(max_size, dtype=_size_t)
+            out_count = _size_t()
+            hash_code = _HashCode_t()
+            ret = _dll().AStarIndex_size_t_get_elems_nearest(self._native_AStarIndex, query_array, max_size,
+                                                             out_count, elems, hash_code)
+            ret.check()
+            if out_count.value <= max_size:
+                return elems[:out_count.value], int(hash_code.value)
+            max_size = out_count.value
+
+    def insert_hash(self, hash_code: int, value):
+        """
+        Insert a value indexed by a hash code (e.g. from candidates_and_hash).
+        :param value: an integer (size_t)
+        """
+        ret = _dll().AStarIndex_size_t_put_hash(self._native_AStarIndex, hash_code, value)
+        ret.check()
+
+    def candidates_adaptive(self, query_vector, radius: float) -> Tuple[np.ndarray, int]:
+        """
+        As per candidates, but probing only as many hash codes as needed to find every
+        value whose vector is within radius of the query (see AStarNN.adaptive_hash).
+        :param query_vector: a vector of the right dimensionality
+        :return: (an array of integer (size_t), the number of hash codes probed)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._input_dim)
+        size = _size_t()
+        ret = _dll().AStarIndex_size_t_count_adaptive(self._native_AStarIndex, query_array, radius, size)
+        ret.check()
+        elems = np.empty(size.value, dtype=_size_t)
+        out_count = _size_t()
+        num_probes = _size_t()
+        ret = _dll().AStarIndex_size_t_get_elems_adaptive(self._native_AStarIndex, query_array, radius, size.value,
+                                                          out_count, elems, num_probes)
+        ret.check()
+        return elems, int(num_probes.value)
+
+    def insert_batch(self, vectors, values, num_threads: int = 1):
+        """
+        Insert values[i] indexed by vectors[i], for each row i.
+        The vectors are hashed using num_threads threads (0 for all cores).
+        :param vectors: a 2D array, one vector of the right dimensionality per row
+        :param values: an array of integer (size_t), one per row
+        """
+        array = self._make_batch(vectors)
+        values = np.ascontiguousarray(values, dtype=_size_t)
+        if len(values) != array.shape[0]:
+            raise ValueError('need one value per vector')
+        ret = _dll().AStarIndex_size_t_put_batch(self._native_AStarIndex, array, array.shape[0], values, num_threads)
+        ret.check()
+
+    def candidates_batch(self, query_vectors, width: int = 0, num_threads: int = 1) -> list:
+        """
+        Get the candidates of many query vectors at once. The hash table lookups of
+        up to 'width' queries are interleaved, which hides memory latency for large indexes.
+        The queries are shared between num_threads threads (0 for all cores) by a
+        work-stealing scheduler.
+        :param query_vectors: a 2D array, one query vector of the right dimensionality per row
+        :param width: number of queries interleaved (0 for the library default)
+        :param num_threads: number of threads to use
+        :return: a list with an array of integer (size_t) per query, as per 'candidates'
+        """
+        query_array = self._make_batch(query_vectors)
+        num_vectors = query_array.shape[0]
+        counts = self.num_candidates_batch(query_array, width, num_threads)
+        offsets = np.zeros(num_vectors + 1, dtype=_size_t)
+        np.cumsum(counts, out=offsets[1:])
+        elems = np.empty(int(offsets[-1]), dtype=_size_t)
+        ret = _dll().AStarIndex_size_t_get_elems_batch(self._native_AStarIndex, query_array, num_vectors, width,
+                                                       num_threads, offsets, elems)
+        ret.check()
+        return [elems[offsets[i]:offsets[i + 1]] for i in range(num_vectors)]
+
+    def num_candidates_batch(self, query_vectors, width: int = 0, num_threads: int = 1) -> np.ndarray:
+        """
+        :param query_vectors: a 2D array, one query vector of the right dimensionality per row
+        :param width: number of queries interleaved (0 for the library default)
+        :param num_threads: number of threads to use (0 for all cores)
+        :return: an array with the number of candidates of each query
+        """
+        query_array = self._make_batch(query_vectors)
+        num_vectors = query_array.shape[0]
+        counts = np.empty(num_vectors, dtype=_size_t)
+        ret = _dll().AStarIndex_size_t_count_batch(self._native_AStarIndex, query_array, num_vectors, width,
+                                                   num_threads, counts)
+        ret.check()
+        return counts
+
+    def merge(self, other: 'AStarIndex', num_threads: int = 1):
+        """
+        Add all the values of another index, with the same dim, packing radius and num_shells.
+        :param num_threads: number of threads to copy the values with (0 for all cores)
+        """
+        ret = _dll().AStarIndex_size_t_merge(self._native_AStarIndex, other._native_AStarIndex, num_threads)
+        ret.check()
+
+    def merge_all(self, others: List['AStarIndex'], num_threads: int = 1):
+        """
+        Add all the values of the other indexes (e.g., built independently from parts
+        of the data), with the same dim, packing radius and num_shells. Values of the
+        same hash code are kept in the order of the indexes.
+        :param num_threads: number of threads to copy the values with (0 for all cores)
+        """
+        natives = (_AStarIndex * len(others))(*[other._native_AStarIndex for other in others])
+        ret = _dll().AStarIndex_size_t_merge_all(self._native_AStarIndex, natives, len(others), num_threads)
+        ret.check()
+
+    def publish_shared(self, name: str) -> int:
+        """
+        Publish a read-only copy of the index in POSIX shared memory, as the next
+        generation of the given name (see SharedIndex).
+        :return: the generation published.
+        """
+        value = _uint64_t()
+        ret = _dll().AStarIndex_size_t_publish_shared(self._native_AStarIndex, name.encode(), value)
+        ret.check()
+        return int(value.value)
+
+    @staticmethod
+    def publish_shared_all(name: str, indexes: List['AStarIndex']) -> int:
+        """
+        As per publish_shared, for the merge of the indexes, without building the merged index.
+        :return: the generation published.
+        """
+        natives = (_AStarIndex * len(indexes))(*[index._native_AStarIndex for index in indexes])
+        value = _uint64_t()
+        ret = _dll().AStarIndex_size_t_publish_shared_all(natives, len(indexes), name.encode(), value)
+        ret.check()
+        return int(value.value)
+
+    def to_memfd(self) -> int:
+        """
+        Write a read-only copy of the index to a new anonymous memory file (Linux only).
+        :return: the file descriptor, for SharedIndex(fd=...) in this or a child process.
+        """
+        value = ct.c_int()
+        ret = _dll().AStarIndex_size_t_to_memfd(self._native_AStarIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def _make_batch(self, vectors) -> np.ndarray:
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2 or array.shape[1] != self._input_dim:
+            raise AStarException(_Error_invalid_dim)
+        return array
+
     def _num_candidates(self, query_array) -> int:
         value = _size_t()
         ret = _dll().AStarIndex_size_t_count(self._native_AStarIndex, query_array, value)
@@ -826,6 +1425,1536 @@ class AStarIndex:
         return int(value.value)
 
 
+class AStarBoundedIndex:
+    """
+    An AStarBoundedIndex is an AStarIndex that keeps its native memory use
+    under a byte budget, for use as a cache. When an insert takes the index over budget,
+    the least recently used hash codes (with their elements) are evicted, using the CLOCK policy.
+    An AStarBoundedIndex can only store objects of type size_t, and does not store the inserted vectors.
+    """
+
+    def __init__(self, dim: int, packing_radius: float, num_shells: int, budget: int):
+        """
+        :param dim: dimensionality of vectors that we process.
+            This is a positive integer.
+        :param packing_radius: a scaling value which is the radius of the largest sphere
+            fitting within a voronoi cell. This is a positive floating point number.
+        :param num_shells: how many extended shells to use in extended queries.
+            This is a non-negative integer.
+        :param budget: maximum number of bytes of native memory used for index storage.
+        """
+        self._native_AStarBoundedIndex = _AStarBoundedIndex()
+        self._dim = dim
+        self._budget = budget
+
+        ret = _dll().AStarBoundedIndex_size_t_new(dim, packing_radius, num_shells, budget,
+                                                  self._native_AStarBoundedIndex)
+        ret.check()
+
+    def __del__(self):
+        ret = _dll().AStarBoundedIndex_size_t_delete(self._native_AStarBoundedIndex)
+        self._native_AStarBoundedIndex = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        """
+        :return: the dimensionality of vectors that we process.
+        """
+        return self._dim
+
+    @property
+    def budget(self) -> int:
+        """
+        :return: the maximum number of bytes of native memory used for index storage.
+        """
+        return self._budget
+
+    @budget.setter
+    def budget(self, budget: int):
+        ret = _dll().AStarBoundedIndex_size_t_set_budget(self._native_AStarBoundedIndex, budget)
+        ret.check()
+        self._budget = budget
+
+    def num_hashes(self) -> int:
+        """
+        :return: number of hash codes used in the index.
+        """
+        value = _size_t()
+        ret = _dll().AStarBoundedIndex_size_t_num_hashes(self._native_AStarBoundedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def num_elements(self) -> int:
+        """
+        :return: number of elements in the index.
+        """
+        value = _size_t()
+        ret = _dll().AStarBoundedIndex_size_t_num_elements(self._native_AStarBoundedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def bytes_allocated(self) -> int:
+        """
+        :return: number of bytes of native memory currently allocated for index storage.
+        """
+        value = _size_t()
+        ret = _dll().AStarBoundedIndex_size_t_bytes_allocated(self._native_AStarBoundedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def counters(self) -> Tuple[int, int, int, int]:
+        """
+        :return: (hits, misses, evictions, evicted_elements) where hits and misses count
+            probed hash codes found or not found by candidates(...), evictions counts
+            evicted hash codes and evicted_elements counts the elements they held.
+        """
+        hits = _size_t()
+        misses = _size_t()
+        evictions = _size_t()
+        evicted_elements = _size_t()
+        ret = _dll().AStarBoundedIndex_size_t_counters(self._native_AStarBoundedIndex,
+                                                       hits, misses, evictions, evicted_elements)
+        ret.check()
+        return int(hits.value), int(misses.value), int(evictions.value), int(evicted_elements.value)
+
+    def clear(self):
+        """
+        Remove all elements from the index.
+        """
+        ret = _dll().AStarBoundedIndex_size_t_clear(self._native_AStarBoundedIndex)
+        ret.check()
+
+    def insert(self, vector, value):
+        """
+        :param vector: a vector of the right dimensionality
+        :param value: an integer (size_t)
+        """
+        array = _make_array(_VElem_t, vector, self._dim)
+        ret = _dll().AStarBoundedIndex_size_t_put(self._native_AStarBoundedIndex, array, value)
+        ret.check()
+
+    def candidates(self, query_vector) -> np.ndarray:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: an array of integer (size_t)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        size = self._num_candidates(query_array)
+        elems = np.empty(size, dtype=_size_t)
+        out_count = _size_t()
+        ret = _dll().AStarBoundedIndex_size_t_get_elems(self._native_AStarBoundedIndex, query_array, size,
+                                                        out_count, elems)
+        ret.check()
+        return elems[:out_count.value]
+
+    def num_candidates(self, query_vector) -> int:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: number of items to be retrieved by the key
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        return self._num_candidates(query_array)
+
+    def _num_candidates(self, query_array) -> int:
+        value = _size_t()
+        ret = _dll().AStarBoundedIndex_size_t_count(self._native_AStarBoundedIndex, query_array, value)
+        ret.check()
+        return int(value.value)
+
+
+class AStarVersionedIndex:
+    """
+    An AStarVersionedIndex is an AStarIndex that can take cheap read-only snapshots.
+    A snapshot keeps a consistent view of the index while the index continues to be modified.
+    Only the parts of the index modified after a snapshot is taken are copied.
+    An AStarVersionedIndex can only store objects of type size_t, and does not store the inserted vectors.
+    """
+
+    def __init__(self, dim: int, packing_radius: float, num_shells: int):
+        """
+        :param dim: dimensionality of vectors that we process.
+            This is a positive integer.
+        :param packing_radius: a scaling value which is the radius of the largest sphere
+            fitting within a voronoi cell. This is a positive floating point number.
+        :param num_shells: how many extended shells to use in extended queries.
+            This is a non-negative integer.
+        """
+        self._native_AStarVersionedIndex = _AStarVersionedIndex()
+        self._dim = dim
+
+        ret = _dll().AStarVersionedIndex_size_t_new(dim, packing_radius, num_shells, self._native_AStarVersionedIndex)
+        ret.check()
+
+    def __del__(self):
+        ret = _dll().AStarVersionedIndex_size_t_delete(self._native_AStarVersionedIndex)
+        self._native_AStarVersionedIndex = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        """
+        :return: the dimensionality of vectors that we process.
+        """
+        return self._dim
+
+    def num_hashes(self) -> int:
+        """
+        :return: number of hash codes used in the index.
+        """
+        value = _size_t()
+        ret = _dll().AStarVersionedIndex_size_t_num_hashes(self._native_AStarVersionedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def num_elements(self) -> int:
+        """
+        :return: number of elements in the index.
+        """
+        value = _size_t()
+        ret = _dll().AStarVersionedIndex_size_t_num_elements(self._native_AStarVersionedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def pages_copied(self) -> int:
+        """
+        :return: number of pages copied because a snapshot was sharing them.
+        """
+        value = _size_t()
+        ret = _dll().AStarVersionedIndex_size_t_pages_copied(self._native_AStarVersionedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def hashes_copied(self) -> int:
+        """
+        :return: number of hash codes (with their elements) in the pages copied because a
+            snapshot was sharing them; a page holds a bounded number of hash codes.
+        """
+        value = _size_t()
+        ret = _dll().AStarVersionedIndex_size_t_hashes_copied(self._native_AStarVersionedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def clear(self):
+        """
+        Remove all elements from the index.
+        """
+        ret = _dll().AStarVersionedIndex_size_t_clear(self._native_AStarVersionedIndex)
+        ret.check()
+
+    def clear_by_vector(self, query_vector):
+        """
+        Remove elements from the index with hash code equal to that of the given vector.
+        :param query_vector: a vector of the right dimensionality
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        ret = _dll().AStarVersionedIndex_size_t_clear_by_vector(self._native_AStarVersionedIndex, query_array)
+        ret.check()
+
+    def insert(self, vector, value):
+        """
+        :param vector: a vector of the right dimensionality
+        :param value: an integer (size_t)
+        """
+        array = _make_array(_VElem_t, vector, self._dim)
+        ret = _dll().AStarVersionedIndex_size_t_put(self._native_AStarVersionedIndex, array, value)
+        ret.check()
+
+    def candidates(self, query_vector) -> np.ndarray:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: an array of integer (size_t)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        size = self._num_candidates(query_array)
+        elems = np.empty(size, dtype=_size_t)
+        out_count = _size_t()
+        ret = _dll().AStarVersionedIndex_size_t_get_elems(self._native_AStarVersionedIndex, query_array, size,
+                                                          out_count, elems)
+        ret.check()
+        return elems
+
+    def num_candidates(self, query_vector) -> int:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: number of items to be retrieved by the key
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        return self._num_candidates(query_array)
+
+    def snapshot(self) -> 'AStarIndexSnapshot':
+        """
+        :return: a read-only view of the index as it is now.
+        """
+        native_snapshot = _AStarIndexSnapshot()
+        ret = _dll().AStarVersionedIndex_size_t_snapshot(self._native_AStarVersionedIndex, native_snapshot)
+        ret.check()
+        return AStarIndexSnapshot(native_snapshot, self._dim)
+
+    def _num_candidates(self, query_array) -> int:
+        value = _size_t()
+        ret = _dll().AStarVersionedIndex_size_t_count(self._native_AStarVersionedIndex, query_array, value)
+        ret.check()
+        return int(value.value)
+
+
+class AStarIndexSnapshot:
+    """
+    A read-only view of an AStarVersionedIndex, as returned by AStarVersionedIndex.snapshot().
+    The view does not change when the index is modified, and stays valid after the index is deleted.
+    """
+
+    def __init__(self, native_snapshot, dim: int):
+        self._native_AStarIndexSnapshot = native_snapshot
+        self._dim = dim
+
+    def __del__(self):
+        ret = _dll().AStarIndexSnapshot_size_t_delete(self._native_AStarIndexSnapshot)
+        self._native_AStarIndexSnapshot = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        """
+        :return: the dimensionality of vectors that we process.
+        """
+        return self._dim
+
+    def num_hashes(self) -> int:
+        """
+        :return: number of hash codes used in the snapshot.
+        """
+        value = _size_t()
+        ret = _dll().AStarIndexSnapshot_size_t_num_hashes(self._native_AStarIndexSnapshot, value)
+        ret.check()
+        return int(value.value)
+
+    def num_elements(self) -> int:
+        """
+        :return: number of elements in the snapshot.
+        """
+        value = _size_t()
+        ret = _dll().AStarIndexSnapshot_size_t_num_elements(self._native_AStarIndexSnapshot, value)
+        ret.check()
+        return int(value.value)
+
+    def candidates(self, query_vector) -> np.ndarray:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: an array of integer (size_t)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        size = self._num_candidates(query_array)
+        elems = np.empty(size, dtype=_size_t)
+        out_count = _size_t()
+        ret = _dll().AStarIndexSnapshot_size_t_get_elems(self._native_AStarIndexSnapshot, query_array, size,
+                                                         out_count, elems)
+        ret.check()
+        return elems
+
+    def num_candidates(self, query_vector) -> int:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: number of items to be retrieved by the key
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        return self._num_candidates(query_array)
+
+    def _num_candidates(self, query_array) -> int:
+        value = _size_t()
+        ret = _dll().AStarIndexSnapshot_size_t_count(self._native_AStarIndexSnapshot, query_array, value)
+        ret.check()
+        return int(value.value)
+
+
+class AStarPartitionedIndex:
+    """
+    An AStarPartitionedIndex is an index of size_t objects, like AStarIndex, that is held as
+    a number of independent partitions (by hash code). This allows fast multi-threaded
+    ingest of many vectors (see 'ingest'). Queries give the same results as AStarIndex.
+    """
+
+    # The stages of an ingest, in the order of the native metrics.
+    _STAGES = ('read', 'hash', 'insert')
+
+    def __init__(self, dim: int, packing_radius: float, num_shells: int, num_partitions: int):
+        """
+        :param dim: dimensionality of vectors that we process.
+        :param packing_radius: the radius of the largest sphere fitting within a voronoi cell.
+        :param num_shells: how many extended shells to use in queries.
+        :param num_partitions: number of partitions, which limits the number of inserter threads of 'ingest'.
+        """
+        self._native_AStarPartitionedIndex = _AStarPartitionedIndex()
+        self._dim = dim
+        ret = _dll().AStarPartitionedIndex_size_t_new(dim, packing_radius, num_shells, num_partitions,
+                                                      self._native_AStarPartitionedIndex)
+        ret.check()
+
+    def __del__(self):
+        ret = _dll().AStarPartitionedIndex_size_t_delete(self._native_AStarPartitionedIndex)
+        self._native_AStarPartitionedIndex = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        """
+        :return: the dimensionality of vectors that we process.
+        """
+        return self._dim
+
+    def num_partitions(self) -> int:
+        """
+        :return: number of partitions.
+        """
+        value = _size_t()
+        ret = _dll().AStarPartitionedIndex_size_t_num_partitions(self._native_AStarPartitionedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def num_hashes(self) -> int:
+        """
+        :return: number of hash codes used in the index.
+        """
+        value = _size_t()
+        ret = _dll().AStarPartitionedIndex_size_t_num_hashes(self._native_AStarPartitionedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def num_elements(self) -> int:
+        """
+        :return: number of elements in the index.
+        """
+        value = _size_t()
+        ret = _dll().AStarPartitionedIndex_size_t_num_elements(self._native_AStarPartitionedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def clear(self):
+        ret = _dll().AStarPartitionedIndex_size_t_clear(self._native_AStarPartitionedIndex)
+        ret.check()
+
+    def insert(self, vector, value):
+        """
+        :param vector: a vector of the right dimensionality
+        :param value: an integer (size_t)
+        """
+        array = _make_array(_VElem_t, vector, self._dim)
+        ret = _dll().AStarPartitionedIndex_size_t_put(self._native_AStarPartitionedIndex, array, value)
+        ret.check()
+
+    def ingest(self, vectors, values, num_hash_workers: int = 2, num_inserters: int = 2,
+               chunk_rows: int = 1024) -> dict:
+        """
+        Insert values[i] indexed by vectors[i], for each row i, using a pipeline of
+        a reader, num_hash_workers hashing threads and num_inserters inserting threads.
+        :param vectors: a 2D array, one vector of the right dimensionality per row
+        :param values: an array of integer (size_t), one per row
+        :return: metrics of the pipeline: for each stage ('read', 'hash', 'insert') a dict of
+            'threads', 'items', 'busy_ns', 'wait_ns' and 'utilization', and the total 'elapsed_ns'.
+        """
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2 or array.shape[1] != self._dim:
+            raise AStarException(_Error_invalid_dim)
+        values = np.ascontiguousarray(values, dtype=_size_t)
+        if len(values) != array.shape[0]:
+            raise ValueError('need one value per vector')
+        metrics = np.zeros(13, dtype=np.uint64)
+        ret = _dll().AStarPartitionedIndex_size_t_ingest(self._native_AStarPartitionedIndex, array, array.shape[0],
+                                                         values, num_hash_workers, num_inserters, chunk_rows, metrics)
+        ret.check()
+        result = {}
+        for i, stage in enumerate(self._STAGES):
+            threads, items, busy_ns, wait_ns = (int(x) for x in metrics[i * 4:i * 4 + 4])
+            total = busy_ns + wait_ns
+            result[stage] = {
+                'threads': threads,
+                'items': items,
+                'busy_ns': busy_ns,
+                'wait_ns': wait_ns,
+                'utilization': busy_ns / total if total else 0.0
+            }
+        result['elapsed_ns'] = int(metrics[12])
+        return result
+
+    def candidates(self, query_vector) -> np.ndarray:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: an array of integer (size_t)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        size = self._num_candidates(query_array)
+        elems = np.empty(size, dtype=_size_t)
+        out_count = _size_t()
+        ret = _dll().AStarPartitionedIndex_size_t_get_elems(self._native_AStarPartitionedIndex, query_array, size,
+                                                            out_count, elems)
+        ret.check()
+        return elems
+
+    def num_candidates(self, query_vector) -> int:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: number of items to be retrieved by the key
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        return self._num_candidates(query_array)
+
+    def _num_candidates(self, query_array) -> int:
+        value = _size_t()
+        ret = _dll().AStarPartitionedIndex_size_t_count(self._native_AStarPartitionedIndex, query_array, value)
+        ret.check()
+        return int(value.value)
+
+
+class ProbeCursor:
+    """
+    A resumable extended query of an AStarNN object.
+
+    After 'start', the probes (the same as given by AStarNN.extended_hash
+    and AStarNN.extended_cvector) are returned a few at a time by 'next'.
+    """
+
+    def __init__(self, nn: AStarNN):
+        """
+        :param nn: the AStarNN object to query with, which is kept alive by the cursor.
+        """
+        self._nn = nn
+        self._dim = nn.dim
+        self._native_ProbeCursor = _ProbeCursor()
+        ret = _dll().ProbeCursor_new(nn._native_AStarNN, self._native_ProbeCursor)
+        ret.check()
+
+    def __del__(self):
+        ret = _dll().ProbeCursor_delete(self._native_ProbeCursor)
+        self._native_ProbeCursor = None
+        ret.check()
+
+    def start(self, vector):
+        """
+        Start a new extended query, abandoning any current one.
+        The vector is taken to be in the quantisation space.
+        """
+        vector = _make_array(_VElem_t, vector, self._dim)
+        ret = _dll().ProbeCursor_start(self._native_ProbeCursor, vector)
+        ret.check()
+
+    def next(self, max_probes: int) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        Get up to max_probes more probes of the current query.
+        :return: (hash codes, c-vectors) of the probes, which are empty when the query is finished.
+        """
+        hashes = np.empty(max_probes, dtype=_HashCode_t)
+        cvectors = np.empty((max_probes, self._dim + 1), dtype=_CElem_t)
+        count = _size_t()
+        ret = _dll().ProbeCursor_next(self._native_ProbeCursor, max_probes, hashes, cvectors, count)
+        ret.check()
+        count = int(count.value)
+        return hashes[:count], cvectors[:count]
+
+    @property
+    def remaining(self) -> int:
+        """
+        :return: the number of probes of the current query not yet returned by 'next'.
+        """
+        value = _size_t()
+        ret = _dll().ProbeCursor_remaining(self._native_ProbeCursor, value)
+        ret.check()
+        return int(value.value)
+
+
+class AStarServer:
+    """
+    An AStarServer serves queries of an index of vectors (element i being
+    the i-th vector) to AStarClient objects, over a Unix domain socket.
+    Candidate and k-NN requests of concurrent clients are coalesced into
+    batch queries of the index. Only available on POSIX systems.
+
+    The same server is available as the stand-alone 'astarnn-server' program.
+    """
+
+    def __init__(self, vectors, packing_radius: float, num_shells: int, num_threads: int = 1, elems=None):
+        """
+        :param vectors: a 2D array, one vector per row, which is copied.
+        :param packing_radius: the radius of the largest sphere fitting within a voronoi cell.
+        :param num_shells: how many extended shells to use in queries.
+        :param num_threads: number of threads to build the index with, and to query each batch with.
+        :param elems: optional element (integer) of each vector, e.g., row numbers of a shard of a
+            larger array (see ShardMap), default is the row number.
+        """
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2:
+            raise AStarException(_Error_invalid_dim)
+        elems_array = None
+        if elems is not None:
+            elems_array = np.ascontiguousarray(elems, dtype=_size_t)
+            if elems_array.shape != (array.shape[0],):
+                raise AStarException(_Error_invalid_dim)
+        self._native_AStarServer = _AStarServer()
+        ret = _dll().AStarServer_size_t_new(array.shape[1], packing_radius, num_shells, array, array.shape[0],
+                                            None if elems_array is None else elems_array.ctypes.data,
+                                            num_threads, self._native_AStarServer)
+        ret.check()
+
+    def __del__(self):
+        ret = _dll().AStarServer_size_t_delete(self._native_AStarServer)
+        self._native_AStarServer = None
+        ret.check()
+
+    def start(self, socket_path: str, max_batch: int = 0):
+        """
+        Start serving at the given socket path (which is created).
+        :param max_batch: most query vectors in a coalesced batch (0 for the library default).
+        """
+        ret = _dll().AStarServer_size_t_start(self._native_AStarServer, socket_path.encode(), max_batch)
+        ret.check()
+
+    def stop(self):
+        """
+        Stop serving, closing all client connections.
+        """
+        ret = _dll().AStarServer_size_t_stop(self._native_AStarServer)
+        ret.check()
+
+    def counters(self) -> Tuple[int, int]:
+        """
+        :return: (number of candidate and k-NN requests served, number of batches they were coalesced into)
+        """
+        requests = _size_t()
+        batches = _size_t()
+        ret = _dll().AStarServer_size_t_counters(self._native_AStarServer, requests, batches)
+        ret.check()
+        return int(requests.value), int(batches.value)
+
+    def prune_counters(self) -> Tuple[int, int]:
+        """
+        :return: (number of exact distances computed by k-NN requests, number of candidates
+                 skipped by the residual lower bound instead)
+        """
+        distances = _size_t()
+        pruned = _size_t()
+        ret = _dll().AStarServer_size_t_prune_counters(self._native_AStarServer, distances, pruned)
+        ret.check()
+        return int(distances.value), int(pruned.value)
+
+    def requantize(self, packing_radius: float, num_shells: int):
+        """
+        Rebuild the index at a new packing radius and number of shells, from the stored
+        vectors, while the current index keeps serving; the new index then replaces it
+        atomically. Clients connected before should reconnect, as num_probes may change.
+        """
+        ret = _dll().AStarServer_size_t_requantize(self._native_AStarServer, packing_radius, num_shells)
+        ret.check()
+
+    def num_hashes(self) -> int:
+        """
+        :return: the number of distinct hash codes in the index being served.
+        """
+        value = _size_t()
+        ret = _dll().AStarServer_size_t_num_hashes(self._native_AStarServer, value)
+        ret.check()
+        return int(value.value)
+
+
+class AStarClient:
+    """
+    A connection to an AStarServer (or an 'astarnn-server' program).
+    A client should only be used by one thread at a time.
+    """
+
+    def __init__(self, socket_path: str):
+        """
+        :param socket_path: the socket path the server is listening at.
+        """
+        self._native_AStarClient = _AStarClient()
+        ret = _dll().AStarClient_connect(socket_path.encode(), self._native_AStarClient)
+        ret.check()
+        dim = _uint32_t()
+        num_probes = _size_t()
+        num_vectors = _size_t()
+        ret = _dll().AStarClient_info(self._native_AStarClient, dim, num_probes, num_vectors)
+        ret.check()
+        self._dim = int(dim.value)
+        self._num_probes = int(num_probes.value)
+        self._num_vectors = int(num_vectors.value)
+
+    def __del__(self):
+        ret = _dll().AStarClient_close(self._native_AStarClient)
+        self._native_AStarClient = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        """
+        :return: the dimensionality of vectors served.
+        """
+        return self._dim
+
+    @property
+    def num_probes(self) -> int:
+        """
+        :return: the number of hash codes of an extended query.
+        """
+        return self._num_probes
+
+    @property
+    def num_vectors(self) -> int:
+        """
+        :return: the number of vectors indexed by the server.
+        """
+        return self._num_vectors
+
+    def nearest_hash(self, query_vectors) -> np.ndarray:
+        """
+        :param query_vectors: a 2D array, one query vector of the right dimensionality per row
+        :return: an array with the nearest hash code of each query
+        """
+        query_array = self._make_batch(query_vectors)
+        hashes = np.empty(query_array.shape[0], dtype=_HashCode_t)
+        ret = _dll().AStarClient_nearest_hash(self._native_AStarClient, query_array, query_array.shape[0], hashes)
+        ret.check()
+        return hashes
+
+    def extended_hash(self, query_vectors) -> np.ndarray:
+        """
+        :param query_vectors: a 2D array, one query vector of the right dimensionality per row
+        :return: a 2D array with the extended hash codes of each query per row
+        """
+        query_array = self._make_batch(query_vectors)
+        hashes = np.empty((query_array.shape[0], self._num_probes), dtype=_HashCode_t)
+        ret = _dll().AStarClient_extended_hash(self._native_AStarClient, query_array, query_array.shape[0], hashes)
+        ret.check()
+        return hashes
+
+    def candidates(self, query_vectors) -> list:
+        """
+        :param query_vectors: a 2D array, one query vector of the right dimensionality per row
+        :return: a list with an array of integer (size_t) per query, as per AStarIndex.candidates
+        """
+        query_array = self._make_batch(query_vectors)
+        counts = np.empty(query_array.shape[0], dtype=_size_t)
+        total = _size_t()
+        ret = _dll().AStarClient_candidates(self._native_AStarClient, query_array, query_array.shape[0], counts, total)
+        ret.check()
+        elems, _ = self._results(int(total.value), False)
+        return self._split(elems, counts)
+
+    def knn(self, query_vectors, k: int) -> list:
+        """
+        The k nearest of the candidates of each query vector.
+        :param query_vectors: a 2D array, one query vector of the right dimensionality per row
+        :param k: the number of neighbours wanted
+        :return: a list with a pair of arrays per query, (elements, distances), nearest first
+        """
+        query_array = self._make_batch(query_vectors)
+        counts = np.empty(query_array.shape[0], dtype=_size_t)
+        total = _size_t()
+        ret = _dll().AStarClient_knn(self._native_AStarClient, query_array, query_array.shape[0], k, counts, total)
+        ret.check()
+        elems, distances = self._results(int(total.value), True)
+        return list(zip(self._split(elems, counts), self._split(distances, counts)))
+
+    def _results(self, total: int, with_distances: bool) -> Tuple[np.ndarray, Optional[np.ndarray]]:
+        elems = np.empty(total, dtype=_size_t)
+        distances = np.empty(total, dtype=_VElem_t) if with_distances else None
+        out_distances = distances.ctypes.data_as(_Ptr(_Distance_t)) if with_distances else None
+        ret = _dll().AStarClient_results(self._native_AStarClient, elems, out_distances)
+        ret.check()
+        return elems, distances
+
+    @staticmethod
+    def _split(array, counts) -> list:
+        offsets = np.zeros(len(counts) + 1, dtype=_size_t)
+        np.cumsum(counts, out=offsets[1:])
+        return [array[offsets[i]:offsets[i + 1]] for i in range(len(counts))]
+
+    def _make_batch(self, vectors) -> np.ndarray:
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2 or array.shape[1] != self._dim:
+            raise AStarException(_Error_invalid_dim)
+        return array
+
+
+class SharedIndex:
+    """
+    A read-only index in shared memory, published by AStarIndex.publish_shared (or
+    AStarIndex.to_memfd). Any number of processes can attach to one copy of the index.
+    A named index may be published again; attached objects keep the generation they
+    have until 'refresh'. Only available on POSIX systems.
+    """
+
+    def __init__(self, name: Optional[str] = None, fd: Optional[int] = None):
+        """
+        :param name: the name of a published index, to attach to its current generation.
+        :param fd: alternatively, the file descriptor of an index image (see AStarIndex.to_memfd).
+        """
+        self._native_SharedIndex = _SharedIndex()
+        if name is not None:
+            ret = _dll().SharedIndex_attach(name.encode(), self._native_SharedIndex)
+        else:
+            ret = _dll().SharedIndex_attach_fd(fd, self._native_SharedIndex)
+        ret.check()
+        dim = _uint32_t()
+        ret = _dll().SharedIndex_dim(self._native_SharedIndex, dim)
+        ret.check()
+        self._dim = int(dim.value)
+
+    def __del__(self):
+        ret = _dll().SharedIndex_delete(self._native_SharedIndex)
+        self._native_SharedIndex = None
+        ret.check()
+
+    @staticmethod
+    def unlink(name: str):
+        """
+        Remove the named index. Attached objects are not affected.
+        """
+        ret = _dll().SharedIndex_unlink(name.encode())
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        """
+        :return: the dimensionality of vectors that we process.
+        """
+        return self._dim
+
+    @property
+    def generation(self) -> int:
+        """
+        :return: the generation attached to (0 if attached by file descriptor).
+        """
+        value = _uint64_t()
+        ret = _dll().SharedIndex_generation(self._native_SharedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def stale(self) -> bool:
+        """
+        :return: True if a newer generation has been published.
+        """
+        value = ct.c_int()
+        ret = _dll().SharedIndex_stale(self._native_SharedIndex, value)
+        ret.check()
+        return bool(value.value)
+
+    def refresh(self) -> bool:
+        """
+        Attach to the newest generation, if stale.
+        :return: True if the generation changed.
+        """
+        value = ct.c_int()
+        ret = _dll().SharedIndex_refresh(self._native_SharedIndex, value)
+        ret.check()
+        return bool(value.value)
+
+    def num_hashes(self) -> int:
+        """
+        :return: number of hash codes used in the index.
+        """
+        value = _size_t()
+        ret = _dll().SharedIndex_num_hashes(self._native_SharedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def num_elements(self) -> int:
+        """
+        :return: number of elements in the index.
+        """
+        value = _size_t()
+        ret = _dll().SharedIndex_num_elements(self._native_SharedIndex, value)
+        ret.check()
+        return int(value.value)
+
+    def candidates(self, query_vector) -> np.ndarray:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: an array of integer (size_t)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        size = self._num_candidates(query_array)
+        elems = np.empty(size, dtype=_size_t)
+        out_count = _size_t()
+        ret = _dll().SharedIndex_get_elems(self._native_SharedIndex, query_array, size, out_count, elems)
+        ret.check()
+        return elems
+
+    def num_candidates(self, query_vector) -> int:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: number of items to be retrieved by the key
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        return self._num_candidates(query_array)
+
+    def _num_candidates(self, query_array) -> int:
+        value = _size_t()
+        ret = _dll().SharedIndex_count(self._native_SharedIndex, query_array, value)
+        ret.check()
+        return int(value.value)
+
+
+class ShardMap:
+    """
+    A ShardMap assigns vectors to shards by the cell of a coarse A* lattice, an integer
+    scaling of the (fine) quantisation lattice. The vectors of each shard are served by
+    an AStarServer (with elems being their row numbers), and queried with a ShardCoordinator.
+    """
+
+    def __init__(self, dim: int, packing_radius: float, num_shells: int, coarse_factor: int, num_shards: int):
+        """
+        :param dim: the dimensionality of vectors.
+        :param packing_radius: the packing radius of the (fine) quantisation lattice.
+        :param num_shells: how many extended shells to use in queries.
+        :param coarse_factor: the scale of the coarse lattice relative to the fine one (>= 1).
+        :param num_shards: the number of shards (>= 1).
+        """
+        self._native_ShardMap = _ShardMap()
+        ret = _dll().ShardMap_new(dim, packing_radius, num_shells, coarse_factor, num_shards, self._native_ShardMap)
+        ret.check()
+        self._dim = dim
+
+    def __del__(self):
+        ret = _dll().ShardMap_delete(self._native_ShardMap)
+        self._native_ShardMap = None
+        ret.check()
+
+    def assign(self, vectors) -> np.ndarray:
+        """
+        :param vectors: a 2D array, one vector of the right dimensionality per row
+        :return: an array with the shard of each vector
+        """
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2 or array.shape[1] != self._dim:
+            raise AStarException(_Error_invalid_dim)
+        shards = np.empty(array.shape[0], dtype=_size_t)
+        ret = _dll().ShardMap_assign(self._native_ShardMap, array, array.shape[0], shards)
+        ret.check()
+        return shards
+
+
+class ShardCoordinator:
+    """
+    Answers k-NN queries over a sharded index, where shard i is served at socket_paths[i]
+    by an AStarServer of the vectors that a ShardMap (of the same parameters) puts in shard i.
+    Each query is only sent to the shards its probes fall in. Only available on POSIX systems.
+    A coordinator should only be used by one thread at a time.
+    """
+
+    def __init__(self, dim: int, packing_radius: float, num_shells: int, coarse_factor: int,
+                 socket_paths: List[str]):
+        """
+        :param dim: the dimensionality of vectors.
+        :param packing_radius: the packing radius of the (fine) quantisation lattice.
+        :param num_shells: how many extended shells to use in queries.
+        :param coarse_factor: the scale of the coarse lattice relative to the fine one.
+        :param socket_paths: the socket path of each shard server.
+        """
+        paths = (_str_t * len(socket_paths))(*[path.encode() for path in socket_paths])
+        self._native_ShardCoordinator = _ShardCoordinator()
+        ret = _dll().ShardCoordinator_size_t_new(dim, packing_radius, num_shells, coarse_factor,
+                                                 paths, len(socket_paths), self._native_ShardCoordinator)
+        ret.check()
+        self._dim = dim
+
+    def __del__(self):
+        ret = _dll().ShardCoordinator_size_t_delete(self._native_ShardCoordinator)
+        self._native_ShardCoordinator = None
+        ret.check()
+
+    def knn(self, query_vectors, k: int) -> list:
+        """
+        The k nearest of the candidates of each query vector, over all shards.
+        :param query_vectors: a 2D array, one query vector of the right dimensionality per row
+        :param k: the number of neighbours wanted
+        :return: a list with a pair of arrays per query, (elements, distances), nearest first
+        """
+        query_array = np.ascontiguousarray(query_vectors, dtype=_VElem_t)
+        if query_array.ndim != 2 or query_array.shape[1] != self._dim:
+            raise AStarException(_Error_invalid_dim)
+        counts = np.empty(query_array.shape[0], dtype=_size_t)
+        total = _size_t()
+        ret = _dll().ShardCoordinator_size_t_knn(self._native_ShardCoordinator, query_array, query_array.shape[0],
+                                                 k, counts, total)
+        ret.check()
+        elems = np.empty(int(total.value), dtype=_size_t)
+        distances = np.empty(int(total.value), dtype=_VElem_t)
+        ret = _dll().ShardCoordinator_size_t_results(self._native_ShardCoordinator, elems,
+                                                     distances.ctypes.data_as(_Ptr(_Distance_t)))
+        ret.check()
+        return list(zip(AStarClient._split(elems, counts), AStarClient._split(distances, counts)))
+
+    @property
+    def num_shard_requests(self) -> int:
+        """
+        :return: the number of (query, shard) pairs sent so far, i.e., the total number of shards touched.
+        """
+        requests = _size_t()
+        ret = _dll().ShardCoordinator_size_t_num_shard_requests(self._native_ShardCoordinator, requests)
+        ret.check()
+        return int(requests.value)
+
+
+class LatticeCodec:
+    """
+    A LatticeCodec compresses vectors to the c-vectors of their nearest points in an A* lattice
+    (relative to a base vector), with each of the dim + 1 elements packed into a fixed number of bits.
+    The packing radius sets the error (at most the covering radius of the lattice), and the bits set
+    the range that can be coded without clipping: each element is about (vector - base) / (2 * packing_radius).
+    """
+
+    def __init__(self, dim: int, packing_radius: float, bits: int, base=None):
+        """
+        :param dim: the dimensionality of vectors.
+        :param packing_radius: the packing radius of the quantisation lattice.
+        :param bits: the bits per c-vector element, 2 to 16.
+        :param base: optional base vector, e.g. the mean of the vectors; default is the origin.
+        """
+        base_array = None
+        if base is not None:
+            base_array = _make_array(_VElem_t, base, dim)
+        self._native_LatticeCodec = _LatticeCodec()
+        ret = _dll().LatticeCodec_new(dim, packing_radius, bits,
+                                      None if base_array is None else base_array.ctypes.data,
+                                      self._native_LatticeCodec)
+        ret.check()
+        self._dim = dim
+        code_size = _size_t()
+        ret = _dll().LatticeCodec_code_size(self._native_LatticeCodec, code_size)
+        ret.check()
+        self._code_size = int(code_size.value)
+
+    def __del__(self):
+        ret = _dll().LatticeCodec_delete(self._native_LatticeCodec)
+        self._native_LatticeCodec = None
+        ret.check()
+
+    @property
+    def code_size(self) -> int:
+        """
+        :return: the number of bytes in the code of a vector.
+        """
+        return self._code_size
+
+    @property
+    def bits_per_dim(self) -> float:
+        """
+        :return: the number of bits of code per vector dimension.
+        """
+        return self._code_size * 8 / self._dim
+
+    def encode(self, vectors, num_threads: int = 1) -> np.ndarray:
+        """
+        :param vectors: a 2D array, one vector of the right dimensionality per row
+        :return: a 2D array of uint8, one code per row
+        """
+        array = self._make_batch(vectors)
+        codes = np.empty((array.shape[0], self._code_size), dtype=np.uint8)
+        ret = _dll().LatticeCodec_encode(self._native_LatticeCodec, array, array.shape[0], num_threads, codes)
+        ret.check()
+        return codes
+
+    def decode(self, codes, num_threads: int = 1) -> np.ndarray:
+        """
+        :param codes: a 2D array of uint8, one code per row, as from encode
+        :return: a 2D array, one decoded vector per row
+        """
+        codes = np.ascontiguousarray(codes, dtype=np.uint8)
+        if codes.ndim != 2 or codes.shape[1] != self._code_size:
+            raise ValueError('need one code per row')
+        vectors = np.empty((codes.shape[0], self._dim), dtype=_VElem_t)
+        ret = _dll().LatticeCodec_decode(self._native_LatticeCodec, codes, codes.shape[0], num_threads, vectors)
+        ret.check()
+        return vectors
+
+    def rate_distortion(self, vectors, num_threads: int = 1) -> Tuple[float, float, float, float]:
+        """
+        Encode the vectors and measure the error of their codes.
+        :param vectors: a 2D array, one vector of the right dimensionality per row
+        :return: (bits per dimension, root mean squared error per vector, maximum error,
+            fraction of vectors clipped)
+        """
+        array = self._make_batch(vectors)
+        codes = np.empty((array.shape[0], self._code_size), dtype=np.uint8)
+        num_clipped = _size_t()
+        sum_squared = _double_t()
+        max_error = _double_t()
+        ret = _dll().LatticeCodec_encode_stats(self._native_LatticeCodec, array, array.shape[0], num_threads, codes,
+                                               num_clipped, sum_squared, max_error)
+        ret.check()
+        n = max(array.shape[0], 1)
+        return (self.bits_per_dim, float(np.sqrt(sum_squared.value / n)), float(max_error.value),
+                num_clipped.value / n)
+
+    def _make_batch(self, vectors) -> np.ndarray:
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2 or array.shape[1] != self._dim:
+            raise AStarException(_Error_invalid_dim)
+        return array
+
+
+class SparseAStarNN:
+    """
+    A SparseAStarNN finds the nearest A* lattice points of sparse vectors, such as TF-IDF or
+    bag-of-words vectors, given by the indices and values of their non-zero elements. The time
+    taken is proportional to nnz log nnz rather than to the dimensionality, which may be up to 2^31.
+    The hash codes are the same as AStarNN.nearest_hash of the dense vectors.
+    """
+
+    def __init__(self, dim: int, packing_radius: float):
+        """
+        :param dim: the dimensionality of vectors.
+        :param packing_radius: the packing radius of the quantisation lattice.
+        """
+        self._native_SparseAStarNN = _SparseAStarNN()
+        ret = _dll().SparseAStarNN_new(dim, packing_radius, self._native_SparseAStarNN)
+        ret.check()
+        self._dim = dim
+
+    def __del__(self):
+        ret = _dll().SparseAStarNN_delete(self._native_SparseAStarNN)
+        self._native_SparseAStarNN = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        return self._dim
+
+    def nearest_hash(self, indices, values) -> int:
+        """
+        :param indices: the (distinct) indices of the non-zero elements of the vector
+        :param values: the values of the non-zero elements
+        :return: the hash code of the nearest lattice point
+        """
+        indices, values = self._make_sparse(indices, values)
+        hash_code = _HashCode_t()
+        ret = _dll().SparseAStarNN_nearest_hash(self._native_SparseAStarNN, len(indices), indices, values, hash_code)
+        ret.check()
+        return int(hash_code.value)
+
+    def nearest_cvector(self, indices, values) -> Tuple[np.ndarray, int, int, int]:
+        """
+        :param indices: the (distinct) indices of the non-zero elements of the vector
+        :param values: the values of the non-zero elements
+        :return: the c-vector of the nearest lattice point in sparse form, as
+            (its elements at the given indices, its element at all other indices below dim,
+            its element at index dim), and the k value of the lattice point
+        """
+        indices, values = self._make_sparse(indices, values)
+        c_nonzero = np.empty(len(indices), dtype=_CElem_t)
+        c_zero = _int32_t()
+        c_last = _int32_t()
+        k = _K_t()
+        ret = _dll().SparseAStarNN_nearest_cvector(self._native_SparseAStarNN, len(indices), indices, values,
+                                                   c_nonzero, c_zero, c_last, k)
+        ret.check()
+        return c_nonzero, int(c_zero.value), int(c_last.value), int(k.value)
+
+    def nearest_hashes(self, offsets, indices, values, num_threads: int = 1) -> np.ndarray:
+        """
+        :param offsets: the start of each vector in indices and values, and their end, as the
+            indptr of a scipy.sparse.csr_matrix
+        :param indices: the indices of the non-zero elements of the vectors
+        :param values: the values of the non-zero elements of the vectors
+        :return: the hash code of the nearest lattice point of each vector
+        """
+        offsets = np.ascontiguousarray(offsets, dtype=_size_t)
+        indices, values = self._make_sparse(indices, values)
+        if offsets.ndim != 1 or len(offsets) == 0 or offsets[0] != 0 or offsets[-1] != len(indices) \
+                or np.any(np.diff(offsets.astype(np.int64)) < 0):
+            raise ValueError('offsets must increase from 0 to the number of non-zeros')
+        hashes = np.empty(len(offsets) - 1, dtype=_HashCode_t)
+        ret = _dll().SparseAStarNN_nearest_hashes(self._native_SparseAStarNN, len(hashes), offsets, indices, values,
+                                                  num_threads, hashes)
+        ret.check()
+        return hashes
+
+    @staticmethod
+    def _make_sparse(indices, values) -> Tuple[np.ndarray, np.ndarray]:
+        indices = np.ascontiguousarray(indices, dtype=np.uint32)
+        values = np.ascontiguousarray(values, dtype=_VElem_t)
+        if indices.ndim != 1 or indices.shape != values.shape:
+            raise ValueError('need one value per index')
+        return indices, values
+
+
+class VectorTransform:
+    """
+    A VectorTransform is an affine map y = W (x - offset) of vectors, either diagonal (a scale
+    and offset per dimension, e.g. z-scoring) or a (truncated) PCA whitening. Given to an
+    AStarNN, it is applied as each vector is mapped to the lattice, with no extra pass.
+    Use the static methods to make one.
+    """
+
+    def __init__(self, native):
+        self._native_VectorTransform = native
+        input_dim = _Dim_t()
+        output_dim = _Dim_t()
+        is_diagonal = ct.c_int()
+        ret = _dll().VectorTransform_dims(self._native_VectorTransform, input_dim, output_dim, is_diagonal)
+        ret.check()
+        self._input_dim = int(input_dim.value)
+        self._output_dim = int(output_dim.value)
+        self._is_diagonal = bool(is_diagonal.value)
+
+    def __del__(self):
+        ret = _dll().VectorTransform_delete(self._native_VectorTransform)
+        self._native_VectorTransform = None
+        ret.check()
+
+    @staticmethod
+    def diagonal(dim: int, offset=None, scale=None) -> 'VectorTransform':
+        """
+        :param dim: the dimensionality of vectors.
+        :param offset: optional offset per dimension; default zero.
+        :param scale: optional scale per dimension; default one.
+        :return: the transform y_i = scale_i (x_i - offset_i).
+        """
+        offset_array = None if offset is None else _make_array(_VElem_t, offset, dim)
+        scale_array = None if scale is None else _make_array(_VElem_t, scale, dim)
+        native = _VectorTransform()
+        ret = _dll().VectorTransform_new_diagonal(dim,
+                                                  None if offset_array is None else offset_array.ctypes.data,
+                                                  None if scale_array is None else scale_array.ctypes.data,
+                                                  native)
+        ret.check()
+        return VectorTransform(native)
+
+    @staticmethod
+    def whitening(matrix, offset=None) -> 'VectorTransform':
+        """
+        :param matrix: the output_dim x input_dim matrix W.
+        :param offset: optional offset (e.g. the mean) of input_dim elements; default zero.
+        :return: the transform y = W (x - offset).
+        """
+        matrix = np.ascontiguousarray(matrix, dtype=_VElem_t)
+        if matrix.ndim != 2:
+            raise AStarException(_Error_invalid_dim)
+        output_dim, input_dim = matrix.shape
+        offset_array = None if offset is None else _make_array(_VElem_t, offset, input_dim)
+        native = _VectorTransform()
+        ret = _dll().VectorTransform_new_whitening(input_dim, output_dim,
+                                                   None if offset_array is None else offset_array.ctypes.data,
+                                                   matrix, native)
+        ret.check()
+        return VectorTransform(native)
+
+    @staticmethod
+    def fit_diagonal(sample, num_threads: int = 1) -> 'VectorTransform':
+        """
+        Fit a diagonal transform mapping the sample to zero mean and unit variance per dimension.
+        :param sample: a 2D array, one vector per row.
+        :param num_threads: the number of threads to use (0 for all cores).
+        """
+        sample = VectorTransform._make_sample(sample)
+        native = _VectorTransform()
+        ret = _dll().VectorTransform_fit_diagonal(sample.shape[1], sample, sample.shape[0], num_threads, native)
+        ret.check()
+        return VectorTransform(native)
+
+    @staticmethod
+    def fit_whitening(sample, output_dim: Optional[int] = None, epsilon: float = 0.0,
+                      num_threads: int = 1) -> 'VectorTransform':
+        """
+        Fit a PCA whitening transform mapping the sample to zero mean and unit covariance.
+        :param sample: a 2D array, one vector per row.
+        :param output_dim: the number of principal axes kept; default all.
+        :param epsilon: added to the variance of each axis, to limit the gain of small axes.
+        :param num_threads: the number of threads to use (0 for all cores).
+        """
+        sample = VectorTransform._make_sample(sample)
+        if output_dim is None:
+            output_dim = sample.shape[1]
+        native = _VectorTransform()
+        ret = _dll().VectorTransform_fit_whitening(sample.shape[1], output_dim, sample, sample.shape[0], epsilon,
+                                                   num_threads, native)
+        ret.check()
+        return VectorTransform(native)
+
+    @property
+    def input_dim(self) -> int:
+        return self._input_dim
+
+    @property
+    def output_dim(self) -> int:
+        return self._output_dim
+
+    @property
+    def is_diagonal(self) -> bool:
+        return self._is_diagonal
+
+    def params(self) -> Tuple[np.ndarray, np.ndarray]:
+        """
+        :return: (offset, weights), where weights is the scale per dimension of a diagonal
+            transform, else the output_dim x input_dim matrix W.
+        """
+        offset = np.empty(self._input_dim, dtype=_VElem_t)
+        if self._is_diagonal:
+            weights = np.empty(self._input_dim, dtype=_VElem_t)
+        else:
+            weights = np.empty((self._output_dim, self._input_dim), dtype=_VElem_t)
+        ret = _dll().VectorTransform_params(self._native_VectorTransform, offset, weights)
+        ret.check()
+        return offset, weights
+
+    def apply(self, vectors, num_threads: int = 1) -> np.ndarray:
+        """
+        :param vectors: a 2D array, one vector of input_dim elements per row.
+        :return: a 2D array, one transformed vector of output_dim elements per row.
+        """
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2 or array.shape[1] != self._input_dim:
+            raise AStarException(_Error_invalid_dim)
+        out = np.empty((array.shape[0], self._output_dim), dtype=_VElem_t)
+        ret = _dll().VectorTransform_apply(self._native_VectorTransform, array, array.shape[0], num_threads, out)
+        ret.check()
+        return out
+
+    @staticmethod
+    def _make_sample(sample) -> np.ndarray:
+        array = np.ascontiguousarray(sample, dtype=_VElem_t)
+        if array.ndim != 2:
+            raise AStarException(_Error_invalid_dim)
+        return array
+
+
+class ProbeProfile:
+    """
+    A ProbeProfile counts, for each orbit of the extended probes of an AStarNN, how many of
+    the true nearest neighbours of a set of training queries it finds (the first probe with
+    the hash code of a neighbour's nearest lattice point finds it). select_orbits chooses
+    the orbits worth walking, by yield, for AStarNN.set_orbits.
+    """
+
+    def __init__(self, nn: AStarNN):
+        """
+        :param nn: the AStarNN to profile; its orbits must not change while recording.
+        """
+        self._nn = nn
+        self._native_ProbeProfile = _ProbeProfile()
+        ret = _dll().ProbeProfile_new(nn._native_AStarNN, self._native_ProbeProfile)
+        ret.check()
+        num_orbits = _size_t()
+        ret = _dll().ProbeProfile_num_orbits(self._native_ProbeProfile, num_orbits)
+        ret.check()
+        self._num_orbits = int(num_orbits.value)
+
+    def __del__(self):
+        ret = _dll().ProbeProfile_delete(self._native_ProbeProfile)
+        self._native_ProbeProfile = None
+        ret.check()
+
+    @property
+    def num_orbits(self) -> int:
+        """
+        :return: the number of orbits of the AStarNN's shells, all of which are counted.
+        """
+        return self._num_orbits
+
+    def record(self, queries, data, neighbours, num_threads: int = 1):
+        """
+        :param queries: a 2D array, one query vector per row.
+        :param data: a 2D array, one data vector per row.
+        :param neighbours: a 2D array, the indices (into data) of the k true nearest
+            neighbours of each query, one row per query.
+        :param num_threads: the number of threads to use (0 for all cores).
+        """
+        queries = self._make_batch(queries)
+        data = self._make_batch(data)
+        neighbours = np.ascontiguousarray(neighbours, dtype=_size_t)
+        if neighbours.ndim != 2 or neighbours.shape[0] != queries.shape[0]:
+            raise ValueError('need one row of neighbours per query')
+        if neighbours.size and neighbours.max() >= data.shape[0]:
+            raise ValueError('neighbour index out of range')
+        ret = _dll().ProbeProfile_record(self._native_ProbeProfile, queries, queries.shape[0], data, neighbours,
+                                         neighbours.shape[1], num_threads)
+        ret.check()
+
+    def counts(self) -> Tuple[int, int, int]:
+        """
+        :return: (number of queries, number of neighbours, number of neighbours found) recorded.
+        """
+        num_queries = _uint64_t()
+        num_neighbours = _uint64_t()
+        num_found = _uint64_t()
+        ret = _dll().ProbeProfile_counts(self._native_ProbeProfile, num_queries, num_neighbours, num_found)
+        ret.check()
+        return int(num_queries.value), int(num_neighbours.value), int(num_found.value)
+
+    def hits(self) -> np.ndarray:
+        """
+        :return: the number of neighbours found by each orbit.
+        """
+        hits = np.empty(self._num_orbits, dtype=np.uint64)
+        ret = _dll().ProbeProfile_hits(self._native_ProbeProfile, hits)
+        ret.check()
+        return hits
+
+    def select_orbits(self, min_yield: float = 0.0, max_probes: int = 0) -> np.ndarray:
+        """
+        :param min_yield: the least fraction of the neighbours that an orbit must find.
+        :param max_probes: the most probes in all (dim + 1 per orbit), or 0 for no limit.
+        :return: orbit 0, then the orbits of at least min_yield, highest yield first.
+        """
+        orbits = np.empty(self._num_orbits, dtype=np.uint32)
+        num_orbits = _size_t()
+        ret = _dll().ProbeProfile_select_orbits(self._native_ProbeProfile, min_yield, max_probes, orbits, num_orbits)
+        ret.check()
+        return orbits[:num_orbits.value]
+
+    def clear(self):
+        ret = _dll().ProbeProfile_clear(self._native_ProbeProfile)
+        ret.check()
+
+    def _make_batch(self, vectors) -> np.ndarray:
+        array = np.ascontiguousarray(vectors, dtype=_VElem_t)
+        if array.ndim != 2 or array.shape[1] != self._nn.input_dim:
+            raise AStarException(_Error_invalid_dim)
+        return array
+
+
+class E8NN:
+    """
+    An E8NN quantises vectors (of a dimensionality that is a multiple of 8) to the product
+    lattice E8 x ... x E8, one E8 per block of 8 elements, a better quantiser than A*8.
+    Extended probes are the nearest lattice point and, for each block, the num_shells nearest
+    of the 240 neighbours of its point in that block (so num_shells is at most 240), nearest first.
+    """
+
+    def __init__(self, dim: int, packing_radius: float, num_shells: int):
+        """
+        :param dim: the dimensionality of vectors, a multiple of 8.
+        :param packing_radius: the packing radius of the product lattice.
+        :param num_shells: the number of neighbours per block for extended probes, 0 to 240.
+        """
+        self._native_E8NN = _E8NN()
+        ret = _dll().E8NN_new(dim, packing_radius, num_shells, self._native_E8NN)
+        ret.check()
+        self._dim = dim
+        num_probes = _size_t()
+        ret = _dll().E8NN_num_probes(self._native_E8NN, num_probes)
+        ret.check()
+        self._num_probes = int(num_probes.value)
+
+    def __del__(self):
+        ret = _dll().E8NN_delete(self._native_E8NN)
+        self._native_E8NN = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        return self._dim
+
+    @property
+    def num_probes(self) -> int:
+        return self._num_probes
+
+    def nearest_hash(self, vector) -> int:
+        """
+        Return the hash code of the lattice point nearest to the given vector.
+        """
+        array = _make_array(_VElem_t, vector, self._dim)
+        hash_code = _HashCode_t()
+        ret = _dll().E8NN_nearest_hash(self._native_E8NN, array, hash_code)
+        ret.check()
+        return int(hash_code.value)
+
+    def nearest_point(self, vector) -> np.ndarray:
+        """
+        Return the lattice point nearest to the given vector, in doubled coordinates (twice
+        the coordinates in the lattice space, all integers).
+        """
+        array = _make_array(_VElem_t, vector, self._dim)
+        doubled = np.empty(self._dim, dtype=_CElem_t)
+        ret = _dll().E8NN_nearest_point(self._native_E8NN, array, doubled)
+        ret.check()
+        return doubled
+
+    def extended_hash(self, vector) -> np.ndarray:
+        """
+        Return the hash codes of the num_probes extended probes of the given vector, nearest first.
+        """
+        array = _make_array(_VElem_t, vector, self._dim)
+        hashes = np.empty(self._num_probes, dtype=_HashCode_t)
+        ret = _dll().E8NN_extended_hash(self._native_E8NN, array, hashes)
+        ret.check()
+        return hashes
+
+
+class E8Index:
+    """
+    An E8Index is an AStarIndex (of integer values) on the E8NN product lattice, for
+    vectors of a dimensionality that is a multiple of 8.
+    """
+
+    def __init__(self, dim: int, packing_radius: float, num_shells: int):
+        """
+        :param dim: the dimensionality of vectors, a multiple of 8.
+        :param packing_radius: the packing radius of the product lattice.
+        :param num_shells: the number of neighbours per block for extended probes, 0 to 240.
+        """
+        self._native_E8Index = _E8Index()
+        ret = _dll().E8Index_size_t_new(dim, packing_radius, num_shells, self._native_E8Index)
+        ret.check()
+        self._dim = dim
+
+    def __del__(self):
+        ret = _dll().E8Index_size_t_delete(self._native_E8Index)
+        self._native_E8Index = None
+        ret.check()
+
+    @property
+    def dim(self) -> int:
+        return self._dim
+
+    @property
+    def num_probes(self) -> int:
+        num_probes = _size_t()
+        ret = _dll().E8Index_size_t_num_probes(self._native_E8Index, num_probes)
+        ret.check()
+        return int(num_probes.value)
+
+    def num_hashes(self) -> int:
+        """
+        :return: number of hash codes used in the index.
+        """
+        size = _size_t()
+        ret = _dll().E8Index_size_t_num_hashes(self._native_E8Index, size)
+        ret.check()
+        return int(size.value)
+
+    def bytes_allocated(self) -> int:
+        """
+        :return: number of bytes of native memory currently allocated for index storage.
+        """
+        size = _size_t()
+        ret = _dll().E8Index_size_t_bytes_allocated(self._native_E8Index, size)
+        ret.check()
+        return int(size.value)
+
+    def insert(self, vector, value):
+        """
+        :param vector: a vector of the right dimensionality
+        :param value: an integer (size_t)
+        """
+        array = _make_array(_VElem_t, vector, self._dim)
+        ret = _dll().E8Index_size_t_put(self._native_E8Index, array, value)
+        ret.check()
+
+    def candidates(self, query_vector) -> np.ndarray:
+        """
+        :param query_vector: a vector of the right dimensionality
+        :return: an array of integer (size_t)
+        """
+        query_array = _make_array(_VElem_t, query_vector, self._dim)
+        size = _size_t()
+        ret = _dll().E8Index_size_t_count(self._native_E8Index, query_array, size)
+        ret.check()
+        elems = np.empty(size.value, dtype=_size_t)
+        out_count = _size_t()
+        ret = _dll().E8Index_size_t_get_elems(self._native_E8Index, query_array, size.value, out_count, elems)
+        ret.check()
+        return elems
+
+
 class LSH:
     """
     An LSH is a more general form of AStartIndex.
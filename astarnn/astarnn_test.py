@@ -5,9 +5,17 @@ __author__ = 'Barry Drake'
 
 import unittest
 import math
+import os
+import socket
+import struct
+import sys
+import tempfile
+import threading
 from dataclasses import dataclass
 from astarnn import info_string, extended_info_string, ReturnVal, AStarException, AStarNN, max_num_shells, \
-    rho, AStarIndex
+    rho, AStarIndex, AStarBoundedIndex, AStarVersionedIndex, ProbeCursor, \
+    AStarPartitionedIndex, AStarServer, AStarClient, SharedIndex, ShardMap, ShardCoordinator, \
+    LatticeCodec, SparseAStarNN, E8NN, E8Index, VectorTransform, ProbeProfile
 from _astarnn import _round_up  # white box testing
 import numpy as np
 
@@ -120,6 +128,81 @@ class Test_AStarNN(unittest.TestCase):
         hash_code = nn.nearest_hash(v)
         self.assertEqual(18446744073709549664, hash_code)
 
+    def test_nearest_hash_margin(self):
+        dim = 5
+        packing_radius = 1.5
+        num_shells = 1
+
+        nn = AStarNN(dim, packing_radius, num_shells)
+
+        rng = np.random.default_rng(3)
+        for v in rng.normal(scale=4, size=(200, dim)):
+            hash_code, margin = nn.nearest_hash_margin(v)
+            self.assertEqual(nn.nearest_hash(v), hash_code)
+            self.assertTrue(0 <= margin <= packing_radius * 1.0001)
+
+            # Any step shorter than the margin stays in the cell.
+            step = rng.normal(size=dim)
+            step *= 0.999 * margin / np.linalg.norm(step)
+            self.assertEqual(hash_code, nn.nearest_hash(v + step))
+
+    def test_nearest_hash_margins(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+
+        nn = AStarNN(dim, packing_radius, num_shells)
+
+        rng = np.random.default_rng(5)
+        for v in rng.normal(scale=4, size=(200, dim)):
+            hash_code, distance, cell_margin, delaunay_margin = nn.nearest_hash_margins(v)
+            self.assertEqual(nn.nearest_hash(v), hash_code)
+            self.assertAlmostEqual(nn.nearest_hash_margin(v)[1], cell_margin, 9)
+
+            # cvector_to_lattice_point gives the lattice point negated.
+            lattice_point = -nn.cvector_to_lattice_point(nn.nearest_cvector(v))
+            self.assertAlmostEqual(np.linalg.norm(lattice_point - v), distance, 6)
+
+            # Any step shorter than the Delaunay margin stays in the Delaunay cell.
+            step = rng.normal(size=dim)
+            step *= 0.999 * delaunay_margin / np.linalg.norm(step)
+            self.assertEqual(sorted(nn.delaunay_hash(v)), sorted(nn.delaunay_hash(v + step)))
+
+    def test_adaptive_hash(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+
+        nn = AStarNN(dim, packing_radius, num_shells)
+
+        rng = np.random.default_rng(6)
+        counts = {}
+        for v in rng.normal(scale=4, size=(300, dim)):
+            radius = rng.uniform(0, 0.6)
+            hashes = nn.adaptive_hash(v, radius)
+            counts[len(hashes)] = counts.get(len(hashes), 0) + 1
+            self.assertIn(len(hashes), [1, dim + 1, nn.num_probes])
+            if len(hashes) == nn.num_probes:
+                self.assertEqual(list(nn.extended_hash(v)), list(hashes))
+                continue
+
+            # Every vector within the radius is hashed to one of the probes.
+            for _ in range(20):
+                step = rng.normal(size=dim)
+                step *= rng.uniform(0, radius) / np.linalg.norm(step)
+                self.assertIn(nn.nearest_hash(v + step), hashes)
+        self.assertTrue(counts.get(1, 0) > 0 and counts.get(dim + 1, 0) > 0)
+
+    def test_extended_nearest_hash(self):
+        for dim in [1, 3, 8]:
+            nn = AStarNN(dim, 1, 2)
+            rng = np.random.default_rng(dim)
+            for v in rng.normal(scale=4, size=(100, dim)):
+                hashes, nearest = nn.extended_nearest_hash(v)
+                self.assertEqual(list(nn.extended_hash(v)), list(hashes))
+                self.assertEqual(nn.nearest_hash(v), nearest)
+                self.assertEqual(sorted(nn.delaunay_hash(v)), sorted(hashes[:dim + 1]))
+
     def test_nearest_cvector(self):
         dim = 2
         packing_radius = 1
@@ -337,6 +420,33 @@ class Test_AStarNN(unittest.TestCase):
 
         self.assertTrue(np.array_equal(np.array(expect), cvectors))
 
+    def test_probe_cursor(self):
+        dim = 7
+        packing_radius = 1
+        num_shells = 2
+
+        nn = AStarNN(dim, packing_radius, num_shells)
+        cursor = ProbeCursor(nn)
+        rng = np.random.default_rng(3)
+
+        for _ in range(5):
+            v = rng.normal(size=dim)
+            cursor.start(v)
+            self.assertEqual(nn.num_probes, cursor.remaining)
+
+            hashes = []
+            cvectors = []
+            while True:
+                h, c = cursor.next(5)
+                if len(h) == 0:
+                    break
+                hashes.append(h)
+                cvectors.append(c)
+
+            self.assertEqual(0, cursor.remaining)
+            self.assertTrue(np.array_equal(nn.extended_hash(v), np.concatenate(hashes)))
+            self.assertTrue(np.array_equal(nn.extended_cvector(v), np.concatenate(cvectors)))
+
     def test_extended_callback_high_dim(self):
         dim = 32
         packing_radius = 1
@@ -658,6 +768,490 @@ class Test_AStarIndex(unittest.TestCase):
         self.assertEqual(1, index.num_hashes())
         self.assertEqual(1, index.num_elements())
 
+    def test_bytes_allocated(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 7
+
+        v1 = np.array([6.1, -0.3, 0.8], dtype=np.double)
+        v2 = np.array([9.1, -9.3, 9.8], dtype=np.double)
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        empty_bytes = index.bytes_allocated()
+
+        index.insert(v1, 123)
+        index.insert(v2, 456)
+        full_bytes = index.bytes_allocated()
+        self.assertLess(empty_bytes, full_bytes)
+
+        index.clear()
+        self.assertLess(index.bytes_allocated(), full_bytes)
+
+    def test_compact(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 2
+
+        np.random.seed(2468)
+        vectors = np.random.rand(2000, dim) * 100
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(vectors):
+            index.insert(v, i)
+        keep = vectors[0]
+        for v in vectors[1:]:
+            index.clear_by_vector(v)
+        self.assertEqual(1, index.num_hashes())
+
+        before = index.bytes_allocated()
+        reclaimed = index.compact()
+        self.assertLess(0, reclaimed)
+        self.assertLess(index.bytes_allocated(), before)
+        self.assertEqual([0], list(index.candidates(keep)))
+
+    def test_compact_step(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 2
+
+        v = np.array([6.1, -0.3, 0.8], dtype=np.double)
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        for i in range(100):
+            index.insert(v, i)
+        index.clear()
+        index.insert(v, 100)
+
+        total = 0
+        for _ in range(10000):
+            done, reclaimed = index.compact_step(4)
+            total += reclaimed
+            if done:
+                break
+        self.assertTrue(done)
+        self.assertLess(0, total)
+        self.assertEqual([100], list(index.candidates(v)))
+
+    def test_compact_step_migrates(self):
+        dim = 3
+        rng = np.random.default_rng(2469)
+        vectors = rng.uniform(0, 100, size=(3000, dim))
+
+        index = AStarIndex(dim, 1, 1)
+        index.insert_batch(vectors, np.arange(len(vectors)))
+        for v in vectors[100:]:
+            index.clear_by_vector(v)
+        kept = vectors[:50]
+        expect = [sorted(index.candidates(q)) for q in kept]
+        num_hashes = index.num_hashes()
+        before = index.bytes_allocated()
+
+        # The oversized table is replaced a few slots at a time, while the
+        # index stays queryable and writable.
+        steps = 0
+        done = False
+        while not done:
+            done, reclaimed = index.compact_step(64)
+            steps += 1
+            self.assertEqual(num_hashes, index.num_hashes())
+            if steps % 7 == 0:
+                self.assertEqual(expect, [sorted(index.candidates(q)) for q in kept])
+                self.assertEqual(expect, [sorted(c) for c in index.candidates_batch(kept, width=4)])
+            if steps == 50:
+                index.insert(vectors[2000], 2000)
+                expect = [sorted(index.candidates(q)) for q in kept]
+                num_hashes = index.num_hashes()
+        self.assertLess(50, steps)
+        self.assertLess(0, reclaimed)   # the old table's slots, freed by the last step
+        self.assertLess(index.bytes_allocated(), before)
+        self.assertEqual(expect, [sorted(index.candidates(q)) for q in kept])
+        self.assertEqual([2000], [e for e in index.candidates(vectors[2000]) if e == 2000])
+
+    def test_arena(self):
+        dim = 3
+        chunk_size = 64 * 1024
+        rng = np.random.default_rng(2470)
+        vectors = rng.uniform(0, 100, size=(3000, dim))
+        queries = vectors[:40] + 0.1
+
+        index = AStarIndex(dim, 1, 1)
+        arena_index = AStarIndex(dim, 1, 1, arena_chunk_size=chunk_size)
+        self.assertEqual(0, arena_index.bytes_allocated())
+        for i, v in enumerate(vectors):
+            index.insert(v, i)
+            arena_index.insert(v, i)
+
+        self.assertEqual(index.num_hashes(), arena_index.num_hashes())
+        expect = [sorted(index.candidates(q)) for q in queries]
+        self.assertEqual(expect, [sorted(arena_index.candidates(q)) for q in queries])
+        self.assertEqual(expect, [sorted(c) for c in arena_index.candidates_batch(queries, width=4)])
+
+        # The arena holds all the storage, and keeps it until the index is deleted.
+        full_bytes = arena_index.bytes_allocated()
+        self.assertLessEqual(chunk_size, full_bytes)
+
+        # Merging and compacting take their new storage from the arena too.
+        merged = AStarIndex(dim, 1, 1, arena_chunk_size=chunk_size)
+        merged.merge(index)
+        self.assertEqual(expect, [sorted(merged.candidates(q)) for q in queries])
+        for v in vectors[100:]:
+            arena_index.clear_by_vector(v)
+        self.assertEqual(full_bytes, arena_index.bytes_allocated())
+        expect = [sorted(arena_index.candidates(q)) for q in queries]
+        done, _ = arena_index.compact_step(64)
+        while not done:
+            done, _ = arena_index.compact_step(64)
+        self.assertLessEqual(full_bytes, arena_index.bytes_allocated())
+        self.assertEqual(expect, [sorted(arena_index.candidates(q)) for q in queries])
+
+        # Delete an index part way through replacing its table, when both tables
+        # hold nodes (an index without an arena, built alike, counts the steps).
+        twin = AStarIndex(dim, 1, 1)
+        twin.merge(index)
+        for v in vectors[100:]:
+            merged.clear_by_vector(v)
+            twin.clear_by_vector(v)
+        steps = 1
+        while not twin.compact_step(64)[0]:
+            steps += 1
+        for _ in range(steps - 2):
+            self.assertFalse(merged.compact_step(64)[0])
+        self.assertEqual(twin.num_hashes(), merged.num_hashes())
+        del merged
+        del arena_index
+
+        with self.assertRaises(ValueError):
+            AStarIndex(dim, 1, 1, transform=VectorTransform.diagonal(dim), arena_chunk_size=chunk_size)
+
+    def test_candidates_batch(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(5)
+        data = rng.normal(scale=2, size=(500, dim))
+        queries = rng.normal(scale=2, size=(37, dim))
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            index.insert(v, i)
+
+        expect = [index.candidates(q) for q in queries]
+        for width in [0, 1, 3, 8, 100]:
+            for num_threads in [1, 4]:
+                counts = index.num_candidates_batch(queries, width, num_threads)
+                self.assertEqual([len(e) for e in expect], list(counts))
+                got = index.candidates_batch(queries, width, num_threads)
+                self.assertEqual(len(expect), len(got))
+                for e, g in zip(expect, got):
+                    self.assertEqual(list(e), list(g))
+
+    def test_insert_batch(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(6)
+        data = rng.normal(scale=2, size=(300, dim))
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        index.insert_batch(data, np.arange(len(data)), num_threads=3)
+
+        self.assertEqual(expect.num_hashes(), index.num_hashes())
+        self.assertEqual(expect.num_elements(), index.num_elements())
+        for v in data[:20]:
+            self.assertEqual(list(expect.candidates(v)), list(index.candidates(v)))
+
+    def test_merge(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(7)
+        data = rng.normal(scale=2, size=(1200, dim))
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+
+        # Independently built parts, merged in order, keep the insertion order.
+        parts = [AStarIndex(dim, packing_radius, num_shells) for _ in range(4)]
+        for part, rows in zip(parts, np.array_split(np.arange(len(data)), len(parts))):
+            part.insert_batch(data[rows], rows)
+
+        for num_threads in [1, 3]:
+            index = AStarIndex(dim, packing_radius, num_shells)
+            index.merge(parts[0])
+            index.merge_all(parts[1:], num_threads)
+            self.assertEqual(expect.num_hashes(), index.num_hashes())
+            self.assertEqual(expect.num_elements(), index.num_elements())
+            for v in data[::10]:
+                self.assertEqual(list(expect.candidates(v)), list(index.candidates(v)))
+
+        with self.assertRaises(AStarException):
+            index.merge(AStarIndex(dim + 1, packing_radius, num_shells))
+        with self.assertRaises(AStarException):
+            index.merge(AStarIndex(dim, packing_radius, num_shells + 1))
+        with self.assertRaises(AStarException):
+            index.merge(index)
+        self.assertEqual(expect.num_elements(), index.num_elements())
+
+    def test_update(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(11)
+        data = rng.normal(scale=3, size=(300, dim))
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        states = [index.insert_tracked(v, i) for i, v in enumerate(data)]
+
+        num_updates = 0
+        num_moved = 0
+        for _ in range(20):
+            steps = rng.normal(scale=0.05, size=data.shape)
+            for i in range(len(data)):
+                moved, states[i] = index.update(i, data[i], data[i] + steps[i], states[i])
+                data[i] += steps[i]
+                num_updates += 1
+                num_moved += moved
+        self.assertTrue(0 < num_moved < num_updates // 4)
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+        self.assertEqual(expect.num_hashes(), index.num_hashes())
+        self.assertEqual(expect.num_elements(), index.num_elements())
+        for v in data:
+            self.assertEqual(sorted(expect.candidates(v)), sorted(index.candidates(v)))
+
+        # The value must be where its state says.
+        hash_code, margin = states[0]
+        with self.assertRaises(AStarException):
+            index.update(len(data), data[0], data[0] + 10, (hash_code, 0.0))
+
+    def test_candidates_and_hash(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(13)
+        data = rng.normal(scale=2, size=(500, dim))
+        data = np.concatenate([data, data[:100] + rng.normal(scale=1e-3, size=(100, dim))])
+
+        # Streaming dedup: only add a vector if no candidate is within 0.01 of it.
+        index = AStarIndex(dim, packing_radius, num_shells)
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        kept = []
+        for i, v in enumerate(data):
+            elems, hash_code = index.candidates_and_hash(v, max_size=4)
+            self.assertEqual(sorted(index.candidates(v)), sorted(elems))
+            if all(np.linalg.norm(data[j] - v) > 0.01 for j in elems):
+                index.insert_hash(hash_code, i)
+                expect.insert(v, i)
+                kept.append(i)
+        self.assertEqual(list(range(500)), kept)
+        for v in data[::7]:
+            self.assertEqual(list(expect.candidates(v)), list(index.candidates(v)))
+
+    def test_candidates_adaptive(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(12)
+        data = rng.normal(scale=3, size=(3000, dim))
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        index.insert_batch(data, np.arange(len(data)))
+
+        radius = 0.3
+        total_probes = 0
+        for q in rng.normal(scale=3, size=(200, dim)):
+            elems, num_probes = index.candidates_adaptive(q, radius)
+            total_probes += num_probes
+            if num_probes < index.num_probes:
+                near = np.nonzero(np.linalg.norm(data - q, axis=1) <= radius)[0]
+                self.assertTrue(set(near) <= set(elems))
+            else:
+                self.assertEqual(sorted(index.candidates(q)), sorted(elems))
+        self.assertTrue(total_probes < 200 * index.num_probes)
+
+    def test_bucket_size_histogram(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 7
+
+        v1 = np.array([6.1, -0.3, 0.8], dtype=np.double)
+        v2 = np.array([9.1, -9.3, 9.8], dtype=np.double)
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        for i in range(20):
+            index.insert(v1, i)
+        index.insert(v2, 20)
+
+        histogram = index.bucket_size_histogram(4)
+        self.assertEqual([0, 1, 0, 1], list(histogram))
+
+        # large buckets spill out of line, and still return every element
+        result = index.candidates(v1)
+        self.assertEqual(list(range(20)), sorted(result))
+
+
+class Test_AStarBoundedIndex(unittest.TestCase):
+
+    def test_get_singleton(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 7
+
+        index = AStarBoundedIndex(dim, packing_radius, num_shells, 1024 * 1024)
+
+        v = np.array([6.1, -0.2, 0.8], dtype=np.double)
+
+        index.insert(v, 123)
+        self.assertEqual(1, index.num_candidates(v))
+
+        result = index.candidates(v)
+        self.assertEqual([123], list(result))
+
+        hits, misses, evictions, evicted_elements = index.counters()
+        self.assertEqual(1, hits)
+        self.assertEqual(index_num_probes(dim, packing_radius, num_shells) - 1, misses)
+        self.assertEqual(0, evictions)
+        self.assertEqual(0, evicted_elements)
+
+    def test_budget(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 2
+        budget = 4096
+
+        np.random.seed(1234)
+        index = AStarBoundedIndex(dim, packing_radius, num_shells, budget)
+        for i in range(1000):
+            index.insert(np.random.rand(dim) * 100, i)
+            self.assertLessEqual(index.bytes_allocated(), budget)
+
+        _, _, evictions, evicted_elements = index.counters()
+        self.assertLess(0, evictions)
+        self.assertEqual(1000, index.num_elements() + evicted_elements)
+
+        # shrinking the budget evicts more
+        index.budget = budget // 2
+        self.assertLessEqual(index.bytes_allocated(), budget // 2)
+
+    def test_recently_used_survive(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 0
+        budget = 4096
+
+        hot = np.array([6.1, -0.2, 0.8], dtype=np.double)
+
+        np.random.seed(4321)
+        index = AStarBoundedIndex(dim, packing_radius, num_shells, budget)
+        index.insert(hot, 7)
+        for i in range(1000):
+            index.insert(np.random.rand(dim) * 100 + 200, i)
+            self.assertIn(7, index.candidates(hot))
+
+
+class Test_AStarVersionedIndex(unittest.TestCase):
+
+    def test_get_multiple(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 7
+
+        index = AStarVersionedIndex(dim, packing_radius, num_shells)
+
+        v = np.array([6.1, -0.2, 0.8], dtype=np.double)
+
+        index.insert(v, 123)
+        index.insert(v, 456)
+
+        self.assertEqual(1, index.num_hashes())
+        self.assertEqual(2, index.num_elements())
+        self.assertEqual([123, 456], list(index.candidates(v)))
+
+    def test_snapshot(self):
+        dim = 3
+        packing_radius = 1
+        num_shells = 7
+
+        v1 = np.array([6.1, -0.3, 0.8], dtype=np.double)
+        v2 = np.array([9.1, -9.3, 9.8], dtype=np.double)
+
+        index = AStarVersionedIndex(dim, packing_radius, num_shells)
+        index.insert(v1, 123)
+
+        snapshot = index.snapshot()
+
+        index.insert(v1, 456)
+        index.insert(v2, 789)
+        index.clear_by_vector(v1)
+
+        # the index sees the changes
+        self.assertEqual(1, index.num_elements())
+        self.assertEqual(0, index.num_candidates(v1))
+        self.assertEqual([789], list(index.candidates(v2)))
+
+        # the snapshot does not
+        self.assertEqual(1, snapshot.num_hashes())
+        self.assertEqual(1, snapshot.num_elements())
+        self.assertEqual([123], list(snapshot.candidates(v1)))
+        self.assertEqual(0, snapshot.num_candidates(v2))
+
+        # the snapshot outlives the index
+        index.clear()
+        del index
+        self.assertEqual([123], list(snapshot.candidates(v1)))
+
+    def test_small_refresh_of_large_index(self):
+        dim = 3
+        max_page_hashes = 64    # AStarVersionedIndex::MAX_PAGE_HASHES
+        rng = np.random.default_rng(2471)
+        vectors = rng.uniform(0, 1000, size=(100_000, dim))
+
+        index = AStarVersionedIndex(dim, 0.5, 0)
+        for i, v in enumerate(vectors):
+            index.insert(v, i)
+        num_hashes = index.num_hashes()
+        self.assertLess(90_000, num_hashes)
+
+        # Refresh a few hundred hash codes while a snapshot holds the index:
+        # each page copied holds a bounded number of hash codes, so the copies
+        # are a small part of the index.
+        snapshot = index.snapshot()
+        refresh = vectors[:300]
+        for i, v in enumerate(refresh):
+            index.insert(v, len(vectors) + i)
+        self.assertLessEqual(index.pages_copied(), len(refresh))
+        self.assertLessEqual(index.hashes_copied(), len(refresh) * max_page_hashes)
+        self.assertLess(index.hashes_copied(), num_hashes // 4)
+
+        self.assertEqual(len(vectors), snapshot.num_elements())
+        self.assertEqual(len(vectors) + len(refresh), index.num_elements())
+        self.assertEqual([0], [e for e in snapshot.candidates(vectors[0]) if e in (0, len(vectors))])
+        self.assertEqual([0, len(vectors)], sorted(e for e in index.candidates(vectors[0]) if e in (0, len(vectors))))
+
+        # The pages copied are written to again without copying.
+        pages_copied = index.pages_copied()
+        for v in refresh:
+            index.clear_by_vector(v)
+        self.assertEqual(pages_copied, index.pages_copied())
+        self.assertEqual(len(vectors), snapshot.num_elements())
+
+
+def index_num_probes(dim, packing_radius, num_shells):
+    return AStarIndex(dim, packing_radius, num_shells).num_probes
+
 
 class Test_WhiteBox(unittest.TestCase):
 
@@ -740,5 +1334,754 @@ class Test_WhiteBox(unittest.TestCase):
             self.assertEqual(result, expect)
 
 
+
+class Test_AStarPartitionedIndex(unittest.TestCase):
+
+    def test_ingest(self):
+        dim = 5
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(7)
+        data = rng.normal(scale=2, size=(2000, dim))
+        values = np.arange(len(data))
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+
+        index = AStarPartitionedIndex(dim, packing_radius, num_shells, 8)
+        metrics = index.ingest(data, values, num_hash_workers=3, num_inserters=4, chunk_rows=64)
+
+        self.assertEqual(expect.num_hashes(), index.num_hashes())
+        self.assertEqual(expect.num_elements(), index.num_elements())
+        for stage in ['read', 'hash', 'insert']:
+            self.assertEqual(len(data), metrics[stage]['items'])
+        self.assertEqual(3, metrics['hash']['threads'])
+        self.assertEqual(4, metrics['insert']['threads'])
+
+        for q in data[:50]:
+            self.assertEqual(sorted(expect.candidates(q)), sorted(index.candidates(q)))
+
+
+@unittest.skipIf(sys.platform == 'win32', 'Unix domain sockets only')
+class Test_AStarServer(unittest.TestCase):
+
+    def test_serve(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+
+        rng = np.random.default_rng(11)
+        data = rng.normal(scale=2, size=(1000, dim))
+        queries = rng.normal(scale=2, size=(40, dim))
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+        nn = AStarNN(dim, packing_radius, num_shells)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'astarnn.sock')
+            server = AStarServer(data, packing_radius, num_shells)
+            server.start(path)
+
+            client = AStarClient(path)
+            self.assertEqual(dim, client.dim)
+            self.assertEqual(nn.num_probes, client.num_probes)
+            self.assertEqual(len(data), client.num_vectors)
+
+            self.assertEqual([nn.nearest_hash(q) for q in queries], list(client.nearest_hash(queries)))
+            self.assertEqual([list(nn.extended_hash(q)) for q in queries],
+                             [list(h) for h in client.extended_hash(queries)])
+
+            for q, got in zip(queries, client.candidates(queries)):
+                self.assertEqual(sorted(expect.candidates(q)), sorted(got))
+
+            k = 3
+            for q, (elems, distances) in zip(queries, client.knn(queries, k)):
+                candidates = expect.candidates(q)
+                true_distances = sorted(np.linalg.norm(data[candidates] - q, axis=1))[:k]
+                self.assertEqual(min(k, len(candidates)), len(elems))
+                self.assertTrue(np.allclose(true_distances, distances))
+                self.assertTrue(np.allclose(np.linalg.norm(data[elems] - q, axis=1), distances))
+
+            # Concurrent clients, one query per request, are coalesced into batches.
+            results = {}
+
+            def run(t):
+                c = AStarClient(path)
+                results[t] = [list(c.candidates(q[np.newaxis])[0]) for q in queries]
+
+            before_requests, before_batches = server.counters()
+            threads = [threading.Thread(target=run, args=(t,)) for t in range(4)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+            requests, batches = server.counters()
+
+            for t in range(4):
+                self.assertEqual([sorted(expect.candidates(q)) for q in queries], [sorted(r) for r in results[t]])
+            self.assertEqual(4 * len(queries), requests - before_requests)
+            self.assertLessEqual(batches - before_batches, requests - before_requests)
+
+            with self.assertRaises(AStarException):
+                client.candidates(np.zeros((1, dim + 1)))
+
+            del client
+            server.stop()
+            self.assertFalse(os.path.exists(path))
+
+    def test_oversized_requests(self):
+        dim = 3
+        data = np.random.default_rng(12).normal(size=(100, dim))
+        magic, op_hash_knn = 0x4E4E5341, 6
+
+        def error_of(request: bytes) -> str:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+                s.connect(path)
+                s.sendall(request)
+                reply = b''
+                while len(reply) < 24:
+                    got = s.recv(24 - len(reply))
+                    self.assertTrue(got)
+                    reply += got
+                # The connection is closed after the error.
+                self.assertEqual(b'', s.recv(1))
+            _, error, _, _ = struct.unpack('=IIQQ', reply)
+            return ReturnVal(error).return_val_string()
+
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'astarnn.sock')
+            server = AStarServer(data, 1, 1)
+            server.start(path)
+
+            self.assertEqual('Error_insufficient_buffers',
+                             error_of(struct.pack('=IIIIQ', magic, op_hash_knn, dim, 1, 1 << 21)))
+
+            # Hash counts whose sum wraps around to zero.
+            vectors = np.zeros((2, dim), dtype=np.double).tobytes()
+            counts = struct.pack('=QQ', 1, 2 ** 64 - 1)
+            self.assertEqual('Error_insufficient_buffers',
+                             error_of(struct.pack('=IIIIQ', magic, op_hash_knn, dim, 1, 2) + vectors + counts))
+
+            # The server is still serving.
+            self.assertEqual(dim, AStarClient(path).dim)
+            server.stop()
+
+    def test_knn_pruning(self):
+        dim = 8
+        packing_radius = 2
+        num_shells = 1
+
+        rng = np.random.default_rng(17)
+        data = rng.normal(size=(3000, dim))
+        queries = rng.normal(size=(30, dim))
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'astarnn.sock')
+            server = AStarServer(data, packing_radius, num_shells)
+            server.start(path)
+            client = AStarClient(path)
+
+            # Pruning by the residual lower bound doesn't change the results.
+            k = 5
+            num_candidates = 0
+            for q, (elems, distances) in zip(queries, client.knn(queries, k)):
+                candidates = expect.candidates(q)
+                num_candidates += len(candidates)
+                true_distances = sorted(np.linalg.norm(data[candidates] - q, axis=1))[:k]
+                self.assertEqual(min(k, len(candidates)), len(elems))
+                self.assertTrue(np.allclose(true_distances, distances))
+                self.assertTrue(np.allclose(np.linalg.norm(data[elems] - q, axis=1), distances))
+
+            num_distances, num_pruned = server.prune_counters()
+            self.assertEqual(num_candidates, num_distances + num_pruned)
+            self.assertGreater(num_pruned, 0)
+
+            del client
+            server.stop()
+
+    def test_requantize(self):
+        dim = 4
+        num_shells = 1
+
+        rng = np.random.default_rng(12)
+        data = rng.normal(scale=2, size=(800, dim))
+        queries = rng.normal(scale=2, size=(20, dim))
+
+        def expected(packing_radius):
+            index = AStarIndex(dim, packing_radius, num_shells)
+            for i, v in enumerate(data):
+                index.insert(v, i)
+            return index.num_hashes(), [sorted(index.candidates(q)) for q in queries]
+
+        old_hashes, old = expected(1)
+        new_hashes, new = expected(2)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'astarnn.sock')
+            server = AStarServer(data, 1, num_shells, num_threads=2)
+            server.start(path)
+            self.assertEqual(old_hashes, server.num_hashes())
+
+            # A client keeps querying while the index is rebuilt; each reply
+            # is from either the old or the new index.
+            answers = []
+            stop = threading.Event()
+
+            def run():
+                c = AStarClient(path)
+                while not stop.is_set():
+                    answers.append([sorted(r) for r in c.candidates(queries)])
+
+            thread = threading.Thread(target=run)
+            thread.start()
+            server.requantize(2, num_shells)
+            client = AStarClient(path)
+            got = [sorted(r) for r in client.candidates(queries)]
+            stop.set()
+            thread.join()
+
+            self.assertEqual(new_hashes, server.num_hashes())
+            self.assertEqual(new, got)
+            self.assertTrue(answers)
+            for answer in answers:
+                self.assertIn(answer, [old, new])
+
+            del client
+            server.stop()
+
+
+@unittest.skipIf(sys.platform == 'win32', 'POSIX shared memory only')
+class Test_SharedIndex(unittest.TestCase):
+
+    def test_generations(self):
+        dim = 5
+        packing_radius = 1
+        num_shells = 1
+        name = f'astarnn_test_{os.getpid()}'
+
+        rng = np.random.default_rng(5)
+        data = rng.normal(scale=2, size=(1500, dim))
+        queries = rng.normal(scale=2, size=(30, dim))
+
+        index = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data[:1000]):
+            index.insert(v, i)
+        first = [sorted(index.candidates(q)) for q in queries]
+
+        generation = index.publish_shared(name)
+        try:
+            shared = SharedIndex(name)
+            self.assertEqual(dim, shared.dim)
+            self.assertEqual(generation, shared.generation)
+            self.assertEqual(index.num_hashes(), shared.num_hashes())
+            self.assertEqual(index.num_elements(), shared.num_elements())
+            self.assertEqual(first, [sorted(shared.candidates(q)) for q in queries])
+            self.assertFalse(shared.stale())
+
+            # A new generation; the attached one is unchanged until refreshed.
+            for i, v in enumerate(data[1000:], 1000):
+                index.insert(v, i)
+            self.assertEqual(generation + 1, index.publish_shared(name))
+            self.assertTrue(shared.stale())
+            self.assertEqual(first, [sorted(shared.candidates(q)) for q in queries])
+
+            self.assertTrue(shared.refresh())
+            self.assertEqual(generation + 1, shared.generation)
+            self.assertEqual(len(data), shared.num_elements())
+            self.assertEqual([sorted(index.candidates(q)) for q in queries],
+                             [sorted(shared.candidates(q)) for q in queries])
+            self.assertEqual(generation + 1, SharedIndex(name).generation)
+        finally:
+            SharedIndex.unlink(name)
+
+        with self.assertRaises(AStarException):
+            SharedIndex(name)
+
+    def test_publish_merged(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+        name = f'astarnn_test_merged_{os.getpid()}'
+
+        rng = np.random.default_rng(8)
+        data = rng.normal(scale=2, size=(900, dim))
+        queries = rng.normal(scale=2, size=(30, dim))
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+
+        parts = [AStarIndex(dim, packing_radius, num_shells) for _ in range(3)]
+        for part, rows in zip(parts, np.array_split(np.arange(len(data)), len(parts))):
+            part.insert_batch(data[rows], rows)
+
+        AStarIndex.publish_shared_all(name, parts)
+        try:
+            shared = SharedIndex(name)
+            self.assertEqual(expect.num_hashes(), shared.num_hashes())
+            self.assertEqual(expect.num_elements(), shared.num_elements())
+            for q in queries:
+                self.assertEqual(list(expect.candidates(q)), list(shared.candidates(q)))
+        finally:
+            SharedIndex.unlink(name)
+
+    def test_pruned_orbits(self):
+        dim = 4
+        name = f'astarnn_test_pruned_{os.getpid()}'
+
+        rng = np.random.default_rng(9)
+        data = rng.normal(scale=2, size=(600, dim))
+        queries = rng.normal(scale=2, size=(30, dim))
+
+        index = AStarIndex(dim, 1, 3)
+        index.set_orbits([0, 2])
+        index.insert_batch(data, np.arange(len(data)))
+
+        index.publish_shared(name)
+        try:
+            shared = SharedIndex(name)
+            for q in queries:
+                self.assertEqual(sorted(index.candidates(q)), sorted(shared.candidates(q)))
+
+            # The parts of a merge must walk the same orbits.
+            with self.assertRaises(AStarException):
+                AStarIndex.publish_shared_all(name, [index, AStarIndex(dim, 1, 3)])
+        finally:
+            SharedIndex.unlink(name)
+
+    @unittest.skipIf(not sys.platform.startswith('linux'), 'memfd is Linux only')
+    def test_memfd(self):
+        dim = 3
+        index = AStarIndex(dim, 1, 1)
+        rng = np.random.default_rng(6)
+        data = rng.normal(size=(300, dim))
+        for i, v in enumerate(data):
+            index.insert(v, i)
+
+        fd = index.to_memfd()
+        try:
+            shared = SharedIndex(fd=fd)
+            self.assertEqual(0, shared.generation)
+            for q in data[:20]:
+                self.assertEqual(sorted(index.candidates(q)), sorted(shared.candidates(q)))
+        finally:
+            os.close(fd)
+
+
+@unittest.skipIf(sys.platform == 'win32', 'Unix domain sockets only')
+class Test_ShardCoordinator(unittest.TestCase):
+
+    def test_knn(self):
+        dim = 4
+        packing_radius = 1
+        num_shells = 1
+        coarse_factor = 4
+        num_shards = 3
+
+        rng = np.random.default_rng(13)
+        data = rng.normal(scale=3, size=(1500, dim))
+        queries = rng.normal(scale=3, size=(40, dim))
+
+        expect = AStarIndex(dim, packing_radius, num_shells)
+        for i, v in enumerate(data):
+            expect.insert(v, i)
+
+        shard_map = ShardMap(dim, packing_radius, num_shells, coarse_factor, num_shards)
+        shards = shard_map.assign(data)
+        self.assertTrue(all(0 <= s < num_shards for s in shards))
+        self.assertEqual(list(shards), list(shard_map.assign(data)))
+
+        # The elements of each hash code are all in one shard.
+        nn = AStarNN(dim, packing_radius, num_shells)
+        owner = {}
+        for v, s in zip(data, shards):
+            self.assertEqual(s, owner.setdefault(nn.nearest_hash(v), s))
+
+        with tempfile.TemporaryDirectory() as tmp:
+            paths = [os.path.join(tmp, 'shard%d.sock' % s) for s in range(num_shards)]
+            servers = []
+            for s, path in enumerate(paths):
+                rows = np.flatnonzero(shards == s)
+                server = AStarServer(data[rows], packing_radius, num_shells, elems=rows)
+                server.start(path)
+                servers.append(server)
+
+            coordinator = ShardCoordinator(dim, packing_radius, num_shells, coarse_factor, paths)
+            k = 5
+            for q, (elems, distances) in zip(queries, coordinator.knn(queries, k)):
+                candidates = expect.candidates(q)
+                true_distances = sorted(np.linalg.norm(data[candidates] - q, axis=1))[:k]
+                self.assertEqual(min(k, len(candidates)), len(elems))
+                self.assertTrue(np.allclose(true_distances, distances))
+                self.assertTrue(np.allclose(np.linalg.norm(data[elems] - q, axis=1), distances))
+
+            # Queries only touch the shards their probes fall in.
+            self.assertGreaterEqual(coordinator.num_shard_requests, len(queries))
+            self.assertLess(coordinator.num_shard_requests, len(queries) * num_shards)
+
+            with self.assertRaises(AStarException):
+                ShardCoordinator(dim + 1, packing_radius, num_shells, coarse_factor, paths)
+
+            del coordinator
+            for server in servers:
+                server.stop()
+
+
+class Test_LatticeCodec(unittest.TestCase):
+
+    def test_round_trip(self):
+        rng = np.random.default_rng(17)
+        for dim, bits in [(1, 3), (5, 4), (16, 2), (33, 8)]:
+            packing_radius = 0.25
+            base = rng.normal(size=dim) * 10
+            data = base + rng.normal(size=(300, dim))
+            codec = LatticeCodec(dim, packing_radius, bits, base)
+            self.assertEqual(math.ceil((dim + 1) * bits / 8), codec.code_size)
+
+            codes = codec.encode(data)
+            self.assertEqual((len(data), codec.code_size), codes.shape)
+            decoded = codec.decode(codes, num_threads=2)
+
+            # The decoded vectors are lattice points, so encode to the same codes.
+            self.assertTrue(np.array_equal(codes, codec.encode(decoded)))
+
+            bits_per_dim, rmse, max_error, clipped = codec.rate_distortion(data)
+            self.assertEqual(codec.bits_per_dim, bits_per_dim)
+            errors = np.linalg.norm(decoded - data, axis=1)
+            if clipped == 0:
+                # No error is more than the covering radius.
+                self.assertLessEqual(max_error, packing_radius * math.sqrt((dim + 2) / 3) * 1.0001)
+            self.assertAlmostEqual(np.sqrt(np.mean(errors ** 2)), rmse, 9)
+            self.assertAlmostEqual(np.max(errors), max_error, 9)
+
+    def test_clipping(self):
+        dim = 4
+        codec = LatticeCodec(dim, 0.5, 3)
+        data = np.array([[0.5, -0.3, 0.2, 0.1], [100, -100, 50, 0]], dtype=np.double)
+        _, _, _, clipped = codec.rate_distortion(data)
+        self.assertEqual(0.5, clipped)
+        decoded = codec.decode(codec.encode(data))
+        self.assertTrue(np.all(np.isfinite(decoded)))
+        self.assertLess(np.linalg.norm(decoded[0] - data[0]), 0.5 * math.sqrt(2))
+
+        with self.assertRaises(AStarException):
+            LatticeCodec(dim, 0.5, 1)
+        with self.assertRaises(AStarException):
+            LatticeCodec(dim, 0.0, 4)
+
+
+
+class Test_SparseAStarNN(unittest.TestCase):
+
+    def test_matches_dense(self):
+        rng = np.random.default_rng(19)
+        for dim, nnz in [(1, 1), (7, 0), (7, 7), (30, 4), (200, 12)]:
+            packing_radius = 0.5
+            dense = AStarNN(dim, packing_radius, 0)
+            sparse = SparseAStarNN(dim, packing_radius)
+            for _ in range(50):
+                indices = rng.permutation(dim)[:nnz]
+                values = rng.normal(size=nnz)
+                vector = np.zeros(dim)
+                vector[indices] = values
+                self.assertEqual(dense.nearest_hash(vector), sparse.nearest_hash(indices, values))
+
+                c_nonzero, c_zero, c_last, k = sparse.nearest_cvector(indices, values)
+                c = np.full(dim + 1, c_zero)
+                c[indices] = c_nonzero
+                c[dim] = c_last
+                self.assertEqual(0, (k + c.sum()) % (dim + 1))
+                self.assertEqual(list(dense.nearest_cvector(vector)), list(c))
+
+    def test_high_dim(self):
+        rng = np.random.default_rng(23)
+        dim = 3 * 10 ** 6
+        sparse = SparseAStarNN(dim, 0.1)
+        offsets = [0]
+        indices = []
+        values = []
+        for _ in range(20):
+            indices.extend(rng.choice(dim, size=100, replace=False))
+            values.extend(rng.random(100))
+            offsets.append(len(indices))
+        hashes = sparse.nearest_hashes(offsets, indices, values)
+        for h, begin, end in zip(hashes, offsets[:-1], offsets[1:]):
+            self.assertEqual(h, sparse.nearest_hash(indices[begin:end], values[begin:end]))
+            # The order of the non-zeros doesn't matter.
+            self.assertEqual(h, sparse.nearest_hash(indices[begin:end][::-1], values[begin:end][::-1]))
+
+        with self.assertRaises(AStarException):
+            sparse.nearest_hash([dim], [1.0])
+        with self.assertRaises(AStarException):
+            sparse.nearest_hash([3, 3], [1.0, 2.0])
+
+
+
+class Test_E8NN(unittest.TestCase):
+
+    @staticmethod
+    def minimal_vectors() -> np.ndarray:
+        # In doubled coordinates: (+-2, +-2, 0, ..., 0) and (+-1, ..., +-1) with an even number of minus signs.
+        vectors = []
+        for i in range(8):
+            for j in range(i + 1, 8):
+                for si in (-2, 2):
+                    for sj in (-2, 2):
+                        v = np.zeros(8, dtype=int)
+                        v[i], v[j] = si, sj
+                        vectors.append(v)
+        for signs in range(256):
+            v = np.array([-1 if (signs >> d) & 1 else 1 for d in range(8)])
+            if (v < 0).sum() % 2 == 0:
+                vectors.append(v)
+        return np.array(vectors)
+
+    def test_nearest_point(self):
+        rng = np.random.default_rng(29)
+        minimal = self.minimal_vectors()
+        self.assertEqual(240, len(minimal))
+        packing_radius = 0.7
+        for dim in (8, 16):
+            nn = E8NN(dim, packing_radius, 0)
+            scale = math.sqrt(0.5) / packing_radius
+            for _ in range(100):
+                v = rng.normal(scale=3, size=dim)
+                doubled = nn.nearest_point(v)
+
+                # A point of E8 in each block: all even or all odd, and a sum that is a multiple of 4.
+                for block in doubled.reshape(-1, 8):
+                    self.assertEqual(1, len(set(block % 2)))
+                    self.assertEqual(0, block.sum() % 4)
+
+                # The minimal vectors are the Voronoi relevant vectors, so no neighbour is nearer.
+                residual = (scale * v - doubled / 2).reshape(-1, 8)
+                for r in residual:
+                    self.assertTrue(np.all(np.sum((r - minimal / 2) ** 2, axis=1) >= np.sum(r ** 2) - 1e-9))
+
+    def test_extended_hash(self):
+        rng = np.random.default_rng(31)
+        dim = 16
+        num_shells = 3
+        nn = E8NN(dim, 0.5, num_shells)
+        self.assertEqual(1 + 2 * num_shells, nn.num_probes)
+        for _ in range(20):
+            v = rng.normal(size=dim)
+            hashes = nn.extended_hash(v)
+            self.assertEqual(nn.nearest_hash(v), hashes[0])
+            self.assertEqual(nn.num_probes, len(set(hashes)))
+
+        # The neighbours are probes of vectors moved towards them.
+        v = rng.normal(size=dim)
+        self.assertIn(nn.nearest_hash(v + 0.3 * np.eye(dim)[0]), nn.extended_hash(v))
+
+        with self.assertRaises(AStarException):
+            E8NN(12, 0.5, 1)
+        with self.assertRaises(AStarException):
+            E8NN(8, 0.5, 241)
+
+    def test_index(self):
+        rng = np.random.default_rng(37)
+        dim = 16
+        data = rng.normal(size=(500, dim))
+        index = E8Index(dim, 1.0, 4)
+        nn = E8NN(dim, 1.0, 4)
+        for i, v in enumerate(data):
+            index.insert(v, i)
+        self.assertGreater(index.bytes_allocated(), 0)
+        self.assertEqual(len(set(nn.nearest_hash(v) for v in data)), index.num_hashes())
+
+        for q in rng.normal(size=(20, dim)):
+            probes = set(nn.extended_hash(q))
+            expect = [i for i, v in enumerate(data) if nn.nearest_hash(v) in probes]
+            self.assertEqual(sorted(expect), sorted(index.candidates(q)))
+
+
+class Test_VectorTransform(unittest.TestCase):
+
+    @staticmethod
+    def sample(rng, num_vectors: int, dim: int) -> np.ndarray:
+        # Correlated features with very different scales and offsets.
+        mixing = rng.normal(size=(dim, dim))
+        scales = 10.0 ** rng.uniform(-2, 2, size=dim)
+        return rng.normal(size=(num_vectors, dim)) @ mixing * scales + rng.normal(scale=50, size=dim)
+
+    def test_fit(self):
+        rng = np.random.default_rng(31)
+        dim = 12
+        sample = self.sample(rng, 5000, dim)
+
+        diagonal = VectorTransform.fit_diagonal(sample, num_threads=0)
+        self.assertTrue(diagonal.is_diagonal)
+        offset, scale = diagonal.params()
+        self.assertTrue(np.allclose(offset, sample.mean(axis=0)))
+        self.assertTrue(np.allclose(scale, 1 / sample.std(axis=0, ddof=1)))
+
+        whitening = VectorTransform.fit_whitening(sample, num_threads=0)
+        self.assertFalse(whitening.is_diagonal)
+        self.assertTrue(np.allclose(np.cov(whitening.apply(sample), rowvar=False), np.eye(dim), atol=1e-6))
+
+        # Truncation keeps the axes of largest variance.
+        truncated = VectorTransform.fit_whitening(sample, output_dim=4, num_threads=2)
+        self.assertEqual((12, 4), (truncated.input_dim, truncated.output_dim))
+        _, matrix = truncated.params()
+        variances = np.linalg.eigvalsh(np.cov(sample, rowvar=False))[::-1][:4]
+        self.assertTrue(np.allclose(1 / np.sum(matrix ** 2, axis=1), variances))
+
+    def test_astarnn(self):
+        rng = np.random.default_rng(37)
+        dim = 10
+        sample = self.sample(rng, 2000, dim)
+        queries = self.sample(rng, 50, dim)
+        for transform in (VectorTransform.diagonal(dim, offset=rng.normal(size=dim), scale=rng.uniform(0.1, 2, size=dim)),
+                          VectorTransform.fit_diagonal(sample),
+                          VectorTransform.fit_whitening(sample, output_dim=6, epsilon=1e-3)):
+            nn = AStarNN(dim, 0.4, 1, transform=transform)
+            plain = AStarNN(transform.output_dim, 0.4, 1)
+            self.assertEqual((dim, transform.output_dim), (nn.input_dim, nn.dim))
+            self.assertEqual(plain.num_probes, nn.num_probes)
+            for q, t in zip(queries, transform.apply(queries)):
+                self.assertEqual(plain.nearest_hash(t), nn.nearest_hash(q))
+                self.assertTrue(np.array_equal(plain.extended_hash(t), nn.extended_hash(q)))
+                self.assertTrue(np.array_equal(plain.delaunay_cvector(t), nn.delaunay_cvector(q)))
+                self.assertTrue(np.allclose(plain.nearest_hash_margins(t)[1:], nn.nearest_hash_margins(q)[1:]))
+                self.assertTrue(np.allclose(plain.to_lattice_space(t), nn.to_lattice_space(q), atol=1e-4))
+        with self.assertRaises(AStarException):
+            AStarNN(dim + 1, 0.4, 1, transform=transform)
+
+    def test_index(self):
+        rng = np.random.default_rng(43)
+        dim = 10
+        sample = self.sample(rng, 2000, dim)
+        queries = self.sample(rng, 40, dim)
+        transform = VectorTransform.fit_whitening(sample, output_dim=6)
+        mapped = transform.apply(sample)
+
+        index = AStarIndex(dim, 0.8, 1, transform=transform)
+        plain = AStarIndex(transform.output_dim, 0.8, 1)
+        self.assertEqual((dim, transform.output_dim), (index.input_dim, index.dim))
+        index.insert_batch(sample, np.arange(len(sample)), num_threads=2)
+        plain.insert_batch(mapped, np.arange(len(sample)))
+        self.assertEqual(plain.num_hashes(), index.num_hashes())
+
+        for q, t in zip(queries, transform.apply(queries)):
+            self.assertEqual(sorted(plain.candidates(t)), sorted(index.candidates(q)))
+        self.assertEqual([sorted(c) for c in plain.candidates_batch(transform.apply(queries))],
+                         [sorted(c) for c in index.candidates_batch(queries, width=4)])
+
+        # Tracked margins are in the transformed space.
+        value = len(sample)
+        state = index.insert_tracked(queries[0], value)
+        self.assertEqual(plain.insert_tracked(transform.apply(queries[:1])[0], value), state)
+        _, state = index.update(value, queries[0], queries[1], state)
+        self.assertEqual(index.candidates(queries[1]).tolist().count(value), 1)
+
+        # Indexes with different transforms can't be merged, nor shared.
+        with self.assertRaises(AStarException):
+            index.merge(AStarIndex(dim, 0.8, 1, transform=VectorTransform.fit_whitening(sample[:1000], output_dim=6)))
+        with self.assertRaises(AStarException):
+            index.publish_shared(f'astarnn_test_transformed_{os.getpid()}')
+        with self.assertRaises(AStarException):
+            AStarIndex(dim + 1, 0.8, 1, transform=transform)
+
+
+class Test_ProbeProfile(unittest.TestCase):
+
+    def test_profile_and_prune(self):
+        rng = np.random.default_rng(41)
+        dim, k = 6, 5
+        data = rng.normal(size=(3000, dim))
+        queries = data[:100] + rng.normal(scale=0.1, size=(100, dim))
+        distances = np.sum((queries[:, None, :] - data[None, :, :]) ** 2, axis=2)
+        neighbours = np.argsort(distances, axis=1)[:, :k]
+
+        nn = AStarNN(dim, 0.5, 4)
+        dimp = dim + 1
+        self.assertTrue(np.array_equal(np.arange(nn.num_probes // dimp), nn.orbits()))
+
+        profile = ProbeProfile(nn)
+        self.assertEqual(nn.num_probes // dimp, profile.num_orbits)
+        profile.record(queries, data, neighbours, num_threads=2)
+
+        # The orbit of the first probe with each neighbour's hash code.
+        expected = np.zeros(profile.num_orbits, dtype=np.uint64)
+        for q, row in zip(queries, neighbours):
+            probes = list(nn.extended_hash(q))
+            for n in row:
+                h = nn.nearest_hash(data[n])
+                if h in probes:
+                    expected[probes.index(h) // dimp] += 1
+        self.assertTrue(np.array_equal(expected, profile.hits()))
+        self.assertEqual((100, 100 * k, int(expected.sum())), profile.counts())
+
+        # Prune to a budget, highest yield first.
+        budget = 4 * dimp
+        orbits = profile.select_orbits(max_probes=budget)
+        self.assertEqual(0, orbits[0])
+        self.assertLessEqual(len(orbits) * dimp, budget)
+        self.assertTrue(np.all(np.diff(expected[orbits[1:]].astype(np.int64)) <= 0))
+        self.assertTrue(np.all(expected[orbits[1:]] >= np.sort(np.delete(expected, orbits))[-1]))
+
+        pruned = AStarNN(dim, 0.5, 4)
+        pruned.set_orbits(orbits)
+        self.assertTrue(np.array_equal(orbits, pruned.orbits()))
+        self.assertEqual(len(orbits) * dimp, pruned.num_probes)
+        found = 0
+        for q, row in zip(queries, neighbours):
+            full = nn.extended_hash(q)
+            hashes = pruned.extended_hash(q)
+            for i, o in enumerate(orbits):
+                self.assertEqual(set(full[o * dimp:(o + 1) * dimp]), set(hashes[i * dimp:(i + 1) * dimp]))
+            self.assertEqual(nn.extended_nearest_hash(q)[1], pruned.extended_nearest_hash(q)[1])
+            found += sum(nn.nearest_hash(data[n]) in hashes for n in row)
+        self.assertEqual(int(expected[orbits].sum()), found)
+
+        # A yield threshold keeps only the orbits that find enough neighbours.
+        orbits = profile.select_orbits(min_yield=0.01)
+        self.assertTrue(np.all(expected[orbits[1:]] >= 0.01 * 100 * k))
+
+        with self.assertRaises(AStarException):
+            pruned.set_orbits([1, 0])
+        with self.assertRaises(AStarException):
+            pruned.set_orbits([0, 1, 1])
+        profile.clear()
+        self.assertEqual((0, 0, 0), profile.counts())
+
+    def test_pruned_index(self):
+        rng = np.random.default_rng(43)
+        dim = 6
+        data = rng.normal(size=(2000, dim))
+        queries = rng.normal(size=(30, dim))
+        orbits = [0, 5, 2]
+
+        index = AStarIndex(dim, 0.5, 4)
+        for i, v in enumerate(data):
+            index.insert(v, i)
+        full_candidates = [np.sort(index.candidates(q)) for q in queries]
+        index.set_orbits(orbits)
+        self.assertTrue(np.array_equal(orbits, index.orbits()))
+        self.assertEqual(len(orbits) * (dim + 1), index.num_probes)
+
+        # The candidates are the elements of the hash codes of the pruned stream.
+        nn = AStarNN(dim, 0.5, 4)
+        nn.set_orbits(orbits)
+        hashes = np.array([nn.nearest_hash(v) for v in data], dtype=np.uint64)
+        for q, full in zip(queries, full_candidates):
+            expected = np.flatnonzero(np.isin(hashes, nn.extended_hash(q)))
+            candidates = np.sort(index.candidates(q))
+            self.assertTrue(np.array_equal(expected, candidates))
+            self.assertTrue(np.all(np.isin(candidates, full)))
+
+        with self.assertRaises(AStarException):
+            index.set_orbits([2, 0])
+
+
 if __name__ == '__main__':
     unittest.main()
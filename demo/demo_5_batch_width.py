@@ -0,0 +1,74 @@
+"""
+Demo 5: Query throughput of the astarnn batch queries against the number of
+queries interleaved (the 'width'), for an index too large for the caches.
+A width of 1 looks up one probe at a time, as per the single vector queries.
+"""
+__author__ = 'Barry Drake'
+
+from astarnn import AStarIndex
+from stop_watch import StopWatch
+import numpy as np
+
+
+DIM = 16
+NUM_OF_SHELLS = 1
+NUM_OF_INSERTIONS = 1_000_000
+NUM_OF_QUERIES = 20_000
+PACKING_RADIUS = 0.05
+WIDTHS = [1, 2, 4, 8, 16, 32]
+RAND_SEED = 18491283
+
+
+def main():
+    print("dimensions           =", DIM)
+    print("number of shells     =", NUM_OF_SHELLS)
+    print("number of insertions =", NUM_OF_INSERTIONS)
+    print("number of queries    =", NUM_OF_QUERIES)
+    print("packing radius       =", PACKING_RADIUS)
+    print("rand seed            =", RAND_SEED)
+
+    np.random.seed(RAND_SEED)
+    lsh = AStarIndex(DIM, PACKING_RADIUS, NUM_OF_SHELLS)
+
+    print("number of probes     =", lsh.num_probes)
+
+    print()
+    print("Inserting")
+    insert_time = StopWatch()
+    lsh.insert_batch(np.random.rand(NUM_OF_INSERTIONS, DIM), np.arange(NUM_OF_INSERTIONS))
+    insert_time.stop()
+    print(f"insert time = {insert_time}")
+    print("number of hashes     =", lsh.num_hashes())
+
+    queries = np.random.rand(NUM_OF_QUERIES, DIM)
+
+    # The first batch query builds the directory of hash codes.
+    lsh.num_candidates_batch(queries[:1])
+
+    print()
+    print("width   count QPS   candidates QPS")
+    expected = None
+    for width in WIDTHS:
+        count_time = StopWatch()
+        counts = lsh.num_candidates_batch(queries, width)
+        count_time.stop()
+
+        candidates_time = StopWatch()
+        candidates = lsh.candidates_batch(queries, width)
+        candidates_time.stop()
+
+        if expected is None:
+            expected = counts
+        assert np.array_equal(counts, expected)
+        assert sum(len(c) for c in candidates) == counts.sum()
+
+        count_qps = NUM_OF_QUERIES / count_time.seconds()
+        candidates_qps = NUM_OF_QUERIES / candidates_time.seconds()
+        print(f"{width:5d} {count_qps:13,.0f} {candidates_qps:16,.0f}")
+
+    print()
+    print("Done.")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,148 @@
+/*
+ * astarnn-server: serve queries of an index of vectors over a Unix domain socket.
+ *
+ *      astarnn-server socket_path vectors_file dim packing_radius num_shells
+ *                     [num_threads [max_batch [shard num_shards coarse_factor]]]
+ *
+ * The vectors file is raw native doubles, dim per vector, which is
+ * memory mapped (so the vectors are loaded once and shared with the
+ * page cache). Element i of the index is the i-th vector of the file.
+ * The server runs until it gets SIGINT or SIGTERM.
+ *
+ * Given a shard number, the server only indexes the vectors that a
+ * ShardMap (see Sharding.h) with num_shards and coarse_factor puts in
+ * that shard, so that one server per shard serves a ShardCoordinator.
+ *
+ * Author: Barry Drake
+ */
+
+#include "Server.h"
+#include "Sharding.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+static int usage(const char* name)
+{
+    std::fprintf(stderr, "usage: %s socket_path vectors_file dim packing_radius num_shells"
+                         " [num_threads [max_batch [shard num_shards coarse_factor]]]\n", name);
+    return 2;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 6 || argc > 11 || argc == 9 || argc == 10)
+    {
+        return usage(argv[0]);
+    }
+
+    const char*  socket_path    = argv[1];
+    const char*  vectors_file   = argv[2];
+    const Dim_t  dim            = Dim_t(std::strtoul(argv[3], 0, 10));
+    const double packing_radius = std::strtod(argv[4], 0);
+    const long   num_shells     = std::strtol(argv[5], 0, 10);
+    const size_t num_threads    = argc > 6 ? std::strtoul(argv[6], 0, 10) : 1;
+    const size_t max_batch      = argc > 7 ? std::strtoul(argv[7], 0, 10) : AStarServer::DEFAULT_MAX_BATCH;
+    const bool   sharded        = argc > 8;
+    const size_t shard          = sharded ? std::strtoul(argv[8], 0, 10) : 0;
+    const size_t num_shards     = sharded ? std::strtoul(argv[9], 0, 10) : 1;
+    const size_t coarse_factor  = sharded ? std::strtoul(argv[10], 0, 10) : 1;
+
+    if (dim == 0 || num_shells < 0 || num_shards == 0 || coarse_factor == 0 || shard >= num_shards)
+    {
+        return usage(argv[0]);
+    }
+
+    //
+    // Map the vectors.
+    //
+    int fd = open(vectors_file, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        std::perror(vectors_file);
+        return 1;
+    }
+    const size_t num_vectors = size_t(info.st_size) / (dim * sizeof(VElem_t));
+    const size_t num_bytes   = num_vectors * dim * sizeof(VElem_t);
+
+    const VElem_t* vectors = 0;
+    if (num_bytes > 0)
+    {
+        void* mapped = mmap(0, num_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            std::perror(vectors_file);
+            return 1;
+        }
+        vectors = (const VElem_t*)mapped;
+    }
+    close(fd);
+
+    //
+    // Block the stop signals in all threads, so that they can be waited for here.
+    //
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        //
+        // Select the vectors of the shard, if any.
+        //
+        std::vector<VElem_t> shard_vectors;
+        std::vector<size_t>  shard_elems;
+        if (sharded)
+        {
+            ShardMap map(dim, packing_radius, NumShells_t(num_shells), coarse_factor, num_shards);
+            for (size_t i = 0; i < num_vectors; ++i)
+            {
+                const VElem_t* vector = vectors + i * dim;
+                if (map.shard_of(vector) == shard)
+                {
+                    shard_vectors.insert(shard_vectors.end(), vector, vector + dim);
+                    shard_elems.push_back(i);
+                }
+            }
+        }
+
+        AStarServer server(dim, packing_radius, NumShells_t(num_shells),
+                           sharded ? shard_vectors.data() : vectors,
+                           sharded ? shard_elems.size() : num_vectors,
+                           sharded ? shard_elems.data() : 0,
+                           num_threads);
+        server.start(socket_path, max_batch);
+        std::fprintf(stderr, "%s: serving %zu vectors (%zu hash codes) at %s\n",
+                     argv[0], server.index()->num_elements(), server.index()->num_hashes(), socket_path);
+
+        int signal_number;
+        sigwait(&signals, &signal_number);
+
+        server.stop();
+        std::fprintf(stderr, "%s: served %zu requests in %zu batches\n",
+                     argv[0], server.num_requests(), server.num_batches());
+    }
+    catch (Error e)
+    {
+        std::fprintf(stderr, "%s: %s\n", argv[0], error_to_string(e));
+        return 1;
+    }
+
+    if (vectors)
+    {
+        munmap((void*)vectors, num_bytes);
+    }
+    return 0;
+}
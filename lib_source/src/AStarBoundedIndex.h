@@ -0,0 +1,479 @@
+/*
+ * A memory-bounded vector index based on AStarNN hash codes, for use
+ * as a cache.
+ *
+ * The index keeps all of its storage under a byte budget. When a put
+ * takes the index over budget, cold buckets (hash codes with all of
+ * their elements) are evicted using the CLOCK (second chance) policy.
+ * A bucket is marked as recently used whenever a query finds it or a put
+ * adds to it. New buckets start unmarked, so a burst of one-off inserts
+ * cannot push out buckets that queries are using.
+ *
+ * Thread safety: the const query methods may be called concurrently
+ * from many threads (usage bits and counters are atomic). Methods that
+ * modify the index require exclusive access, as with AStarIndex.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef ASTARBOUNDEDINDEX__H
+#define ASTARBOUNDEDINDEX__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include "AStarIndex.h"
+#include "Allocator.h"
+#include "SmallBucket.h"
+#include <atomic>
+#include <functional>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+template <typename T>
+class AStarBoundedIndex
+{
+public:
+    /// Create an AStarBoundedIndex.
+    ///
+    /// \param[in]  dim             number of dimensions in the lattice quantisation space, n.
+    /// \param[in]  packing_radius  packing radius of the A* lattice.
+    /// \param[in]  num_shells      number of extended shells for extended probes.
+    /// \param[in]  budget          maximum number of bytes of index storage.
+    ///
+    AStarBoundedIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t budget);
+    ~AStarBoundedIndex(void);
+
+    /// Remove all elements (and hash codes) from the index.
+    /// The counters are not reset.
+    void clear(void);
+
+    /// Put the given element into the index, indexed by the given vector.
+    void put(const VElem_t* vector, const T& elem);
+
+    /// Put the given elements into the index, indexed by the given vector.
+    void put(const VElem_t* vector, size_t num_elements, const T* elems);
+
+    /// Put the given element into the index, indexed by the given hash code.
+    void put_hash(Hash_t hash_code, const T& elem);
+
+    /// Put the given elements into the index, indexed by the given hash code.
+    void put_hash(Hash_t hash_code, size_t num_elements, const T* elems);
+
+    /// Call the given callback for each element found nearby to the
+    /// given vector, using extended A* lattice probing.
+    void get_extended(const VElem_t* vector, IndexCallback<T>* callback) const;
+
+    /// How many elements are nearby to the
+    /// given vector, using extended A* lattice probing.
+    /// This does not mark buckets as used, nor update the counters.
+    size_t count_extended(const VElem_t* vector) const;
+
+    /// Call the given callback for each element stored with the
+    /// given hash code.
+    void get_hash(Hash_t hash_code, IndexCallback<T>* callback) const;
+
+    /// How many elements stored with the given hash code.
+    size_t count_hash(Hash_t hash_code) const;
+
+    /// Remove all element associated with the hash code of the given vector.
+    void clear(const VElem_t* vector);
+
+    /// Remove all element associated with the given hash code.
+    void clear_hash(Hash_t hash_code);
+
+    /// Change the byte budget, evicting as needed.
+    void set_budget(size_t budget);
+
+    /// Get the hash code for the given vector
+    inline Hash_t hash(const VElem_t* vector) const
+    {
+        return m_hash.nearest_hash(vector);
+    }
+
+    /// Get the dimensionality of vectors processed by this index.
+    inline Dim_t dim(void) const
+    {
+        return m_hash.dim();
+    }
+
+    /// Get the packing radius of the quantisation lattice.
+    inline Distance_t packing_radius(void) const
+    {
+        return m_hash.packing_radius();
+    }
+
+    /// Number of shells of lattice point beyond the Delaunay cell,
+    /// that are used by 'get' queries.
+    inline int num_shells(void) const
+    {
+        return m_hash.num_shells();
+    }
+
+    /// Number of probe points (hash codes) used by 'get' queries.
+    inline size_t num_probes(void) const
+    {
+        return m_hash.num_probes();
+    }
+
+    /// Get the number of distinct hash codes in the index.
+    inline size_t num_hashes() const
+    {
+        return m_map.size();
+    }
+
+    /// Get the number of elements in the index.
+    inline size_t num_elements() const
+    {
+        return m_num_elements;
+    }
+
+    /// Get the maximum number of bytes of index storage.
+    inline size_t budget() const
+    {
+        return m_budget;
+    }
+
+    /// Get the number of bytes of index storage currently allocated.
+    inline size_t bytes_allocated() const
+    {
+        return m_stats.bytes;
+    }
+
+    /// Number of probed hash codes that were found in the index.
+    inline size_t hits() const
+    {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+
+    /// Number of probed hash codes that were not found in the index.
+    inline size_t misses() const
+    {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+
+    /// Number of buckets evicted to keep within budget.
+    inline size_t evictions() const
+    {
+        return m_evictions;
+    }
+
+    /// Number of elements evicted to keep within budget.
+    inline size_t evicted_elements() const
+    {
+        return m_evicted_elements;
+    }
+
+private:
+    // Copy and assignment not implemented
+    AStarBoundedIndex(const AStarBoundedIndex& obj);
+    AStarBoundedIndex& operator=(const AStarBoundedIndex& obj);
+
+    typedef CountingAllocator<T>    Alloc;
+    typedef SmallBucket<T, Alloc>   List;
+
+    /// A bucket together with its CLOCK state.
+    struct Entry
+    {
+        explicit Entry(const Alloc& alloc)
+            : list(alloc)
+            , slot(0)
+            , referenced(0)
+        {}
+
+        List                            list;
+        size_t                          slot;       // position in m_clock
+        mutable std::atomic<uint8_t>    referenced;
+    };
+
+    typedef typename std::allocator_traits<Alloc>::template
+        rebind_alloc<std::pair<const Hash_t, Entry> > MapAlloc;
+    typedef std::unordered_map<Hash_t, Entry, std::hash<Hash_t>, std::equal_to<Hash_t>, MapAlloc> Map;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Hash_t> ClockAlloc;
+
+    /// Get the list for the given hash code, creating an empty list as needed.
+    List& _list(Hash_t hash_code);
+
+    /// Look up a bucket, marking it as used. Returns 0 if not found.
+    const List* _find(Hash_t hash_code) const;
+
+    /// Remove the bucket found in the map.
+    void _erase(typename Map::iterator found);
+
+    /// Evict buckets until within budget.
+    void _enforce_budget(void);
+
+    AllocStats                              m_stats;
+    AStarNN                                 m_hash;
+    Alloc                                   m_alloc;
+    Map                                     m_map;
+    std::vector<Hash_t, ClockAlloc>         m_clock;
+    size_t                                  m_hand;
+    size_t                                  m_budget;
+    size_t                                  m_num_elements;
+    size_t                                  m_evictions;
+    size_t                                  m_evicted_elements;
+    mutable std::atomic<size_t>             m_hits;
+    mutable std::atomic<size_t>             m_misses;
+};
+
+
+//  Implementation
+
+template <typename T>
+AStarBoundedIndex<T>::AStarBoundedIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t budget)
+    : m_stats()
+    , m_hash(dim, packing_radius, num_shells)
+    , m_alloc(&m_stats)
+    , m_map(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(m_alloc))
+    , m_clock(ClockAlloc(m_alloc))
+    , m_hand(0)
+    , m_budget(budget)
+    , m_num_elements(0)
+    , m_evictions(0)
+    , m_evicted_elements(0)
+    , m_hits(0)
+    , m_misses(0)
+{}
+
+
+template <typename T>
+AStarBoundedIndex<T>::~AStarBoundedIndex(void)
+{}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::clear(void)
+{
+    m_map.clear();
+    m_clock.clear();
+    m_hand = 0;
+    m_num_elements = 0;
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::put(const VElem_t* vector, const T& elem)
+{
+    put_hash(hash(vector), elem);
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::put(const VElem_t* vector, size_t num_elements, const T* elems)
+{
+    put_hash(hash(vector), num_elements, elems);
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::put_hash(Hash_t hash_code, const T& elem)
+{
+    put_hash(hash_code, 1, &elem);
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::put_hash(Hash_t hash_code, size_t num_elements, const T* elems)
+{
+    if (num_elements > 0)
+    {
+        List& list(_list(hash_code));
+        list.append(elems, num_elements);
+        m_num_elements += num_elements;
+        _enforce_budget();
+    }
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::get_extended(const VElem_t* vector, IndexCallback<T>* callback) const
+{
+    size_t hits = 0;
+    m_hash.visit_extended(vector, [this, callback, &hits](Hash_t hash_code)
+    {
+        const List* list = _find(hash_code);
+        if (list)
+        {
+            ++hits;
+            auto end = list->end();
+            for (auto it(list->begin()); it != end; ++it)
+            {
+                callback->match(hash_code, *it);
+            }
+        }
+    });
+
+    // One update of the shared counters per query.
+    m_hits.fetch_add(hits, std::memory_order_relaxed);
+    m_misses.fetch_add(num_probes() - hits, std::memory_order_relaxed);
+}
+
+
+template <typename T>
+size_t AStarBoundedIndex<T>::count_extended(const VElem_t* vector) const
+{
+    size_t count = 0;
+    m_hash.visit_extended(vector, [this, &count](Hash_t hash_code)
+    {
+        count += count_hash(hash_code);
+    });
+    return count;
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::get_hash(Hash_t hash_code, IndexCallback<T>* callback) const
+{
+    const List* list = _find(hash_code);
+    if (list)
+    {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        auto end = list->end();
+        for (auto it(list->begin()); it != end; ++it)
+        {
+            callback->match(hash_code, *it);
+        }
+    }
+    else
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+template <typename T>
+size_t AStarBoundedIndex<T>::count_hash(Hash_t hash_code) const
+{
+    auto found = m_map.find(hash_code);
+    return (found != m_map.end()) ? found->second.list.size() : 0;
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::clear(const VElem_t* vector)
+{
+    clear_hash(hash(vector));
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::clear_hash(Hash_t hash_code)
+{
+    auto found = m_map.find(hash_code);
+    if (found != m_map.end())
+    {
+        _erase(found);
+    }
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::set_budget(size_t budget)
+{
+    m_budget = budget;
+    _enforce_budget();
+}
+
+
+template <typename T>
+typename AStarBoundedIndex<T>::List& AStarBoundedIndex<T>::_list(Hash_t hash_code)
+{
+    auto found = m_map.find(hash_code);
+    if (found == m_map.end())
+    {
+        found = m_map.emplace(
+            std::piecewise_construct,
+            std::forward_as_tuple(hash_code),
+            std::forward_as_tuple(m_alloc)
+        ).first;
+
+        try
+        {
+            m_clock.push_back(hash_code);
+        }
+        catch (...)
+        {
+            m_map.erase(found);
+            throw;
+        }
+        found->second.slot = m_clock.size() - 1;
+    }
+    else
+    {
+        found->second.referenced.store(1, std::memory_order_relaxed);
+    }
+    return found->second.list;
+}
+
+
+template <typename T>
+const typename AStarBoundedIndex<T>::List* AStarBoundedIndex<T>::_find(Hash_t hash_code) const
+{
+    auto found = m_map.find(hash_code);
+    if (found == m_map.end())
+    {
+        return 0;
+    }
+
+    // Only write when the bit changes, to keep the cache line shared between readers.
+    const Entry& entry(found->second);
+    if (!entry.referenced.load(std::memory_order_relaxed))
+    {
+        entry.referenced.store(1, std::memory_order_relaxed);
+    }
+    return &entry.list;
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::_erase(typename Map::iterator found)
+{
+    const size_t slot = found->second.slot;
+    const size_t last = m_clock.size() - 1;
+    if (slot != last)
+    {
+        const Hash_t moved = m_clock[last];
+        m_clock[slot] = moved;
+        m_map.find(moved)->second.slot = slot;
+    }
+    m_clock.pop_back();
+
+    m_num_elements -= found->second.list.size();
+    m_map.erase(found);
+}
+
+
+template <typename T>
+void AStarBoundedIndex<T>::_enforce_budget(void)
+{
+    while (m_stats.bytes > m_budget && !m_map.empty())
+    {
+        if (m_hand >= m_clock.size())
+        {
+            m_hand = 0;
+        }
+
+        auto found = m_map.find(m_clock[m_hand]);
+        Entry& entry(found->second);
+        if (entry.referenced.load(std::memory_order_relaxed))
+        {
+            // Second chance.
+            entry.referenced.store(0, std::memory_order_relaxed);
+            ++m_hand;
+        }
+        else
+        {
+            // The last bucket in the clock moves into the hand's slot.
+            m_evictions        += 1;
+            m_evicted_elements += entry.list.size();
+            _erase(found);
+        }
+    }
+}
+
+
+
+#endif // ASTARBOUNDEDINDEX__H
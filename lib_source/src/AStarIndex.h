@@ -1,6 +1,19 @@
 /*
  * A simple vector index based on AStarNN hash codes with
- * STL unordered_map and vector.
+ * STL unordered_map and small inline buckets (see SmallBucket.h).
+ *
+ * All index storage is obtained from the 'Alloc' template parameter,
+ * a standard allocator for T (see Allocator.h for ready made policies).
+ *
+ * The lattice is the 'Hasher' template parameter, AStarNN by default.
+ * Another lattice (such as E8NN) need only have the AStarNN methods used
+ * by the index methods that are called: the constructor, accessors,
+ * nearest_hash and visit_extended for put and get; the margins, adaptive
+ * and batch methods are for AStarNN only.
+ *
+ * An index built with a VectorTransform (see AStarNN) takes vectors of the
+ * transform's input_dim() elements, and applies the transform as they are
+ * hashed; dim() is that of the lattice.
  *
  * Author: Barry Drake
  */
@@ -10,6 +23,17 @@
 
 #include "common.h"
 #include "AStarNN.h"
+#include "Allocator.h"
+#include "SmallBucket.h"
+#include "ProbeCursor.h"
+#include "Scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -59,18 +83,46 @@ private:
 };
 
 
+/// The cell of an element whose vector moves a little at a time, kept
+/// by the caller between updates (see AStarIndex::update).
+///
+struct CellState
+{
+    Hash_t      hash_code;  // the hash code the element is indexed by
+    Distance_t  margin;     // how much further the vector can move and certainly keep hash_code
+};
+
+
 
-template <typename T>
+template <typename T, typename Alloc = std::allocator<T>, typename Hasher = AStarNN>
 class AStarIndex
 {
 public:
+    /// The list of elements stored for a hash code.
+    /// Up to List::INLINE_SIZE elements are held in the hash table node itself.
+    typedef SmallBucket<T, Alloc> List;
+
+    /// The allocator type used for the hash table.
+    typedef typename std::allocator_traits<Alloc>::template
+        rebind_alloc<std::pair<const Hash_t, List> > MapAlloc;
+
+    /// The hash table type.
+    typedef std::unordered_map<Hash_t, List, std::hash<Hash_t>, std::equal_to<Hash_t>, MapAlloc> Map;
+
     /// Create an AStarIndex.
     ///
     /// \param[in]  dim             number of dimensions in the lattice quantisation space, n.
     /// \param[in]  packing_radius  packing radius of the A* lattice.
     /// \param[in]  num_shells      number of extended shells for extended probes.
+    /// \param[in]  alloc           allocator used for all index storage.
     ///
-    AStarIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells);
+    AStarIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, const Alloc& alloc = Alloc());
+
+    /// Create an AStarIndex of vectors mapped by the given transform, which
+    /// is copied (see AStarNN). The lattice has transform.output_dim()
+    /// dimensions.
+    AStarIndex(const VectorTransform& transform, Distance_t packing_radius, NumShells_t num_shells, const Alloc& alloc = Alloc());
+
     ~AStarIndex(void);
 
     /// Remove all elements (and hash codes) from the index.
@@ -94,6 +146,49 @@ public:
     /// Put the given elements into the index, indexed by the given hash code.
     void put_hash(Hash_t hash_code, const std::vector<T>& elems);
 
+    /// Put num_vectors elements into the index, where elems[i] is indexed
+    /// by the i-th vector (the vectors are stored one after the other).
+    /// The vectors are hashed using num_threads threads (see parallel_for);
+    /// the elements are then inserted by the calling thread.
+    void put_batch(const VElem_t* vectors, size_t num_vectors, const T* elems, size_t num_threads = 1);
+
+    /// Put the given element into the index, indexed by the given vector,
+    /// and get its state for tracking the vector as it moves (see update).
+    /// With a transform, the margin is in the transformed space.
+    CellState put_tracked(const VElem_t* vector, const T& elem);
+
+    /// Re-index an element whose vector has moved from old_vector to
+    /// new_vector, given the element's state (from put_tracked or the last
+    /// update), which is updated.
+    ///
+    /// While the total movement since the vector was last hashed is within
+    /// the margin of its Voronoi cell, the hash code can't have changed, and
+    /// an update costs one distance. Only then is new_vector hashed, and the
+    /// element is only moved if its hash code has changed (in which case its
+    /// old list is reordered). Returns true if the element moved.
+    ///
+    /// With a transform, the margins are in the transformed space, so the
+    /// movement is measured there (the transform is applied to both vectors).
+    bool update(const T& elem, const VElem_t* old_vector, const VElem_t* new_vector, CellState& state);
+
+    /// Add all the elements of another index, which must have the same
+    /// dimensionality, packing radius, number of shells and transform
+    /// (see merge_all).
+    void merge(const AStarIndex& other, size_t num_threads = 1);
+
+    /// Add all the elements of num_indexes other indexes (e.g. built
+    /// independently from parts of the data), which must have the same
+    /// dimensionality, packing radius and number of shells as this one.
+    /// The elements of a hash code are appended in the order of the
+    /// indexes.
+    ///
+    /// The hash table is only touched once per distinct hash code of the
+    /// other indexes, and each list is allocated once at its final size.
+    /// The elements are then copied list by list, with the lists shared
+    /// between num_threads threads (see parallel_for); there is no
+    /// allocation in this phase, so the allocator need not be thread safe.
+    void merge_all(const AStarIndex* const* indexes, size_t num_indexes, size_t num_threads = 1);
+
     /// Call the given callback for each element found nearby to the
     /// given vector, using extended A* lattice probing.
     void get_extended(const VElem_t* vector, IndexCallback<T>* callback) const;
@@ -102,6 +197,68 @@ public:
     /// given vector, using extended A* lattice probing.
     size_t count_extended(const VElem_t* vector) const;
 
+    /// As per get_extended, and return the hash code that put would index
+    /// the vector by, from the same decode. E.g. to look for duplicates of a
+    /// vector and then (if there are none) put_hash it.
+    Hash_t get_extended_nearest(const VElem_t* vector, IndexCallback<T>* callback) const;
+
+    /// Call the given callback for each element found nearby to the given
+    /// vector, probing only as much as needed to find every element within
+    /// 'radius' of it (see AStarNN::visit_adaptive): a vector deep inside
+    /// its cell needs only one probe. Returns the number of probes.
+    size_t get_adaptive(const VElem_t* vector, Distance_t radius, IndexCallback<T>* callback) const;
+
+    /// How many elements get_adaptive would find.
+    size_t count_adaptive(const VElem_t* vector, Distance_t radius) const;
+
+    /// The default number of queries interleaved by the batch query methods.
+    static const size_t DEFAULT_BATCH_WIDTH = 8;
+
+    /// For each of num_vectors query vectors (stored one after the other
+    /// in 'vectors'), call f(query, hash_code, elem) for each element found
+    /// nearby to the query vector, using extended A* lattice probing.
+    /// 'query' is the index of the query vector in the batch.
+    ///
+    /// The hash table lookups of up to 'width' queries are interleaved: each
+    /// lookup is split into steps of one memory access, and each access is
+    /// prefetched and only made after the other queries have had a turn.
+    /// This hides memory latency for large indexes. A width of 0 means
+    /// DEFAULT_BATCH_WIDTH; a width of 1 is the same as calling get_extended
+    /// for each query in turn.
+    ///
+    /// The lookups go through a directory of the hash codes, which the first
+    /// batch query after hash codes are added or removed builds (in time
+    /// linear in num_hashes, see memory_usage).
+    ///
+    /// The elements of each query are given in the same order as
+    /// by get_extended, but calls for different queries are interleaved.
+    ///
+    /// The queries are shared between num_threads threads by a work-stealing
+    /// scheduler (see parallel_for). With more than one thread, f is called
+    /// concurrently, but all calls for any one query are from one thread.
+    ///
+    template<typename F>
+    void visit_extended_batch(const VElem_t* vectors, size_t num_vectors, size_t width, F&& f, size_t num_threads = 1) const
+    {
+        const Dim_t d = input_dim();
+        parallel_for(num_vectors, num_threads, 0, [this, vectors, d, width, &f](size_t begin, size_t end)
+        {
+            _batch_lookup(vectors + begin * d, end - begin, width, true, [begin, &f](size_t query, Hash_t hash_code, const List& list)
+            {
+                auto list_end = list.end();
+                for (auto it(list.begin()); it != list_end; ++it)
+                {
+                    f(begin + query, hash_code, *it);
+                }
+            });
+        });
+    }
+
+    /// As per count_extended, for each of num_vectors query vectors
+    /// (see visit_extended_batch). The counts array must have
+    /// num_vectors entries.
+    void count_extended_batch(const VElem_t* vectors, size_t num_vectors, size_t width, size_t* counts, size_t num_threads = 1) const;
+
     /// Call the given callback for each element stored with the
     /// given hash code.
     void get_hash(Hash_t hash_code, IndexCallback<T>* callback) const;
@@ -121,12 +278,25 @@ public:
         return m_hash.nearest_hash(vector);
     }
 
-    /// Get the dimensionality of vectors processed by this index.
+    /// Get the dimensionality of the lattice of this index.
     inline Dim_t dim(void) const
     {
         return m_hash.dim();
     }
 
+    /// Get the dimensionality of the vectors given to put and get, which
+    /// is dim() unless there is a transform.
+    inline Dim_t input_dim(void) const
+    {
+        return m_hash.input_dim();
+    }
+
+    /// The transform applied to vectors, or null for none.
+    inline const VectorTransform* transform(void) const
+    {
+        return m_hash.transform();
+    }
+
     /// Get the packing radius of the quantisation lattice.
     inline Distance_t packing_radius(void) const
     {
@@ -154,16 +324,31 @@ public:
         return m_hash.num_probes();
     }
 
+    /// The orbits walked by 'get' queries (see AStarNN::orbits).
+    inline const std::vector<uint32_t>& orbits(void) const
+    {
+        return m_hash.orbits();
+    }
+
+    /// Walk only the given orbits in 'get' queries, e.g. as chosen by
+    /// ProbeProfile::select_orbits (see AStarNN::set_orbits). The elements
+    /// are kept, as their (nearest) hash codes do not change. Must not be
+    /// called during queries.
+    inline void set_orbits(const uint32_t* orbits, size_t num_orbits)
+    {
+        m_hash.set_orbits(orbits, num_orbits);
+    }
+
     /// Is the index empty.
     inline bool empty() const
     {
-        return m_map.empty();
+        return m_map.empty() && m_old.empty();
     }
 
     /// Get the number of distinct hash codes in the index.
     inline size_t num_hashes() const
     {
-        return m_map.size();
+        return m_map.size() + m_old.size();
     }
 
     /// Get the number of elements in the index.
@@ -172,207 +357,923 @@ public:
         return m_num_elements;
     }
 
+    /// Call f(hash_code, list) for each distinct hash code in the index
+    /// and its (non-empty) list of elements, in no particular order.
+    template<typename F>
+    void visit_hashes(F&& f) const
+    {
+        const Map* maps[2] = {&m_map, &m_old};
+        for (const Map* map : maps)
+        {
+            auto end = map->end();
+            for (auto it(map->begin()); it != end; ++it)
+            {
+                if (!it->second.empty())
+                {
+                    f(it->first, it->second);
+                }
+            }
+        }
+    }
+
+    /// Count the buckets (distinct hash codes) by their number of elements.
+    /// On return, histogram[i] is the number of buckets holding i elements,
+    /// except that the last bin, histogram[num_bins - 1], also counts all
+    /// larger buckets.
+    void bucket_size_histogram(size_t num_bins, size_t* histogram) const;
+
+    /// An estimate of the number of bytes used for index storage:
+    /// the hash table, its nodes, out of line bucket memory and the
+    /// directory of the batch query methods.
+    size_t memory_usage(void) const;
+
+    /// Perform a bounded step of compaction, releasing memory left
+    /// behind by clear_hash and by buckets that have shrunk.
+    ///
+    /// A pass has two phases, each step doing at most max_buckets slots
+    /// of a hash table (max_buckets must be positive):
+    ///     (1) the buckets of each slot are shrunk to fit.
+    ///     (2) only if the table has more than twice the slots its hash
+    ///         codes need, it is replaced: a table of the needed size is
+    ///         made, and each step moves the hash codes of the next slots
+    ///         of the old table into it (as new nodes). Meanwhile queries
+    ///         look in both tables, and the old one is freed when empty.
+    /// So no step rehashes the whole table, but a replacement allocates
+    /// the new slot array (zero filled) while the old one is held.
+    ///
+    /// The index may be modified between steps; compaction simply
+    /// continues from where it was, which may miss some new buckets
+    /// in phase (1).
+    ///
+    /// \param[in]  max_buckets      maximum number of hash table slots to process.
+    /// \param[out] bytes_reclaimed  incremented by the (estimated) number of bytes released.
+    /// \returns true when the pass is finished (the next step starts a new pass).
+    ///
+    bool compact_step(size_t max_buckets, size_t& bytes_reclaimed);
+
+    /// Compact the whole index in one go (see compact_step).
+    /// Returns the (estimated) number of bytes released.
+    size_t compact(void);
+
+    /// Get the allocator used for index storage.
+    inline const Alloc& get_allocator() const
+    {
+        return m_alloc;
+    }
+
+protected:
+    /// Empty the index in constant time, without destroying its hash table
+    /// nodes and lists or deallocating them. Only for an index whose storage
+    /// is all released at once afterwards (e.g. by an Arena), so T must be
+    /// trivially destructible.
+    void _abandon_storage(void);
+
 private:
-    size_t                                      m_num_elements;
-    AStarNN                                     m_hash;
-    std::unordered_map<Hash_t, std::vector<T> > m_map;
+    // Copy and assignment not implemented
+    AStarIndex(const AStarIndex& obj);
+    AStarIndex& operator=(const AStarIndex& obj);
+
+    /// Get the list for the given hash code, creating an empty list as needed.
+    /// A list still in the old table (see compact_step) is moved to m_map.
+    List& _list(Hash_t hash_code);
+
+    /// The list for the given hash code, in either table, or null if none.
+    const List* _find(Hash_t hash_code) const;
+    List* _find(Hash_t hash_code);
+
+    /// Remove the hash code (which must be present) and its list.
+    void _erase(Hash_t hash_code);
+
+    /// An entry of the directory of the batch query methods: an open
+    /// addressed table of the hash codes (in either hash table) and their
+    /// lists, which can be prefetched, unlike the slots of an unordered_map.
+    struct DirEntry
+    {
+        Hash_t      hash_code;
+        const List* list;       // null for an empty entry
+    };
+
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<DirEntry> DirAlloc;
+    typedef std::vector<DirEntry, DirAlloc> Directory;
+
+    /// The home entry of a hash code in a directory of 2^bits entries.
+    static inline size_t _dir_slot(Hash_t hash_code, unsigned bits)
+    {
+        return size_t((hash_code * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+    }
+
+    /// Get the directory, building it if the hash codes have changed since
+    /// it was built. It has 2^bits entries, and is at most half full.
+    const DirEntry* _directory(unsigned& bits) const;
+
+    /// The interleaved lookup engine for the batch query methods.
+    /// Calls on_bucket(query, hash_code, list) for each probe found.
+    /// If elems, on_bucket reads the elements of the list, so they are
+    /// prefetched too.
+    template<typename F>
+    void _batch_lookup(const VElem_t* vectors, size_t num_vectors, size_t width, bool elems, F on_bucket) const;
+
+    size_t      m_num_elements;
+    Hasher      m_hash;
+    Alloc       m_alloc;
+    Map         m_map;
+    Map         m_old;              // the table being replaced by compact_step, else empty
+    bool        m_migrating;        // is compact_step moving m_old into m_map
+    size_t      m_compact_cursor;   // next hash table slot for compact_step
+    size_t      m_version;          // changed whenever a list is added, moved or removed
+
+    mutable std::mutex  m_dir_mutex;    // guards building the directory
+    mutable Directory   m_dir;
+    mutable unsigned    m_dir_bits;
+    mutable size_t      m_dir_version;  // m_version when m_dir was built
 };
 
 
 //  Implementation
 
-template <typename T>
-AStarIndex<T>::AStarIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells)
-    : m_hash(dim, packing_radius, num_shells)
-    , m_num_elements(0)
+template <typename T, typename Alloc, typename Hasher>
+AStarIndex<T, Alloc, Hasher>::AStarIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, const Alloc& alloc)
+    : m_num_elements(0)
+    , m_hash(dim, packing_radius, num_shells)
+    , m_alloc(alloc)
+    , m_map(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(alloc))
+    , m_old(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(alloc))
+    , m_migrating(false)
+    , m_compact_cursor(0)
+    , m_version(0)
+    , m_dir(DirAlloc(alloc))
+    , m_dir_bits(0)
+    , m_dir_version(size_t(-1))
 {}
 
 
-template <typename T>
-AStarIndex<T>::~AStarIndex(void)
+template <typename T, typename Alloc, typename Hasher>
+AStarIndex<T, Alloc, Hasher>::AStarIndex(const VectorTransform& transform, Distance_t packing_radius, NumShells_t num_shells, const Alloc& alloc)
+    : m_num_elements(0)
+    , m_hash(transform, packing_radius, num_shells)
+    , m_alloc(alloc)
+    , m_map(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(alloc))
+    , m_old(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(alloc))
+    , m_migrating(false)
+    , m_compact_cursor(0)
+    , m_version(0)
+    , m_dir(DirAlloc(alloc))
+    , m_dir_bits(0)
+    , m_dir_version(size_t(-1))
 {}
 
 
-template <typename T>
-void AStarIndex<T>::clear(void)
+template <typename T, typename Alloc, typename Hasher>
+AStarIndex<T, Alloc, Hasher>::~AStarIndex(void)
+{}
+
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::clear(void)
 {
     m_map.clear();
-    m_num_elements = 0;
+    Map(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(m_alloc)).swap(m_old);
+    Directory(DirAlloc(m_alloc)).swap(m_dir);
+    m_migrating      = false;
+    m_compact_cursor = 0;
+    m_num_elements   = 0;
+    m_version       += 1;
 }
 
-template <typename T>
-void AStarIndex<T>::put(const VElem_t* vector, const T& elem)
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::_abandon_storage(void)
+{
+    static_assert(std::is_trivially_destructible<T>::value, "the elements would not be destroyed");
+
+    // Swap the tables into maps which are never destroyed.
+    typedef typename std::aligned_storage<sizeof(Map), alignof(Map)>::type Storage;
+    Storage storage[2];
+    Map* maps[2] = {&m_map, &m_old};
+    for (size_t i = 0; i < 2; ++i)
+    {
+        Map* abandoned = new (&storage[i]) Map(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(m_alloc));
+        abandoned->swap(*maps[i]);
+    }
+    m_migrating      = false;
+    m_compact_cursor = 0;
+    m_num_elements   = 0;
+    m_version       += 1;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::put(const VElem_t* vector, const T& elem)
 {
     put_hash(hash(vector), elem);
 }
 
 
-template <typename T>
-void AStarIndex<T>::put(const VElem_t* vector, size_t num_elements, const T* elems)
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::put(const VElem_t* vector, size_t num_elements, const T* elems)
 {
     put_hash(hash(vector), num_elements, elems);
 }
 
 
-template <typename T>
-void AStarIndex<T>::put(const VElem_t* vector, const std::vector<T>& elems)
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::put(const VElem_t* vector, const std::vector<T>& elems)
 {
     put_hash(hash(vector), elems);
 }
 
 
-template <typename T>
-void AStarIndex<T>::get_extended(const VElem_t* vector, IndexCallback<T>* callback) const
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::put_batch(const VElem_t* vectors, size_t num_vectors, const T* elems, size_t num_threads)
+{
+    std::vector<Hash_t> hashes(num_vectors);
+    const Dim_t d = input_dim();
+
+    parallel_for(num_vectors, num_threads, 0, [this, vectors, d, &hashes](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            hashes[i] = hash(vectors + i * d);
+        }
+    });
+
+    for (size_t i = 0; i < num_vectors; ++i)
+    {
+        put_hash(hashes[i], elems[i]);
+    }
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+CellState AStarIndex<T, Alloc, Hasher>::put_tracked(const VElem_t* vector, const T& elem)
+{
+    CellState state;
+    state.hash_code = m_hash.nearest_hash(vector, state.margin);
+    put_hash(state.hash_code, elem);
+    return state;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+bool AStarIndex<T, Alloc, Hasher>::update(const T& elem, const VElem_t* old_vector, const VElem_t* new_vector, CellState& state)
 {
-    class MyCallback : public QueryCallback_Hash
+    const VectorTransform* transform = m_hash.transform();
+    const Dim_t            d         = dim();
+
+    // The margins are in the lattice's (transformed) space.
+    std::vector<VElem_t> mapped;
+    const VElem_t*       from = old_vector;
+    const VElem_t*       to   = new_vector;
+    if (transform)
     {
-    public:
-        const AStarIndex<T>* m_self;
-        IndexCallback<T>*    m_callback;
+        mapped.resize(2 * size_t(d));
+        transform->apply(old_vector, &mapped[0]);
+        transform->apply(new_vector, &mapped[d]);
+        from = &mapped[0];
+        to   = &mapped[d];
+    }
 
-        MyCallback(const AStarIndex<T>* self, IndexCallback<T>* callback)
-            : m_self(self)
-            , m_callback(callback)
-        {}
+    VElem_t step2 = 0;
+    for (Dim_t i = 0; i < d; ++i)
+    {
+        const VElem_t diff = to[i] - from[i];
+        step2 += diff * diff;
+    }
+    state.margin -= Distance_t(std::sqrt(step2));
+    if (state.margin >= 0)
+    {
+        return false;
+    }
 
-        void init(Dim_t dim, const VElem_t* mapped)
-        {}
+    Distance_t   margin;
+    const Hash_t hash_code = m_hash.nearest_hash(new_vector, margin);
+    if (hash_code == state.hash_code)
+    {
+        state.margin = margin;
+        return false;
+    }
 
-        void match(Hash_t hash_code)
-        {
-            m_self->get_hash(hash_code, m_callback);
-        }
+    // Move the element from its old list.
+    List* list = _find(state.hash_code);
+    if (!list)
+    {
+        throw Error_unknown;
+    }
+    auto it = std::find(list->begin(), list->end(), elem);
+    if (it == list->end())
+    {
+        throw Error_unknown;
+    }
+    list->swap_remove(it - list->begin());
+    if (list->empty())
+    {
+        _erase(state.hash_code);
     }
-    query_callback(this, callback);
+    m_num_elements -= 1;
 
-    m_hash.extended_probes(vector, &query_callback);
+    put_hash(hash_code, elem);
+    state.hash_code = hash_code;
+    state.margin    = margin;
+    return true;
 }
 
-template <typename T>
-size_t AStarIndex<T>::count_extended(const VElem_t* vector) const
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::merge(const AStarIndex& other, size_t num_threads)
 {
-    class MyCallback : public QueryCallback_Hash
+    const AStarIndex* indexes = &other;
+    merge_all(&indexes, 1, num_threads);
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::merge_all(const AStarIndex* const* indexes, size_t num_indexes, size_t num_threads)
+{
+    // A copy of a list from another index.
+    struct Piece
+    {
+        List*       dst;
+        const List* src;
+    };
+
+    size_t sum_hashes = num_hashes();
+    for (size_t i = 0; i < num_indexes; ++i)
     {
-    public:
-        const AStarIndex<T>* m_self;
-        size_t               m_count;;
+        const AStarIndex& other = *indexes[i];
+        if (&other == this)
+        {
+            throw Error_unknown;
+        }
+        if (other.dim() != dim())
+        {
+            throw Error_invalid_dim;
+        }
+        if (other.packing_radius() != packing_radius())
+        {
+            throw Error_invalid_packing_radius;
+        }
+        if (other.num_shells() != num_shells())
+        {
+            throw Error_invalid_num_shells;
+        }
+        if (other.transform() ? !transform() || *other.transform() != *transform() : transform() != 0)
+        {
+            throw Error_unknown;
+        }
+        sum_hashes += other.num_hashes();
+    }
 
-        MyCallback(const AStarIndex<T>* self)
-            : m_self(self)
-            , m_count(0)
-        {}
+    // Find or create the list of each hash code (serial: the hash table
+    // is not thread safe). Reserving for the total number of hash codes
+    // avoids rehashing; compact() releases any excess.
+    m_map.reserve(sum_hashes);
+    std::vector<Piece> pieces;
+    pieces.reserve(sum_hashes - num_hashes());
+    for (size_t i = 0; i < num_indexes; ++i)
+    {
+        indexes[i]->visit_hashes([this, &pieces](Hash_t hash_code, const List& list)
+        {
+            Piece piece = {&_list(hash_code), &list};
+            pieces.push_back(piece);
+        });
+    }
 
-        void init(Dim_t dim, const VElem_t* mapped)
-        {}
+    // Group the pieces by list, keeping the order of the indexes, and
+    // allocate each list at its final size.
+    std::stable_sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b)
+    {
+        return std::less<List*>()(a.dst, b.dst);
+    });
 
-        void match(Hash_t hash_code)
+    std::vector<size_t> groups;
+    for (size_t begin = 0; begin < pieces.size(); )
+    {
+        List*  dst  = pieces[begin].dst;
+        size_t size = dst->size();
+        size_t end  = begin;
+        for (; end < pieces.size() && pieces[end].dst == dst; ++end)
         {
-            m_count += m_self->count_hash(hash_code);
+            size += pieces[end].src->size();
         }
+        dst->reserve(size);
+        m_num_elements += size - dst->size();
+        groups.push_back(begin);
+        begin = end;
     }
-    query_callback(this);
+    groups.push_back(pieces.size());
+
+    // Copy the elements.
+    parallel_for(groups.size() - 1, num_threads, 0, [&pieces, &groups](size_t begin, size_t end)
+    {
+        for (size_t i = groups[begin]; i < groups[end]; ++i)
+        {
+            const List& src = *pieces[i].src;
+            pieces[i].dst->append(src.begin(), src.size());
+        }
+    });
+}
 
-    m_hash.extended_probes(vector, &query_callback);
 
-    return query_callback.m_count;
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::get_extended(const VElem_t* vector, IndexCallback<T>* callback) const
+{
+    m_hash.visit_extended(vector, [this, callback](Hash_t hash_code)
+    {
+        get_hash(hash_code, callback);
+    });
 }
 
+template <typename T, typename Alloc, typename Hasher>
+size_t AStarIndex<T, Alloc, Hasher>::count_extended(const VElem_t* vector) const
+{
+    size_t count = 0;
+    m_hash.visit_extended(vector, [this, &count](Hash_t hash_code)
+    {
+        count += count_hash(hash_code);
+    });
+    return count;
+}
 
-template <typename T>
-void AStarIndex<T>::clear(const VElem_t* vector)
+
+template <typename T, typename Alloc, typename Hasher>
+Hash_t AStarIndex<T, Alloc, Hasher>::get_extended_nearest(const VElem_t* vector, IndexCallback<T>* callback) const
+{
+    return m_hash.visit_extended_nearest(vector, [this, callback](Hash_t hash_code)
+    {
+        get_hash(hash_code, callback);
+    });
+}
+
+template <typename T, typename Alloc, typename Hasher>
+size_t AStarIndex<T, Alloc, Hasher>::get_adaptive(const VElem_t* vector, Distance_t radius, IndexCallback<T>* callback) const
+{
+    return m_hash.visit_adaptive(vector, radius, [this, callback](Hash_t hash_code)
+    {
+        get_hash(hash_code, callback);
+    });
+}
+
+template <typename T, typename Alloc, typename Hasher>
+size_t AStarIndex<T, Alloc, Hasher>::count_adaptive(const VElem_t* vector, Distance_t radius) const
+{
+    size_t count = 0;
+    m_hash.visit_adaptive(vector, radius, [this, &count](Hash_t hash_code)
+    {
+        count += count_hash(hash_code);
+    });
+    return count;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::clear(const VElem_t* vector)
 {
     Hash_t hash_code = m_hash.nearest_hash(vector);
     clear_hash(hash_code);
 }
 
 
-template <typename T>
-void AStarIndex<T>::put_hash(Hash_t hash_code, const T& elem)
+template <typename T, typename Alloc, typename Hasher>
+typename AStarIndex<T, Alloc, Hasher>::List& AStarIndex<T, Alloc, Hasher>::_list(Hash_t hash_code)
+{
+    auto found = m_map.find(hash_code);
+    if (found == m_map.end())
+    {
+        auto old = m_old.empty() ? m_old.end() : m_old.find(hash_code);
+        if (old != m_old.end())
+        {
+            found = m_map.emplace(hash_code, std::move(old->second)).first;
+            m_old.erase(old);
+        }
+        else
+        {
+            found = m_map.emplace(hash_code, List(m_alloc)).first;
+        }
+        m_version += 1;
+    }
+    return found->second;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+const typename AStarIndex<T, Alloc, Hasher>::List* AStarIndex<T, Alloc, Hasher>::_find(Hash_t hash_code) const
+{
+    auto found = m_map.find(hash_code);
+    if (found != m_map.end())
+    {
+        return &found->second;
+    }
+    if (!m_old.empty())
+    {
+        auto old = m_old.find(hash_code);
+        if (old != m_old.end())
+        {
+            return &old->second;
+        }
+    }
+    return 0;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+typename AStarIndex<T, Alloc, Hasher>::List* AStarIndex<T, Alloc, Hasher>::_find(Hash_t hash_code)
+{
+    auto found = m_map.find(hash_code);
+    if (found != m_map.end())
+    {
+        return &found->second;
+    }
+    if (!m_old.empty())
+    {
+        auto old = m_old.find(hash_code);
+        if (old != m_old.end())
+        {
+            return &old->second;
+        }
+    }
+    return 0;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::_erase(Hash_t hash_code)
+{
+    if (!m_map.erase(hash_code))
+    {
+        m_old.erase(hash_code);
+    }
+    m_version += 1;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::put_hash(Hash_t hash_code, const T& elem)
 {
-    std::vector<T>& list(m_map[hash_code]);
+    List& list(_list(hash_code));
     list.push_back(elem);
     m_num_elements += 1;
 }
 
 
-template <typename T>
-void AStarIndex<T>::put_hash(Hash_t hash_code, size_t num_elements, const T* elems)
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::put_hash(Hash_t hash_code, size_t num_elements, const T* elems)
 {
     if (num_elements > 0)
     {
-        std::vector<T>& list(m_map[hash_code]);
-        const T* end = elems + num_elements;
-        for (; elems != end; ++elems)
-        {
-            list.push_back(*elems);
-        }
+        List& list(_list(hash_code));
+        list.append(elems, num_elements);
         m_num_elements += num_elements;
     }
 }
 
 
 
-template <typename T>
-void AStarIndex<T>::put_hash(Hash_t hash_code, const std::vector<T>& elems)
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::put_hash(Hash_t hash_code, const std::vector<T>& elems)
 {
-    auto it  = elems.begin();
-    auto end = elems.end();
+    put_hash(hash_code, elems.size(), elems.data());
+}
+
 
-    if (it != end)
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::get_hash(Hash_t hash_code, IndexCallback<T>* callback) const
+{
+    const List* list = _find(hash_code);
+    if (list)
     {
-        std::vector<T>& list(m_map[hash_code]);
-        for (; it != end; ++it)
+        auto end = list->end();
+        for (auto it(list->begin()); it != end; ++it)
         {
-            list.push_back(*it);
+            callback->match(hash_code, *it);
         }
-        m_num_elements += elems.size();
     }
 }
 
 
-template <typename T>
-void AStarIndex<T>::get_hash(Hash_t hash_code, IndexCallback<T>* callback) const
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::count_extended_batch(const VElem_t* vectors, size_t num_vectors, size_t width, size_t* counts, size_t num_threads) const
 {
-    auto found = m_map.find(hash_code);
-    if (found != m_map.end())
+    const Dim_t d = input_dim();
+    parallel_for(num_vectors, num_threads, 0, [this, vectors, d, width, counts](size_t begin, size_t end)
     {
-        const std::vector<T>& list(found->second);
+        size_t* row_counts = counts + begin;
+        std::fill(row_counts, counts + end, size_t(0));
+        _batch_lookup(vectors + begin * d, end - begin, width, false, [row_counts](size_t query, Hash_t, const List& list)
+        {
+            row_counts[query] += list.size();
+        });
+    });
+}
+
 
-        auto end = list.end();
-        for (auto it(list.begin()); it != end; ++it)
+template <typename T, typename Alloc, typename Hasher>
+const typename AStarIndex<T, Alloc, Hasher>::DirEntry* AStarIndex<T, Alloc, Hasher>::_directory(unsigned& bits) const
+{
+    std::lock_guard<std::mutex> lock(m_dir_mutex);
+    if (m_dir_version != m_version)
+    {
+        unsigned dir_bits = 1;
+        while ((size_t(1) << dir_bits) < 2 * num_hashes())
         {
-            callback->match(hash_code, *it);
+            ++dir_bits;
         }
+
+        Directory    dir(size_t(1) << dir_bits, DirEntry(), DirAlloc(m_alloc));
+        const size_t mask = dir.size() - 1;
+        visit_hashes([&dir, dir_bits, mask](Hash_t hash_code, const List& list)
+        {
+            size_t pos = _dir_slot(hash_code, dir_bits);
+            while (dir[pos].list)
+            {
+                pos = (pos + 1) & mask;
+            }
+            dir[pos].hash_code = hash_code;
+            dir[pos].list      = &list;
+        });
+
+        m_dir.swap(dir);
+        m_dir_bits    = dir_bits;
+        m_dir_version = m_version;
     }
+    bits = m_dir_bits;
+    return m_dir.data();
 }
 
 
-template <typename T>
-size_t AStarIndex<T>::count_hash(Hash_t hash_code) const
+template <typename T, typename Alloc, typename Hasher>
+template <typename F>
+void AStarIndex<T, Alloc, Hasher>::_batch_lookup(const VElem_t* vectors, size_t num_vectors, size_t width, bool elems, F on_bucket) const
 {
-    auto found = m_map.find(hash_code);
-    if (found != m_map.end())
+    // This is a hand written state machine for asynchronous memory access
+    // chaining (AMAC). Each slot holds one query in progress, with one
+    // memory access pending: a turn of a slot makes the access prefetched
+    // on its last turn and prefetches the next one, so that each miss is
+    // overlapped with the turns of the other slots. A lookup takes up to
+    // three turns:
+    //     PROBE   the directory entry of the hash code (see _directory),
+    //     NODE    the hash table node, which holds a small list inline,
+    //     ELEMS   the out of line elements of a larger list, if elems.
+
+    enum Stage { PROBE, NODE, ELEMS };
+
+    // Number of probes taken from a cursor at a time.
+    static const size_t CHUNK = 16;
+
+    struct Slot
+    {
+        std::unique_ptr<ProbeCursor> cursor;
+        size_t      query;
+        Hash_t      hashes[CHUNK];
+        size_t      num_hashes;
+        size_t      cur;        // position of the pending lookup in hashes
+        size_t      pos;        // directory entry of the pending lookup
+        const List* list;
+        Stage       stage;
+        bool        active;
+    };
+
+    if (num_vectors == 0 || empty())
+    {
+        return;
+    }
+    if (width == 0)
+    {
+        width = DEFAULT_BATCH_WIDTH;
+    }
+    if (width > num_vectors)
+    {
+        width = num_vectors;
+    }
+
+    unsigned        dir_bits;
+    const DirEntry* dir  = _directory(dir_bits);
+    const size_t    mask = (size_t(1) << dir_bits) - 1;
+
+    const Dim_t dim = m_hash.input_dim();
+    size_t next_query = 0;
+    size_t num_active = 0;
+
+    // Move a slot to its next probe, starting the next query if needed,
+    // and start the lookup.
+    auto issue = [&](Slot& slot)
+    {
+        if (++slot.cur >= slot.num_hashes)
+        {
+            if (slot.cursor->done())
+            {
+                if (next_query == num_vectors)
+                {
+                    slot.active = false;
+                    --num_active;
+                    return;
+                }
+                slot.query = next_query++;
+                slot.cursor->start(vectors + slot.query * dim);
+            }
+            slot.num_hashes = slot.cursor->next(CHUNK, slot.hashes);
+            slot.cur = 0;
+        }
+        slot.pos   = _dir_slot(slot.hashes[slot.cur], dir_bits);
+        slot.stage = PROBE;
+        prefetch(&dir[slot.pos]);
+    };
+
+    std::vector<Slot> slots(width);
+    for (size_t i = 0; i < width; ++i)
+    {
+        Slot& slot = slots[i];
+        slot.cursor.reset(new ProbeCursor(m_hash));
+        slot.num_hashes = 0;
+        slot.cur = 0;
+        slot.active = true;
+        ++num_active;
+        issue(slot);
+    }
+
+    while (num_active > 0)
     {
-        const std::vector<T>& list(found->second);
-        return list.size();
+        for (size_t i = 0; i < width; ++i)
+        {
+            Slot& slot = slots[i];
+            if (!slot.active)
+            {
+                continue;
+            }
+
+            if (slot.stage == PROBE)
+            {
+                // Probe the directory (a following entry is usually in the
+                // same cache line).
+                const Hash_t hash_code = slot.hashes[slot.cur];
+                size_t pos = slot.pos;
+                while (dir[pos].list && dir[pos].hash_code != hash_code)
+                {
+                    pos = (pos + 1) & mask;
+                }
+                if (!dir[pos].list)
+                {
+                    issue(slot);
+                    continue;
+                }
+                slot.list  = dir[pos].list;
+                slot.stage = NODE;
+                prefetch(slot.list);
+                continue;
+            }
+
+            if (slot.stage == NODE && elems && !slot.list->is_inline())
+            {
+                slot.stage = ELEMS;
+                prefetch(slot.list->data());
+                continue;
+            }
+
+            on_bucket(slot.query, slot.hashes[slot.cur], *slot.list);
+            issue(slot);
+        }
     }
-    else
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+size_t AStarIndex<T, Alloc, Hasher>::count_hash(Hash_t hash_code) const
+{
+    const List* list = _find(hash_code);
+    return list ? list->size() : 0;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::clear_hash(Hash_t hash_code)
+{
+    const List* list = _find(hash_code);
+    if (list)
     {
-        return 0;
+        m_num_elements -= list->size();
+        _erase(hash_code);
     }
 }
 
 
-template <typename T>
-void AStarIndex<T>::clear_hash(Hash_t hash_code)
+
+template <typename T, typename Alloc, typename Hasher>
+void AStarIndex<T, Alloc, Hasher>::bucket_size_histogram(size_t num_bins, size_t* histogram) const
 {
-    auto found = m_map.find(hash_code);
-    if (found != m_map.end())
+    if (num_bins == 0)
     {
-        const std::vector<T>& list(found->second);
-        m_num_elements -= list.size();
-        m_map.erase(found);
+        return;
     }
+    std::fill(histogram, histogram + num_bins, size_t(0));
+
+    const size_t last = num_bins - 1;
+    visit_hashes([histogram, last](Hash_t, const List& list)
+    {
+        const size_t size = list.size();
+        histogram[size < last ? size : last] += 1;
+    });
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+size_t AStarIndex<T, Alloc, Hasher>::memory_usage(void) const
+{
+    // A node holds a 'next' pointer and the (hash code, list) pair.
+    const size_t node_size = sizeof(void*) + sizeof(typename Map::value_type);
+
+    size_t bytes = (m_map.bucket_count() + m_old.bucket_count()) * sizeof(void*) + num_hashes() * node_size;
+    {
+        std::lock_guard<std::mutex> lock(m_dir_mutex);
+        bytes += m_dir.capacity() * sizeof(DirEntry);
+    }
+
+    visit_hashes([&bytes](Hash_t, const List& list)
+    {
+        bytes += list.bytes_allocated();
+    });
+    return bytes;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+bool AStarIndex<T, Alloc, Hasher>::compact_step(size_t max_buckets, size_t& bytes_reclaimed)
+{
+    if (max_buckets == 0)
+    {
+        throw Error_unknown;
+    }
+
+    if (!m_migrating)
+    {
+        // Phase 1: shrink the buckets.
+        const size_t bucket_count = m_map.bucket_count();
+        if (m_compact_cursor < bucket_count)
+        {
+            const size_t end_slot = m_compact_cursor + std::min(max_buckets, bucket_count - m_compact_cursor);
+            for (size_t slot = m_compact_cursor; slot < end_slot; ++slot)
+            {
+                auto end = m_map.end(slot);
+                for (auto it(m_map.begin(slot)); it != end; ++it)
+                {
+                    bytes_reclaimed += it->second.shrink_to_fit();
+                }
+            }
+            m_compact_cursor = end_slot;
+            return false;
+        }
+
+        // Replace the table only if it is more than twice the size needed.
+        const size_t needed = size_t(std::ceil(m_map.size() / m_map.max_load_factor()));
+        m_compact_cursor = 0;
+        if (bucket_count <= 2 * needed + 1)
+        {
+            return true;
+        }
+        Map map(needed, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(m_alloc));
+        m_old.swap(m_map);
+        m_map.swap(map);
+        m_migrating = true;
+        return false;
+    }
+
+    // Phase 2: move the hash codes of the next slots of the old table
+    // (whose slots don't change, as erasing doesn't rehash).
+    const size_t old_count = m_old.bucket_count();
+    const size_t end_slot  = m_compact_cursor + std::min(max_buckets, old_count - m_compact_cursor);
+    for (size_t slot = m_compact_cursor; slot < end_slot && !m_old.empty(); ++slot)
+    {
+        while (m_old.begin(slot) != m_old.end(slot))
+        {
+            const Hash_t hash_code = m_old.begin(slot)->first;
+            auto         old       = m_old.find(hash_code);
+            m_map.emplace(hash_code, std::move(old->second));
+            m_old.erase(old);
+            m_version += 1;
+        }
+    }
+    m_compact_cursor = end_slot;
+    if (m_compact_cursor < old_count && !m_old.empty())
+    {
+        return false;
+    }
+
+    if (old_count > m_map.bucket_count())
+    {
+        bytes_reclaimed += (old_count - m_map.bucket_count()) * sizeof(void*);
+    }
+    Map(0, std::hash<Hash_t>(), std::equal_to<Hash_t>(), MapAlloc(m_alloc)).swap(m_old);
+    m_migrating      = false;
+    m_compact_cursor = 0;
+    return true;
+}
+
+
+template <typename T, typename Alloc, typename Hasher>
+size_t AStarIndex<T, Alloc, Hasher>::compact(void)
+{
+    size_t bytes_reclaimed = 0;
+    m_compact_cursor = 0;
+    while (!compact_step(size_t(-1), bytes_reclaimed))
+    {}
+    return bytes_reclaimed;
 }
 
 
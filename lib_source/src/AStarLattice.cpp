@@ -6,6 +6,7 @@
 
 #include "AStarLattice.h"
 #include "WorkBuff.h"
+#include "VectorTransform.h"
 #include <cstring>
 #include <math.h>
 #include <stdlib.h>
@@ -386,6 +387,64 @@ void AStarLattice::to_lattice_space
 }
 
 
+void AStarLattice::to_lattice_space
+(
+    Dim_t                   dim,
+    Distance_t              scale,
+    const VectorTransform*  transform,
+    const VElem_t*          v_in,
+    VElem_t*                v_out
+)
+{
+    if (!transform)
+    {
+        to_lattice_space(dim, scale, v_in, v_out);
+        return;
+    }
+
+    //
+    // The first pass transforms the vector into v_out and sums it, the
+    // second rotates and scales v_out in place (as per to_lattice_space).
+    //
+    const VElem_t*  w    = transform->weights();
+    const VElem_t*  bias = transform->bias();
+    double          sum  = 0;
+    if (transform->is_diagonal())
+    {
+        for (Dim_t i = 0; i < dim; ++i)
+        {
+            const VElem_t y = w[i] * v_in[i] + bias[i];
+            v_out[i] = y;
+            sum     += y;
+        }
+    }
+    else
+    {
+        const size_t n = transform->input_dim();
+        for (Dim_t i = 0; i < dim; ++i, w += n)
+        {
+            double y = bias[i];
+            for (size_t j = 0; j < n; ++j)
+            {
+                y += w[j] * v_in[j];
+            }
+            v_out[i] = VElem_t(y);
+            sum     += y;
+        }
+    }
+
+    const double norm = sqrt(dim + 1.0);
+    const double v_n  = -sum / norm;
+    const double t    = (v_n + sum) / dim;
+
+    for (Dim_t i = 0; i < dim; ++i)
+    {
+        v_out[i] = scale * (v_out[i] - t);
+    }
+    v_out[dim] = scale * v_n;
+}
+
+
 void AStarLattice::from_lattice_space
 (
     Dim_t           dim,
@@ -469,7 +528,7 @@ void AStarLattice::cvector_to_lattice_point_in_lattice_space
 }
 
 
-void AStarLattice::closest_point(Dim_t dim, const VElem_t* v, K_t& k, CElem_t* c, WorkBuff* buff)
+VElem_t AStarLattice::closest_point(Dim_t dim, const VElem_t* v, K_t& k, CElem_t* c, WorkBuff* buff)
 {
     /// This is a variation on Algorithm 2 from:
     /// McKilliam, Clarkson, Smith and Quinn, 2008, ISTA
@@ -559,9 +618,101 @@ void AStarLattice::closest_point(Dim_t dim, const VElem_t* v, K_t& k, CElem_t* c
         *c++ -= s_k;
     }
 
-    // We could return the distance.
     // The multipication by dimpd compensates for the different scales.
-    // return D * dimpd;
+    return VElem_t(D * dimpd);
+}
+
+
+VElem_t AStarLattice::cell_margin(Dim_t dim, const VElem_t* v, K_t k, const CElem_t* c, WorkBuff* buff)
+{
+    // The Voronoi cell of the lattice point p, p_i = (n+1) c_i + k (as
+    // found by closest_point), is a permutohedron. Its facets are the
+    // bisectors with the lattice points p + (n+1) 1_S - m 1, for each
+    // proper subset S of the coordinates, m = |S|. With y = v - p (which
+    // sums to zero), the facet of S is at
+    //     sum_{i in S} y_i = m (n + 1 - m) / 2
+    // and the distance to it is
+    //     (m (n + 1 - m) / 2 - sum_{i in S} y_i) / sqrt(m (n + 1 - m) / (n + 1)).
+    // For each m, the nearest facet is that of the m largest y_i.
+
+    const int       dimp  = dim + 1;
+    const double    dimpd = dimp;
+
+    VElem_t*        y     = get_buff<VElem_t>(buff);
+    Order_t*        order = get_buff<Order_t>(buff);
+
+    for (int i = 0; i < dimp; ++i)
+    {
+        y[i] = v[i] - (c[i] * dimpd + k);
+    }
+    memcpy(order, START_SORT_ORD.ord(dim), dimp * sizeof(Order_t));
+    sort_order(y, order, &order[dimp]);
+
+    double margin = HUGE_VAL;
+    double sum    = 0;
+    for (int m = 1; m < dimp; ++m)
+    {
+        sum += y[order[dimp - m]];
+        const double h = 0.5 * m * (dimp - m);
+        const double d = (h - sum) / sqrt(h * 2.0 / dimpd);
+        if (d < margin)
+        {
+            margin = d;
+        }
+    }
+    return margin;
+}
+
+
+VElem_t AStarLattice::delaunay_margin(Dim_t dim, const VElem_t* xmod, const Order_t* order)
+{
+    // With xmod and order as given by setK0, the Delaunay cell is the
+    // simplex where the xmod elements keep their order and the largest is
+    // no more than n+1 above the smallest. Its facets are where two
+    // elements adjacent in the order are equal, and where the spread is
+    // n+1; each is a plane with normal (e_i - e_j) / sqrt(2).
+
+    const Dim_t  dimp   = dim + 1;
+    const double first  = xmod[order[0]];
+    const double last   = xmod[order[dim]];
+
+    double gap = dimp - fabs(first - last);
+    for (Dim_t i = 0; i < dim; ++i)
+    {
+        const double d = fabs(xmod[order[i]] - xmod[order[i + 1]]);
+        if (d < gap)
+        {
+            gap = d;
+        }
+    }
+    return VElem_t(gap * sqrt(0.5));
+}
+
+
+K_t AStarLattice::nearest_vertex(Dim_t dim, const VElem_t* xmod, const Order_t* order)
+{
+    // Vertex k of the Delaunay cell is the k=0 vertex with c decremented
+    // at order[0 .. k-1]. As xmod sums to zero, the squared distance to
+    // vertex k is
+    //     |xmod|^2 + (n + 1) (k (n + 1 - k) + 2 sum_{j < k} xmod[order[j]]),
+    // so only the bracketed part need be compared.
+
+    const Dim_t dimp = dim + 1;
+
+    K_t    nearest = 0;
+    double best    = 0;
+    double sum     = 0;
+    for (Dim_t k = 1; k <= dim; ++k)
+    {
+        sum += xmod[order[k - 1]];
+        const double d = double(k) * (dimp - k) + 2.0 * sum;
+        if (d < best)
+        {
+            best    = d;
+            nearest = K_t(k);
+        }
+    }
+    return nearest;
 }
 
 
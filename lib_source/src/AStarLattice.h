@@ -10,6 +10,7 @@
 #include "common.h"
 
 class WorkBuff;
+class VectorTransform;
 
 ///
 /// This is just a name space for A* lattice functions.
@@ -46,6 +47,26 @@ public:
     );
 
 
+    ///
+    /// As per to_lattice_space, of the vector transformed by the given
+    /// transform (if it is not null), in the same passes over the vector.
+    ///
+    /// \param[in]  dim         number of dimensions, n (the transform's output_dim()).
+    /// \param[in]  scale       scaling factor (rho(dim)/packing radius).
+    /// \param[in]  transform   transform of the input vector, or null for none.
+    /// \param[in]  v_in        input vector (of transform->input_dim() dimensions).
+    /// \param[out] v_out       n+1 dimensional output vector.
+    ///
+    static void to_lattice_space
+    (
+        Dim_t                   dim,
+        Distance_t              scale,
+        const VectorTransform*  transform,
+        const VElem_t*          v_in,
+        VElem_t*                v_out
+    );
+
+
     ///
     /// Convert a vector from the representation space of the lattice back to
     /// the ordinary working space.
@@ -105,8 +126,9 @@ public:
     /// \param[in]  v           n+1 dimensional query vector (in the lattice representation space).
     /// \param[out] k           k value of the lattice point, k = -sum(c).
     /// \param[out] c           n+1 dimensional c-vector for the lattice point.
+    /// \return                 the squared distance from v to the lattice point.
     ///
-    static void closest_point
+    static VElem_t closest_point
     (
         Dim_t               dim,
         const VElem_t*      v,
@@ -116,6 +138,62 @@ public:
     );
 
 
+    ///
+    /// The distance from v to the boundary of the Voronoi cell of the
+    /// lattice point given by its c-vector (negative if v is outside the
+    /// cell). v can move by up to this distance and still have the same
+    /// closest lattice point. Uses 2 work buffers.
+    ///
+    /// \param[in]  dim   number of dimensions, n.
+    /// \param[in]  v     n+1 dimensional vector (in the lattice representation space).
+    /// \param[in]  k     k value of the lattice point.
+    /// \param[in]  c     n+1 dimensional c-vector of the lattice point.
+    ///
+    static VElem_t cell_margin
+    (
+        Dim_t           dim,
+        const VElem_t*  v,
+        K_t             k,
+        const CElem_t*  c,
+        WorkBuff*       buff
+    );
+
+
+    ///
+    /// The distance from v to the boundary of the Delaunay cell containing
+    /// it, given the residual and order found by setK0. v can move by up
+    /// to this distance and still have the same Delaunay probes.
+    ///
+    /// \param[in]  dim   number of dimensions, n.
+    /// \param[in]  xmod  v translated by setK0.
+    /// \param[in]  order permutation order from setK0.
+    ///
+    static VElem_t delaunay_margin
+    (
+        Dim_t           dim,
+        const VElem_t*  xmod,
+        const Order_t*  order
+    );
+
+
+    ///
+    /// The k of the Delaunay cell vertex nearest to v, given the residual
+    /// and order found by setK0; the vertex is the k=0 lattice point found
+    /// by setK0 with c[order[0 .. k-1]] decremented. This is the lattice
+    /// point closest to v, as found by closest_point.
+    ///
+    /// \param[in]  dim   number of dimensions, n.
+    /// \param[in]  xmod  v translated by setK0.
+    /// \param[in]  order permutation order from setK0.
+    ///
+    static K_t nearest_vertex
+    (
+        Dim_t           dim,
+        const VElem_t*  xmod,
+        const Order_t*  order
+    );
+
+
     ///
     /// Find the closest k=0 A* lattice point to v.
     ///
@@ -9,263 +9,56 @@
 #include "AStarLattice.h"
 #include "AStarProbes.h"
 #include "Hash.h"
-#include "Deleter.h"
+#include "Allocator.h"
 #include "WorkBuff.h"
+#include <algorithm>
+#include <math.h>
+#include <vector>
 
 
 ///
-/// The Switcher struct is templated on the Callback type.
-/// This allows the compiler to optimise away unneeded code
-/// for different callback kinds.
+/// Adaptors that present each query callback interface as a callable
+/// for the ProbeWalk functions.
 ///
-template<typename Callback> struct Switcher {static const int value;};
-template<> const int Switcher<QueryCallback>::value         = 1;
-template<> const int Switcher<QueryCallback_Hash>::value    = 2;
-template<> const int Switcher<QueryCallback_CVector>::value = 3;
-template<> const int Switcher<QueryCallback_Point>::value   = 4;
-
-///
-/// This macro gets the Switcher value for a given Callback type.
-///
-#define	TYPE(CallbackType) (Switcher<CallbackType>::value)
-
-///
-/// This macro is for use in the generic query methods.
-/// It assumes 'Callback' type variable is in scope.
-///
-#define	IS(CallbackType)	(TYPE(CallbackType) == TYPE(Callback))
-
-#define NEED_CVECTOR		(IS(QueryCallback) || IS(QueryCallback_CVector) || IS(QueryCallback_Point))
-#define NEED_HASH			(IS(QueryCallback) || IS(QueryCallback_Hash))
-
-
-
-///
-/// This macro is for use in the generic query methods.
-/// It assumes 'Callback' type variable and other variables are in scope.
-/// A decent optimising compiler should optimize away the switch statement. 
-///
-#define MATCH(hash_code,k,c)			\
-	switch (TYPE(Callback))				\
-	{									\
-	case TYPE(QueryCallback):			\
-		reinterpret_cast<QueryCallback*>(callback)->match(hash_code, k, c);	\
-		break;							\
-	case TYPE(QueryCallback_Hash):		\
-		reinterpret_cast<QueryCallback_Hash*>(callback)->match(hash_code);	\
-		break;							\
-	case TYPE(QueryCallback_CVector):	\
-		reinterpret_cast<QueryCallback_CVector*>(callback)->match(k, c);	\
-		break;							\
-	case TYPE(QueryCallback_Point):		\
-		AStarLattice::cvector_k_to_lattice_point_in_lattice_space(dim, c, k, lattice_point);\
-		reinterpret_cast<QueryCallback_Point*>(callback)->match(lattice_point);				\
-		break;							\
-	default:							\
-		throw Error_unknown;			\
-	}
-
-
-
-template<typename Callback>
-static inline void _nearest_probe
-(
-	Dim_t			dim,
-	Distance_t		scale,
-	const VElem_t*	vector,
-	Callback*		callback
-)
+class CallQueryCallback
 {
-	BuffStack		stack(dim, 6);
-	WorkBuff*		buff = stack.buff();
-
-	VElem_t*		lattice_point =
-					IS(QueryCallback_Point) ?
-					get_buff<VElem_t>(buff) :
-					0;
-
-    VElem_t*        mapped = get_buff<VElem_t>(buff);
-    CElem_t*        c      = get_buff<CElem_t>(buff);
-    K_t             k;
-
-    //
-    // Map the vector to the lattice representation space (including rescaling).
-    //
-    AStarLattice::to_lattice_space(dim, scale, vector, mapped);
-
-	callback->init(dim, mapped);
-
-    //
-    // Find the closest lattice point (i.e. containing Voronoi cell).
-    //
-    AStarLattice::closest_point(dim, mapped, k, c, buff);
-
-    Hash_t hash_code = 
-		NEED_HASH ?
-		Hash::hash(dim, c) :
-		0;
-
-	// Call callback->match(...) passing the nearest lattice point.
-	MATCH(hash_code, k, c)
-}
-
-
-
-template<typename Callback>
-static inline void _delaunay_probes
-(
-	Dim_t			dim,
-	Distance_t		scale,
-	const VElem_t*	vector,
-	Callback*		callback
-)
+public:
+	CallQueryCallback(QueryCallback* callback) : m_callback(callback) {}
+	inline void init(Dim_t dim, const VElem_t* mapped) { m_callback->init(dim, mapped); }
+	inline void operator()(Hash_t hash_code, K_t k, const CElem_t* c) { m_callback->match(hash_code, k, c); }
+private:
+	QueryCallback* m_callback;
+};
+
+class CallQueryCallback_Hash
 {
-	BuffStack		stack(dim, 5);
-	WorkBuff*		buff = stack.buff();
-
-	VElem_t*		lattice_point =
-					IS(QueryCallback_Point) ?
-					get_buff<VElem_t>(buff) :
-					0;
-
-	VElem_t*        mapped = get_buff<VElem_t>(buff);
-    CElem_t*        c      = get_buff<CElem_t>(buff);
-    VElem_t*        xmod   = get_buff<VElem_t>(buff);
-    Order_t*        order  = get_buff<Order_t>(buff);
-
-    //
-    // Map the vector to the lattice representation space (including rescaling).
-    //
-    AStarLattice::to_lattice_space(dim, scale, vector, mapped);
-
-	callback->init(dim, mapped);
-
-	//
-    // Find the containing Delaunay cell.
-	// The first probe, where all elements of the canonical probe are zero.
-    //
-	AStarLattice::setK0(dim, mapped, xmod, c, order, buff);
-
-    Hash_t hash_code = 
-		NEED_HASH ?
-		Hash::hash(dim, c) :
-		0;
-
-	// Call callback->match(...) on the first lattice point.
-	MATCH(hash_code, 0, c)
-
-	//
-	// Determing the other Delauny cell verticies.
-	//
-    for (K_t k = 1; k <= ((K_t)dim); k++)
-    {
-        c[order[k - 1]]--;
-
-		if (NEED_HASH)
-			hash_code = Hash::hash(dim, c);
-
-		// Call callback->match(...) on the next lattice point.
-		MATCH(hash_code, k, c)
-    }
-}
-
-
-
-template<typename Callback>
-static inline void _extended_probes
-(
-	Dim_t			dim,
-	Distance_t		scale,
-	const Order_t*	probe_diff_stream,
-	const Order_t*	end,
-	const VElem_t*	vector,
-	Callback*		callback
-)
+public:
+	CallQueryCallback_Hash(QueryCallback_Hash* callback) : m_callback(callback) {}
+	inline void init(Dim_t dim, const VElem_t* mapped) { m_callback->init(dim, mapped); }
+	inline void operator()(Hash_t hash_code) { m_callback->match(hash_code); }
+private:
+	QueryCallback_Hash* m_callback;
+};
+
+class CallQueryCallback_CVector
 {
-	BuffStack		stack(dim, 7);
-	WorkBuff*		buff = stack.buff();
-
-	VElem_t*		lattice_point =
-					IS(QueryCallback_Point) ?
-					get_buff<VElem_t>(buff) :
-					0;
-
-	VElem_t*        mapped         = get_buff<VElem_t>(buff);
-    CElem_t*        c              = get_buff<CElem_t>(buff);
-    VElem_t*        xmod           = get_buff<VElem_t>(buff);
-    Order_t*        order          = get_buff<Order_t>(buff);
-	Hash_t*         ordered_powers = get_buff<Hash_t>(buff);
-
-    //
-    // Map the vector to the lattice representation space (including rescaling).
-    //
-    AStarLattice::to_lattice_space(dim, scale, vector, mapped);
-
-	callback->init(dim, mapped);
-
-	//
-    // Find the containing Delaunay cell.
-    //
-	AStarLattice::setK0(dim, mapped, xmod, c, order, buff);
-
-    //
-    // Precompute the ordered array of powers of RADIX for fast indexing in hash.
-    //
-	if (NEED_HASH)
-	{
-		Hash::makeOrdered(dim, order, ordered_powers);
-	}
-
-    //
-    // The first probe, where all elements of the canonical probe are zero.
-    //
-    Hash_t hash_code =
-		NEED_HASH ?
-		Hash::hash(dim, c) :
-		0;
-
-	// Call callback->match(...) for the first lattice point.
-	MATCH(hash_code, 0, c)
-
-    //
-    // Loop over each of the remaining probes.
-    //
-    do
-    {
-        // Extract k from the start of the stream segment for this probe
-        const K_t k = *probe_diff_stream++;
-    
-        // Apply the decrement adjustments per column specified in the stream.
-        Order_t diffCol = *probe_diff_stream++;
-        while (diffCol != AStarProbes::STREAM_MARK)
-        {
-			if (NEED_CVECTOR)
-				c[order[diffCol]]--;
-
-			if (NEED_HASH)
-				hash_code -= ordered_powers[diffCol];
-
-			diffCol = *probe_diff_stream++;
-        }
-
-        // Apply the increment adjustments per column specified in the stream.
-        diffCol = *probe_diff_stream++;
-        while (diffCol != AStarProbes::STREAM_MARK)
-        {
-			if (NEED_CVECTOR)
-				c[order[diffCol]]++;
-
-			if (NEED_HASH)
-				hash_code += ordered_powers[diffCol];
-
-            diffCol = *probe_diff_stream++;
-        }
-
-		// Call callback->match(...) for the next lattice point.
-		MATCH(hash_code, k, c)
-    }
-    while (probe_diff_stream < end);
-}
+public:
+	CallQueryCallback_CVector(QueryCallback_CVector* callback) : m_callback(callback) {}
+	inline void init(Dim_t dim, const VElem_t* mapped) { m_callback->init(dim, mapped); }
+	inline void operator()(K_t k, const CElem_t* c) { m_callback->match(k, c); }
+private:
+	QueryCallback_CVector* m_callback;
+};
+
+class CallQueryCallback_Point
+{
+public:
+	CallQueryCallback_Point(QueryCallback_Point* callback) : m_callback(callback) {}
+	inline void init(Dim_t dim, const VElem_t* mapped) { m_callback->init(dim, mapped); }
+	inline void operator()(const VElem_t* lattice_point) { m_callback->match(lattice_point); }
+private:
+	QueryCallback_Point* m_callback;
+};
 
 
 
@@ -290,102 +83,230 @@ AStarNN::AStarNN(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells)
         throw Error_invalid_packing_radius;
     }
 
-    m_num_probes = AStarProbes::num_probes(m_dim, m_num_shells);
+    // Grow the shared table of powers of RADIX now, rather than during
+    // (possibly concurrent) queries.
+    Hash::powers(m_dim);
 
-    const size_t probes_size = m_num_probes * (m_dim + 1);
+    // All of the orbits, in shell order.
+    std::vector<uint32_t> orbits(AStarProbes::num_zero_probes(m_dim, m_num_shells));
+    for (size_t i = 0; i < orbits.size(); ++i)
+    {
+        orbits[i] = uint32_t(i);
+    }
+    _make_stream(orbits.data(), orbits.size());
+}
+
+
+void AStarNN::set_orbits(const uint32_t* orbits, size_t num_orbits)
+{
+    const size_t num_all = AStarProbes::num_zero_probes(m_dim, m_num_shells);
+    if (num_orbits == 0 || orbits[0] != 0)
+    {
+        throw Error_unknown;
+    }
+    std::vector<bool> seen(num_all, false);
+    for (size_t i = 0; i < num_orbits; ++i)
+    {
+        if (orbits[i] >= num_all || seen[orbits[i]])
+        {
+            throw Error_unknown;
+        }
+        seen[orbits[i]] = true;
+    }
+    _make_stream(orbits, num_orbits);
+}
+
+
+void AStarNN::_make_stream(const uint32_t* orbits, size_t num_orbits)
+{
+    const size_t dimp = m_dim + 1;
 
-    CElem_t* probes = new CElem_t[probes_size];
-    Deleter<CElem_t[]> delete_probes(probes);
+    CElem_t* all_probes = Memory::alloc_array<CElem_t>(AStarProbes::num_probes(m_dim, m_num_shells) * dimp);
+    MemoryFreer<CElem_t> free_all_probes(all_probes);
 
-    AStarProbes::generate_probes(m_dim, m_num_shells, probes);
+    AStarProbes::generate_probes(m_dim, m_num_shells, all_probes);
 
-    size_t size_diff_stream = AStarProbes::size_probe_stream(m_dim, m_num_probes, probes);
-    m_probe_diff_stream = new Order_t[size_diff_stream];
-    m_probe_diff_stream_end = AStarProbes::generate_probe_diffs(m_dim, m_num_probes, probes, m_probe_diff_stream);
+    // The blocks of the given orbits, in the given order.
+    const size_t num_probes = num_orbits * dimp;
+
+    CElem_t* probes = Memory::alloc_array<CElem_t>(num_probes * dimp);
+    MemoryFreer<CElem_t> free_probes(probes);
+
+    for (size_t i = 0; i < num_orbits; ++i)
+    {
+        const CElem_t* block = all_probes + size_t(orbits[i]) * dimp * dimp;
+        std::copy(block, block + dimp * dimp, probes + i * dimp * dimp);
+    }
+
+    size_t size_diff_stream = AStarProbes::size_probe_stream(m_dim, num_probes, probes);
+    Order_t* stream = Memory::alloc_array<Order_t>(size_diff_stream);
+    MemoryFreer<Order_t> free_stream(stream);
+
+    Order_t* stream_end = AStarProbes::generate_probe_diffs(m_dim, num_probes, probes, stream);
 
     // consistency check
-    if (m_probe_diff_stream_end != m_probe_diff_stream + size_diff_stream)
+    if (stream_end != stream + size_diff_stream)
     {
         throw Error_unknown;
     }
+
+    // The old stream (if any) is freed with free_stream.
+    std::swap(m_probe_diff_stream, stream);
+    m_probe_diff_stream_end = stream_end;
+    m_num_probes            = num_probes;
+    m_orbits.assign(orbits, orbits + num_orbits);
+}
+
+
+AStarNN::AStarNN(const VectorTransform& transform, Distance_t packing_radius, NumShells_t num_shells)
+    : AStarNN(transform.output_dim(), packing_radius, num_shells)
+{
+    m_transform.reset(new VectorTransform(transform));
 }
 
 
 AStarNN::~AStarNN(void)
 {
-    delete [] m_probe_diff_stream;
+    Memory::free(m_probe_diff_stream);
 }
 
 
 Hash_t AStarNN::nearest_hash(const VElem_t* vector) const
 {
-	Hash_t		hash_code;
-	KeepHashes	query_callback(1, &hash_code);
-	nearest_probe(vector, &query_callback);
+	Hash_t hash_code;
+	visit_nearest(vector, [&hash_code](Hash_t h) { hash_code = h; });
+	return hash_code;
+}
+
+
+/// A probe callable keeping the hash code and cell margin of the nearest lattice point.
+struct NearestWithMargin
+{
+	NearestWithMargin(Dim_t dim)
+		: stack(dim, 2)
+		, dim(dim)
+		, mapped(0)
+		, hash_code(0)
+		, margin(0)
+	{}
+
+	void init(Dim_t, const VElem_t* vector)
+	{
+		mapped = vector;
+	}
+
+	void operator()(Hash_t h, K_t k, const CElem_t* c)
+	{
+		hash_code = h;
+		margin    = AStarLattice::cell_margin(dim, mapped, k, c, stack.buff());
+	}
+
+	BuffStack		stack;
+	Dim_t			dim;
+	const VElem_t*	mapped;		// the query in the lattice representation space
+	Hash_t			hash_code;
+	VElem_t			margin;
+};
+
+
+Hash_t AStarNN::nearest_hash(const VElem_t* vector, Distance_t& margin) const
+{
+	NearestWithMargin nearest(m_dim);
+	visit_nearest(vector, nearest);
+
+	// The mapping to the lattice space scales distances by m_scale.
+	margin = Distance_t(nearest.margin / m_scale);
+	return nearest.hash_code;
+}
+
+
+Hash_t AStarNN::nearest_hash(const VElem_t* vector, ProbeMargins& margins) const
+{
+	BuffStack	stack(m_dim, 7);
+	WorkBuff*	buff = stack.buff();
+
+	VElem_t*	mapped = get_buff<VElem_t>(buff);
+	CElem_t*	c      = get_buff<CElem_t>(buff);
+	VElem_t*	xmod   = get_buff<VElem_t>(buff);
+	Order_t*	order  = get_buff<Order_t>(buff);
+	K_t			k;
+
+	AStarLattice::to_lattice_space(m_dim, m_scale, m_transform.get(), vector, mapped);
+
+	const VElem_t distance2 = AStarLattice::closest_point(m_dim, mapped, k, c, buff);
+	const VElem_t margin    = AStarLattice::cell_margin(m_dim, mapped, k, c, buff);
+	const Hash_t  hash_code = Hash::hash(m_dim, c);
+
+	AStarLattice::setK0(m_dim, mapped, xmod, c, order, buff);
+
+	// The mapping to the lattice space scales distances by m_scale.
+	margins.distance        = Distance_t(sqrt(distance2) / m_scale);
+	margins.cell_margin     = Distance_t(margin / m_scale);
+	margins.delaunay_margin = Distance_t(AStarLattice::delaunay_margin(m_dim, xmod, order) / m_scale);
 	return hash_code;
 }
 
 
 void AStarNN::_nearest_probe(const VElem_t* vector, QueryCallback* callback) const
 {
-    ::_nearest_probe(m_dim, m_scale, vector, callback);
+    visit_nearest(vector, CallQueryCallback(callback));
 }
 
 void AStarNN::_nearest_probe(const VElem_t* vector, QueryCallback_Hash* callback) const
 {
-    ::_nearest_probe(m_dim, m_scale, vector, callback);
+    visit_nearest(vector, CallQueryCallback_Hash(callback));
 }
 
 void AStarNN::_nearest_probe(const VElem_t* vector, QueryCallback_CVector* callback) const
 {
-    ::_nearest_probe(m_dim, m_scale, vector, callback);
+    visit_nearest(vector, CallQueryCallback_CVector(callback));
 }
 
 void AStarNN::_nearest_probe(const VElem_t* vector, QueryCallback_Point* callback) const
 {
-    ::_nearest_probe(m_dim, m_scale, vector, callback);
+    visit_nearest(vector, CallQueryCallback_Point(callback));
 }
 
 
 void AStarNN::_delaunay_probes(const VElem_t* vector, QueryCallback* callback) const
 {
-    ::_delaunay_probes(m_dim, m_scale, vector, callback);
+    visit_delaunay(vector, CallQueryCallback(callback));
 }
 
 void AStarNN::_delaunay_probes(const VElem_t* vector, QueryCallback_Hash* callback) const
 {
-    ::_delaunay_probes(m_dim, m_scale, vector, callback);
+    visit_delaunay(vector, CallQueryCallback_Hash(callback));
 }
 
 void AStarNN::_delaunay_probes(const VElem_t* vector, QueryCallback_CVector* callback) const
 {
-    ::_delaunay_probes(m_dim, m_scale, vector, callback);
+    visit_delaunay(vector, CallQueryCallback_CVector(callback));
 }
 
 void AStarNN::_delaunay_probes(const VElem_t* vector, QueryCallback_Point* callback) const
 {
-    ::_delaunay_probes(m_dim, m_scale, vector, callback);
+    visit_delaunay(vector, CallQueryCallback_Point(callback));
 }
 
 
 
 void AStarNN::_extended_probes(const VElem_t* vector, QueryCallback* callback) const
 {
-    ::_extended_probes(m_dim, m_scale, m_probe_diff_stream, m_probe_diff_stream_end, vector, callback);
+    visit_extended(vector, CallQueryCallback(callback));
 }
 
 void AStarNN::_extended_probes(const VElem_t* vector, QueryCallback_Hash* callback) const
 {
-    ::_extended_probes(m_dim, m_scale, m_probe_diff_stream, m_probe_diff_stream_end, vector, callback);
+    visit_extended(vector, CallQueryCallback_Hash(callback));
 }
 
 void AStarNN::_extended_probes(const VElem_t* vector, QueryCallback_CVector* callback) const
 {
-    ::_extended_probes(m_dim, m_scale, m_probe_diff_stream, m_probe_diff_stream_end, vector, callback);
+    visit_extended(vector, CallQueryCallback_CVector(callback));
 }
 
 void AStarNN::_extended_probes(const VElem_t* vector, QueryCallback_Point* callback) const
 {
-    ::_extended_probes(m_dim, m_scale, m_probe_diff_stream, m_probe_diff_stream_end, vector, callback);
+    visit_extended(vector, CallQueryCallback_Point(callback));
 }
 
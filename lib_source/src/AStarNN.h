@@ -10,6 +10,10 @@
  * are available. Each type of query callback provides different kinds of information
  * on the matching lattice points.
  *
+ * Alternatively, each query type can be given any callable (e.g., a lambda), via the
+ * 'visit_' methods. These are resolved at compile time (see ProbeWalk.h) so avoid the
+ * cost of a virtual call per probe.
+ *
  * Author: Barry Drake
  */
 
@@ -18,6 +22,10 @@
 
 #include "common.h"
 #include "version.h"
+#include "ProbeWalk.h"
+#include "VectorTransform.h"
+#include <memory>
+#include <vector>
 
 
 ///
@@ -259,6 +267,23 @@ private:
 };
 
 
+///
+/// Where a vector lies in the quantisation lattice.
+/// All distances are in the vector (quantisation) space.
+///
+struct ProbeMargins
+{
+	/// Distance to the nearest lattice point.
+	Distance_t	distance;
+
+	/// Distance to the edge of the nearest lattice point's Voronoi cell.
+	Distance_t	cell_margin;
+
+	/// Distance to the edge of the Delaunay cell containing the vector.
+	Distance_t	delaunay_margin;
+};
+
+
 
 
 
@@ -272,6 +297,15 @@ public:
     /// \param[in]  num_shells		number of extended shells for extended probes.
 	///
     AStarNN(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells);
+
+	/// Create an AStarNN hash code generator of vectors mapped by the
+	/// given transform (which is copied): the lattice has the transform's
+	/// output_dim() dimensions, and the vectors input_dim(). The transform
+	/// is applied as the vectors are mapped to the lattice space, so costs
+	/// no extra pass over the vectors. Distances (e.g. margins) are in the
+	/// transformed space.
+	///
+    AStarNN(const VectorTransform& transform, Distance_t packing_radius, NumShells_t num_shells);
     ~AStarNN(void);
 
 
@@ -279,6 +313,19 @@ public:
 	Hash_t nearest_hash(const VElem_t* vector) const;
 
 
+	/// Get the hash code of the lattice point nearest to the given vector,
+	/// and its margin: the distance (in the vector space) from the vector
+	/// to the edge of the Voronoi cell of the lattice point. So any vector
+	/// within 'margin' of this one has the same nearest hash code.
+	Hash_t nearest_hash(const VElem_t* vector, Distance_t& margin) const;
+
+
+	/// Get the hash code of the lattice point nearest to the given vector,
+	/// and how deep the vector is in the lattice (see ProbeMargins), e.g.
+	/// to choose how many probes a query needs (see visit_adaptive).
+	Hash_t nearest_hash(const VElem_t* vector, ProbeMargins& margins) const;
+
+
 	/// Call the given callback exactly once for the lattice point that is
 	/// nearest to the given vector.
 	///
@@ -321,12 +368,93 @@ public:
 	}
 
 
+	/// Call f exactly once for the lattice point that is nearest to the
+	/// given vector.
+	///
+	/// f is any callable with a signature recognised by ProbeWalk.h, e.g.,
+	/// a lambda taking (Hash_t) or (Hash_t, K_t, const CElem_t*).
+	///
+	template<typename F>
+	inline void visit_nearest(const VElem_t* vector, F&& f) const
+	{
+		ProbeWalk::nearest(m_dim, m_scale, m_transform.get(), vector, f);
+	}
+
+
+	/// Call f for each of the lattice points that are the vertices of the
+	/// Delaunay cell containing the given vector (n+1 calls).
+	///
+	/// f is any callable with a signature recognised by ProbeWalk.h.
+	///
+	template<typename F>
+	inline void visit_delaunay(const VElem_t* vector, F&& f) const
+	{
+		ProbeWalk::delaunay(m_dim, m_scale, m_transform.get(), vector, f);
+	}
+
+
+	/// Call f for each of the lattice points that form shells around
+	/// the hole nearest to the given vector ('num_probes' calls).
+	///
+	/// f is any callable with a signature recognised by ProbeWalk.h.
+	///
+	template<typename F>
+	inline void visit_extended(const VElem_t* vector, F&& f) const
+	{
+		ProbeWalk::extended(m_dim, m_scale, m_transform.get(), m_probe_diff_stream, m_probe_diff_stream_end, vector, f);
+	}
+
+
+	/// As per visit_extended, and return the hash code of the lattice point
+	/// nearest to the given vector (as per nearest_hash), for the cost of
+	/// one decode rather than two. The first n+1 calls are for the vertices
+	/// of the Delaunay cell (as per visit_delaunay, though not in order).
+	///
+	/// f is any callable with a signature recognised by ProbeWalk.h.
+	///
+	template<typename F>
+	inline Hash_t visit_extended_nearest(const VElem_t* vector, F&& f) const
+	{
+		return ProbeWalk::extended_nearest(m_dim, m_scale, m_transform.get(), m_probe_diff_stream, m_probe_diff_stream_end, vector, f);
+	}
+
+
+	/// Call f for the fewest probes that are sure to find every vector
+	/// within 'radius' of the given vector: the nearest lattice point (one
+	/// call) if the ball of that radius is inside its Voronoi cell, else the
+	/// vertices of the Delaunay cell (n+1 calls) if the ball is inside that.
+	/// Otherwise f is called for all of the extended probes, as per
+	/// visit_extended. Returns the number of calls.
+	///
+	/// f is any callable with a signature recognised by ProbeWalk.h.
+	///
+	template<typename F>
+	inline size_t visit_adaptive(const VElem_t* vector, Distance_t radius, F&& f) const
+	{
+		return ProbeWalk::adaptive(m_dim, m_scale, m_transform.get(), m_probe_diff_stream, m_probe_diff_stream_end,
+								   m_num_probes, vector, radius, f);
+	}
+
+
 	/// Get the dimensionality of quantisation lattice.
     inline Dim_t dim(void) const
     {
         return m_dim;
     }
 
+	/// Get the dimensionality of the vectors, which is dim() unless
+	/// there is a transform.
+    inline Dim_t input_dim(void) const
+    {
+        return m_transform ? m_transform->input_dim() : m_dim;
+    }
+
+	/// The transform of the vectors, or null for none.
+    inline const VectorTransform* transform(void) const
+    {
+        return m_transform.get();
+    }
+
 	/// Get the packing radius of the quantisation lattice.
     inline Distance_t packing_radius(void) const
     {
@@ -354,7 +482,28 @@ public:
         return m_num_probes;
     }
 
+	/// The orbits (blocks of n+1 probes, see AStarProbes::generate_probes)
+	/// walked by 'extended_probes' queries, in order. This is all of the
+	/// orbits of num_shells() shells, in shell order, unless set_orbits
+	/// has been called.
+    inline const std::vector<uint32_t>& orbits(void) const
+    {
+        return m_orbits;
+    }
+
+	/// Walk only the given orbits in extended probe queries, in the given
+	/// order, e.g. as chosen by ProbeProfile::select_orbits. Each orbit is
+	/// the index of an orbit of num_shells() shells, with no repeats, and
+	/// the first must be orbit 0 (the vertices of the Delaunay cell). So
+	/// num_probes() becomes num_orbits * (n + 1).
+	///
+	/// This replaces the probe diff stream, so must not be called during
+	/// queries.
+	void set_orbits(const uint32_t* orbits, size_t num_orbits);
+
 private:
+friend class ProbeCursor;
+
     const Dim_t         m_dim;
     const NumShells_t   m_num_shells;
     const Distance_t    m_packing_radius;
@@ -362,6 +511,11 @@ private:
     size_t              m_num_probes;
     Order_t*            m_probe_diff_stream;
     Order_t*            m_probe_diff_stream_end;
+    std::unique_ptr<VectorTransform> m_transform;
+    std::vector<uint32_t> m_orbits;
+
+	/// Make the probe diff stream of the given orbits.
+	void _make_stream(const uint32_t* orbits, size_t num_orbits);
 
 
 	// Concrete implementation for template methods delegations.
@@ -9,15 +9,167 @@
 #include "AStarLattice.h"
 #include "AStarProbes.h"
 #include "AStarIndex.h"
+#include "AStarBoundedIndex.h"
+#include "AStarVersionedIndex.h"
+#include "ProbeCursor.h"
+#include "AStarPartitionedIndex.h"
+#include "Ingest.h"
+#include "Server.h"
+#include "Client.h"
+#include "SharedIndex.h"
+#include "Sharding.h"
+#include "LatticeCodec.h"
+#include "SparseAStarNN.h"
+#include "E8NN.h"
+#include "VectorTransform.h"
+#include "ProbeProfile.h"
+#include <cstring>
 #include "Deleter.h"
 #include <new>
 
-class AStarIndex_size_t : public AStarIndex<size_t>
+/// Holds the allocation statistics (and any arena) of an AStarIndex_size_t.
+/// This is a base class so that it is constructed before the index, and
+/// destroyed after it.
+struct AStarIndex_size_t_Stats
+{
+	AStarIndex_size_t_Stats(size_t arena_chunk_size = 0)
+		: m_arena(arena_chunk_size ? new Arena(arena_chunk_size) : 0)
+	{}
+
+	AllocStats             m_stats;
+	std::unique_ptr<Arena> m_arena;     // null unless the index storage is taken from an arena
+};
+
+class AStarIndex_size_t
+	: private AStarIndex_size_t_Stats
+	, public AStarIndex<size_t, CountingAllocator<size_t> >
 {
 public:
+	typedef AStarIndex<size_t, CountingAllocator<size_t> > Base;
+
 	AStarIndex_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells)
-		: AStarIndex<size_t>(dim, packing_radius, num_shells)
+		: AStarIndex<size_t, CountingAllocator<size_t> >(dim, packing_radius, num_shells, CountingAllocator<size_t>(&m_stats))
+	{}
+
+	AStarIndex_size_t(const VectorTransform& transform, Distance_t packing_radius, NumShells_t num_shells)
+		: AStarIndex<size_t, CountingAllocator<size_t> >(transform, packing_radius, num_shells, CountingAllocator<size_t>(&m_stats))
+	{}
+
+	/// An index whose storage is taken from its own arena, in chunks of
+	/// (at least) arena_chunk_size bytes, and released all at once.
+	AStarIndex_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t arena_chunk_size)
+		: AStarIndex_size_t_Stats(arena_chunk_size)
+		, AStarIndex<size_t, CountingAllocator<size_t> >(dim, packing_radius, num_shells, CountingAllocator<size_t>(&m_stats, m_arena.get()))
+	{}
+
+	~AStarIndex_size_t(void)
+	{
+		// The arena is released after the index, so the hash table nodes
+		// need not be destroyed one by one.
+		if (m_arena)
+		{
+			_abandon_storage();
+		}
+	}
+
+	/// Number of bytes currently allocated for index storage (for an
+	/// arena, the bytes it has reserved, which are only returned when
+	/// the index is deleted).
+	inline size_t bytes_allocated(void) const
+	{
+		return m_arena ? m_arena->bytes_reserved() : size_t(m_stats.bytes);
+	}
+};
+
+
+class E8Index_size_t
+	: private AStarIndex_size_t_Stats
+	, public AStarIndex<size_t, CountingAllocator<size_t>, E8NN>
+{
+public:
+	E8Index_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells)
+		: AStarIndex<size_t, CountingAllocator<size_t>, E8NN>(dim, packing_radius, num_shells, CountingAllocator<size_t>(&m_stats))
+	{}
+
+	/// Number of bytes currently allocated for index storage.
+	inline size_t bytes_allocated(void) const
+	{
+		return m_stats.bytes;
+	}
+};
+
+
+class AStarBoundedIndex_size_t : public AStarBoundedIndex<size_t>
+{
+public:
+	AStarBoundedIndex_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t budget)
+		: AStarBoundedIndex<size_t>(dim, packing_radius, num_shells, budget)
+	{}
+};
+
+
+class AStarVersionedIndex_size_t : public AStarVersionedIndex<size_t>
+{
+public:
+	AStarVersionedIndex_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells)
+		: AStarVersionedIndex<size_t>(dim, packing_radius, num_shells)
+	{}
+};
+
+
+class AStarIndexSnapshot_size_t : public AStarIndexSnapshot<size_t>
+{
+public:
+	AStarIndexSnapshot_size_t(const AStarIndexSnapshot<size_t>& snapshot)
+		: AStarIndexSnapshot<size_t>(snapshot)
+	{}
+};
+
+
+class AStarPartitionedIndex_size_t : public AStarPartitionedIndex<size_t>
+{
+public:
+	AStarPartitionedIndex_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t num_partitions)
+		: AStarPartitionedIndex<size_t>(dim, packing_radius, num_shells, num_partitions)
+	{}
+};
+
+
+/// Holds the copy of the vectors served by an AStarServer_size_t.
+/// This is a base class so that it is constructed before the server.
+struct AStarServer_size_t_Vectors
+{
+	AStarServer_size_t_Vectors(const VElem_t* vectors, size_t size)
+		: m_served(vectors, vectors + size)
+	{}
+
+	std::vector<VElem_t> m_served;
+};
+
+class AStarServer_size_t
+	: private AStarServer_size_t_Vectors
+	, public AStarServer
+{
+public:
+	AStarServer_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, const VElem_t* vectors, size_t num_vectors,
+	                   const size_t* elems, size_t num_threads)
+		: AStarServer_size_t_Vectors(vectors, num_vectors * dim)
+		, AStarServer(dim, packing_radius, num_shells, m_served.data(), num_vectors, elems, num_threads)
+	{}
+};
+
+class ShardCoordinator_size_t : public ShardCoordinator
+{
+public:
+	ShardCoordinator_size_t(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor,
+	                        const std::vector<std::string>& socket_paths)
+		: ShardCoordinator(dim, packing_radius, num_shells, coarse_factor, socket_paths)
 	{}
+
+	// The results of the last knn.
+	std::vector<size_t>  m_counts;
+	std::vector<size_t>  m_elems;
+	std::vector<VElem_t> m_distances;
 };
 
 
@@ -93,6 +245,38 @@ private:
 };
 
 
+/// Keep up to max_size matching elements, and count all of them, so
+/// that the caller can retry with a larger buffer.
+class AStarIndex_size_t_KeepSomeElems : public IndexCallback<size_t>
+{
+public:
+	AStarIndex_size_t_KeepSomeElems(size_t max_size, size_t* elems)
+		: m_elems(elems)
+		, m_max_size(max_size)
+		, m_count(0)
+	{}
+
+	virtual void match(Hash_t hash_code, const size_t& elem)
+	{
+		if (m_count < m_max_size)
+		{
+			m_elems[m_count] = elem;
+		}
+		++m_count;
+	}
+
+	inline size_t count(void) const
+	{
+		return m_count;
+	}
+
+private:
+	size_t* const	m_elems;
+	const size_t	m_max_size;
+	size_t			m_count;
+};
+
+
 const char* info_string()
 {
      return Version::info();
@@ -117,6 +301,14 @@ NumShells_t AStar_max_num_shells(void)
 }
 
 
+Error AStar_set_allocator(AStar_Malloc_t malloc_function, AStar_Free_t free_function)
+{
+    RETURN_ERROR({
+        Memory::set_functions(malloc_function, free_function);
+    })
+}
+
+
 Error AStar_rho(Dim_t dim, Distance_t* out_rho)
 {
     RETURN_ERROR({
@@ -187,6 +379,15 @@ Error AStarNN_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells,
 }
 
 
+Error AStarNN_new_transformed(const VectorTransform* transform, Distance_t packing_radius, NumShells_t num_shells, AStarNN** out_AStarNN)
+{
+    RETURN_ERROR({
+        *out_AStarNN = 0;
+        *out_AStarNN = new AStarNN(*transform, packing_radius, num_shells);
+    })
+}
+
+
 Error AStarNN_delete(AStarNN* self)
 {
     RETURN_ERROR({
@@ -203,6 +404,41 @@ Error AStarNN_nearest_hash(const AStarNN* self, const VElem_t* vector, Hash_t* h
     })
 }
 
+Error AStarNN_nearest_hash_margin(const AStarNN* self, const VElem_t* vector, Hash_t* out_hash, Distance_t* out_margin)
+{
+    RETURN_ERROR({
+        *out_hash = self->nearest_hash(vector, *out_margin);
+    })
+}
+
+Error AStarNN_nearest_hash_margins(const AStarNN* self, const VElem_t* vector, Hash_t* out_hash,
+                                   Distance_t* out_distance, Distance_t* out_cell_margin, Distance_t* out_delaunay_margin)
+{
+    RETURN_ERROR({
+        ProbeMargins margins;
+        *out_hash            = self->nearest_hash(vector, margins);
+        *out_distance        = margins.distance;
+        *out_cell_margin     = margins.cell_margin;
+        *out_delaunay_margin = margins.delaunay_margin;
+    })
+}
+
+Error AStarNN_extended_nearest_hash(const AStarNN* self, const VElem_t* vector, Hash_t* hashes, Hash_t* out_nearest)
+{
+    RETURN_ERROR({
+        Hash_t* out = hashes;
+        *out_nearest = self->visit_extended_nearest(vector, [&out](Hash_t hash_code) { *out++ = hash_code; });
+    })
+}
+
+Error AStarNN_adaptive_hash(const AStarNN* self, const VElem_t* vector, Distance_t radius, Hash_t* hashes, size_t* out_count)
+{
+    RETURN_ERROR({
+        Hash_t* out = hashes;
+        *out_count = self->visit_adaptive(vector, radius, [&out](Hash_t hash_code) { *out++ = hash_code; });
+    })
+}
+
 Error AStarNN_delaunay_hash(const AStarNN* self, const VElem_t* vector, Hash_t* hashes)
 {
     RETURN_ERROR({
@@ -219,6 +455,13 @@ Error AStarNN_extended_hash(const AStarNN* self, const VElem_t* vector, Hash_t*
     })
 }
 
+Error AStarNN_to_lattice_space(const AStarNN* self, const VElem_t* vector, VElem_t* out_v)
+{
+    RETURN_ERROR({
+        AStarLattice::to_lattice_space(self->dim(), self->scale(), self->transform(), vector, out_v);
+    })
+}
+
 
 Error AStarNN_nearest_cvector(const AStarNN* self, const VElem_t* vector, CElem_t* cvectors)
 {
@@ -311,6 +554,13 @@ Error AStarNN_dim(const AStarNN* self, Dim_t* out_dim)
     })
 }
 
+Error AStarNN_input_dim(const AStarNN* self, Dim_t* out_dim)
+{
+    RETURN_ERROR({
+        *out_dim = self->input_dim();
+    })
+}
+
 
 Error AStarNN_packing_radius(const AStarNN* self, Distance_t* out_packing_radius)
 {
@@ -344,6 +594,30 @@ Error AStarNN_num_probes(const AStarNN* self, size_t* out_num_probes)
 }
 
 
+Error AStarNN_num_orbits(const AStarNN* self, size_t* out_num_orbits)
+{
+    RETURN_ERROR({
+        *out_num_orbits = self->orbits().size();
+    })
+}
+
+
+Error AStarNN_orbits(const AStarNN* self, uint32_t* out_orbits)
+{
+    RETURN_ERROR({
+        std::copy(self->orbits().begin(), self->orbits().end(), out_orbits);
+    })
+}
+
+
+Error AStarNN_set_orbits(AStarNN* self, const uint32_t* orbits, size_t num_orbits)
+{
+    RETURN_ERROR({
+        self->set_orbits(orbits, num_orbits);
+    })
+}
+
+
 Error AStarIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, AStarIndex_size_t** out_AStarIndex)
 {
 	RETURN_ERROR({
@@ -352,6 +626,26 @@ Error AStarIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t nu
     })
 }
 
+Error AStarIndex_size_t_new_transformed(const VectorTransform* transform, Distance_t packing_radius, NumShells_t num_shells, AStarIndex_size_t** out_AStarIndex)
+{
+	RETURN_ERROR({
+        *out_AStarIndex = 0;
+        *out_AStarIndex = new AStarIndex_size_t(*transform, packing_radius, num_shells);
+    })
+}
+
+Error AStarIndex_size_t_new_arena(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t arena_chunk_size, AStarIndex_size_t** out_AStarIndex)
+{
+	RETURN_ERROR({
+        *out_AStarIndex = 0;
+        if (arena_chunk_size == 0)
+        {
+            throw Error_unknown;
+        }
+        *out_AStarIndex = new AStarIndex_size_t(dim, packing_radius, num_shells, arena_chunk_size);
+    })
+}
+
 Error AStarIndex_size_t_delete(AStarIndex_size_t* self)
 {
 	RETURN_ERROR({
@@ -368,6 +662,14 @@ Error AStarIndex_size_t_dim(const AStarIndex_size_t* self, Dim_t* out_dim)
 }
 
 
+Error AStarIndex_size_t_input_dim(const AStarIndex_size_t* self, Dim_t* out_dim)
+{
+	RETURN_ERROR({
+		*out_dim = self->input_dim();
+	})
+}
+
+
 Error AStarIndex_size_t_packing_radius(const AStarIndex_size_t* self, Distance_t* out_packing_radius)
 {
 	RETURN_ERROR({
@@ -400,6 +702,30 @@ Error AStarIndex_size_t_num_probes(const AStarIndex_size_t* self, size_t* out_nu
 }
 
 
+Error AStarIndex_size_t_num_orbits(const AStarIndex_size_t* self, size_t* out_num_orbits)
+{
+	RETURN_ERROR({
+		*out_num_orbits = self->orbits().size();
+	})
+}
+
+
+Error AStarIndex_size_t_orbits(const AStarIndex_size_t* self, uint32_t* out_orbits)
+{
+	RETURN_ERROR({
+		std::copy(self->orbits().begin(), self->orbits().end(), out_orbits);
+	})
+}
+
+
+Error AStarIndex_size_t_set_orbits(AStarIndex_size_t* self, const uint32_t* orbits, size_t num_orbits)
+{
+	RETURN_ERROR({
+		self->set_orbits(orbits, num_orbits);
+	})
+}
+
+
 Error AStarIndex_size_t_num_hashes(AStarIndex_size_t* self, size_t* out_size)
 {
 	RETURN_ERROR({
@@ -416,6 +742,40 @@ Error AStarIndex_size_t_num_elements(AStarIndex_size_t* self, size_t* out_size)
 }
 
 
+Error AStarIndex_size_t_bytes_allocated(const AStarIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->bytes_allocated();
+	})
+}
+
+
+Error AStarIndex_size_t_bucket_size_histogram(const AStarIndex_size_t* self, size_t num_bins, size_t* out_histogram)
+{
+	RETURN_ERROR({
+		self->bucket_size_histogram(num_bins, out_histogram);
+	})
+}
+
+
+Error AStarIndex_size_t_compact(AStarIndex_size_t* self, size_t* out_bytes_reclaimed)
+{
+	RETURN_ERROR({
+		*out_bytes_reclaimed = self->compact();
+	})
+}
+
+
+Error AStarIndex_size_t_compact_step(AStarIndex_size_t* self, size_t max_buckets, int* out_done, size_t* out_bytes_reclaimed)
+{
+	RETURN_ERROR({
+		size_t bytes_reclaimed = 0;
+		*out_done = self->compact_step(max_buckets, bytes_reclaimed) ? 1 : 0;
+		*out_bytes_reclaimed = bytes_reclaimed;
+	})
+}
+
+
 Error AStarIndex_size_t_clear(AStarIndex_size_t* self)
 {
 	RETURN_ERROR({
@@ -440,6 +800,30 @@ Error AStarIndex_size_t_put(AStarIndex_size_t* self, const VElem_t* vector, size
 }
 
 
+Error AStarIndex_size_t_put_tracked(AStarIndex_size_t* self, const VElem_t* vector, size_t elem, Hash_t* out_hash, Distance_t* out_margin)
+{
+	RETURN_ERROR({
+		CellState state = self->put_tracked(vector, elem);
+		*out_hash   = state.hash_code;
+		*out_margin = state.margin;
+	})
+}
+
+
+Error AStarIndex_size_t_update(AStarIndex_size_t* self, size_t elem, const VElem_t* old_vector, const VElem_t* new_vector,
+                               Hash_t* inout_hash, Distance_t* inout_margin, int* out_moved)
+{
+	RETURN_ERROR({
+		CellState state;
+		state.hash_code = *inout_hash;
+		state.margin    = *inout_margin;
+		*out_moved      = self->update(elem, old_vector, new_vector, state);
+		*inout_hash     = state.hash_code;
+		*inout_margin   = state.margin;
+	})
+}
+
+
 Error AStarIndex_size_t_put_all(AStarIndex_size_t* self, const VElem_t* vector, size_t count, const size_t* elems)
 {
 	RETURN_ERROR({
@@ -476,6 +860,1215 @@ Error AStarIndex_size_t_get_elems(const AStarIndex_size_t* self, const VElem_t*
 }
 
 
+Error AStarIndex_size_t_get_elems_nearest(const AStarIndex_size_t* self, const VElem_t* vector, size_t max_size,
+                                          size_t* out_count, size_t* out_elems, Hash_t* out_hash)
+{
+	RETURN_ERROR({
+        AStarIndex_size_t_KeepSomeElems callback_object(max_size, out_elems);
+		*out_hash  = self->get_extended_nearest(vector, &callback_object);
+		*out_count = callback_object.count();
+	})
+}
+
+
+Error AStarIndex_size_t_put_hash(AStarIndex_size_t* self, Hash_t hash_code, size_t elem)
+{
+	RETURN_ERROR({
+		self->put_hash(hash_code, elem);
+	})
+}
+
+
+Error AStarIndex_size_t_count_adaptive(const AStarIndex_size_t* self, const VElem_t* vector, Distance_t radius, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->count_adaptive(vector, radius);
+	})
+}
+
+
+Error AStarIndex_size_t_get_elems_adaptive(const AStarIndex_size_t* self, const VElem_t* vector, Distance_t radius, size_t max_size,
+                                           size_t* out_count, size_t* out_elems, size_t* out_num_probes)
+{
+	RETURN_ERROR({
+        KeepElems<size_t> callback_object(max_size, out_elems);
+		*out_num_probes = self->get_adaptive(vector, radius, &callback_object);
+		*out_count = callback_object.size();
+	})
+}
+
+
+Error AStarIndex_size_t_put_batch(AStarIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, const size_t* elems, size_t num_threads)
+{
+	RETURN_ERROR({
+		self->put_batch(vectors, num_vectors, elems, num_threads);
+	})
+}
+
+
+Error AStarIndex_size_t_count_batch(const AStarIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, size_t width, size_t num_threads, size_t* out_counts)
+{
+	RETURN_ERROR({
+		self->count_extended_batch(vectors, num_vectors, width, out_counts, num_threads);
+	})
+}
+
+
+Error AStarIndex_size_t_get_elems_batch(const AStarIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, size_t width, size_t num_threads, const size_t* offsets, size_t* out_elems)
+{
+	RETURN_ERROR({
+		// Each query (row) writes only to its own slot of out_elems,
+		// so the order of results is independent of the scheduling.
+		std::vector<size_t> cur(offsets, offsets + num_vectors);
+		self->visit_extended_batch(vectors, num_vectors, width, [&cur, offsets, out_elems](size_t query, Hash_t, size_t elem)
+		{
+			ASSERT(cur[query] < offsets[query + 1]);
+			out_elems[cur[query]++] = elem;
+		},
+		num_threads);
+	})
+}
+
+
+Error AStarIndex_size_t_merge(AStarIndex_size_t* self, const AStarIndex_size_t* other, size_t num_threads)
+{
+	RETURN_ERROR({
+		self->merge(*other, num_threads);
+	})
+}
+
+
+Error AStarIndex_size_t_merge_all(AStarIndex_size_t* self, const AStarIndex_size_t* const* others, size_t num_others, size_t num_threads)
+{
+	RETURN_ERROR({
+		std::vector<const AStarIndex_size_t::Base*> indexes(others, others + num_others);
+		self->merge_all(indexes.data(), indexes.size(), num_threads);
+	})
+}
+
+
+Error AStarIndex_size_t_publish_shared(const AStarIndex_size_t* self, const char* name, uint64_t* out_generation)
+{
+	RETURN_ERROR({
+		*out_generation = SharedIndex::publish(name, *self);
+	})
+}
+
+
+Error AStarIndex_size_t_publish_shared_all(const AStarIndex_size_t* const* indexes, size_t num_indexes, const char* name, uint64_t* out_generation)
+{
+	RETURN_ERROR({
+		std::vector<const AStarIndex_size_t::Base*> bases(indexes, indexes + num_indexes);
+		*out_generation = SharedIndex::publish(name, bases.data(), bases.size());
+	})
+}
+
+
+Error AStarIndex_size_t_to_memfd(const AStarIndex_size_t* self, int* out_fd)
+{
+	RETURN_ERROR({
+		*out_fd = SharedIndex::to_memfd(*self);
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t budget, AStarBoundedIndex_size_t** out_AStarBoundedIndex)
+{
+	RETURN_ERROR({
+        *out_AStarBoundedIndex = 0;
+        *out_AStarBoundedIndex = new AStarBoundedIndex_size_t(dim, packing_radius, num_shells, budget);
+    })
+}
+
+Error AStarBoundedIndex_size_t_delete(AStarBoundedIndex_size_t* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_num_hashes(const AStarBoundedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_hashes();
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_num_elements(const AStarBoundedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_elements();
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_bytes_allocated(const AStarBoundedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->bytes_allocated();
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_set_budget(AStarBoundedIndex_size_t* self, size_t budget)
+{
+	RETURN_ERROR({
+		self->set_budget(budget);
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_counters(const AStarBoundedIndex_size_t* self, size_t* out_hits, size_t* out_misses, size_t* out_evictions, size_t* out_evicted_elements)
+{
+	RETURN_ERROR({
+		*out_hits             = self->hits();
+		*out_misses           = self->misses();
+		*out_evictions        = self->evictions();
+		*out_evicted_elements = self->evicted_elements();
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_clear(AStarBoundedIndex_size_t* self)
+{
+	RETURN_ERROR({
+		self->clear();
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_put(AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t elem)
+{
+	RETURN_ERROR({
+		self->put(vector, elem);
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_put_all(AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t count, const size_t* elems)
+{
+	RETURN_ERROR({
+		self->put(vector, count, elems);
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_count(const AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->count_extended(vector);
+	})
+}
+
+
+Error AStarBoundedIndex_size_t_get_elems(const AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems)
+{
+	RETURN_ERROR({
+        KeepElems<size_t> callback_object(max_size, out_elems);
+		self->get_extended(vector, &callback_object);
+		*out_count = callback_object.size();
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, AStarVersionedIndex_size_t** out_AStarVersionedIndex)
+{
+	RETURN_ERROR({
+        *out_AStarVersionedIndex = 0;
+        *out_AStarVersionedIndex = new AStarVersionedIndex_size_t(dim, packing_radius, num_shells);
+    })
+}
+
+Error AStarVersionedIndex_size_t_delete(AStarVersionedIndex_size_t* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_num_hashes(const AStarVersionedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_hashes();
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_num_elements(const AStarVersionedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_elements();
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_pages_copied(const AStarVersionedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->pages_copied();
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_hashes_copied(const AStarVersionedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->hashes_copied();
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_clear(AStarVersionedIndex_size_t* self)
+{
+	RETURN_ERROR({
+		self->clear();
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_clear_by_vector(AStarVersionedIndex_size_t* self, const VElem_t* vector)
+{
+	RETURN_ERROR({
+		self->clear(vector);
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_put(AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t elem)
+{
+	RETURN_ERROR({
+		self->put(vector, elem);
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_put_all(AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t count, const size_t* elems)
+{
+	RETURN_ERROR({
+		self->put(vector, count, elems);
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_count(const AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->count_extended(vector);
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_get_elems(const AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems)
+{
+	RETURN_ERROR({
+        KeepElems<size_t> callback_object(max_size, out_elems);
+		self->get_extended(vector, &callback_object);
+		*out_count = callback_object.size();
+	})
+}
+
+
+Error AStarVersionedIndex_size_t_snapshot(const AStarVersionedIndex_size_t* self, AStarIndexSnapshot_size_t** out_AStarIndexSnapshot)
+{
+	RETURN_ERROR({
+        *out_AStarIndexSnapshot = 0;
+        *out_AStarIndexSnapshot = new AStarIndexSnapshot_size_t(self->snapshot());
+	})
+}
+
+
+Error AStarIndexSnapshot_size_t_delete(AStarIndexSnapshot_size_t* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error AStarIndexSnapshot_size_t_num_hashes(const AStarIndexSnapshot_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_hashes();
+	})
+}
+
+
+Error AStarIndexSnapshot_size_t_num_elements(const AStarIndexSnapshot_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_elements();
+	})
+}
+
+
+Error AStarIndexSnapshot_size_t_count(const AStarIndexSnapshot_size_t* self, const VElem_t* vector, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->count_extended(vector);
+	})
+}
+
+
+Error AStarIndexSnapshot_size_t_get_elems(const AStarIndexSnapshot_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems)
+{
+	RETURN_ERROR({
+        KeepElems<size_t> callback_object(max_size, out_elems);
+		self->get_extended(vector, &callback_object);
+		*out_count = callback_object.size();
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t num_partitions, AStarPartitionedIndex_size_t** out_AStarPartitionedIndex)
+{
+	RETURN_ERROR({
+		*out_AStarPartitionedIndex = 0;
+		*out_AStarPartitionedIndex = new AStarPartitionedIndex_size_t(dim, packing_radius, num_shells, num_partitions);
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_delete(AStarPartitionedIndex_size_t* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_num_partitions(const AStarPartitionedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_partitions();
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_num_hashes(const AStarPartitionedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_hashes();
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_num_elements(const AStarPartitionedIndex_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_elements();
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_clear(AStarPartitionedIndex_size_t* self)
+{
+	RETURN_ERROR({
+		self->clear();
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_put(AStarPartitionedIndex_size_t* self, const VElem_t* vector, size_t elem)
+{
+	RETURN_ERROR({
+		self->put(vector, elem);
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_count(const AStarPartitionedIndex_size_t* self, const VElem_t* vector, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->count_extended(vector);
+	})
+}
+
+
+Error AStarPartitionedIndex_size_t_get_elems(const AStarPartitionedIndex_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems)
+{
+	RETURN_ERROR({
+        KeepElems<size_t> callback_object(max_size, out_elems);
+		self->get_extended(vector, &callback_object);
+		*out_count = callback_object.size();
+	})
+}
+
+
+static void ingest_arrays(AStarPartitionedIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, const size_t* elems,
+                          size_t num_hash_workers, size_t num_inserters, size_t chunk_rows, uint64_t* out_metrics)
+{
+	const Dim_t dim = self->dim();
+	size_t      next = 0;
+
+	// The reader stage just copies rows from the given arrays.
+	IngestPipeline<size_t> pipeline(*self, num_hash_workers, num_inserters, chunk_rows);
+	pipeline.run([=, &next](VElem_t* out_vectors, size_t* out_elems, size_t max_rows)
+	{
+		size_t num_rows = num_vectors - next;
+		if (num_rows > max_rows)
+		{
+			num_rows = max_rows;
+		}
+		memcpy(out_vectors, vectors + next * dim, num_rows * dim * sizeof(VElem_t));
+		memcpy(out_elems, elems + next, num_rows * sizeof(size_t));
+		next += num_rows;
+		return num_rows;
+	});
+
+	const IngestMetrics& metrics = pipeline.metrics();
+	const StageMetrics* stages[3] = {&metrics.read, &metrics.hash, &metrics.insert};
+	for (size_t i = 0; i < 3; ++i)
+	{
+		*out_metrics++ = stages[i]->threads;
+		*out_metrics++ = stages[i]->items;
+		*out_metrics++ = stages[i]->busy_ns;
+		*out_metrics++ = stages[i]->wait_ns;
+	}
+	*out_metrics = metrics.elapsed_ns;
+}
+
+
+Error AStarPartitionedIndex_size_t_ingest(AStarPartitionedIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, const size_t* elems,
+                                          size_t num_hash_workers, size_t num_inserters, size_t chunk_rows, uint64_t* out_metrics)
+{
+	RETURN_ERROR({
+		ingest_arrays(self, vectors, num_vectors, elems, num_hash_workers, num_inserters, chunk_rows, out_metrics);
+	})
+}
+
+
+Error ProbeCursor_new(const AStarNN* hasher, ProbeCursor** out_ProbeCursor)
+{
+	RETURN_ERROR({
+		*out_ProbeCursor = 0;
+		*out_ProbeCursor = new ProbeCursor(*hasher);
+	})
+}
+
+
+Error ProbeCursor_delete(ProbeCursor* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error ProbeCursor_start(ProbeCursor* self, const VElem_t* vector)
+{
+	RETURN_ERROR({
+		self->start(vector);
+	})
+}
+
+
+Error ProbeCursor_next(ProbeCursor* self, size_t max_probes, Hash_t* hashes, CElem_t* cvectors, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->next(max_probes, hashes, cvectors);
+	})
+}
+
+
+Error ProbeCursor_remaining(const ProbeCursor* self, size_t* out_remaining)
+{
+	RETURN_ERROR({
+		*out_remaining = self->remaining();
+	})
+}
+
+
+Error AStarServer_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, const VElem_t* vectors, size_t num_vectors,
+                             const size_t* elems, size_t num_threads, AStarServer_size_t** out_AStarServer)
+{
+	RETURN_ERROR({
+		*out_AStarServer = 0;
+		*out_AStarServer = new AStarServer_size_t(dim, packing_radius, num_shells, vectors, num_vectors, elems, num_threads);
+	})
+}
+
+
+Error AStarServer_size_t_delete(AStarServer_size_t* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error AStarServer_size_t_start(AStarServer_size_t* self, const char* socket_path, size_t max_batch)
+{
+	RETURN_ERROR({
+		self->start(socket_path, max_batch ? max_batch : AStarServer::DEFAULT_MAX_BATCH);
+	})
+}
+
+
+Error AStarServer_size_t_stop(AStarServer_size_t* self)
+{
+	RETURN_ERROR({
+		self->stop();
+	})
+}
+
+
+Error AStarServer_size_t_counters(const AStarServer_size_t* self, size_t* out_requests, size_t* out_batches)
+{
+	RETURN_ERROR({
+		*out_requests = self->num_requests();
+		*out_batches  = self->num_batches();
+	})
+}
+
+
+Error AStarServer_size_t_prune_counters(const AStarServer_size_t* self, size_t* out_distances, size_t* out_pruned)
+{
+	RETURN_ERROR({
+		*out_distances = self->num_distances();
+		*out_pruned    = self->num_pruned();
+	})
+}
+
+
+Error AStarServer_size_t_requantize(AStarServer_size_t* self, Distance_t packing_radius, NumShells_t num_shells)
+{
+	RETURN_ERROR({
+		self->requantize(packing_radius, num_shells);
+	})
+}
+
+
+Error AStarServer_size_t_num_hashes(const AStarServer_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->index()->num_hashes();
+	})
+}
+
+
+Error AStarClient_connect(const char* socket_path, AStarClient** out_AStarClient)
+{
+	RETURN_ERROR({
+		*out_AStarClient = 0;
+		*out_AStarClient = new AStarClient(socket_path);
+	})
+}
+
+
+Error AStarClient_close(AStarClient* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error AStarClient_info(const AStarClient* self, Dim_t* out_dim, size_t* out_num_probes, size_t* out_num_vectors)
+{
+	RETURN_ERROR({
+		*out_dim         = self->dim();
+		*out_num_probes  = self->num_probes();
+		*out_num_vectors = self->num_vectors();
+	})
+}
+
+
+Error AStarClient_nearest_hash(AStarClient* self, const VElem_t* vectors, size_t num_vectors, Hash_t* hashes)
+{
+	RETURN_ERROR({
+		self->request(ServerProtocol::OP_NEAREST_HASH, vectors, num_vectors);
+		std::copy(self->items().begin(), self->items().end(), hashes);
+	})
+}
+
+
+Error AStarClient_extended_hash(AStarClient* self, const VElem_t* vectors, size_t num_vectors, Hash_t* hashes)
+{
+	RETURN_ERROR({
+		self->request(ServerProtocol::OP_EXTENDED_HASH, vectors, num_vectors);
+		std::copy(self->items().begin(), self->items().end(), hashes);
+	})
+}
+
+
+Error AStarClient_candidates(AStarClient* self, const VElem_t* vectors, size_t num_vectors, size_t* out_counts, size_t* out_total)
+{
+	RETURN_ERROR({
+		self->request(ServerProtocol::OP_CANDIDATES, vectors, num_vectors);
+		std::copy(self->counts().begin(), self->counts().end(), out_counts);
+		*out_total = self->num_items();
+	})
+}
+
+
+Error AStarClient_knn(AStarClient* self, const VElem_t* vectors, size_t num_vectors, uint32_t k, size_t* out_counts, size_t* out_total)
+{
+	RETURN_ERROR({
+		self->request(ServerProtocol::OP_KNN, vectors, num_vectors, k);
+		std::copy(self->counts().begin(), self->counts().end(), out_counts);
+		*out_total = self->num_items();
+	})
+}
+
+
+Error AStarClient_results(const AStarClient* self, size_t* out_elems, Distance_t* out_distances)
+{
+	RETURN_ERROR({
+		const std::vector<uint64_t>& items = self->items();
+		const size_t                 n     = self->num_items();
+		const size_t                 words = n ? items.size() / n : 1;
+		for (size_t i = 0; i < n; ++i)
+		{
+			out_elems[i] = size_t(items[i * words]);
+			if (out_distances && words > 1)
+			{
+				std::memcpy(&out_distances[i], &items[i * words + 1], sizeof(Distance_t));
+			}
+		}
+	})
+}
+
+
+Error SharedIndex_attach(const char* name, SharedIndex** out_SharedIndex)
+{
+	RETURN_ERROR({
+		*out_SharedIndex = 0;
+		*out_SharedIndex = new SharedIndex(name);
+	})
+}
+
+
+Error SharedIndex_attach_fd(int fd, SharedIndex** out_SharedIndex)
+{
+	RETURN_ERROR({
+		*out_SharedIndex = 0;
+		*out_SharedIndex = new SharedIndex(fd);
+	})
+}
+
+
+Error SharedIndex_unlink(const char* name)
+{
+	RETURN_ERROR({
+		SharedIndex::unlink(name);
+	})
+}
+
+
+Error SharedIndex_delete(SharedIndex* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error SharedIndex_dim(const SharedIndex* self, Dim_t* out_dim)
+{
+	RETURN_ERROR({
+		*out_dim = self->dim();
+	})
+}
+
+
+Error SharedIndex_generation(const SharedIndex* self, uint64_t* out_generation)
+{
+	RETURN_ERROR({
+		*out_generation = self->generation();
+	})
+}
+
+
+Error SharedIndex_stale(const SharedIndex* self, int* out_stale)
+{
+	RETURN_ERROR({
+		*out_stale = self->stale() ? 1 : 0;
+	})
+}
+
+
+Error SharedIndex_refresh(SharedIndex* self, int* out_changed)
+{
+	RETURN_ERROR({
+		*out_changed = self->refresh() ? 1 : 0;
+	})
+}
+
+
+Error SharedIndex_num_hashes(const SharedIndex* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_hashes();
+	})
+}
+
+
+Error SharedIndex_num_elements(const SharedIndex* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_elements();
+	})
+}
+
+
+Error SharedIndex_count(const SharedIndex* self, const VElem_t* vector, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->count_extended(vector);
+	})
+}
+
+
+Error SharedIndex_get_elems(const SharedIndex* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems)
+{
+	RETURN_ERROR({
+		KeepElems<size_t> callback_object(max_size, out_elems);
+		self->get_extended(vector, &callback_object);
+		*out_count = callback_object.size();
+	})
+}
+
+
+Error LatticeCodec_new(Dim_t dim, Distance_t packing_radius, unsigned bits, const VElem_t* base, LatticeCodec** out_LatticeCodec)
+{
+	RETURN_ERROR({
+		*out_LatticeCodec = 0;
+		*out_LatticeCodec = new LatticeCodec(dim, packing_radius, bits, base);
+	})
+}
+
+
+Error LatticeCodec_delete(LatticeCodec* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error LatticeCodec_code_size(const LatticeCodec* self, size_t* out_code_size)
+{
+	RETURN_ERROR({
+		*out_code_size = self->code_size();
+	})
+}
+
+
+Error LatticeCodec_encode(const LatticeCodec* self, const VElem_t* vectors, size_t num_vectors, size_t num_threads, uint8_t* out_codes)
+{
+	RETURN_ERROR({
+		self->encode(vectors, num_vectors, out_codes, 0, num_threads);
+	})
+}
+
+
+Error LatticeCodec_encode_stats(const LatticeCodec* self, const VElem_t* vectors, size_t num_vectors, size_t num_threads, uint8_t* out_codes,
+                                size_t* out_num_clipped, double* out_sum_squared_error, double* out_max_error)
+{
+	RETURN_ERROR({
+		CodecStats stats;
+		self->encode(vectors, num_vectors, out_codes, &stats, num_threads);
+		*out_num_clipped       = stats.num_clipped;
+		*out_sum_squared_error = stats.sum_squared_error;
+		*out_max_error         = stats.max_error;
+	})
+}
+
+
+Error LatticeCodec_decode(const LatticeCodec* self, const uint8_t* codes, size_t num_vectors, size_t num_threads, VElem_t* out_vectors)
+{
+	RETURN_ERROR({
+		self->decode(codes, num_vectors, out_vectors, num_threads);
+	})
+}
+
+
+Error SparseAStarNN_new(Dim_t dim, Distance_t packing_radius, SparseAStarNN** out_SparseAStarNN)
+{
+	RETURN_ERROR({
+		*out_SparseAStarNN = 0;
+		*out_SparseAStarNN = new SparseAStarNN(dim, packing_radius);
+	})
+}
+
+
+Error SparseAStarNN_delete(SparseAStarNN* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error SparseAStarNN_nearest_hash(const SparseAStarNN* self, size_t nnz, const Dim_t* indices, const VElem_t* values, Hash_t* out_hash)
+{
+	RETURN_ERROR({
+		*out_hash = self->nearest_hash(nnz, indices, values);
+	})
+}
+
+
+Error SparseAStarNN_nearest_cvector(const SparseAStarNN* self, size_t nnz, const Dim_t* indices, const VElem_t* values,
+                                    CElem_t* out_c_nonzero, CElem_t* out_c_zero, CElem_t* out_c_last, K_t* out_k)
+{
+	RETURN_ERROR({
+		*out_k = self->nearest_cvector(nnz, indices, values, out_c_nonzero, *out_c_zero, *out_c_last);
+	})
+}
+
+
+Error SparseAStarNN_nearest_hashes(const SparseAStarNN* self, size_t num_vectors, const size_t* offsets, const Dim_t* indices,
+                                   const VElem_t* values, size_t num_threads, Hash_t* out_hashes)
+{
+	RETURN_ERROR({
+		self->nearest_hashes(num_vectors, offsets, indices, values, out_hashes, num_threads);
+	})
+}
+
+
+Error E8NN_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, E8NN** out_E8NN)
+{
+	RETURN_ERROR({
+		*out_E8NN = 0;
+		*out_E8NN = new E8NN(dim, packing_radius, num_shells);
+	})
+}
+
+
+Error E8NN_delete(E8NN* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error E8NN_num_probes(const E8NN* self, size_t* out_num_probes)
+{
+	RETURN_ERROR({
+		*out_num_probes = self->num_probes();
+	})
+}
+
+
+Error E8NN_nearest_hash(const E8NN* self, const VElem_t* vector, Hash_t* out_hash)
+{
+	RETURN_ERROR({
+		*out_hash = self->nearest_hash(vector);
+	})
+}
+
+
+Error E8NN_nearest_point(const E8NN* self, const VElem_t* vector, CElem_t* out_doubled)
+{
+	RETURN_ERROR({
+		self->nearest_point(vector, out_doubled);
+	})
+}
+
+
+Error E8NN_extended_hash(const E8NN* self, const VElem_t* vector, Hash_t* out_hashes)
+{
+	RETURN_ERROR({
+		self->extended_hash(vector, out_hashes);
+	})
+}
+
+
+Error E8Index_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, E8Index_size_t** out_E8Index)
+{
+	RETURN_ERROR({
+		*out_E8Index = 0;
+		*out_E8Index = new E8Index_size_t(dim, packing_radius, num_shells);
+	})
+}
+
+
+Error E8Index_size_t_delete(E8Index_size_t* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error E8Index_size_t_num_probes(const E8Index_size_t* self, size_t* out_num_probes)
+{
+	RETURN_ERROR({
+		*out_num_probes = self->num_probes();
+	})
+}
+
+
+Error E8Index_size_t_num_hashes(const E8Index_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->num_hashes();
+	})
+}
+
+
+Error E8Index_size_t_bytes_allocated(const E8Index_size_t* self, size_t* out_size)
+{
+	RETURN_ERROR({
+		*out_size = self->bytes_allocated();
+	})
+}
+
+
+Error E8Index_size_t_put(E8Index_size_t* self, const VElem_t* vector, size_t elem)
+{
+	RETURN_ERROR({
+		self->put(vector, elem);
+	})
+}
+
+
+Error E8Index_size_t_count(const E8Index_size_t* self, const VElem_t* vector, size_t* out_count)
+{
+	RETURN_ERROR({
+		*out_count = self->count_extended(vector);
+	})
+}
+
+
+Error E8Index_size_t_get_elems(const E8Index_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems)
+{
+	RETURN_ERROR({
+		KeepElems<size_t> callback_object(max_size, out_elems);
+		self->get_extended(vector, &callback_object);
+		*out_count = callback_object.size();
+	})
+}
+
+
+Error VectorTransform_new_diagonal(Dim_t dim, const VElem_t* offset, const VElem_t* scale, VectorTransform** out_VectorTransform)
+{
+	RETURN_ERROR({
+		*out_VectorTransform = 0;
+		*out_VectorTransform = new VectorTransform(VectorTransform::diagonal(dim, offset, scale));
+	})
+}
+
+
+Error VectorTransform_new_whitening(Dim_t input_dim, Dim_t output_dim, const VElem_t* offset, const VElem_t* matrix,
+                                    VectorTransform** out_VectorTransform)
+{
+	RETURN_ERROR({
+		*out_VectorTransform = 0;
+		*out_VectorTransform = new VectorTransform(VectorTransform::whitening(input_dim, output_dim, offset, matrix));
+	})
+}
+
+
+Error VectorTransform_fit_diagonal(Dim_t dim, const VElem_t* sample, size_t num_vectors, size_t num_threads,
+                                   VectorTransform** out_VectorTransform)
+{
+	RETURN_ERROR({
+		*out_VectorTransform = 0;
+		*out_VectorTransform = new VectorTransform(VectorTransform::fit_diagonal(dim, sample, num_vectors, num_threads));
+	})
+}
+
+
+Error VectorTransform_fit_whitening(Dim_t dim, Dim_t output_dim, const VElem_t* sample, size_t num_vectors, double epsilon,
+                                    size_t num_threads, VectorTransform** out_VectorTransform)
+{
+	RETURN_ERROR({
+		*out_VectorTransform = 0;
+		*out_VectorTransform = new VectorTransform(
+			VectorTransform::fit_whitening(dim, output_dim, sample, num_vectors, epsilon, num_threads));
+	})
+}
+
+
+Error VectorTransform_delete(VectorTransform* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error VectorTransform_dims(const VectorTransform* self, Dim_t* out_input_dim, Dim_t* out_output_dim, int* out_is_diagonal)
+{
+	RETURN_ERROR({
+		*out_input_dim   = self->input_dim();
+		*out_output_dim  = self->output_dim();
+		*out_is_diagonal = self->is_diagonal() ? 1 : 0;
+	})
+}
+
+
+Error VectorTransform_params(const VectorTransform* self, VElem_t* out_offset, VElem_t* out_weights)
+{
+	RETURN_ERROR({
+		const size_t n = self->input_dim();
+		const size_t num_weights = self->is_diagonal() ? n : n * self->output_dim();
+		std::copy(self->offset(), self->offset() + n, out_offset);
+		std::copy(self->weights(), self->weights() + num_weights, out_weights);
+	})
+}
+
+
+Error VectorTransform_apply(const VectorTransform* self, const VElem_t* vectors, size_t num_vectors, size_t num_threads,
+                            VElem_t* out_vectors)
+{
+	RETURN_ERROR({
+		self->apply(vectors, num_vectors, out_vectors, num_threads);
+	})
+}
+
+
+Error ProbeProfile_new(const AStarNN* hasher, ProbeProfile** out_ProbeProfile)
+{
+	RETURN_ERROR({
+		*out_ProbeProfile = 0;
+		*out_ProbeProfile = new ProbeProfile(*hasher);
+	})
+}
+
+
+Error ProbeProfile_delete(ProbeProfile* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error ProbeProfile_num_orbits(const ProbeProfile* self, size_t* out_num_orbits)
+{
+	RETURN_ERROR({
+		*out_num_orbits = self->num_orbits();
+	})
+}
+
+
+Error ProbeProfile_record(ProbeProfile* self, const VElem_t* queries, size_t num_queries, const VElem_t* data,
+                          const size_t* neighbours, size_t k, size_t num_threads)
+{
+	RETURN_ERROR({
+		self->record(queries, num_queries, data, neighbours, k, num_threads);
+	})
+}
+
+
+Error ProbeProfile_counts(const ProbeProfile* self, uint64_t* out_num_queries, uint64_t* out_num_neighbours, uint64_t* out_num_found)
+{
+	RETURN_ERROR({
+		*out_num_queries    = self->num_queries();
+		*out_num_neighbours = self->num_neighbours();
+		*out_num_found      = self->num_found();
+	})
+}
+
+
+Error ProbeProfile_hits(const ProbeProfile* self, uint64_t* out_hits)
+{
+	RETURN_ERROR({
+		std::copy(self->hits().begin(), self->hits().end(), out_hits);
+	})
+}
+
+
+Error ProbeProfile_select_orbits(const ProbeProfile* self, double min_yield, size_t max_probes,
+                                 uint32_t* out_orbits, size_t* out_num_orbits)
+{
+	RETURN_ERROR({
+		*out_num_orbits = self->select_orbits(min_yield, max_probes, out_orbits);
+	})
+}
+
+
+Error ProbeProfile_clear(ProbeProfile* self)
+{
+	RETURN_ERROR({
+		self->clear();
+	})
+}
+
+
+Error ShardMap_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor, size_t num_shards, ShardMap** out_ShardMap)
+{
+	RETURN_ERROR({
+		*out_ShardMap = 0;
+		*out_ShardMap = new ShardMap(dim, packing_radius, num_shells, coarse_factor, num_shards);
+	})
+}
+
+
+Error ShardMap_delete(ShardMap* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error ShardMap_assign(const ShardMap* self, const VElem_t* vectors, size_t num_vectors, size_t* out_shards)
+{
+	RETURN_ERROR({
+		const Dim_t dim = self->hasher().dim();
+		for (size_t i = 0; i < num_vectors; ++i)
+		{
+			out_shards[i] = self->shard_of(vectors + i * dim);
+		}
+	})
+}
+
+
+Error ShardCoordinator_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor,
+                                  const char** socket_paths, size_t num_shards, ShardCoordinator_size_t** out_ShardCoordinator)
+{
+	RETURN_ERROR({
+		*out_ShardCoordinator = 0;
+		std::vector<std::string> paths(socket_paths, socket_paths + num_shards);
+		*out_ShardCoordinator = new ShardCoordinator_size_t(dim, packing_radius, num_shells, coarse_factor, paths);
+	})
+}
+
+
+Error ShardCoordinator_size_t_delete(ShardCoordinator_size_t* self)
+{
+	RETURN_ERROR({
+		delete self;
+	})
+}
+
+
+Error ShardCoordinator_size_t_knn(ShardCoordinator_size_t* self, const VElem_t* vectors, size_t num_vectors, uint32_t k, size_t* out_counts, size_t* out_total)
+{
+	RETURN_ERROR({
+		self->knn(vectors, num_vectors, k, self->m_counts, self->m_elems, self->m_distances);
+		std::copy(self->m_counts.begin(), self->m_counts.end(), out_counts);
+		*out_total = self->m_elems.size();
+	})
+}
+
+
+Error ShardCoordinator_size_t_results(const ShardCoordinator_size_t* self, size_t* out_elems, Distance_t* out_distances)
+{
+	RETURN_ERROR({
+		std::copy(self->m_elems.begin(), self->m_elems.end(), out_elems);
+		if (out_distances)
+		{
+			std::copy(self->m_distances.begin(), self->m_distances.end(), out_distances);
+		}
+	})
+}
+
+
+Error ShardCoordinator_size_t_num_shard_requests(const ShardCoordinator_size_t* self, size_t* out_requests)
+{
+	RETURN_ERROR({
+		*out_requests = self->num_shard_requests();
+	})
+}
+
 CElem_t TESTING_round_up(double x)
 {
 	return round_up<CElem_t>(x);
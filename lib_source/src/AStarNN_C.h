@@ -8,9 +8,26 @@
 #define ASTARNN_C__H
 
 #include "common.h"
+#include "Allocator.h"
 
 class AStarNN;
 class AStarIndex_size_t;
+class AStarBoundedIndex_size_t;
+class AStarVersionedIndex_size_t;
+class AStarIndexSnapshot_size_t;
+class ProbeCursor;
+class AStarPartitionedIndex_size_t;
+class AStarServer_size_t;
+class AStarClient;
+class SharedIndex;
+class ShardMap;
+class LatticeCodec;
+class SparseAStarNN;
+class E8NN;
+class E8Index_size_t;
+class VectorTransform;
+class ProbeProfile;
+class ShardCoordinator_size_t;
 
 #if _WIN32
 #define DLL __declspec(dllexport)
@@ -35,6 +52,9 @@ extern "C"
     DLL const char* AStar_error_string(Error err);
     DLL NumShells_t AStar_max_num_shells(void);
 
+    /* replace the malloc/free pair used for library allocations (null restores the defaults) */
+    DLL Error AStar_set_allocator(AStar_Malloc_t malloc_function, AStar_Free_t free_function);
+
     DLL Error AStar_rho(Dim_t dim, Distance_t* out_rho);
     DLL Error AStar_to_lattice_space(Dim_t dim, Distance_t scale, const VElem_t* in_v, VElem_t* out_v);
     DLL Error AStar_from_lattice_space(Dim_t dim, Distance_t scale, const VElem_t* in_v, VElem_t* out_v);
@@ -46,6 +66,7 @@ extern "C"
     /* AStarNN object methods */
 
     DLL Error AStarNN_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, AStarNN** out_AStarNN);
+    DLL Error AStarNN_new_transformed(const VectorTransform* transform, Distance_t packing_radius, NumShells_t num_shells, AStarNN** out_AStarNN);
     DLL Error AStarNN_delete(AStarNN* self);
     
 	DLL Error AStarNN_nearest_callback(const AStarNN* self, const VElem_t* vector, AStarNN_Callback_t callback);
@@ -55,6 +76,11 @@ extern "C"
 	DLL Error AStarNN_nearest_hash(const AStarNN* self, const VElem_t* vector, Hash_t* hashes);  // buff size >= 1
     DLL Error AStarNN_delaunay_hash(const AStarNN* self, const VElem_t* vector, Hash_t* hashes); // buff size >= dim + 1
     DLL Error AStarNN_extended_hash(const AStarNN* self, const VElem_t* vector, Hash_t* hashes); // buff size >= num_probes
+    DLL Error AStarNN_nearest_hash_margin(const AStarNN* self, const VElem_t* vector, Hash_t* out_hash, Distance_t* out_margin);
+    DLL Error AStarNN_nearest_hash_margins(const AStarNN* self, const VElem_t* vector, Hash_t* out_hash,
+                                           Distance_t* out_distance, Distance_t* out_cell_margin, Distance_t* out_delaunay_margin);
+    DLL Error AStarNN_extended_nearest_hash(const AStarNN* self, const VElem_t* vector, Hash_t* hashes, Hash_t* out_nearest); // buff size >= num_probes
+    DLL Error AStarNN_adaptive_hash(const AStarNN* self, const VElem_t* vector, Distance_t radius, Hash_t* hashes, size_t* out_count); // buff size >= num_probes
 
     DLL Error AStarNN_nearest_cvector(const AStarNN* self, const VElem_t* vector, CElem_t* cvectors);  // buff size >= 1 x dim + 1
     DLL Error AStarNN_delaunay_cvector(const AStarNN* self, const VElem_t* vector, CElem_t* cvectors); // buff size >= (dim + 1) x (dim + 1)
@@ -64,37 +90,278 @@ extern "C"
     DLL Error AStarNN_delaunay_probe(const AStarNN* self, const VElem_t* vector, Hash_t* hashes, CElem_t* cvectors);
     DLL Error AStarNN_extended_probe(const AStarNN* self, const VElem_t* vector, Hash_t* hashes, CElem_t* cvectors);
 
+    DLL Error AStarNN_to_lattice_space(const AStarNN* self, const VElem_t* vector, VElem_t* out_v); // buff size >= dim + 1, after any transform
+
 
     DLL Error AStarNN_dim(const AStarNN* self, Dim_t* out_dim);
+    DLL Error AStarNN_input_dim(const AStarNN* self, Dim_t* out_dim);
     DLL Error AStarNN_packing_radius(const AStarNN* self, Distance_t* out_packing_radius);
     DLL Error AStarNN_scale(const AStarNN* self, Distance_t* out_scale);
     DLL Error AStarNN_num_shells(const AStarNN* self, NumShells_t* out_num_shells);
     DLL Error AStarNN_num_probes(const AStarNN* self, size_t* out_num_probes);
+    DLL Error AStarNN_num_orbits(const AStarNN* self, size_t* out_num_orbits);
+    DLL Error AStarNN_orbits(const AStarNN* self, uint32_t* out_orbits); // buff size >= num_orbits
+    DLL Error AStarNN_set_orbits(AStarNN* self, const uint32_t* orbits, size_t num_orbits); // orbits[0] must be 0
 
 	/* AStarIndex_size_t object methods */
 
 	DLL Error AStarIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, AStarIndex_size_t** out_AStarIndex);
+	DLL Error AStarIndex_size_t_new_transformed(const VectorTransform* transform, Distance_t packing_radius, NumShells_t num_shells, AStarIndex_size_t** out_AStarIndex); // vectors of transform's input_dim
+	DLL Error AStarIndex_size_t_new_arena(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t arena_chunk_size, AStarIndex_size_t** out_AStarIndex); // storage released at once on delete
 	DLL Error AStarIndex_size_t_delete(AStarIndex_size_t* self);
 
     DLL Error AStarIndex_size_t_dim(const AStarIndex_size_t* self, Dim_t* out_dim);
+    DLL Error AStarIndex_size_t_input_dim(const AStarIndex_size_t* self, Dim_t* out_dim);
     DLL Error AStarIndex_size_t_packing_radius(const AStarIndex_size_t* self, Distance_t* out_packing_radius);
     DLL Error AStarIndex_size_t_scale(const AStarIndex_size_t* self, Distance_t* out_scale);
     DLL Error AStarIndex_size_t_num_shells(const AStarIndex_size_t* self, NumShells_t* out_num_shells);
     DLL Error AStarIndex_size_t_num_probes(const AStarIndex_size_t* self, size_t* out_num_probes);
+	DLL Error AStarIndex_size_t_num_orbits(const AStarIndex_size_t* self, size_t* out_num_orbits);
+	DLL Error AStarIndex_size_t_orbits(const AStarIndex_size_t* self, uint32_t* out_orbits); // buff size >= num_orbits
+	DLL Error AStarIndex_size_t_set_orbits(AStarIndex_size_t* self, const uint32_t* orbits, size_t num_orbits); // orbits[0] must be 0
 	DLL Error AStarIndex_size_t_num_hashes(AStarIndex_size_t* self, size_t* out_size);
 	DLL Error AStarIndex_size_t_num_elements(AStarIndex_size_t* self, size_t* out_size);
+	DLL Error AStarIndex_size_t_bytes_allocated(const AStarIndex_size_t* self, size_t* out_size);
+	DLL Error AStarIndex_size_t_bucket_size_histogram(const AStarIndex_size_t* self, size_t num_bins, size_t* out_histogram);
 
     DLL Error AStarIndex_size_t_clear(AStarIndex_size_t* self);
+    DLL Error AStarIndex_size_t_compact(AStarIndex_size_t* self, size_t* out_bytes_reclaimed);
+    DLL Error AStarIndex_size_t_compact_step(AStarIndex_size_t* self, size_t max_buckets, int* out_done, size_t* out_bytes_reclaimed);
     DLL Error AStarIndex_size_t_clear_by_vector(AStarIndex_size_t* self, const VElem_t* vector);
 
 	DLL Error AStarIndex_size_t_put(AStarIndex_size_t* self, const VElem_t* vector, size_t elem);
 	DLL Error AStarIndex_size_t_put_all(AStarIndex_size_t* self, const VElem_t* vector, size_t count, const size_t* elems);
 
+	/* moving vectors: the caller keeps each element's (hash, margin) state, see AStarIndex::update */
+	DLL Error AStarIndex_size_t_put_tracked(AStarIndex_size_t* self, const VElem_t* vector, size_t elem, Hash_t* out_hash, Distance_t* out_margin);
+	DLL Error AStarIndex_size_t_update(AStarIndex_size_t* self, size_t elem, const VElem_t* old_vector, const VElem_t* new_vector,
+	                                   Hash_t* inout_hash, Distance_t* inout_margin, int* out_moved);
+
 	DLL Error AStarIndex_size_t_count(const AStarIndex_size_t* self, const VElem_t* vector, size_t* out_count);
 
 	DLL Error AStarIndex_size_t_get_callback(const AStarIndex_size_t* self, const VElem_t* vector, AStarIndex_size_t_Callback_t callback);
 	DLL Error AStarIndex_size_t_get_elems(const AStarIndex_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems);
 
+	/* one decode for both the query and the insert (e.g. dedup): out_count is the number of elements found, of which the first max_size are kept */
+	DLL Error AStarIndex_size_t_get_elems_nearest(const AStarIndex_size_t* self, const VElem_t* vector, size_t max_size,
+	                                              size_t* out_count, size_t* out_elems, Hash_t* out_hash);
+	DLL Error AStarIndex_size_t_put_hash(AStarIndex_size_t* self, Hash_t hash_code, size_t elem);
+
+	/* adaptive probing: only as many probes as needed to find all elements within radius, see AStarIndex::get_adaptive */
+	DLL Error AStarIndex_size_t_count_adaptive(const AStarIndex_size_t* self, const VElem_t* vector, Distance_t radius, size_t* out_count);
+	DLL Error AStarIndex_size_t_get_elems_adaptive(const AStarIndex_size_t* self, const VElem_t* vector, Distance_t radius, size_t max_size,
+	                                               size_t* out_count, size_t* out_elems, size_t* out_num_probes);
+
+	/* batch operations, num_vectors vectors stored one after the other; width is the number of queries interleaved (0 for default); num_threads 0 uses all cores */
+	DLL Error AStarIndex_size_t_put_batch(AStarIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, const size_t* elems, size_t num_threads);
+	DLL Error AStarIndex_size_t_count_batch(const AStarIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, size_t width, size_t num_threads, size_t* out_counts); // out_counts size >= num_vectors
+	DLL Error AStarIndex_size_t_get_elems_batch(const AStarIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, size_t width, size_t num_threads, const size_t* offsets, size_t* out_elems); // query i elements go to out_elems[offsets[i] .. offsets[i + 1])
+
+	/* merging indexes of the same dim, packing radius and shells; num_threads 0 uses all cores */
+	DLL Error AStarIndex_size_t_merge(AStarIndex_size_t* self, const AStarIndex_size_t* other, size_t num_threads);
+	DLL Error AStarIndex_size_t_merge_all(AStarIndex_size_t* self, const AStarIndex_size_t* const* others, size_t num_others, size_t num_threads);
+
+	/* shared memory images (POSIX only), see SharedIndex */
+	DLL Error AStarIndex_size_t_publish_shared(const AStarIndex_size_t* self, const char* name, uint64_t* out_generation);
+	DLL Error AStarIndex_size_t_publish_shared_all(const AStarIndex_size_t* const* indexes, size_t num_indexes, const char* name, uint64_t* out_generation); // the merge of the indexes
+	DLL Error AStarIndex_size_t_to_memfd(const AStarIndex_size_t* self, int* out_fd); // Linux only
+
+
+	/* AStarBoundedIndex_size_t object methods */
+
+	DLL Error AStarBoundedIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t budget, AStarBoundedIndex_size_t** out_AStarBoundedIndex);
+	DLL Error AStarBoundedIndex_size_t_delete(AStarBoundedIndex_size_t* self);
+
+	DLL Error AStarBoundedIndex_size_t_num_hashes(const AStarBoundedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarBoundedIndex_size_t_num_elements(const AStarBoundedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarBoundedIndex_size_t_bytes_allocated(const AStarBoundedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarBoundedIndex_size_t_set_budget(AStarBoundedIndex_size_t* self, size_t budget);
+	DLL Error AStarBoundedIndex_size_t_counters(const AStarBoundedIndex_size_t* self, size_t* out_hits, size_t* out_misses, size_t* out_evictions, size_t* out_evicted_elements);
+
+	DLL Error AStarBoundedIndex_size_t_clear(AStarBoundedIndex_size_t* self);
+	DLL Error AStarBoundedIndex_size_t_put(AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t elem);
+	DLL Error AStarBoundedIndex_size_t_put_all(AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t count, const size_t* elems);
+
+	DLL Error AStarBoundedIndex_size_t_count(const AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t* out_count);
+	DLL Error AStarBoundedIndex_size_t_get_elems(const AStarBoundedIndex_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems);
+
+
+	/* AStarVersionedIndex_size_t object methods */
+
+	DLL Error AStarVersionedIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, AStarVersionedIndex_size_t** out_AStarVersionedIndex);
+	DLL Error AStarVersionedIndex_size_t_delete(AStarVersionedIndex_size_t* self);
+
+	DLL Error AStarVersionedIndex_size_t_num_hashes(const AStarVersionedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarVersionedIndex_size_t_num_elements(const AStarVersionedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarVersionedIndex_size_t_pages_copied(const AStarVersionedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarVersionedIndex_size_t_hashes_copied(const AStarVersionedIndex_size_t* self, size_t* out_size);
+
+	DLL Error AStarVersionedIndex_size_t_clear(AStarVersionedIndex_size_t* self);
+	DLL Error AStarVersionedIndex_size_t_clear_by_vector(AStarVersionedIndex_size_t* self, const VElem_t* vector);
+	DLL Error AStarVersionedIndex_size_t_put(AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t elem);
+	DLL Error AStarVersionedIndex_size_t_put_all(AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t count, const size_t* elems);
+
+	DLL Error AStarVersionedIndex_size_t_count(const AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t* out_count);
+	DLL Error AStarVersionedIndex_size_t_get_elems(const AStarVersionedIndex_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems);
+
+	DLL Error AStarVersionedIndex_size_t_snapshot(const AStarVersionedIndex_size_t* self, AStarIndexSnapshot_size_t** out_AStarIndexSnapshot);
+
+	/* AStarIndexSnapshot_size_t object methods */
+
+	DLL Error AStarIndexSnapshot_size_t_delete(AStarIndexSnapshot_size_t* self);
+	DLL Error AStarIndexSnapshot_size_t_num_hashes(const AStarIndexSnapshot_size_t* self, size_t* out_size);
+	DLL Error AStarIndexSnapshot_size_t_num_elements(const AStarIndexSnapshot_size_t* self, size_t* out_size);
+	DLL Error AStarIndexSnapshot_size_t_count(const AStarIndexSnapshot_size_t* self, const VElem_t* vector, size_t* out_count);
+	DLL Error AStarIndexSnapshot_size_t_get_elems(const AStarIndexSnapshot_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems);
+
+	/* AStarPartitionedIndex_size_t object methods */
+
+	DLL Error AStarPartitionedIndex_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t num_partitions, AStarPartitionedIndex_size_t** out_AStarPartitionedIndex);
+	DLL Error AStarPartitionedIndex_size_t_delete(AStarPartitionedIndex_size_t* self);
+
+	DLL Error AStarPartitionedIndex_size_t_num_partitions(const AStarPartitionedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarPartitionedIndex_size_t_num_hashes(const AStarPartitionedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarPartitionedIndex_size_t_num_elements(const AStarPartitionedIndex_size_t* self, size_t* out_size);
+	DLL Error AStarPartitionedIndex_size_t_clear(AStarPartitionedIndex_size_t* self);
+	DLL Error AStarPartitionedIndex_size_t_put(AStarPartitionedIndex_size_t* self, const VElem_t* vector, size_t elem);
+	DLL Error AStarPartitionedIndex_size_t_count(const AStarPartitionedIndex_size_t* self, const VElem_t* vector, size_t* out_count);
+	DLL Error AStarPartitionedIndex_size_t_get_elems(const AStarPartitionedIndex_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems);
+
+	/* pipelined ingest of num_vectors vectors (one after the other) with their elements;
+	   out_metrics (size >= 13) gets threads, items, busy_ns, wait_ns for each of the read, hash and insert stages, then elapsed_ns */
+	DLL Error AStarPartitionedIndex_size_t_ingest(AStarPartitionedIndex_size_t* self, const VElem_t* vectors, size_t num_vectors, const size_t* elems,
+	                                               size_t num_hash_workers, size_t num_inserters, size_t chunk_rows, uint64_t* out_metrics);
+
+	/* ProbeCursor object methods */
+
+	DLL Error ProbeCursor_new(const AStarNN* hasher, ProbeCursor** out_ProbeCursor);
+	DLL Error ProbeCursor_delete(ProbeCursor* self);
+	DLL Error ProbeCursor_start(ProbeCursor* self, const VElem_t* vector);
+	DLL Error ProbeCursor_next(ProbeCursor* self, size_t max_probes, Hash_t* hashes, CElem_t* cvectors, size_t* out_count); // cvectors may be null
+	DLL Error ProbeCursor_remaining(const ProbeCursor* self, size_t* out_remaining);
+
+	/* AStarServer_size_t object methods (POSIX only), serving an index of a copy of the vectors, where the element of vector i is elems[i] (i if elems is null) */
+
+	DLL Error AStarServer_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, const VElem_t* vectors, size_t num_vectors,
+	                                 const size_t* elems, size_t num_threads, AStarServer_size_t** out_AStarServer);
+	DLL Error AStarServer_size_t_delete(AStarServer_size_t* self);
+	DLL Error AStarServer_size_t_start(AStarServer_size_t* self, const char* socket_path, size_t max_batch); // max_batch 0 for default
+	DLL Error AStarServer_size_t_stop(AStarServer_size_t* self);
+	DLL Error AStarServer_size_t_counters(const AStarServer_size_t* self, size_t* out_requests, size_t* out_batches);
+	DLL Error AStarServer_size_t_prune_counters(const AStarServer_size_t* self, size_t* out_distances, size_t* out_pruned);
+	DLL Error AStarServer_size_t_requantize(AStarServer_size_t* self, Distance_t packing_radius, NumShells_t num_shells); // while serving
+	DLL Error AStarServer_size_t_num_hashes(const AStarServer_size_t* self, size_t* out_size);
+
+	/* AStarClient object methods (POSIX only); query results are kept by the client until taken by AStarClient_results */
+
+	DLL Error AStarClient_connect(const char* socket_path, AStarClient** out_AStarClient);
+	DLL Error AStarClient_close(AStarClient* self);
+	DLL Error AStarClient_info(const AStarClient* self, Dim_t* out_dim, size_t* out_num_probes, size_t* out_num_vectors);
+	DLL Error AStarClient_nearest_hash(AStarClient* self, const VElem_t* vectors, size_t num_vectors, Hash_t* hashes);  // buff size >= num_vectors
+	DLL Error AStarClient_extended_hash(AStarClient* self, const VElem_t* vectors, size_t num_vectors, Hash_t* hashes); // buff size >= num_vectors x num_probes
+	DLL Error AStarClient_candidates(AStarClient* self, const VElem_t* vectors, size_t num_vectors, size_t* out_counts, size_t* out_total);
+	DLL Error AStarClient_knn(AStarClient* self, const VElem_t* vectors, size_t num_vectors, uint32_t k, size_t* out_counts, size_t* out_total);
+	DLL Error AStarClient_results(const AStarClient* self, size_t* out_elems, Distance_t* out_distances); // buff sizes >= total; distances (k-NN only) may be null
+
+	/* SharedIndex object methods (POSIX only), a read-only index in shared memory */
+
+	DLL Error SharedIndex_attach(const char* name, SharedIndex** out_SharedIndex);
+	DLL Error SharedIndex_attach_fd(int fd, SharedIndex** out_SharedIndex);
+	DLL Error SharedIndex_unlink(const char* name);
+	DLL Error SharedIndex_delete(SharedIndex* self);
+
+	DLL Error SharedIndex_dim(const SharedIndex* self, Dim_t* out_dim);
+	DLL Error SharedIndex_generation(const SharedIndex* self, uint64_t* out_generation);
+	DLL Error SharedIndex_stale(const SharedIndex* self, int* out_stale);
+	DLL Error SharedIndex_refresh(SharedIndex* self, int* out_changed);
+	DLL Error SharedIndex_num_hashes(const SharedIndex* self, size_t* out_size);
+	DLL Error SharedIndex_num_elements(const SharedIndex* self, size_t* out_size);
+	DLL Error SharedIndex_count(const SharedIndex* self, const VElem_t* vector, size_t* out_count);
+	DLL Error SharedIndex_get_elems(const SharedIndex* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems);
+
+	/* LatticeCodec object methods, compressing vectors to bit-packed lattice c-vectors; base may be null; num_threads 0 uses all cores */
+
+	DLL Error LatticeCodec_new(Dim_t dim, Distance_t packing_radius, unsigned bits, const VElem_t* base, LatticeCodec** out_LatticeCodec);
+	DLL Error LatticeCodec_delete(LatticeCodec* self);
+	DLL Error LatticeCodec_code_size(const LatticeCodec* self, size_t* out_code_size);
+	DLL Error LatticeCodec_encode(const LatticeCodec* self, const VElem_t* vectors, size_t num_vectors, size_t num_threads, uint8_t* out_codes); // buff size >= num_vectors x code_size
+	DLL Error LatticeCodec_encode_stats(const LatticeCodec* self, const VElem_t* vectors, size_t num_vectors, size_t num_threads, uint8_t* out_codes,
+	                                    size_t* out_num_clipped, double* out_sum_squared_error, double* out_max_error);
+	DLL Error LatticeCodec_decode(const LatticeCodec* self, const uint8_t* codes, size_t num_vectors, size_t num_threads, VElem_t* out_vectors); // buff size >= num_vectors x dim
+
+	/* SparseAStarNN object methods, nearest lattice points of sparse vectors given by the (distinct) indices and values of their non-zeros */
+
+	DLL Error SparseAStarNN_new(Dim_t dim, Distance_t packing_radius, SparseAStarNN** out_SparseAStarNN);
+	DLL Error SparseAStarNN_delete(SparseAStarNN* self);
+	DLL Error SparseAStarNN_nearest_hash(const SparseAStarNN* self, size_t nnz, const Dim_t* indices, const VElem_t* values, Hash_t* out_hash);
+	DLL Error SparseAStarNN_nearest_cvector(const SparseAStarNN* self, size_t nnz, const Dim_t* indices, const VElem_t* values,
+	                                        CElem_t* out_c_nonzero, CElem_t* out_c_zero, CElem_t* out_c_last, K_t* out_k); // buff size >= nnz
+	DLL Error SparseAStarNN_nearest_hashes(const SparseAStarNN* self, size_t num_vectors, const size_t* offsets, const Dim_t* indices,
+	                                       const VElem_t* values, size_t num_threads, Hash_t* out_hashes); // offsets has num_vectors + 1 entries
+
+	/* E8NN object methods, hashing with the product lattice E8 x ... x E8 (dim a multiple of 8, num_shells neighbours per block, at most 240) */
+
+	DLL Error E8NN_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, E8NN** out_E8NN);
+	DLL Error E8NN_delete(E8NN* self);
+	DLL Error E8NN_num_probes(const E8NN* self, size_t* out_num_probes);
+	DLL Error E8NN_nearest_hash(const E8NN* self, const VElem_t* vector, Hash_t* out_hash);
+	DLL Error E8NN_nearest_point(const E8NN* self, const VElem_t* vector, CElem_t* out_doubled); // buff size >= dim, doubled coordinates
+	DLL Error E8NN_extended_hash(const E8NN* self, const VElem_t* vector, Hash_t* out_hashes); // buff size >= num_probes
+
+	/* E8Index_size_t object methods, an AStarIndex on the E8NN lattice */
+
+	DLL Error E8Index_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, E8Index_size_t** out_E8Index);
+	DLL Error E8Index_size_t_delete(E8Index_size_t* self);
+	DLL Error E8Index_size_t_num_probes(const E8Index_size_t* self, size_t* out_num_probes);
+	DLL Error E8Index_size_t_num_hashes(const E8Index_size_t* self, size_t* out_size);
+	DLL Error E8Index_size_t_bytes_allocated(const E8Index_size_t* self, size_t* out_size);
+	DLL Error E8Index_size_t_put(E8Index_size_t* self, const VElem_t* vector, size_t elem);
+	DLL Error E8Index_size_t_count(const E8Index_size_t* self, const VElem_t* vector, size_t* out_count);
+	DLL Error E8Index_size_t_get_elems(const E8Index_size_t* self, const VElem_t* vector, size_t max_size, size_t* out_count, size_t* out_elems);
+
+	/* VectorTransform object methods, diagonal (scale and offset) or PCA whitening transforms of vectors for AStarNN_new_transformed; offset and scale may be null */
+
+	DLL Error VectorTransform_new_diagonal(Dim_t dim, const VElem_t* offset, const VElem_t* scale, VectorTransform** out_VectorTransform);
+	DLL Error VectorTransform_new_whitening(Dim_t input_dim, Dim_t output_dim, const VElem_t* offset, const VElem_t* matrix,
+	                                       VectorTransform** out_VectorTransform); // matrix is output_dim x input_dim
+	DLL Error VectorTransform_fit_diagonal(Dim_t dim, const VElem_t* sample, size_t num_vectors, size_t num_threads,
+	                                       VectorTransform** out_VectorTransform);
+	DLL Error VectorTransform_fit_whitening(Dim_t dim, Dim_t output_dim, const VElem_t* sample, size_t num_vectors, double epsilon,
+	                                        size_t num_threads, VectorTransform** out_VectorTransform);
+	DLL Error VectorTransform_delete(VectorTransform* self);
+	DLL Error VectorTransform_dims(const VectorTransform* self, Dim_t* out_input_dim, Dim_t* out_output_dim, int* out_is_diagonal);
+	DLL Error VectorTransform_params(const VectorTransform* self, VElem_t* out_offset, VElem_t* out_weights); // buff sizes >= input_dim, and input_dim (diagonal) or output_dim x input_dim
+	DLL Error VectorTransform_apply(const VectorTransform* self, const VElem_t* vectors, size_t num_vectors, size_t num_threads,
+	                                VElem_t* out_vectors); // buff size >= num_vectors x output_dim
+
+	/* ProbeProfile object methods, counting the true neighbours found by each orbit of an AStarNN's extended probes, to prune them with AStarNN_set_orbits */
+
+	DLL Error ProbeProfile_new(const AStarNN* hasher, ProbeProfile** out_ProbeProfile);
+	DLL Error ProbeProfile_delete(ProbeProfile* self);
+	DLL Error ProbeProfile_num_orbits(const ProbeProfile* self, size_t* out_num_orbits);
+	DLL Error ProbeProfile_record(ProbeProfile* self, const VElem_t* queries, size_t num_queries, const VElem_t* data,
+	                              const size_t* neighbours, size_t k, size_t num_threads); // neighbours is num_queries x k indices of data
+	DLL Error ProbeProfile_counts(const ProbeProfile* self, uint64_t* out_num_queries, uint64_t* out_num_neighbours, uint64_t* out_num_found);
+	DLL Error ProbeProfile_hits(const ProbeProfile* self, uint64_t* out_hits); // buff size >= num_orbits
+	DLL Error ProbeProfile_select_orbits(const ProbeProfile* self, double min_yield, size_t max_probes,
+	                                     uint32_t* out_orbits, size_t* out_num_orbits); // buff size >= num_orbits
+	DLL Error ProbeProfile_clear(ProbeProfile* self);
+
+	/* ShardMap object methods, assigning vectors to shards by coarse lattice cell */
+	
+	DLL Error ShardMap_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor, size_t num_shards, ShardMap** out_ShardMap);
+	DLL Error ShardMap_delete(ShardMap* self);
+	DLL Error ShardMap_assign(const ShardMap* self, const VElem_t* vectors, size_t num_vectors, size_t* out_shards); // buff size >= num_vectors
+
+	/* ShardCoordinator_size_t object methods (POSIX only), k-NN over the AStarServer shards at socket_paths[i]; results are kept until taken by ShardCoordinator_size_t_results */
+	
+	DLL Error ShardCoordinator_size_t_new(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor,
+	                                      const char** socket_paths, size_t num_shards, ShardCoordinator_size_t** out_ShardCoordinator);
+	DLL Error ShardCoordinator_size_t_delete(ShardCoordinator_size_t* self);
+	DLL Error ShardCoordinator_size_t_knn(ShardCoordinator_size_t* self, const VElem_t* vectors, size_t num_vectors, uint32_t k, size_t* out_counts, size_t* out_total);
+	DLL Error ShardCoordinator_size_t_results(const ShardCoordinator_size_t* self, size_t* out_elems, Distance_t* out_distances); // buff sizes >= total
+	DLL Error ShardCoordinator_size_t_num_shard_requests(const ShardCoordinator_size_t* self, size_t* out_requests);
+
 
 	/* static testing methods - for whiltebox testing purposes only */
 	DLL CElem_t TESTING_round_up(double x);
@@ -0,0 +1,196 @@
+/*
+ * A vector index based on AStarNN hash codes, held as a number of
+ * independent partitions.
+ *
+ * Each hash code belongs to exactly one partition (chosen by mixing the
+ * bits of the hash code), and each partition is an AStarIndex. Different
+ * partitions may be modified concurrently by different threads, which is
+ * how IngestPipeline (see Ingest.h) inserts in parallel. Queries probe
+ * every partition that a probe hash code belongs to, so query results
+ * are the same as for a single AStarIndex.
+ *
+ * Thread safety: const methods may be called concurrently. put_partition
+ * may be called concurrently for different partitions. Other methods that
+ * modify the index require exclusive access.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef ASTARPARTITIONEDINDEX__H
+#define ASTARPARTITIONEDINDEX__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include "AStarIndex.h"
+#include <memory>
+#include <vector>
+
+
+template <typename T>
+class AStarPartitionedIndex
+{
+public:
+    typedef AStarIndex<T> Partition;
+
+    /// Create an AStarPartitionedIndex.
+    ///
+    /// \param[in]  dim             number of dimensions in the lattice quantisation space, n.
+    /// \param[in]  packing_radius  packing radius of the A* lattice.
+    /// \param[in]  num_shells      number of extended shells for extended probes.
+    /// \param[in]  num_partitions  number of partitions (at least 1).
+    ///
+    AStarPartitionedIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t num_partitions)
+        : m_hash(dim, packing_radius, num_shells)
+    {
+        if (num_partitions == 0)
+        {
+            throw Error_unknown;
+        }
+        m_partitions.reserve(num_partitions);
+        for (size_t i = 0; i < num_partitions; ++i)
+        {
+            m_partitions.push_back(std::unique_ptr<Partition>(new Partition(dim, packing_radius, num_shells)));
+        }
+    }
+
+    /// The partition that the given hash code belongs to.
+    inline size_t partition_of(Hash_t hash_code) const
+    {
+        const uint64_t mixed = (hash_code * 0x9E3779B97F4A7C15ull) >> 32;
+        return size_t((mixed * m_partitions.size()) >> 32);
+    }
+
+    /// Remove all elements (and hash codes) from the index.
+    void clear(void)
+    {
+        for (size_t i = 0; i < m_partitions.size(); ++i)
+        {
+            m_partitions[i]->clear();
+        }
+    }
+
+    /// Put the given element into the index, indexed by the given vector.
+    void put(const VElem_t* vector, const T& elem)
+    {
+        put_hash(hash(vector), elem);
+    }
+
+    /// Put the given element into the index, indexed by the given hash code.
+    void put_hash(Hash_t hash_code, const T& elem)
+    {
+        m_partitions[partition_of(hash_code)]->put_hash(hash_code, elem);
+    }
+
+    /// Put the given element into the given partition, which must be
+    /// partition_of(hash_code). This may be called concurrently for
+    /// different partitions.
+    void put_partition(size_t partition, Hash_t hash_code, const T& elem)
+    {
+        ASSERT(partition == partition_of(hash_code));
+        m_partitions[partition]->put_hash(hash_code, elem);
+    }
+
+    /// Call the given callback for each element found nearby to the
+    /// given vector, using extended A* lattice probing.
+    void get_extended(const VElem_t* vector, IndexCallback<T>* callback) const
+    {
+        m_hash.visit_extended(vector, [this, callback](Hash_t hash_code)
+        {
+            get_hash(hash_code, callback);
+        });
+    }
+
+    /// How many elements are nearby to the
+    /// given vector, using extended A* lattice probing.
+    size_t count_extended(const VElem_t* vector) const
+    {
+        size_t count = 0;
+        m_hash.visit_extended(vector, [this, &count](Hash_t hash_code)
+        {
+            count += count_hash(hash_code);
+        });
+        return count;
+    }
+
+    /// Call the given callback for each element stored with the
+    /// given hash code.
+    void get_hash(Hash_t hash_code, IndexCallback<T>* callback) const
+    {
+        m_partitions[partition_of(hash_code)]->get_hash(hash_code, callback);
+    }
+
+    /// How many elements stored with the given hash code.
+    size_t count_hash(Hash_t hash_code) const
+    {
+        return m_partitions[partition_of(hash_code)]->count_hash(hash_code);
+    }
+
+    /// Get the hash code for the given vector
+    inline Hash_t hash(const VElem_t* vector) const
+    {
+        return m_hash.nearest_hash(vector);
+    }
+
+    /// Get the AStarNN object used for hashing and probing.
+    inline const AStarNN& hasher(void) const
+    {
+        return m_hash;
+    }
+
+    /// Get the dimensionality of vectors processed by this index.
+    inline Dim_t dim(void) const
+    {
+        return m_hash.dim();
+    }
+
+    /// Number of probe points (hash codes) used by 'get' queries.
+    inline size_t num_probes(void) const
+    {
+        return m_hash.num_probes();
+    }
+
+    /// Get the number of partitions.
+    inline size_t num_partitions(void) const
+    {
+        return m_partitions.size();
+    }
+
+    /// Get a partition.
+    inline const Partition& partition(size_t i) const
+    {
+        return *m_partitions[i];
+    }
+
+    /// Get the number of distinct hash codes in the index.
+    size_t num_hashes(void) const
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < m_partitions.size(); ++i)
+        {
+            result += m_partitions[i]->num_hashes();
+        }
+        return result;
+    }
+
+    /// Get the number of elements in the index.
+    size_t num_elements(void) const
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < m_partitions.size(); ++i)
+        {
+            result += m_partitions[i]->num_elements();
+        }
+        return result;
+    }
+
+private:
+    // Copy and assignment not implemented
+    AStarPartitionedIndex(const AStarPartitionedIndex& obj);
+    AStarPartitionedIndex& operator=(const AStarPartitionedIndex& obj);
+
+    AStarNN                                 m_hash;
+    std::vector<std::unique_ptr<Partition> > m_partitions;
+};
+
+
+#endif // ASTARPARTITIONEDINDEX__H
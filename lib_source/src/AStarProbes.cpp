@@ -10,6 +10,7 @@
 #include "PointSet.h"
 #include "CostSet.h"
 #include "PriorityQueue.h"
+#include <algorithm>
 #include <stdlib.h>
 #include <math.h>
 
@@ -503,7 +504,26 @@ Order_t* AStarProbes::generate_probe_diffs
 
     // A buffer used in the following loop.
     // A place to temporarily stack up positive increment column numbers.
-    Order_t*            temp_cols = new Order_t[dimp + MAX_NUM_SHELLS];
+    // Adjacent probes of the same or adjacent shells need at most
+    // dimp + MAX_NUM_SHELLS, but the orbits may be in any order (see
+    // AStarNN::set_orbits), so the size is the largest actually needed.
+    size_t max_cols = dimp + MAX_NUM_SHELLS;
+    for (size_t i = 1; i < num_probes; i++)
+    {
+        const CElem_t* probeC_s = probes + flipIdx(i - 1, dimp, dimp2) * dimp;
+        const CElem_t* probeC_t = probes + flipIdx(i, dimp, dimp2) * dimp;
+
+        size_t num_cols = 0;
+        for (Dim_t d = 0; d < dimp; ++d)
+        {
+            if (probeC_t[d] > probeC_s[d])
+            {
+                num_cols += probeC_t[d] - probeC_s[d];
+            }
+        }
+        max_cols = std::max(max_cols, num_cols);
+    }
+    Order_t*            temp_cols = new Order_t[max_cols];
 	Deleter<Order_t[]>	delete_temp_cols(temp_cols);
 
     // Loop over probes, generating a stream of instructions for differences
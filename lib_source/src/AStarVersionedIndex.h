@@ -0,0 +1,598 @@
+/*
+ * A vector index based on AStarNN hash codes that supports cheap,
+ * consistent read-only snapshots.
+ *
+ * The hash table is split into pages (by hash code). Pages are shared
+ * between the index and its snapshots, and a page is copied only when the
+ * index modifies a page that a snapshot still holds (copy-on-write). Taking
+ * a snapshot copies the page table only, and the memory held on behalf of
+ * a snapshot is proportional to the number of pages modified since.
+ *
+ * The page table grows with the index (extendible hashing): a page that
+ * gets more than MAX_PAGE_HASHES hash codes is split in two, doubling the
+ * page table if need be. So a modification copies a bounded number of hash
+ * codes, however large the index, while the page table (copied by each
+ * snapshot) has an entry per few tens of hash codes. Pages are not merged
+ * as hash codes are removed.
+ *
+ * Thread safety: the index itself is single writer; snapshot() and all
+ * modifying methods must be called from the writer. A snapshot never
+ * changes, so it may be queried from any number of threads without locks,
+ * while the index is being modified, and it stays valid after the index
+ * is destroyed.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef ASTARVERSIONEDINDEX__H
+#define ASTARVERSIONEDINDEX__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include "AStarIndex.h"
+#include "SmallBucket.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+
+template <typename T> class AStarVersionedIndex;
+
+
+///
+/// Storage shared between AStarVersionedIndex and AStarIndexSnapshot.
+///
+template <typename T>
+struct VersionedPages
+{
+    typedef SmallBucket<T>                      List;
+    typedef std::unordered_map<Hash_t, List>    Map;
+
+    /// The hash codes whose top 'bits' (mixed) bits are those of the page's
+    /// entries in the page table: 2^(page_bits - bits) adjacent entries of a
+    /// table of 2^page_bits entries. A null entry is an empty page.
+    struct Page
+    {
+        explicit Page(unsigned page_bits)
+            : bits(page_bits)
+        {}
+
+        unsigned    bits;
+        Map         map;
+    };
+
+    /// The page holding the given hash code.
+    /// Hash codes are mixed (Fibonacci hashing) before taking the top bits,
+    /// as neighbouring lattice points have highly regular hash codes.
+    static inline size_t page_of(Hash_t hash_code, unsigned page_bits)
+    {
+        return size_t((hash_code * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - page_bits));
+    }
+
+    /// Find the list for a hash code, or 0.
+    template <typename PagePtr>
+    static inline const List* find(const std::vector<PagePtr>& pages, unsigned page_bits, Hash_t hash_code)
+    {
+        const PagePtr& page(pages[page_of(hash_code, page_bits)]);
+        if (page)
+        {
+            auto found = page->map.find(hash_code);
+            if (found != page->map.end())
+            {
+                return &found->second;
+            }
+        }
+        return 0;
+    }
+
+    /// Call callback->match for each element nearby the given vector.
+    template <typename PagePtr>
+    static void get_extended
+    (
+        const AStarNN&              hasher,
+        const std::vector<PagePtr>& pages,
+        unsigned                    page_bits,
+        const VElem_t*              vector,
+        IndexCallback<T>*           callback
+    )
+    {
+        hasher.visit_extended(vector, [&pages, page_bits, callback](Hash_t hash_code)
+        {
+            const List* list = find(pages, page_bits, hash_code);
+            if (list)
+            {
+                auto end = list->end();
+                for (auto it(list->begin()); it != end; ++it)
+                {
+                    callback->match(hash_code, *it);
+                }
+            }
+        });
+    }
+
+    /// Count the elements nearby the given vector.
+    template <typename PagePtr>
+    static size_t count_extended
+    (
+        const AStarNN&              hasher,
+        const std::vector<PagePtr>& pages,
+        unsigned                    page_bits,
+        const VElem_t*              vector
+    )
+    {
+        size_t count = 0;
+        hasher.visit_extended(vector, [&pages, page_bits, &count](Hash_t hash_code)
+        {
+            const List* list = find(pages, page_bits, hash_code);
+            if (list)
+            {
+                count += list->size();
+            }
+        });
+        return count;
+    }
+};
+
+
+///
+/// A read-only, unchanging view of an AStarVersionedIndex.
+/// Snapshots are cheap to copy.
+///
+template <typename T>
+class AStarIndexSnapshot
+{
+public:
+    /// Call the given callback for each element found nearby to the
+    /// given vector, using extended A* lattice probing.
+    void get_extended(const VElem_t* vector, IndexCallback<T>* callback) const
+    {
+        Pages::get_extended(*m_hash, m_version->pages, m_version->page_bits, vector, callback);
+    }
+
+    /// How many elements are nearby to the
+    /// given vector, using extended A* lattice probing.
+    size_t count_extended(const VElem_t* vector) const
+    {
+        return Pages::count_extended(*m_hash, m_version->pages, m_version->page_bits, vector);
+    }
+
+    /// Call the given callback for each element stored with the
+    /// given hash code.
+    void get_hash(Hash_t hash_code, IndexCallback<T>* callback) const
+    {
+        const List* list = Pages::find(m_version->pages, m_version->page_bits, hash_code);
+        if (list)
+        {
+            auto end = list->end();
+            for (auto it(list->begin()); it != end; ++it)
+            {
+                callback->match(hash_code, *it);
+            }
+        }
+    }
+
+    /// How many elements stored with the given hash code.
+    size_t count_hash(Hash_t hash_code) const
+    {
+        const List* list = Pages::find(m_version->pages, m_version->page_bits, hash_code);
+        return list ? list->size() : 0;
+    }
+
+    /// Get the hash code for the given vector
+    inline Hash_t hash(const VElem_t* vector) const
+    {
+        return m_hash->nearest_hash(vector);
+    }
+
+    /// Number of probe points (hash codes) used by 'get' queries.
+    inline size_t num_probes(void) const
+    {
+        return m_hash->num_probes();
+    }
+
+    /// Get the number of distinct hash codes in the snapshot.
+    inline size_t num_hashes() const
+    {
+        return m_version->num_hashes;
+    }
+
+    /// Get the number of elements in the snapshot.
+    inline size_t num_elements() const
+    {
+        return m_version->num_elements;
+    }
+
+private:
+    friend class AStarVersionedIndex<T>;
+
+    typedef VersionedPages<T>           Pages;
+    typedef typename Pages::List        List;
+    typedef typename Pages::Page        Page;
+
+    struct Version
+    {
+        std::vector<std::shared_ptr<const Page> >   pages;
+        unsigned                                    page_bits;
+        size_t                                      num_hashes;
+        size_t                                      num_elements;
+    };
+
+    AStarIndexSnapshot(const std::shared_ptr<const AStarNN>& hash, const std::shared_ptr<const Version>& version)
+        : m_hash(hash)
+        , m_version(version)
+    {}
+
+    std::shared_ptr<const AStarNN>  m_hash;
+    std::shared_ptr<const Version>  m_version;
+};
+
+
+template <typename T>
+class AStarVersionedIndex
+{
+public:
+    typedef AStarIndexSnapshot<T> Snapshot;
+
+    /// The default initial number of pages is 2^DEFAULT_PAGE_BITS.
+    static const unsigned DEFAULT_PAGE_BITS = 10;
+
+    /// A page with more hash codes is split (see the notes above).
+    static const size_t MAX_PAGE_HASHES = 64;
+
+    /// The page table has at most 2^MAX_PAGE_BITS entries; beyond that,
+    /// pages are not split.
+    static const unsigned MAX_PAGE_BITS = 24;
+
+    /// Create an AStarVersionedIndex.
+    ///
+    /// \param[in]  dim             number of dimensions in the lattice quantisation space, n.
+    /// \param[in]  packing_radius  packing radius of the A* lattice.
+    /// \param[in]  num_shells      number of extended shells for extended probes.
+    /// \param[in]  page_bits       the hash table is initially split into 2^page_bits pages (1 to MAX_PAGE_BITS).
+    ///
+    AStarVersionedIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, unsigned page_bits = DEFAULT_PAGE_BITS);
+    ~AStarVersionedIndex(void);
+
+    /// Get a read-only view of the index as it is now.
+    Snapshot snapshot(void) const;
+
+    /// Remove all elements (and hash codes) from the index.
+    void clear(void);
+
+    /// Put the given element into the index, indexed by the given vector.
+    void put(const VElem_t* vector, const T& elem);
+
+    /// Put the given elements into the index, indexed by the given vector.
+    void put(const VElem_t* vector, size_t num_elements, const T* elems);
+
+    /// Put the given element into the index, indexed by the given hash code.
+    void put_hash(Hash_t hash_code, const T& elem);
+
+    /// Put the given elements into the index, indexed by the given hash code.
+    void put_hash(Hash_t hash_code, size_t num_elements, const T* elems);
+
+    /// Call the given callback for each element found nearby to the
+    /// given vector, using extended A* lattice probing.
+    void get_extended(const VElem_t* vector, IndexCallback<T>* callback) const
+    {
+        Pages::get_extended(*m_hash, m_pages, m_page_bits, vector, callback);
+    }
+
+    /// How many elements are nearby to the
+    /// given vector, using extended A* lattice probing.
+    size_t count_extended(const VElem_t* vector) const
+    {
+        return Pages::count_extended(*m_hash, m_pages, m_page_bits, vector);
+    }
+
+    /// How many elements stored with the given hash code.
+    size_t count_hash(Hash_t hash_code) const
+    {
+        const List* list = Pages::find(m_pages, m_page_bits, hash_code);
+        return list ? list->size() : 0;
+    }
+
+    /// Remove all element associated with the hash code of the given vector.
+    void clear(const VElem_t* vector);
+
+    /// Remove all element associated with the given hash code.
+    void clear_hash(Hash_t hash_code);
+
+    /// Get the hash code for the given vector
+    inline Hash_t hash(const VElem_t* vector) const
+    {
+        return m_hash->nearest_hash(vector);
+    }
+
+    /// Get the dimensionality of vectors processed by this index.
+    inline Dim_t dim(void) const
+    {
+        return m_hash->dim();
+    }
+
+    /// Number of probe points (hash codes) used by 'get' queries.
+    inline size_t num_probes(void) const
+    {
+        return m_hash->num_probes();
+    }
+
+    /// Get the number of distinct hash codes in the index.
+    inline size_t num_hashes() const
+    {
+        return m_num_hashes;
+    }
+
+    /// Get the number of elements in the index.
+    inline size_t num_elements() const
+    {
+        return m_num_elements;
+    }
+
+    /// Number of pages copied because a snapshot was sharing them.
+    inline size_t pages_copied() const
+    {
+        return m_pages_copied;
+    }
+
+    /// Number of hash codes (and their lists) in the pages copied.
+    inline size_t hashes_copied() const
+    {
+        return m_hashes_copied;
+    }
+
+    /// The page table has 2^page_bits() entries.
+    inline unsigned page_bits() const
+    {
+        return m_page_bits;
+    }
+
+private:
+    // Copy and assignment not implemented
+    AStarVersionedIndex(const AStarVersionedIndex& obj);
+    AStarVersionedIndex& operator=(const AStarVersionedIndex& obj);
+
+    typedef VersionedPages<T>           Pages;
+    typedef typename Pages::List        List;
+    typedef typename Pages::Map         Map;
+    typedef typename Pages::Page        Page;
+
+    /// Get the page for the given hash code ready for writing,
+    /// creating or copying it as needed.
+    Page& _writable_page(Hash_t hash_code);
+
+    /// Split the page of the given hash code (and then its halves) while
+    /// it has more than MAX_PAGE_HASHES hash codes.
+    void _split(Hash_t hash_code);
+
+    /// The number of page table entries of a page.
+    inline size_t _num_entries(const Page& page) const
+    {
+        return size_t(1) << (m_page_bits - page.bits);
+    }
+
+    std::shared_ptr<const AStarNN>          m_hash;
+    unsigned                                m_page_bits;
+    std::vector<std::shared_ptr<Page> >     m_pages;
+    size_t                                  m_num_hashes;
+    size_t                                  m_num_elements;
+    size_t                                  m_pages_copied;
+    size_t                                  m_hashes_copied;
+};
+
+
+//  Implementation
+
+template <typename T>
+AStarVersionedIndex<T>::AStarVersionedIndex(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, unsigned page_bits)
+    : m_hash(std::make_shared<AStarNN>(dim, packing_radius, num_shells))
+    , m_page_bits(page_bits)
+    , m_num_hashes(0)
+    , m_num_elements(0)
+    , m_pages_copied(0)
+    , m_hashes_copied(0)
+{
+    if (page_bits < 1 || page_bits > MAX_PAGE_BITS)
+    {
+        throw Error_unknown;
+    }
+    m_pages.resize(size_t(1) << page_bits);
+}
+
+
+template <typename T>
+AStarVersionedIndex<T>::~AStarVersionedIndex(void)
+{}
+
+
+template <typename T>
+typename AStarVersionedIndex<T>::Snapshot AStarVersionedIndex<T>::snapshot(void) const
+{
+    typedef typename Snapshot::Version Version;
+
+    std::shared_ptr<Version> version(std::make_shared<Version>());
+    version->pages.assign(m_pages.begin(), m_pages.end());
+    version->page_bits    = m_page_bits;
+    version->num_hashes   = m_num_hashes;
+    version->num_elements = m_num_elements;
+
+    return Snapshot(m_hash, version);
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::clear(void)
+{
+    // Pages shared with snapshots are kept alive by the snapshots.
+    const size_t num_pages = m_pages.size();
+    m_pages.clear();
+    m_pages.resize(num_pages);
+    m_num_hashes   = 0;
+    m_num_elements = 0;
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::put(const VElem_t* vector, const T& elem)
+{
+    put_hash(hash(vector), 1, &elem);
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::put(const VElem_t* vector, size_t num_elements, const T* elems)
+{
+    put_hash(hash(vector), num_elements, elems);
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::put_hash(Hash_t hash_code, const T& elem)
+{
+    put_hash(hash_code, 1, &elem);
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::put_hash(Hash_t hash_code, size_t num_elements, const T* elems)
+{
+    if (num_elements > 0)
+    {
+        Page& page(_writable_page(hash_code));
+        auto found = page.map.find(hash_code);
+        if (found == page.map.end())
+        {
+            found = page.map.emplace(hash_code, List()).first;
+            m_num_hashes += 1;
+        }
+        found->second.append(elems, num_elements);
+        m_num_elements += num_elements;
+
+        if (page.map.size() > MAX_PAGE_HASHES)
+        {
+            _split(hash_code);
+        }
+    }
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::clear(const VElem_t* vector)
+{
+    clear_hash(hash(vector));
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::clear_hash(Hash_t hash_code)
+{
+    if (!Pages::find(m_pages, m_page_bits, hash_code))
+    {
+        // Nothing to do, and no need to copy the page.
+        return;
+    }
+    Page& page(_writable_page(hash_code));
+    auto found = page.map.find(hash_code);
+    m_num_elements -= found->second.size();
+    m_num_hashes   -= 1;
+    page.map.erase(found);
+}
+
+
+template <typename T>
+typename AStarVersionedIndex<T>::Page& AStarVersionedIndex<T>::_writable_page(Hash_t hash_code)
+{
+    const size_t entry = Pages::page_of(hash_code, m_page_bits);
+    std::shared_ptr<Page>& page(m_pages[entry]);
+    if (!page)
+    {
+        page = std::make_shared<Page>(m_page_bits);
+    }
+    else if (size_t(page.use_count()) > _num_entries(*page))
+    {
+        // A snapshot holds this page: write to a private copy, in all of
+        // the page's entries.
+        std::shared_ptr<Page> copy(std::make_shared<Page>(*page));
+        m_pages_copied  += 1;
+        m_hashes_copied += copy->map.size();
+
+        const size_t num_entries = _num_entries(*copy);
+        const size_t first       = entry & ~(num_entries - 1);
+        std::fill(m_pages.begin() + first, m_pages.begin() + first + num_entries, copy);
+    }
+    else
+    {
+        // Only we hold this page. Synchronise with any reader that
+        // released its snapshot, before writing.
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *m_pages[entry];
+}
+
+
+template <typename T>
+void AStarVersionedIndex<T>::_split(Hash_t hash_code)
+{
+    for (;;)
+    {
+        std::shared_ptr<Page> page(m_pages[Pages::page_of(hash_code, m_page_bits)]);
+        if (page->map.size() <= MAX_PAGE_HASHES)
+        {
+            return;
+        }
+
+        if (page->bits == m_page_bits)
+        {
+            if (m_page_bits == MAX_PAGE_BITS)
+            {
+                return;
+            }
+
+            // Double the page table: entry i becomes entries 2i and 2i + 1.
+            std::vector<std::shared_ptr<Page> > pages(2 * m_pages.size());
+            for (size_t i = 0; i < pages.size(); ++i)
+            {
+                pages[i] = m_pages[i >> 1];
+            }
+            m_pages.swap(pages);
+            m_page_bits += 1;
+        }
+
+        // Split the hash codes by their next bit, and the page's entries
+        // in halves. The lists are moved, unless a snapshot holds the page
+        // (beyond its entries and 'page').
+        const unsigned bits        = page->bits + 1;
+        const size_t   num_entries = _num_entries(*page);
+        const size_t   first       = Pages::page_of(hash_code, m_page_bits) & ~(num_entries - 1);
+        const bool     shared      = size_t(page.use_count()) > num_entries + 1;
+
+        std::shared_ptr<Page> halves[2] = {std::make_shared<Page>(bits), std::make_shared<Page>(bits)};
+        for (auto it(page->map.begin()); it != page->map.end(); ++it)
+        {
+            Map& half = halves[Pages::page_of(it->first, bits) & 1]->map;
+            if (shared)
+            {
+                half.emplace(it->first, it->second);
+            }
+            else
+            {
+                half.emplace(it->first, std::move(it->second));
+            }
+        }
+
+        for (size_t i = 0; i < 2; ++i)
+        {
+            if (halves[i]->map.empty())
+            {
+                halves[i].reset();
+            }
+            auto begin = m_pages.begin() + first + i * num_entries / 2;
+            std::fill(begin, begin + num_entries / 2, halves[i]);
+        }
+    }
+}
+
+
+
+#endif // ASTARVERSIONEDINDEX__H
@@ -0,0 +1,114 @@
+/*
+ * Memory allocation hooks and allocator policies.
+ *
+ * Author: Barry Drake
+ */
+
+#include "Allocator.h"
+#include <stdlib.h>
+
+
+AStar_Malloc_t Memory::s_malloc = ::malloc;
+AStar_Free_t   Memory::s_free   = ::free;
+
+
+void* Memory::alloc(size_t size)
+{
+    void* result = s_malloc(size > 0 ? size : 1);
+    if (!result)
+    {
+        throw Error_mem_fail;
+    }
+    return result;
+}
+
+
+void Memory::free(void* ptr)
+{
+    if (ptr)
+    {
+        s_free(ptr);
+    }
+}
+
+
+void Memory::set_functions(AStar_Malloc_t malloc_function, AStar_Free_t free_function)
+{
+    if (malloc_function && free_function)
+    {
+        s_malloc = malloc_function;
+        s_free   = free_function;
+    }
+    else
+    {
+        s_malloc = ::malloc;
+        s_free   = ::free;
+    }
+}
+
+
+Arena::Arena(size_t chunk_size)
+    : m_chunk_size(chunk_size)
+    , m_chunks(0)
+    , m_cur(0)
+    , m_end(0)
+    , m_used(0)
+    , m_reserved(0)
+{
+    if (chunk_size <= sizeof(Chunk))
+    {
+        throw Error_unknown;
+    }
+}
+
+
+Arena::~Arena(void)
+{
+    release();
+}
+
+
+void* Arena::allocate(size_t size, size_t align)
+{
+    size_t address = reinterpret_cast<size_t>(m_cur);
+    size_t aligned = (address + align - 1) & ~(align - 1);
+
+    if (!m_cur || aligned + size > reinterpret_cast<size_t>(m_end))
+    {
+        // Start a new chunk, big enough for this block if need be.
+        size_t chunk_size = sizeof(Chunk) + size + align;
+        if (chunk_size < m_chunk_size)
+        {
+            chunk_size = m_chunk_size;
+        }
+
+        Chunk* chunk = static_cast<Chunk*>(Memory::alloc(chunk_size));
+        chunk->next = m_chunks;
+        m_chunks    = chunk;
+        m_cur       = reinterpret_cast<char*>(chunk + 1);
+        m_end       = reinterpret_cast<char*>(chunk) + chunk_size;
+        m_reserved += chunk_size;
+
+        address = reinterpret_cast<size_t>(m_cur);
+        aligned = (address + align - 1) & ~(align - 1);
+    }
+
+    m_cur   = reinterpret_cast<char*>(aligned + size);
+    m_used += size;
+    return reinterpret_cast<void*>(aligned);
+}
+
+
+void Arena::release(void)
+{
+    while (m_chunks)
+    {
+        Chunk* next = m_chunks->next;
+        Memory::free(m_chunks);
+        m_chunks = next;
+    }
+    m_cur      = 0;
+    m_end      = 0;
+    m_used     = 0;
+    m_reserved = 0;
+}
@@ -0,0 +1,306 @@
+/*
+ * Memory allocation hooks and allocator policies.
+ *
+ * All library allocations that live beyond a single call, or that are made
+ * on every query, go through Memory::alloc and Memory::free. A host
+ * application may replace the underlying malloc/free pair (see the C API
+ * function AStar_set_allocator).
+ *
+ * The allocator classes below are standard (C++11) allocators that may be
+ * given as the 'Alloc' template parameter of AStarIndex.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef ALLOCATOR__H
+#define ALLOCATOR__H
+
+#include "common.h"
+#include <atomic>
+#include <cstddef>
+
+
+/// Type of a replacement malloc function.
+typedef void* (*AStar_Malloc_t)(size_t size);
+
+/// Type of a replacement free function.
+typedef void  (*AStar_Free_t)(void* ptr);
+
+
+///
+/// This is just a name space for the library memory hooks.
+///
+class Memory
+{
+public:
+
+    ///
+    /// Allocate the given number of bytes using the current malloc hook.
+    /// Throws Error_mem_fail if the memory cannot be allocated.
+    ///
+    static void* alloc(size_t size);
+
+    ///
+    /// Release memory previously returned by 'alloc'.
+    /// A null pointer is ignored.
+    ///
+    static void free(void* ptr);
+
+    ///
+    /// Allocate an array of num_elements uninitialised elements of type T.
+    /// Only use this for plain data types.
+    ///
+    template<typename T>
+    static inline T* alloc_array(size_t num_elements)
+    {
+        return static_cast<T*>(alloc(sizeof(T) * num_elements));
+    }
+
+    ///
+    /// Replace the malloc/free pair used by the library.
+    /// Passing null for either function restores the standard library pair.
+    ///
+    /// This should be called before any library objects are created, as
+    /// memory is always released with the free function current at the time.
+    ///
+    static void set_functions(AStar_Malloc_t malloc_function, AStar_Free_t free_function);
+
+private:
+    // constructor not implemented
+    Memory(void);
+    ~Memory(void);
+
+    static AStar_Malloc_t s_malloc;
+    static AStar_Free_t   s_free;
+};
+
+
+///
+/// Calls Memory::free on a pointer when the MemoryFreer goes out of scope.
+/// This is the Memory::alloc counterpart of Deleter<T[]>.
+///
+template<class T>
+class MemoryFreer
+{
+public:
+    MemoryFreer(T*& ptr)
+        : m_Ptr(ptr)
+    {}
+
+    ~MemoryFreer(void)
+    {
+        Memory::free(m_Ptr);
+        m_Ptr = 0;
+    }
+private:
+    // Copy and assignment constructors not implemented
+    MemoryFreer (const MemoryFreer &obj);
+    MemoryFreer& operator = (const MemoryFreer &obj);
+
+    T*& m_Ptr;
+};
+
+
+///
+/// A bump-pointer memory arena. Memory is taken from large chunks
+/// (obtained via Memory::alloc) and individual blocks are never released.
+/// All memory of the arena is returned at once by 'release' (or when the
+/// arena is destroyed).
+///
+/// An arena must outlive every container that allocates from it, and must
+/// not be released while they use its blocks. An arena is not thread safe.
+///
+class Arena
+{
+public:
+    Arena(size_t chunk_size = 1024 * 1024);
+    ~Arena(void);
+
+    /// Allocate size bytes, aligned to 'align' (a power of two).
+    void* allocate(size_t size, size_t align);
+
+    /// Return all chunks, invalidating every block ever allocated.
+    void release(void);
+
+    /// Number of bytes handed out since construction or the last release.
+    inline size_t bytes_used(void) const
+    {
+        return m_used;
+    }
+
+    /// Number of bytes obtained from Memory::alloc.
+    inline size_t bytes_reserved(void) const
+    {
+        return m_reserved;
+    }
+
+private:
+    // Copy and assignment not implemented
+    Arena(const Arena& obj);
+    Arena& operator=(const Arena& obj);
+
+    struct Chunk
+    {
+        Chunk* next;
+    };
+
+    const size_t m_chunk_size;
+    Chunk*       m_chunks;
+    char*        m_cur;
+    char*        m_end;
+    size_t       m_used;
+    size_t       m_reserved;
+};
+
+
+///
+/// Running totals of memory used through a CountingAllocator.
+/// The totals are atomic, so allocators sharing them (such as those of
+/// indexes built in different threads) may be used concurrently.
+///
+struct AllocStats
+{
+    AllocStats(void)
+        : bytes(0)
+        , allocations(0)
+    {}
+
+    /// Number of bytes currently allocated.
+    std::atomic<size_t> bytes;
+
+    /// Number of blocks currently allocated.
+    std::atomic<size_t> allocations;
+};
+
+
+///
+/// A standard allocator that allocates via Memory::alloc and keeps
+/// a byte count in an AllocStats object. All copies (and rebound copies)
+/// of an allocator share the same AllocStats, so giving each index its
+/// own AllocStats provides per-index accounting.
+///
+/// If an arena is given, blocks are taken from it instead, and are only
+/// counted out by deallocate: their memory is returned when the arena is
+/// released (see ArenaAllocator).
+///
+template<typename T>
+class CountingAllocator
+{
+public:
+    typedef T value_type;
+
+    CountingAllocator(AllocStats* stats = 0, Arena* arena = 0)
+        : m_stats(stats)
+        , m_arena(arena)
+    {}
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>& other)
+        : m_stats(other.stats())
+        , m_arena(other.arena())
+    {}
+
+    T* allocate(size_t n)
+    {
+        T* result = m_arena
+            ? static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)))
+            : Memory::alloc_array<T>(n);
+        if (m_stats)
+        {
+            m_stats->bytes += n * sizeof(T);
+            m_stats->allocations += 1;
+        }
+        return result;
+    }
+
+    void deallocate(T* ptr, size_t n)
+    {
+        if (!m_arena)
+        {
+            Memory::free(ptr);
+        }
+        if (m_stats)
+        {
+            m_stats->bytes -= n * sizeof(T);
+            m_stats->allocations -= 1;
+        }
+    }
+
+    inline AllocStats* stats(void) const
+    {
+        return m_stats;
+    }
+
+    inline Arena* arena(void) const
+    {
+        return m_arena;
+    }
+
+private:
+    AllocStats* m_stats;
+    Arena*      m_arena;
+};
+
+template<typename T, typename U>
+inline bool operator==(const CountingAllocator<T>& a, const CountingAllocator<U>& b)
+{
+    return a.stats() == b.stats() && a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+inline bool operator!=(const CountingAllocator<T>& a, const CountingAllocator<U>& b)
+{
+    return !(a == b);
+}
+
+
+///
+/// A standard allocator that takes memory from an Arena.
+/// Deallocation does nothing; the memory is reclaimed by Arena::release.
+///
+template<typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena* arena)
+        : m_arena(arena)
+    {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        : m_arena(other.arena())
+    {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n)
+    {}
+
+    inline Arena* arena(void) const
+    {
+        return m_arena;
+    }
+
+private:
+    Arena* m_arena;
+};
+
+template<typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() != b.arena();
+}
+
+
+#endif // ALLOCATOR__H
@@ -0,0 +1,107 @@
+/*
+ * A client of an AStarServer.
+ *
+ * Author: Barry Drake
+ */
+
+#include "Client.h"
+#include "Socket.h"
+#include <cstring>
+
+using namespace ServerProtocol;
+
+
+AStarClient::AStarClient(const char* socket_path)
+    : m_fd(Socket::connect_unix(socket_path))
+    , m_op(OP_INFO)
+    , m_dim(0)
+    , m_num_probes(0)
+    , m_num_vectors(0)
+    , m_packing_radius(0)
+    , m_num_shells(0)
+    , m_num_items(0)
+{
+    try
+    {
+        request(OP_INFO, 0, 0);
+        if (m_items.size() < INFO_SIZE)
+        {
+            throw Error_io;
+        }
+    }
+    catch (...)
+    {
+        Socket::close(m_fd);
+        throw;
+    }
+
+    m_dim         = Dim_t(m_items[INFO_DIM]);
+    m_num_probes  = size_t(m_items[INFO_NUM_PROBES]);
+    m_num_vectors = size_t(m_items[INFO_NUM_VECTORS]);
+    m_num_shells  = NumShells_t(m_items[INFO_NUM_SHELLS]);
+    std::memcpy(&m_packing_radius, &m_items[INFO_PACKING_RADIUS], sizeof(m_packing_radius));
+}
+
+
+AStarClient::~AStarClient(void)
+{
+    Socket::close(m_fd);
+}
+
+
+void AStarClient::request(Op op, const VElem_t* vectors, size_t num_vectors, uint32_t k)
+{
+    send(op, vectors, num_vectors, k);
+    receive();
+}
+
+
+void AStarClient::send(Op op, const VElem_t* vectors, size_t num_vectors, uint32_t k, const uint64_t* extra, size_t num_extra)
+{
+    m_counts.clear();
+    m_items.clear();
+    m_num_items = 0;
+
+    if (num_vectors > MAX_VECTORS)
+    {
+        throw Error_insufficient_buffers;
+    }
+
+    Request request;
+    request.magic       = MAGIC;
+    request.op          = op;
+    request.dim         = m_dim;
+    request.k           = k;
+    request.num_vectors = num_vectors;
+
+    Socket::write_all(m_fd, &request, sizeof(request));
+    Socket::write_all(m_fd, vectors, num_vectors * m_dim * sizeof(VElem_t));
+    Socket::write_all(m_fd, extra, num_extra * sizeof(uint64_t));
+    m_op = op;
+}
+
+
+void AStarClient::receive(void)
+{
+    Response response;
+    if (!Socket::read_all(m_fd, &response, sizeof(response)) || response.magic != MAGIC)
+    {
+        throw Error_io;
+    }
+    if (response.error != Error_ok)
+    {
+        throw Error(response.error);
+    }
+
+    m_counts.resize(size_t(response.num_rows));
+    m_items.resize(size_t(response.num_items) * item_words(m_op));
+    if (!Socket::read_all(m_fd, m_counts.data(), m_counts.size() * sizeof(uint64_t)) && !m_counts.empty())
+    {
+        throw Error_io;
+    }
+    if (!Socket::read_all(m_fd, m_items.data(), m_items.size() * sizeof(uint64_t)) && !m_items.empty())
+    {
+        throw Error_io;
+    }
+    m_num_items = size_t(response.num_items);
+}
@@ -0,0 +1,113 @@
+/*
+ * A client of an AStarServer (see Server.h).
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef CLIENT__H
+#define CLIENT__H
+
+#include "common.h"
+#include "ServerProtocol.h"
+#include <vector>
+
+
+///
+/// An AStarClient is a connection to an AStarServer.
+///
+/// Each request blocks until its reply is received. The reply is
+/// kept by the client (see 'counts' and 'items') until the next request.
+/// A client is not thread safe; use one client per thread, so that the
+/// server can coalesce their requests.
+///
+class AStarClient
+{
+public:
+    /// Connect to the server listening at socket_path.
+    AStarClient(const char* socket_path);
+
+    /// Closes the connection.
+    ~AStarClient(void);
+
+    /// The dimensionality of vectors served.
+    inline Dim_t dim(void) const
+    {
+        return m_dim;
+    }
+
+    /// The number of hash codes of an extended query.
+    inline size_t num_probes(void) const
+    {
+        return m_num_probes;
+    }
+
+    /// The packing radius of the server's lattice.
+    inline Distance_t packing_radius(void) const
+    {
+        return m_packing_radius;
+    }
+
+    /// The number of extended shells of the server's probes.
+    inline NumShells_t num_shells(void) const
+    {
+        return m_num_shells;
+    }
+
+    /// The number of vectors in the server index.
+    inline size_t num_vectors(void) const
+    {
+        return m_num_vectors;
+    }
+
+    /// Send a request for num_vectors query vectors (stored one after
+    /// the other) and wait for the reply. Server errors are thrown.
+    /// 'k' is only used by OP_KNN.
+    void request(ServerProtocol::Op op, const VElem_t* vectors, size_t num_vectors, uint32_t k = 0);
+
+    /// The first half of 'request': send the request without waiting, so
+    /// that requests to many servers can be in progress at once.
+    /// 'extra' words follow the vectors (the hash counts and hash codes
+    /// of OP_HASH_KNN).
+    void send(ServerProtocol::Op op, const VElem_t* vectors, size_t num_vectors, uint32_t k = 0,
+              const uint64_t* extra = 0, size_t num_extra = 0);
+
+    /// The second half of 'request': wait for the reply to the last 'send'.
+    void receive(void);
+
+    /// The row counts of the last reply, one per query vector.
+    inline const std::vector<uint64_t>& counts(void) const
+    {
+        return m_counts;
+    }
+
+    /// The items of the last reply (see ServerProtocol.h).
+    inline const std::vector<uint64_t>& items(void) const
+    {
+        return m_items;
+    }
+
+    /// The number of items of the last reply.
+    inline size_t num_items(void) const
+    {
+        return m_num_items;
+    }
+
+private:
+    // Copy and assignment not implemented
+    AStarClient(const AStarClient& obj);
+    AStarClient& operator=(const AStarClient& obj);
+
+    int                     m_fd;
+    ServerProtocol::Op      m_op;           // of the last request sent
+    Dim_t                   m_dim;
+    size_t                  m_num_probes;
+    size_t                  m_num_vectors;
+    Distance_t              m_packing_radius;
+    NumShells_t             m_num_shells;
+    std::vector<uint64_t>   m_counts;
+    std::vector<uint64_t>   m_items;
+    size_t                  m_num_items;
+};
+
+
+#endif // CLIENT__H
@@ -0,0 +1,127 @@
+/*
+ * Mathematical functions of the E8 lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#include "E8Lattice.h"
+#include <math.h>
+
+
+///
+/// The closest point of D8 + (offset, ..., offset) to x, as the integer
+/// point of D8 in p. Returns the squared distance.
+///
+static VElem_t closest_point_D8(const VElem_t* x, VElem_t offset, CElem_t* p)
+{
+    VElem_t distance2 = 0;
+    VElem_t worst     = -1;
+    Dim_t   worst_i   = 0;
+    CElem_t sum       = 0;
+    for (Dim_t i = 0; i < E8Lattice::DIM; ++i)
+    {
+        const VElem_t y   = x[i] - offset;
+        const CElem_t r   = round_up<CElem_t>(y);
+        const VElem_t err = y - r;
+        p[i]       = r;
+        sum       += r;
+        distance2 += err * err;
+        if (fabs(err) > worst)
+        {
+            worst   = fabs(err);
+            worst_i = i;
+        }
+    }
+
+    // D8 has an even sum: round the worst element the other way.
+    if (sum & 1)
+    {
+        const VElem_t err = x[worst_i] - offset - p[worst_i];
+        p[worst_i] += (err >= 0) ? 1 : -1;
+        distance2  += 1.0 - 2.0 * worst;
+    }
+    return distance2;
+}
+
+
+Distance_t E8Lattice::rho(void)
+{
+    return (Distance_t) sqrt(0.5);
+}
+
+
+VElem_t E8Lattice::closest_point(const VElem_t* x, CElem_t* doubled)
+{
+    CElem_t even[DIM];
+    CElem_t odd[DIM];
+    const VElem_t d_even = closest_point_D8(x, 0.0, even);
+    const VElem_t d_odd  = closest_point_D8(x, 0.5, odd);
+
+    if (d_even <= d_odd)
+    {
+        for (Dim_t i = 0; i < DIM; ++i)
+        {
+            doubled[i] = 2 * even[i];
+        }
+        return d_even;
+    }
+    for (Dim_t i = 0; i < DIM; ++i)
+    {
+        doubled[i] = 2 * odd[i] + 1;
+    }
+    return d_odd;
+}
+
+
+///
+/// The table of minimal vectors, built once.
+///
+struct MinimalVectors
+{
+    int8_t m_vectors[E8Lattice::NUM_MINIMAL][E8Lattice::DIM];
+
+    MinimalVectors(void)
+    {
+        size_t n = 0;
+        for (Dim_t i = 0; i < E8Lattice::DIM; ++i)
+        {
+            for (Dim_t j = i + 1; j < E8Lattice::DIM; ++j)
+            {
+                for (int signs = 0; signs < 4; ++signs)
+                {
+                    int8_t* v = m_vectors[n++];
+                    for (Dim_t d = 0; d < E8Lattice::DIM; ++d)
+                    {
+                        v[d] = 0;
+                    }
+                    v[i] = (signs & 1) ? -2 : 2;
+                    v[j] = (signs & 2) ? -2 : 2;
+                }
+            }
+        }
+        for (unsigned signs = 0; signs < 256; ++signs)
+        {
+            unsigned num_minus = 0;
+            for (Dim_t d = 0; d < E8Lattice::DIM; ++d)
+            {
+                num_minus += (signs >> d) & 1;
+            }
+            if (num_minus % 2 == 0)
+            {
+                int8_t* v = m_vectors[n++];
+                for (Dim_t d = 0; d < E8Lattice::DIM; ++d)
+                {
+                    v[d] = ((signs >> d) & 1) ? -1 : 1;
+                }
+            }
+        }
+    }
+};
+
+static const MinimalVectors MINIMAL_VECTORS;
+
+
+const int8_t (*E8Lattice::minimal_vectors(void))[E8Lattice::DIM]
+{
+    return MINIMAL_VECTORS.m_vectors;
+}
@@ -0,0 +1,49 @@
+/*
+ * Mathematical functions of the E8 lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef E8LATTICE__H
+#define E8LATTICE__H
+
+#include "common.h"
+
+
+///
+/// The E8 lattice, as the union of D8 and D8 + (1/2, ..., 1/2), with
+/// minimal norm 2.
+///
+/// Lattice points are given in doubled coordinates (twice the real
+/// coordinates), so that they are integers: all even (from D8) or all odd
+/// (from the coset), with a sum that is a multiple of 4.
+///
+/// Closest points are found by the decoder of Conway and Sloane (Sphere
+/// Packings, Lattices and Groups, chapter 20): the closer of the closest
+/// points of D8 and of its coset.
+///
+struct E8Lattice
+{
+    /// The dimension of E8.
+    static const Dim_t DIM = 8;
+
+    /// The number of minimal vectors, which are the Voronoi relevant
+    /// vectors: the neighbours of a lattice point sharing a face of its
+    /// Voronoi cell.
+    static const size_t NUM_MINIMAL = 240;
+
+    /// The packing radius of E8 with minimal norm 2.
+    static Distance_t rho(void);
+
+    /// Find the lattice point closest to x (8 elements), in doubled
+    /// coordinates. Returns the squared distance from x to it.
+    static VElem_t closest_point(const VElem_t* x, CElem_t* doubled);
+
+    /// The minimal vectors (of norm 2), in doubled coordinates: 112 of
+    /// the form (+-2, +-2, 0, ..., 0) and 128 of (+-1, ..., +-1) with an
+    /// even number of minus signs.
+    static const int8_t (*minimal_vectors(void))[DIM];
+};
+
+
+#endif // E8LATTICE__H
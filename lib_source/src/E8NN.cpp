@@ -0,0 +1,132 @@
+/*
+ * Nearest neighbour hashing with products of the E8 lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#include "E8NN.h"
+#include "Hash.h"
+#include <algorithm>
+#include <utility>
+
+
+E8NN::E8NN(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells)
+    : m_dim(dim)
+    , m_packing_radius(packing_radius)
+    , m_num_shells(num_shells)
+    , m_scale(E8Lattice::rho() / packing_radius)
+    , m_num_probes(0)
+{
+    if (dim <= 0 || dim % E8Lattice::DIM != 0)
+    {
+        throw Error_invalid_dim;
+    }
+    if (num_shells > E8Lattice::NUM_MINIMAL)
+    {
+        throw Error_invalid_num_shells;
+    }
+    if (packing_radius <= 0.0)
+    {
+        throw Error_invalid_packing_radius;
+    }
+
+    // Grow the shared table of powers of RADIX now, rather than during
+    // (possibly concurrent) queries.
+    Hash::powers(m_dim);
+
+    m_num_probes = 1 + size_t(m_dim / E8Lattice::DIM) * m_num_shells;
+}
+
+
+void E8NN::_nearest(const VElem_t* vector, VElem_t* mapped, CElem_t* doubled) const
+{
+    for (Dim_t i = 0; i < m_dim; ++i)
+    {
+        mapped[i] = m_scale * vector[i];
+    }
+    for (Dim_t i = 0; i < m_dim; i += E8Lattice::DIM)
+    {
+        E8Lattice::closest_point(mapped + i, doubled + i);
+    }
+}
+
+
+void E8NN::nearest_point(const VElem_t* vector, CElem_t* doubled) const
+{
+    std::vector<VElem_t> mapped(m_dim);
+    _nearest(vector, mapped.data(), doubled);
+}
+
+
+Hash_t E8NN::nearest_hash(const VElem_t* vector) const
+{
+    std::vector<VElem_t> mapped(m_dim);
+    std::vector<CElem_t> doubled(m_dim);
+    _nearest(vector, mapped.data(), doubled.data());
+    return Hash::hash(m_dim - 1, doubled.data());
+}
+
+
+void E8NN::extended_hash(const VElem_t* vector, Hash_t* hashes) const
+{
+    std::vector<VElem_t> mapped(m_dim);
+    std::vector<CElem_t> doubled(m_dim);
+    _nearest(vector, mapped.data(), doubled.data());
+
+    const Hash_t hash_code = Hash::hash(m_dim - 1, doubled.data());
+    *hashes++ = hash_code;
+    if (m_num_shells == 0)
+    {
+        return;
+    }
+
+    //
+    // For each block, the increase in the squared distance from the
+    // vector of moving the block by a minimal vector m is |m|^2 - 2 r.m,
+    // where r is the residual of the block. In doubled coordinates, that
+    // is 2 - r.m. Keep the num_shells smallest of each block.
+    //
+    typedef std::pair<VElem_t, uint32_t> Move;  // increase, and block * NUM_MINIMAL + minimal vector
+
+    const int8_t (*minimal)[E8Lattice::DIM] = E8Lattice::minimal_vectors();
+    const size_t num_blocks = m_dim / E8Lattice::DIM;
+
+    std::vector<Move> moves;
+    std::vector<Move> block_moves(E8Lattice::NUM_MINIMAL);
+    moves.reserve(num_blocks * m_num_shells);
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        VElem_t residual[E8Lattice::DIM];
+        for (Dim_t i = 0; i < E8Lattice::DIM; ++i)
+        {
+            residual[i] = mapped[b * E8Lattice::DIM + i] - 0.5 * doubled[b * E8Lattice::DIM + i];
+        }
+        for (size_t m = 0; m < E8Lattice::NUM_MINIMAL; ++m)
+        {
+            VElem_t dot = 0;
+            for (Dim_t i = 0; i < E8Lattice::DIM; ++i)
+            {
+                dot += residual[i] * minimal[m][i];
+            }
+            block_moves[m] = Move(2.0 - dot, uint32_t(b * E8Lattice::NUM_MINIMAL + m));
+        }
+        std::partial_sort(block_moves.begin(), block_moves.begin() + m_num_shells, block_moves.end());
+        moves.insert(moves.end(), block_moves.begin(), block_moves.begin() + m_num_shells);
+    }
+    std::sort(moves.begin(), moves.end());
+
+    // The hash code of each probe differs from the nearest by its move.
+    const Hash_t* powers = Hash::powers(m_dim);
+    for (size_t j = 0; j < moves.size(); ++j)
+    {
+        const size_t  b     = moves[j].second / E8Lattice::NUM_MINIMAL;
+        const int8_t* m     = minimal[moves[j].second % E8Lattice::NUM_MINIMAL];
+        const Hash_t* power = powers + b * E8Lattice::DIM;
+        Hash_t        probe = hash_code;
+        for (Dim_t i = 0; i < E8Lattice::DIM; ++i)
+        {
+            probe += (Hash_t)(CElem_t)m[i] * power[i];
+        }
+        *hashes++ = probe;
+    }
+}
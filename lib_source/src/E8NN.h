@@ -0,0 +1,125 @@
+/*
+ * Nearest neighbour hashing with products of the E8 lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef E8NN__H
+#define E8NN__H
+
+#include "common.h"
+#include "E8Lattice.h"
+#include <vector>
+
+class VectorTransform;
+
+
+///
+/// An E8NN quantises vectors, whose dimension is a multiple of 8, to the
+/// product lattice E8 x ... x E8, one E8 per block of 8 elements. E8 is
+/// a better quantiser than A*8 (a smaller mean squared error at the same
+/// density) and its decoder is fast.
+///
+/// It has the AStarNN methods used by AStarIndex for put and get, so an
+/// AStarIndex<T, Alloc, E8NN> is an index on this lattice.
+///
+/// The extended probes are the nearest lattice point and, for each
+/// block, the lattice points that differ from it in only that block, by
+/// one of the num_shells minimal vectors nearest to the vector (of 240,
+/// which are all the neighbours sharing a face of the Voronoi cell). They
+/// are in order of distance, nearest first. So num_shells is at most 240,
+/// and there are 1 + (dim / 8) num_shells probes.
+///
+/// Hash codes are those of Hash::hash of the lattice point in doubled
+/// coordinates (see E8Lattice).
+///
+class E8NN
+{
+public:
+    /// \param[in]  dim             number of dimensions, n, a multiple of 8.
+    /// \param[in]  packing_radius  packing radius of the product lattice.
+    /// \param[in]  num_shells      number of neighbours per block for extended probes.
+    ///
+    E8NN(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells);
+
+    inline Dim_t dim(void) const
+    {
+        return m_dim;
+    }
+
+    /// As dim(): an E8NN has no transform.
+    inline Dim_t input_dim(void) const
+    {
+        return m_dim;
+    }
+
+    /// Always null (see AStarNN::transform).
+    inline const VectorTransform* transform(void) const
+    {
+        return 0;
+    }
+
+    inline Distance_t packing_radius(void) const
+    {
+        return m_packing_radius;
+    }
+
+    /// The scale from the vector space to the lattice space.
+    inline Distance_t scale(void) const
+    {
+        return m_scale;
+    }
+
+    inline NumShells_t num_shells(void) const
+    {
+        return m_num_shells;
+    }
+
+    /// Number of probe points used by extended probes.
+    inline size_t num_probes(void) const
+    {
+        return m_num_probes;
+    }
+
+    /// The lattice point nearest to the vector, in doubled coordinates
+    /// (dim elements).
+    void nearest_point(const VElem_t* vector, CElem_t* doubled) const;
+
+    /// The hash code of the lattice point nearest to the vector.
+    Hash_t nearest_hash(const VElem_t* vector) const;
+
+    /// The hash codes of the extended probes (num_probes) of the vector.
+    void extended_hash(const VElem_t* vector, Hash_t* hashes) const;
+
+    /// Call f(hash_code) for the nearest lattice point.
+    template<typename F>
+    inline void visit_nearest(const VElem_t* vector, F&& f) const
+    {
+        f(nearest_hash(vector));
+    }
+
+    /// Call f(hash_code) for each of the extended probes, nearest first.
+    template<typename F>
+    inline void visit_extended(const VElem_t* vector, F&& f) const
+    {
+        std::vector<Hash_t> hashes(m_num_probes);
+        extended_hash(vector, hashes.data());
+        for (size_t i = 0; i < m_num_probes; ++i)
+        {
+            f(hashes[i]);
+        }
+    }
+
+private:
+    /// Map the vector to the lattice space and find its nearest point.
+    void _nearest(const VElem_t* vector, VElem_t* mapped, CElem_t* doubled) const;
+
+    const Dim_t         m_dim;
+    const Distance_t    m_packing_radius;
+    const NumShells_t   m_num_shells;
+    const Distance_t    m_scale;
+    size_t              m_num_probes;
+};
+
+
+#endif // E8NN__H
@@ -40,6 +40,44 @@ struct Hash
     }
 
 
+    ///
+    /// RADIX to the power i, without the table of powers (for
+    /// dimensions too large to tabulate).
+    ///
+    inline static Hash_t power(Dim_t i)
+    {
+        Hash_t result = 1;
+        Hash_t square = RADIX;
+        for (; i; i >>= 1)
+        {
+            if (i & 1)
+            {
+                result *= square;
+            }
+            square *= square;
+        }
+        return result;
+    }
+
+
+    ///
+    /// The sum of RADIX to the powers 0 to n - 1, without the table of
+    /// powers (by halving, as RADIX - 1 has no inverse modulo 2^64).
+    ///
+    inline static Hash_t sum_powers(Dim_t n)
+    {
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (n & 1)
+        {
+            return 1 + RADIX * sum_powers(n - 1);
+        }
+        return sum_powers(n / 2) * (1 + power(n / 2));
+    }
+
+
     ///
     /// Get the powers of RADIX in the standard
     /// order (identity permutation).
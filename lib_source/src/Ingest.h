@@ -0,0 +1,515 @@
+/*
+ * A pipelined, multi-threaded ingest of vectors into an
+ * AStarPartitionedIndex.
+ *
+ * The pipeline has three stages, connected by bounded lock-free ring
+ * buffers (see RingBuffer.h):
+ *   (1) a reader, on the calling thread, fills chunks of rows
+ *       (vectors and elements) using a caller supplied function,
+ *   (2) hash workers compute the hash code of each row and route the
+ *       rows to the inserter owning the row's partition,
+ *   (3) inserters put the rows into the partitions that they own.
+ * A full ring buffer makes the stage feeding it wait (backpressure), so
+ * memory use is bounded whatever the relative speeds of the stages.
+ *
+ * Each stage records how long it spends working and waiting, so the
+ * bottleneck stage can be seen from the metrics.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef INGEST__H
+#define INGEST__H
+
+#include "common.h"
+#include "AStarPartitionedIndex.h"
+#include "RingBuffer.h"
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+///
+/// Time and work counters for one pipeline stage (summed over its threads).
+///
+struct StageMetrics
+{
+    StageMetrics(void)
+        : threads(0)
+        , items(0)
+        , busy_ns(0)
+        , wait_ns(0)
+    {}
+
+    /// Fraction of time (0 to 1) that the stage's threads spent working.
+    inline double utilization(void) const
+    {
+        const uint64_t total = busy_ns + wait_ns;
+        return total ? double(busy_ns) / double(total) : 0.0;
+    }
+
+    size_t      threads;    ///< Number of threads in the stage.
+    uint64_t    items;      ///< Number of rows processed.
+    uint64_t    busy_ns;    ///< Time spent working, in nanoseconds.
+    uint64_t    wait_ns;    ///< Time spent waiting on a ring buffer, in nanoseconds.
+};
+
+
+///
+/// Metrics for a whole run of an IngestPipeline.
+///
+struct IngestMetrics
+{
+    IngestMetrics(void)
+        : elapsed_ns(0)
+    {}
+
+    StageMetrics    read;
+    StageMetrics    hash;
+    StageMetrics    insert;
+    uint64_t        elapsed_ns;     ///< Wall clock time of the run, in nanoseconds.
+};
+
+
+template <typename T>
+class IngestPipeline
+{
+public:
+    ///
+    /// The reader function. It should write up to max_rows rows, as
+    /// vectors (one after the other) and elements, and return the number
+    /// of rows written. Returning 0 ends the input.
+    ///
+    typedef std::function<size_t(VElem_t* vectors, T* elems, size_t max_rows)> Reader;
+
+    /// Create a pipeline that inserts into the given index.
+    ///
+    /// \param[in]  index               the index to insert into; it must not be otherwise used during 'run'.
+    /// \param[in]  num_hash_workers    number of hash worker threads (at least 1).
+    /// \param[in]  num_inserters       number of inserter threads (1 to index.num_partitions()).
+    /// \param[in]  chunk_rows          number of rows per chunk.
+    /// \param[in]  queue_capacity      capacity (in chunks) of each ring buffer.
+    ///
+    IngestPipeline
+    (
+        AStarPartitionedIndex<T>&   index,
+        size_t                      num_hash_workers,
+        size_t                      num_inserters,
+        size_t                      chunk_rows     = 1024,
+        size_t                      queue_capacity = 16
+    );
+
+    ~IngestPipeline(void);
+
+    ///
+    /// Read and insert all rows given by the reader.
+    /// This returns when every row read is in the index.
+    /// If any stage throws, the pipeline is drained and the first
+    /// exception is rethrown (some rows may have been inserted).
+    ///
+    void run(const Reader& reader);
+
+    /// Metrics of the last run.
+    inline const IngestMetrics& metrics(void) const
+    {
+        return m_metrics;
+    }
+
+private:
+    // Copy and assignment not implemented
+    IngestPipeline(const IngestPipeline& obj);
+    IngestPipeline& operator=(const IngestPipeline& obj);
+
+    typedef std::chrono::steady_clock Clock;
+
+    /// A chunk of rows from the reader.
+    struct Chunk
+    {
+        std::vector<VElem_t>    vectors;
+        std::vector<T>          elems;
+        std::vector<Hash_t>     hashes;
+        size_t                  num_rows;
+    };
+
+    /// Rows for one inserter.
+    typedef std::vector<std::pair<Hash_t, T> > Batch;
+
+    static inline uint64_t nanos(Clock::time_point start, Clock::time_point end)
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    // Push/pop, adding any time spent blocked to wait_ns.
+    template<typename Item>
+    static void push(RingBuffer<Item>& ring, const Item& item, uint64_t& wait_ns)
+    {
+        if (!ring.try_push(item))
+        {
+            const Clock::time_point start = Clock::now();
+            ring.push(item);
+            wait_ns += nanos(start, Clock::now());
+        }
+    }
+
+    template<typename Item>
+    static Item pop(RingBuffer<Item>& ring, uint64_t& wait_ns)
+    {
+        Item item;
+        if (!ring.try_pop(item))
+        {
+            const Clock::time_point start = Clock::now();
+            item = ring.pop();
+            wait_ns += nanos(start, Clock::now());
+        }
+        return item;
+    }
+
+    void _hash_worker(StageMetrics& metrics);
+    void _inserter(size_t self, StageMetrics& metrics);
+    void _hash_workers_done(size_t num_workers);
+    void _fail(void);
+
+    Batch* _new_batch(void);
+    void _free_batch(Batch* batch);
+
+    AStarPartitionedIndex<T>&   m_index;
+    const size_t                m_num_hash_workers;
+    const size_t                m_num_inserters;
+    const size_t                m_chunk_rows;
+
+    std::vector<Chunk>                      m_chunks;
+    RingBuffer<Chunk*>                      m_free_chunks;
+    RingBuffer<Chunk*>                      m_to_hash;
+    std::vector<std::unique_ptr<RingBuffer<Batch*> > > m_to_insert;
+    RingBuffer<Batch*>                      m_free_batches;
+
+    std::atomic<size_t>         m_hash_workers_running;
+    std::atomic<bool>           m_failed;
+    std::exception_ptr          m_error;    // written by the first thread to fail
+
+    IngestMetrics               m_metrics;
+};
+
+
+//  Implementation
+
+template <typename T>
+IngestPipeline<T>::IngestPipeline
+(
+    AStarPartitionedIndex<T>&   index,
+    size_t                      num_hash_workers,
+    size_t                      num_inserters,
+    size_t                      chunk_rows,
+    size_t                      queue_capacity
+)
+    : m_index(index)
+    , m_num_hash_workers(num_hash_workers)
+    , m_num_inserters(num_inserters)
+    , m_chunk_rows(chunk_rows)
+    , m_chunks(queue_capacity + num_hash_workers + 1)
+    , m_free_chunks(queue_capacity + num_hash_workers + 1)
+    , m_to_hash(queue_capacity)
+    , m_free_batches(num_inserters * (queue_capacity + num_hash_workers))
+    , m_hash_workers_running(0)
+    , m_failed(false)
+{
+    if (num_hash_workers == 0 || num_inserters == 0 || num_inserters > index.num_partitions() ||
+        chunk_rows == 0 || queue_capacity == 0)
+    {
+        throw Error_unknown;
+    }
+
+    const Dim_t dim = index.dim();
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        Chunk& chunk = m_chunks[i];
+        chunk.vectors.resize(chunk_rows * dim);
+        chunk.elems.resize(chunk_rows);
+        chunk.hashes.resize(chunk_rows);
+        chunk.num_rows = 0;
+        m_free_chunks.push(&chunk);
+    }
+    for (size_t i = 0; i < num_inserters; ++i)
+    {
+        m_to_insert.push_back(std::unique_ptr<RingBuffer<Batch*> >(new RingBuffer<Batch*>(queue_capacity)));
+    }
+}
+
+
+template <typename T>
+IngestPipeline<T>::~IngestPipeline(void)
+{
+    Batch* batch;
+    while (m_free_batches.try_pop(batch))
+    {
+        delete batch;
+    }
+}
+
+
+template <typename T>
+void IngestPipeline<T>::run(const Reader& reader)
+{
+    const Clock::time_point start = Clock::now();
+
+    m_metrics = IngestMetrics();
+    m_metrics.read.threads   = 1;
+    m_metrics.hash.threads   = m_num_hash_workers;
+    m_metrics.insert.threads = m_num_inserters;
+    m_failed.store(false);
+    m_error = std::exception_ptr();
+
+    std::vector<StageMetrics> hash_metrics(m_num_hash_workers);
+    std::vector<StageMetrics> insert_metrics(m_num_inserters);
+    std::vector<std::thread>  threads;
+    threads.reserve(m_num_hash_workers + m_num_inserters);
+
+    // Start the threads, inserters first. If a thread cannot be started,
+    // the threads already running are stopped by the end of input markers.
+    size_t num_inserters = 0;
+    size_t num_hash_workers = 0;
+    m_hash_workers_running.store(m_num_hash_workers);
+    try
+    {
+        for (; num_inserters < m_num_inserters; ++num_inserters)
+        {
+            threads.push_back(std::thread(&IngestPipeline::_inserter, this, num_inserters, std::ref(insert_metrics[num_inserters])));
+        }
+        for (; num_hash_workers < m_num_hash_workers; ++num_hash_workers)
+        {
+            threads.push_back(std::thread(&IngestPipeline::_hash_worker, this, std::ref(hash_metrics[num_hash_workers])));
+        }
+    }
+    catch (...)
+    {
+        _fail();
+    }
+
+    if (num_hash_workers < m_num_hash_workers)
+    {
+        if (num_inserters < m_num_inserters)
+        {
+            // No hash workers running; stop the inserters directly.
+            for (size_t i = 0; i < num_inserters; ++i)
+            {
+                m_to_insert[i]->push(0);
+            }
+            m_hash_workers_running.store(0);
+        }
+        else
+        {
+            _hash_workers_done(m_num_hash_workers - num_hash_workers);
+        }
+    }
+
+    // The reader stage.
+    StageMetrics& read = m_metrics.read;
+    try
+    {
+        while (!m_failed.load(std::memory_order_relaxed) && num_hash_workers > 0)
+        {
+            Chunk* chunk = pop(m_free_chunks, read.wait_ns);
+
+            const Clock::time_point work_start = Clock::now();
+            chunk->num_rows = reader(&chunk->vectors[0], &chunk->elems[0], m_chunk_rows);
+            read.busy_ns += nanos(work_start, Clock::now());
+
+            if (chunk->num_rows == 0)
+            {
+                m_free_chunks.push(chunk);
+                break;
+            }
+            ASSERT(chunk->num_rows <= m_chunk_rows);
+            read.items += chunk->num_rows;
+            push(m_to_hash, chunk, read.wait_ns);
+        }
+    }
+    catch (...)
+    {
+        _fail();
+    }
+
+    // Signal the end of input, one marker per hash worker.
+    for (size_t i = 0; i < num_hash_workers; ++i)
+    {
+        m_to_hash.push(0);
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+
+    for (size_t i = 0; i < hash_metrics.size(); ++i)
+    {
+        m_metrics.hash.items   += hash_metrics[i].items;
+        m_metrics.hash.busy_ns += hash_metrics[i].busy_ns;
+        m_metrics.hash.wait_ns += hash_metrics[i].wait_ns;
+    }
+    for (size_t i = 0; i < insert_metrics.size(); ++i)
+    {
+        m_metrics.insert.items   += insert_metrics[i].items;
+        m_metrics.insert.busy_ns += insert_metrics[i].busy_ns;
+        m_metrics.insert.wait_ns += insert_metrics[i].wait_ns;
+    }
+    m_metrics.elapsed_ns = nanos(start, Clock::now());
+
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+
+template <typename T>
+void IngestPipeline<T>::_hash_worker(StageMetrics& metrics)
+{
+    const Dim_t dim = m_index.dim();
+    std::vector<Batch*> batches(m_num_inserters, (Batch*)0);
+
+    for (;;)
+    {
+        Chunk* chunk = pop(m_to_hash, metrics.wait_ns);
+        if (!chunk)
+        {
+            break;
+        }
+
+        const Clock::time_point work_start = Clock::now();
+        if (!m_failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                const size_t num_rows = chunk->num_rows;
+                for (size_t i = 0; i < num_rows; ++i)
+                {
+                    chunk->hashes[i] = m_index.hash(&chunk->vectors[i * dim]);
+                }
+
+                // Route each row to the inserter that owns its partition.
+                for (size_t i = 0; i < num_rows; ++i)
+                {
+                    const Hash_t hash_code = chunk->hashes[i];
+                    const size_t inserter = m_index.partition_of(hash_code) % m_num_inserters;
+                    if (!batches[inserter])
+                    {
+                        batches[inserter] = _new_batch();
+                    }
+                    batches[inserter]->push_back(std::make_pair(hash_code, chunk->elems[i]));
+                }
+                metrics.items += num_rows;
+            }
+            catch (...)
+            {
+                _fail();
+            }
+        }
+        metrics.busy_ns += nanos(work_start, Clock::now());
+
+        m_free_chunks.push(chunk);
+
+        for (size_t i = 0; i < m_num_inserters; ++i)
+        {
+            if (batches[i])
+            {
+                push(*m_to_insert[i], batches[i], metrics.wait_ns);
+                batches[i] = 0;
+            }
+        }
+    }
+
+    _hash_workers_done(1);
+}
+
+
+template <typename T>
+void IngestPipeline<T>::_inserter(size_t self, StageMetrics& metrics)
+{
+    RingBuffer<Batch*>& ring = *m_to_insert[self];
+
+    for (;;)
+    {
+        Batch* batch = pop(ring, metrics.wait_ns);
+        if (!batch)
+        {
+            break;
+        }
+
+        const Clock::time_point work_start = Clock::now();
+        if (!m_failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                for (auto it = batch->begin(); it != batch->end(); ++it)
+                {
+                    m_index.put_partition(m_index.partition_of(it->first), it->first, it->second);
+                }
+                metrics.items += batch->size();
+            }
+            catch (...)
+            {
+                _fail();
+            }
+        }
+        metrics.busy_ns += nanos(work_start, Clock::now());
+
+        _free_batch(batch);
+    }
+}
+
+
+template <typename T>
+void IngestPipeline<T>::_hash_workers_done(size_t num_workers)
+{
+    // The last hash worker to finish signals the end of input to the inserters.
+    if (m_hash_workers_running.fetch_sub(num_workers) == num_workers)
+    {
+        for (size_t i = 0; i < m_num_inserters; ++i)
+        {
+            m_to_insert[i]->push(0);
+        }
+    }
+}
+
+
+template <typename T>
+void IngestPipeline<T>::_fail(void)
+{
+    bool expected = false;
+    if (m_failed.compare_exchange_strong(expected, true))
+    {
+        m_error = std::current_exception();
+    }
+}
+
+
+template <typename T>
+typename IngestPipeline<T>::Batch* IngestPipeline<T>::_new_batch(void)
+{
+    Batch* batch;
+    if (m_free_batches.try_pop(batch))
+    {
+        batch->clear();
+        return batch;
+    }
+    batch = new Batch();
+    batch->reserve(m_chunk_rows / m_num_inserters + 1);
+    return batch;
+}
+
+
+template <typename T>
+void IngestPipeline<T>::_free_batch(Batch* batch)
+{
+    if (!m_free_batches.try_push(batch))
+    {
+        delete batch;
+    }
+}
+
+
+#endif // INGEST__H
@@ -0,0 +1,193 @@
+/*
+ * Vector compression by A* lattice quantisation.
+ *
+ * Author: Barry Drake
+ */
+
+#include "LatticeCodec.h"
+#include "AStarLattice.h"
+#include "Scheduler.h"
+#include "WorkBuff.h"
+#include <algorithm>
+#include <math.h>
+#include <mutex>
+
+
+LatticeCodec::LatticeCodec(Dim_t dim, Distance_t packing_radius, unsigned bits, const VElem_t* base)
+    : m_dim(dim)
+    , m_packing_radius(packing_radius)
+    , m_scale(0)
+    , m_bits(bits)
+    , m_code_size((size_t(dim + 1) * bits + 7) / 8)
+    , m_min(-(CElem_t(1) << (bits - 1)))
+    , m_max((CElem_t(1) << (bits - 1)) - 1)
+    , m_base(dim, 0)
+{
+    if (dim <= 0)
+    {
+        throw Error_invalid_dim;
+    }
+    if (packing_radius <= 0.0)
+    {
+        throw Error_invalid_packing_radius;
+    }
+    if (bits < 2 || bits > 16)
+    {
+        throw Error_unknown;
+    }
+    m_scale = AStarLattice::rho(dim) / packing_radius;
+    if (base)
+    {
+        m_base.assign(base, base + dim);
+    }
+}
+
+
+void LatticeCodec::encode(const VElem_t* vectors, size_t num_vectors, uint8_t* codes,
+                          CodecStats* stats, size_t num_threads) const
+{
+    std::mutex  stats_lock;
+    CodecStats  total = { num_vectors, 0, 0.0, 0.0 };
+
+    parallel_for(num_vectors, num_threads, 0, [&](size_t begin, size_t end)
+    {
+        BuffStack               stack(m_dim, 6);
+        std::vector<VElem_t>    decoded(stats ? m_dim : 0);
+        size_t                  num_clipped = 0;
+        double                  sum_squared = 0;
+        double                  max_squared = 0;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            const VElem_t* vector = vectors + i * m_dim;
+            uint8_t*       code   = codes + i * m_code_size;
+
+            num_clipped += _encode(vector, code, stack.buff());
+            if (stats)
+            {
+                _decode(code, decoded.data(), stack.buff());
+                double squared = 0;
+                for (Dim_t j = 0; j < m_dim; ++j)
+                {
+                    const double d = decoded[j] - vector[j];
+                    squared += d * d;
+                }
+                sum_squared += squared;
+                max_squared  = std::max(max_squared, squared);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(stats_lock);
+        total.num_clipped       += num_clipped;
+        total.sum_squared_error += sum_squared;
+        total.max_error          = std::max(total.max_error, sqrt(max_squared));
+    });
+
+    if (stats)
+    {
+        *stats = total;
+    }
+}
+
+
+void LatticeCodec::decode(const uint8_t* codes, size_t num_vectors, VElem_t* vectors, size_t num_threads) const
+{
+    parallel_for(num_vectors, num_threads, 0, [&](size_t begin, size_t end)
+    {
+        BuffStack stack(m_dim, 2);
+        for (size_t i = begin; i < end; ++i)
+        {
+            _decode(codes + i * m_code_size, vectors + i * m_dim, stack.buff());
+        }
+    });
+}
+
+
+bool LatticeCodec::_encode(const VElem_t* vector, uint8_t* code, WorkBuff* buff) const
+{
+    const Dim_t dimp = m_dim + 1;
+
+    VElem_t*    diff   = get_buff<VElem_t>(buff);
+    VElem_t*    mapped = get_buff<VElem_t>(buff);
+    CElem_t*    c      = get_buff<CElem_t>(buff);
+    K_t         k;
+
+    for (Dim_t i = 0; i < m_dim; ++i)
+    {
+        diff[i] = vector[i] - m_base[i];
+    }
+    AStarLattice::to_lattice_space(m_dim, m_scale, diff, mapped);
+    AStarLattice::closest_point(m_dim, mapped, k, c, buff);
+
+    //
+    // Pack the elements, offset to be unsigned, least significant bit first.
+    //
+    bool     clipped = false;
+    uint64_t acc     = 0;
+    unsigned num_acc = 0;
+    for (Dim_t i = 0; i < dimp; ++i)
+    {
+        CElem_t e = c[i];
+        if (e < m_min || e > m_max)
+        {
+            e       = std::min(std::max(e, m_min), m_max);
+            clipped = true;
+        }
+        acc     |= uint64_t(e - m_min) << num_acc;
+        num_acc += m_bits;
+        while (num_acc >= 8)
+        {
+            *code++  = uint8_t(acc);
+            acc    >>= 8;
+            num_acc -= 8;
+        }
+    }
+    if (num_acc)
+    {
+        *code = uint8_t(acc);
+    }
+    return clipped;
+}
+
+
+void LatticeCodec::_decode(const uint8_t* code, VElem_t* vector, WorkBuff* buff) const
+{
+    const Dim_t     dimp = m_dim + 1;
+    const uint64_t  mask = (uint64_t(1) << m_bits) - 1;
+
+    CElem_t*        c      = get_buff<CElem_t>(buff);
+    VElem_t*        mapped = get_buff<VElem_t>(buff);
+
+    uint64_t acc     = 0;
+    unsigned num_acc = 0;
+    CElem_t  sum     = 0;
+    for (Dim_t i = 0; i < dimp; ++i)
+    {
+        while (num_acc < m_bits)
+        {
+            acc     |= uint64_t(*code++) << num_acc;
+            num_acc += 8;
+        }
+        c[i]      = CElem_t(acc & mask) + m_min;
+        sum      += c[i];
+        acc     >>= m_bits;
+        num_acc  -= m_bits;
+    }
+
+    //
+    // The lattice point is (n+1) c + k, with k = -sum(c). This is also the
+    // projection of (n+1) c onto the lattice space, so a clipped c-vector
+    // still decodes to a point in the lattice space.
+    //
+    const VElem_t dimpd = dimp;
+    const VElem_t k     = -sum;
+    for (Dim_t i = 0; i < dimp; ++i)
+    {
+        mapped[i] = dimpd * c[i] + k;
+    }
+    AStarLattice::from_lattice_space(m_dim, m_scale, mapped, vector);
+    for (Dim_t i = 0; i < m_dim; ++i)
+    {
+        vector[i] += m_base[i];
+    }
+}
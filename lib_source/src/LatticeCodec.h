@@ -0,0 +1,119 @@
+/*
+ * Vector compression by A* lattice quantisation.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef LATTICECODEC__H
+#define LATTICECODEC__H
+
+#include "common.h"
+#include <vector>
+
+class WorkBuff;
+
+///
+/// Rate-distortion statistics of a LatticeCodec::encode.
+///
+struct CodecStats
+{
+    /// Number of vectors encoded.
+    size_t      num_vectors;
+
+    /// Number of vectors with a c-vector element outside the range of the
+    /// code (which was clamped, so their error may be large).
+    size_t      num_clipped;
+
+    /// Sum over the vectors of the squared distance from the vector to
+    /// its decoded vector.
+    double      sum_squared_error;
+
+    /// The largest distance from a vector to its decoded vector.
+    double      max_error;
+};
+
+
+///
+/// A LatticeCodec compresses vectors to the c-vectors of their nearest
+/// points in a (fine) A* lattice, relative to a base vector, with each of
+/// the n+1 c-vector elements bit-packed into a fixed number of bits.
+///
+/// The error of a vector is at most the covering radius of the lattice
+/// (so long as no element is clipped), and the A* lattice has a lower
+/// mean squared error than a scalar (cubic) grid of the same density.
+/// The packing radius sets the distortion, and the number of bits sets
+/// the range of vectors (around the base) that can be coded without
+/// clipping: each c-vector element is about the same as the matching
+/// element of (vector - base) / (2 * packing_radius).
+///
+/// Codes are ceil((n + 1) * bits / 8) bytes; the k value of the lattice
+/// point is not stored, as it is minus the sum of the c-vector.
+///
+class LatticeCodec
+{
+public:
+    /// \param[in]  dim             number of dimensions of the vectors, n.
+    /// \param[in]  packing_radius  packing radius of the A* lattice.
+    /// \param[in]  bits            bits per c-vector element, 2 to 16.
+    /// \param[in]  base            n dimensional base vector, or null for the origin.
+    ///
+    LatticeCodec(Dim_t dim, Distance_t packing_radius, unsigned bits, const VElem_t* base = 0);
+
+    /// Number of bytes in the code of a vector.
+    inline size_t code_size(void) const
+    {
+        return m_code_size;
+    }
+
+    /// The number of bits of code per vector dimension.
+    inline double bits_per_dim(void) const
+    {
+        return double(m_code_size) * 8.0 / double(m_dim);
+    }
+
+    inline Dim_t dim(void) const
+    {
+        return m_dim;
+    }
+
+    inline Distance_t packing_radius(void) const
+    {
+        return m_packing_radius;
+    }
+
+    inline unsigned bits(void) const
+    {
+        return m_bits;
+    }
+
+    /// Encode num_vectors vectors (stored one after the other) into codes
+    /// (code_size() bytes each), using num_threads threads (see
+    /// parallel_for). If stats is not null, it is set to the
+    /// rate-distortion statistics of the vectors (which costs a decode).
+    void encode(const VElem_t* vectors, size_t num_vectors, uint8_t* codes,
+                CodecStats* stats = 0, size_t num_threads = 1) const;
+
+    /// Decode num_vectors codes into vectors (stored one after the other),
+    /// using num_threads threads.
+    void decode(const uint8_t* codes, size_t num_vectors, VElem_t* vectors, size_t num_threads = 1) const;
+
+private:
+    /// Encode one vector. Returns true if an element was clipped.
+    /// Uses 6 work buffers.
+    bool _encode(const VElem_t* vector, uint8_t* code, WorkBuff* buff) const;
+
+    /// Decode one code. Uses 2 work buffers.
+    void _decode(const uint8_t* code, VElem_t* vector, WorkBuff* buff) const;
+
+    Dim_t                   m_dim;
+    Distance_t              m_packing_radius;
+    Distance_t              m_scale;
+    unsigned                m_bits;
+    size_t                  m_code_size;
+    CElem_t                 m_min;      // range of a c-vector element
+    CElem_t                 m_max;
+    std::vector<VElem_t>    m_base;
+};
+
+
+#endif // LATTICECODEC__H
@@ -0,0 +1,109 @@
+/*
+ * A resumable (pull-style) walk of the extended probes of a query.
+ *
+ * Author: Barry Drake
+ */
+
+#include "ProbeCursor.h"
+
+#include "AStarLattice.h"
+#include "AStarProbes.h"
+#include "Hash.h"
+
+
+ProbeCursor::ProbeCursor(const AStarNN& hasher)
+    : m_hasher(hasher)
+    , m_dim(hasher.dim())
+    , m_stack(hasher.dim(), 7)
+    , m_hash_code(0)
+    , m_stream(0)
+    , m_remaining(0)
+    , m_at_first(false)
+{
+    WorkBuff* buff = m_stack.buff();
+
+    m_mapped         = get_buff<VElem_t>(buff);
+    m_xmod           = get_buff<VElem_t>(buff);
+    m_c              = get_buff<CElem_t>(buff);
+    m_order          = get_buff<Order_t>(buff);
+    m_ordered_powers = get_buff<Hash_t>(buff);
+    m_work           = buff;
+}
+
+
+void ProbeCursor::start(const VElem_t* vector)
+{
+    AStarLattice::to_lattice_space(m_dim, m_hasher.scale(), m_hasher.transform(), vector, m_mapped);
+    AStarLattice::setK0(m_dim, m_mapped, m_xmod, m_c, m_order, m_work);
+    Hash::makeOrdered(m_dim, m_order, m_ordered_powers);
+
+    m_hash_code = Hash::hash(m_dim, m_c);
+    m_stream    = m_hasher.m_probe_diff_stream;
+    m_remaining = m_hasher.num_probes();
+    m_at_first  = true;
+}
+
+
+size_t ProbeCursor::next(size_t max_probes, Hash_t* hashes, CElem_t* cvectors)
+{
+    const size_t dimp = size_t(m_dim) + 1;
+
+    size_t count = 0;
+    while (count < max_probes && m_remaining > 0)
+    {
+        if (m_at_first)
+        {
+            m_at_first = false;
+        }
+        else
+        {
+            advance();
+        }
+
+        hashes[count] = m_hash_code;
+        if (cvectors)
+        {
+            CElem_t* dst = cvectors + count * dimp;
+            for (size_t i = 0; i < dimp; ++i)
+            {
+                dst[i] = m_c[i];
+            }
+        }
+
+        ++count;
+        --m_remaining;
+    }
+    return count;
+}
+
+
+void ProbeCursor::advance(void)
+{
+    // See ProbeWalk::extended for the format of the stream.
+
+    const Order_t* stream = m_stream;
+
+    // Skip k, which is not needed.
+    ++stream;
+
+    Order_t diffCol = *stream++;
+    while (diffCol != AStarProbes::STREAM_MARK)
+    {
+        m_c[m_order[diffCol]]--;
+        m_hash_code -= m_ordered_powers[diffCol];
+        diffCol = *stream++;
+    }
+
+    diffCol = *stream++;
+    while (diffCol != AStarProbes::STREAM_MARK)
+    {
+        m_c[m_order[diffCol]]++;
+        m_hash_code += m_ordered_powers[diffCol];
+        diffCol = *stream++;
+    }
+
+    // Consistency check - the stream must cover exactly num_probes probes.
+    ASSERT(stream <= m_hasher.m_probe_diff_stream_end);
+
+    m_stream = stream;
+}
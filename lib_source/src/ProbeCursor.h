@@ -0,0 +1,89 @@
+/*
+ * A resumable (pull-style) walk of the extended probes of a query.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef PROBECURSOR__H
+#define PROBECURSOR__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include "WorkBuff.h"
+
+
+///
+/// A ProbeCursor holds the state of an extended probes query
+/// (as per AStarNN::extended_probes) so that the probes can be
+/// pulled a few at a time with 'next'. Many cursors can be advanced
+/// in turn, so that the lookups of one query can overlap with the
+/// probe generation of another.
+///
+/// A cursor can be reused for any number of queries (see 'start')
+/// without further memory allocation.
+///
+/// The AStarNN object must outlive the cursor.
+///
+class ProbeCursor
+{
+public:
+    ProbeCursor(const AStarNN& hasher);
+
+    ///
+    /// Start a new query, abandoning any current one.
+    /// The vector is in the quantisation space.
+    ///
+    void start(const VElem_t* vector);
+
+    ///
+    /// Get up to max_probes more probes of the current query.
+    /// The hash codes are written to 'hashes' and, if 'cvectors' is not
+    /// null, the (dim + 1) c-vectors are written to 'cvectors'.
+    /// Returns the number of probes written, which is zero only when
+    /// the query is finished.
+    ///
+    size_t next(size_t max_probes, Hash_t* hashes, CElem_t* cvectors = 0);
+
+    /// Number of probes of the current query not yet returned by 'next'.
+    inline size_t remaining(void) const
+    {
+        return m_remaining;
+    }
+
+    /// Are all probes of the current query returned.
+    inline bool done(void) const
+    {
+        return m_remaining == 0;
+    }
+
+    /// The AStarNN object used by this cursor.
+    inline const AStarNN& hasher(void) const
+    {
+        return m_hasher;
+    }
+
+private:
+    // Copy and assignment not implemented
+    ProbeCursor(const ProbeCursor& obj);
+    ProbeCursor& operator=(const ProbeCursor& obj);
+
+    // Move c and m_hash_code to the next probe in the stream.
+    void advance(void);
+
+    const AStarNN&  m_hasher;
+    const Dim_t     m_dim;
+    BuffStack       m_stack;
+    WorkBuff*       m_work;             // scratch for setK0
+    VElem_t*        m_mapped;
+    VElem_t*        m_xmod;
+    CElem_t*        m_c;
+    Order_t*        m_order;
+    Hash_t*         m_ordered_powers;
+    Hash_t          m_hash_code;
+    const Order_t*  m_stream;
+    size_t          m_remaining;
+    bool            m_at_first;         // current probe is the first, not yet advanced
+};
+
+
+#endif // PROBECURSOR__H
@@ -0,0 +1,116 @@
+/*
+ * Per orbit yield statistics of extended probes, for pruning the probe stream.
+ *
+ * Author: Barry Drake
+ */
+
+#include "ProbeProfile.h"
+#include "AStarProbes.h"
+#include "Scheduler.h"
+#include <algorithm>
+#include <mutex>
+
+
+ProbeProfile::ProbeProfile(const AStarNN& hasher)
+    : m_hasher(hasher)
+    , m_hits(AStarProbes::num_zero_probes(hasher.dim(), hasher.num_shells()), 0)
+    , m_num_queries(0)
+    , m_num_neighbours(0)
+    , m_num_found(0)
+{}
+
+
+void ProbeProfile::record(const VElem_t* queries, size_t num_queries, const VElem_t* data,
+                          const size_t* neighbours, size_t k, size_t num_threads)
+{
+    const size_t                    d      = m_hasher.input_dim();
+    const size_t                    dimp   = size_t(m_hasher.dim()) + 1;
+    const std::vector<uint32_t>&    orbits = m_hasher.orbits();
+
+    std::mutex  lock;
+    uint64_t    num_found = 0;
+
+    parallel_for(num_queries, num_threads, 0, [&](size_t begin, size_t end)
+    {
+        std::vector<uint64_t>   hits(m_hits.size(), 0);
+        std::vector<Hash_t>     targets(k);
+        std::vector<bool>       found(k);
+        uint64_t                found_here = 0;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            for (size_t j = 0; j < k; ++j)
+            {
+                targets[j] = m_hasher.nearest_hash(data + neighbours[i * k + j] * d);
+                found[j]   = false;
+            }
+
+            size_t probe = 0;
+            m_hasher.visit_extended(queries + i * d, [&](Hash_t hash_code)
+            {
+                const uint32_t orbit = orbits[probe++ / dimp];
+                for (size_t j = 0; j < k; ++j)
+                {
+                    if (!found[j] && targets[j] == hash_code)
+                    {
+                        found[j] = true;
+                        hits[orbit] += 1;
+                        found_here  += 1;
+                    }
+                }
+            });
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t o = 0; o < hits.size(); ++o)
+        {
+            m_hits[o] += hits[o];
+        }
+        num_found += found_here;
+    });
+
+    m_num_queries    += num_queries;
+    m_num_neighbours += uint64_t(num_queries) * k;
+    m_num_found      += num_found;
+}
+
+
+size_t ProbeProfile::select_orbits(double min_yield, size_t max_probes, uint32_t* orbits) const
+{
+    const size_t dimp = size_t(m_hasher.dim()) + 1;
+
+    std::vector<uint32_t> ranked;
+    for (uint32_t o = 1; o < m_hits.size(); ++o)
+    {
+        const double yield = m_num_neighbours ? double(m_hits[o]) / double(m_num_neighbours) : 0.0;
+        if (yield >= min_yield)
+        {
+            ranked.push_back(o);
+        }
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [this](uint32_t a, uint32_t b)
+    {
+        return m_hits[a] > m_hits[b];
+    });
+
+    size_t num_orbits = 0;
+    orbits[num_orbits++] = 0;
+    for (uint32_t o : ranked)
+    {
+        if (max_probes && (num_orbits + 1) * dimp > max_probes)
+        {
+            break;
+        }
+        orbits[num_orbits++] = o;
+    }
+    return num_orbits;
+}
+
+
+void ProbeProfile::clear(void)
+{
+    std::fill(m_hits.begin(), m_hits.end(), 0);
+    m_num_queries    = 0;
+    m_num_neighbours = 0;
+    m_num_found      = 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Per orbit yield statistics of extended probes, for pruning the probe stream.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef PROBEPROFILE__H
+#define PROBEPROFILE__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include <vector>
+
+
+///
+/// A ProbeProfile counts, for each orbit of an AStarNN's extended probes
+/// (see AStarProbes::generate_probes), how many of the true nearest
+/// neighbours of a set of training queries it finds: a neighbour is found
+/// by the first probe whose hash code is that of its nearest lattice
+/// point, and that probe's orbit is credited.
+///
+/// On real data the orbits of the outer shells may rarely find a
+/// neighbour. select_orbits chooses the orbits worth walking, ordered by
+/// yield, for AStarNN::set_orbits.
+///
+/// The AStarNN object must outlive the profile, and its orbits must not
+/// be changed while recording.
+///
+class ProbeProfile
+{
+public:
+    ProbeProfile(const AStarNN& hasher);
+
+    /// Record the probes of num_queries queries (stored one after the
+    /// other), with the given true nearest neighbours: neighbours[i * k + j]
+    /// is the index into data (of vectors stored one after the other) of
+    /// neighbour j of query i. Uses num_threads threads (see parallel_for).
+    void record(const VElem_t* queries, size_t num_queries, const VElem_t* data,
+                const size_t* neighbours, size_t k, size_t num_threads = 1);
+
+    /// Number of orbits of num_shells() shells, all of which are counted.
+    inline size_t num_orbits(void) const
+    {
+        return m_hits.size();
+    }
+
+    /// The number of neighbours found by each orbit (of num_orbits()).
+    inline const std::vector<uint64_t>& hits(void) const
+    {
+        return m_hits;
+    }
+
+    /// Number of queries recorded.
+    inline uint64_t num_queries(void) const
+    {
+        return m_num_queries;
+    }
+
+    /// Number of neighbours recorded.
+    inline uint64_t num_neighbours(void) const
+    {
+        return m_num_neighbours;
+    }
+
+    /// Number of neighbours found by any probe, the sum of hits().
+    inline uint64_t num_found(void) const
+    {
+        return m_num_found;
+    }
+
+    /// Choose the orbits to walk: orbit 0 (the vertices of the Delaunay
+    /// cell, which is always walked first), then the orbits with a yield
+    /// (hits / num_neighbours()) of at least min_yield, in order of
+    /// decreasing yield (ties in shell order), up to max_probes probes in
+    /// all (no limit if 0). Returns the number of orbits, written to orbits
+    /// (which has room for num_orbits()).
+    size_t select_orbits(double min_yield, size_t max_probes, uint32_t* orbits) const;
+
+    /// Clear the counts.
+    void clear(void);
+
+private:
+    const AStarNN&          m_hasher;
+    std::vector<uint64_t>   m_hits;
+    uint64_t                m_num_queries;
+    uint64_t                m_num_neighbours;
+    uint64_t                m_num_found;
+};
+
+
+#endif // PROBEPROFILE__H
@@ -0,0 +1,578 @@
+/*
+ * Statically dispatched probe generation.
+ *
+ * The functions here walk the nearest, Delaunay and extended probes of a
+ * query vector, passing each probe to a callable (a lambda, function object
+ * or function pointer). The callable's signature is inspected at compile
+ * time so that only the work it needs is done (hash codes, c-vectors or
+ * lattice points) and so that each match is a direct (inlinable) call.
+ *
+ * A callable may be invoked as one of:
+ *      f(Hash_t hash_code, K_t k, const CElem_t* c)
+ *      f(Hash_t hash_code)
+ *      f(K_t k, const CElem_t* c)
+ *      f(const VElem_t* lattice_point)
+ * If more than one form is possible, the first one listed is used.
+ *
+ * If the callable has a member 'init(Dim_t dim, const VElem_t* mapped)'
+ * then it is called once at the start of each query, as per QueryCallback.
+ *
+ * Each query vector is mapped to the lattice space through the given
+ * VectorTransform, if it is not null (see AStarLattice::to_lattice_space).
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef PROBEWALK__H
+#define PROBEWALK__H
+
+#include "common.h"
+#include "AStarLattice.h"
+#include "AStarProbes.h"
+#include "Hash.h"
+#include "WorkBuff.h"
+#include <type_traits>
+#include <utility>
+
+
+namespace ProbeWalk
+{
+    ///
+    /// The kinds of callable signature recognised.
+    ///
+    enum Kind
+    {
+        KIND_PROBE,     // f(hash_code, k, c)
+        KIND_HASH,      // f(hash_code)
+        KIND_CVECTOR,   // f(k, c)
+        KIND_POINT,     // f(lattice_point)
+        KIND_NONE
+    };
+
+
+    // Signature detection, one trait per recognised form.
+
+    template<typename F, typename = void>
+    struct takes_probe : std::false_type {};
+
+    template<typename F>
+    struct takes_probe<F, decltype(void(std::declval<F&>()(std::declval<Hash_t>(), std::declval<K_t>(), std::declval<const CElem_t*>())))>
+        : std::true_type {};
+
+    template<typename F, typename = void>
+    struct takes_hash : std::false_type {};
+
+    template<typename F>
+    struct takes_hash<F, decltype(void(std::declval<F&>()(std::declval<Hash_t>())))>
+        : std::true_type {};
+
+    template<typename F, typename = void>
+    struct takes_cvector : std::false_type {};
+
+    template<typename F>
+    struct takes_cvector<F, decltype(void(std::declval<F&>()(std::declval<K_t>(), std::declval<const CElem_t*>())))>
+        : std::true_type {};
+
+    template<typename F, typename = void>
+    struct takes_point : std::false_type {};
+
+    template<typename F>
+    struct takes_point<F, decltype(void(std::declval<F&>()(std::declval<const VElem_t*>())))>
+        : std::true_type {};
+
+    template<typename F, typename = void>
+    struct has_init : std::false_type {};
+
+    template<typename F>
+    struct has_init<F, decltype(void(std::declval<F&>().init(std::declval<Dim_t>(), std::declval<const VElem_t*>())))>
+        : std::true_type {};
+
+
+    ///
+    /// Compile time properties of a callable type, F.
+    ///
+    template<typename F>
+    struct Traits
+    {
+        static const Kind KIND =
+            takes_probe<F>::value   ? KIND_PROBE   :
+            takes_hash<F>::value    ? KIND_HASH    :
+            takes_cvector<F>::value ? KIND_CVECTOR :
+            takes_point<F>::value   ? KIND_POINT   :
+            KIND_NONE;
+
+        static const bool NEED_HASH    = (KIND == KIND_PROBE || KIND == KIND_HASH);
+        static const bool NEED_CVECTOR = (KIND != KIND_HASH);
+        static const bool NEED_POINT   = (KIND == KIND_POINT);
+
+        static_assert(KIND != KIND_NONE, "callable has no recognised probe signature");
+    };
+
+
+    ///
+    /// Call f with the arguments it wants.
+    /// 'lattice_point' is only used (and need only be valid) for KIND_POINT.
+    ///
+    template<Kind KIND> struct Call;
+
+    template<> struct Call<KIND_PROBE>
+    {
+        template<typename F>
+        static inline void match(F& f, Dim_t, Hash_t hash_code, K_t k, const CElem_t* c, VElem_t*)
+        {
+            f(hash_code, k, c);
+        }
+    };
+
+    template<> struct Call<KIND_HASH>
+    {
+        template<typename F>
+        static inline void match(F& f, Dim_t, Hash_t hash_code, K_t, const CElem_t*, VElem_t*)
+        {
+            f(hash_code);
+        }
+    };
+
+    template<> struct Call<KIND_CVECTOR>
+    {
+        template<typename F>
+        static inline void match(F& f, Dim_t, Hash_t, K_t k, const CElem_t* c, VElem_t*)
+        {
+            f(k, c);
+        }
+    };
+
+    template<> struct Call<KIND_POINT>
+    {
+        template<typename F>
+        static inline void match(F& f, Dim_t dim, Hash_t, K_t k, const CElem_t* c, VElem_t* lattice_point)
+        {
+            AStarLattice::cvector_k_to_lattice_point_in_lattice_space(dim, c, k, lattice_point);
+            f(const_cast<const VElem_t*>(lattice_point));
+        }
+    };
+
+
+    /// Call f.init(dim, mapped) if f has such a method.
+    template<typename F>
+    inline typename std::enable_if<has_init<F>::value>::type
+    init(F& f, Dim_t dim, const VElem_t* mapped)
+    {
+        f.init(dim, mapped);
+    }
+
+    template<typename F>
+    inline typename std::enable_if<!has_init<F>::value>::type
+    init(F&, Dim_t, const VElem_t*)
+    {}
+
+
+    ///
+    /// Call f for each of the n+1 vertices of the Delaunay cell found by
+    /// setK0 (as c and order). c is changed.
+    ///
+    /// Each vertex is the previous one with one element of c decremented,
+    /// so its hash code is the previous one less one power of RADIX: only
+    /// the first hash code is computed in full.
+    ///
+    template<typename F>
+    inline void walk_delaunay
+    (
+        Dim_t           dim,
+        CElem_t*        c,
+        const Order_t*  order,
+        F&              f,
+        VElem_t*        lattice_point
+    )
+    {
+        typedef Traits<F> T;
+
+        //
+        // The first probe, where all elements of the canonical probe are zero.
+        //
+        Hash_t hash_code =
+            T::NEED_HASH ?
+            Hash::hash(dim, c) :
+            0;
+
+        Call<T::KIND>::match(f, dim, hash_code, 0, c, lattice_point);
+
+        //
+        // Determine the other Delaunay cell vertices.
+        //
+        const Hash_t* powers =
+            T::NEED_HASH ?
+            Hash::powers(dim) :
+            0;
+
+        for (K_t k = 1; k <= ((K_t)dim); k++)
+        {
+            const Order_t col = order[k - 1];
+
+            if (T::NEED_CVECTOR)
+                c[col]--;
+
+            if (T::NEED_HASH)
+                hash_code -= powers[col];
+
+            Call<T::KIND>::match(f, dim, hash_code, k, c, lattice_point);
+        }
+    }
+
+
+    ///
+    /// Call f for each of the extended probes around the Delaunay cell
+    /// found by setK0 (as c and order), as given by a probe diff stream.
+    /// c is changed; ordered_powers is working space.
+    ///
+    template<typename F>
+    inline void walk_extended
+    (
+        Dim_t           dim,
+        CElem_t*        c,
+        const Order_t*  order,
+        Hash_t*         ordered_powers,
+        const Order_t*  probe_diff_stream,
+        const Order_t*  end,
+        F&              f,
+        VElem_t*        lattice_point
+    )
+    {
+        typedef Traits<F> T;
+
+        //
+        // Precompute the ordered array of powers of RADIX for fast indexing in hash.
+        //
+        if (T::NEED_HASH)
+        {
+            Hash::makeOrdered(dim, order, ordered_powers);
+        }
+
+        //
+        // The first probe, where all elements of the canonical probe are zero.
+        //
+        Hash_t hash_code =
+            T::NEED_HASH ?
+            Hash::hash(dim, c) :
+            0;
+
+        Call<T::KIND>::match(f, dim, hash_code, 0, c, lattice_point);
+
+        //
+        // Loop over each of the remaining probes.
+        //
+        do
+        {
+            // Extract k from the start of the stream segment for this probe
+            const K_t k = *probe_diff_stream++;
+
+            // Apply the decrement adjustments per column specified in the stream.
+            Order_t diffCol = *probe_diff_stream++;
+            while (diffCol != AStarProbes::STREAM_MARK)
+            {
+                if (T::NEED_CVECTOR)
+                    c[order[diffCol]]--;
+
+                if (T::NEED_HASH)
+                    hash_code -= ordered_powers[diffCol];
+
+                diffCol = *probe_diff_stream++;
+            }
+
+            // Apply the increment adjustments per column specified in the stream.
+            diffCol = *probe_diff_stream++;
+            while (diffCol != AStarProbes::STREAM_MARK)
+            {
+                if (T::NEED_CVECTOR)
+                    c[order[diffCol]]++;
+
+                if (T::NEED_HASH)
+                    hash_code += ordered_powers[diffCol];
+
+                diffCol = *probe_diff_stream++;
+            }
+
+            Call<T::KIND>::match(f, dim, hash_code, k, c, lattice_point);
+        }
+        while (probe_diff_stream < end);
+    }
+
+
+    ///
+    /// Call f exactly once for the lattice point nearest to the vector.
+    ///
+    template<typename F>
+    inline void nearest
+    (
+        Dim_t                   dim,
+        Distance_t              scale,
+        const VectorTransform*  transform,
+        const VElem_t*          vector,
+        F&                      f
+    )
+    {
+        typedef Traits<F> T;
+
+        BuffStack       stack(dim, 6);
+        WorkBuff*       buff = stack.buff();
+
+        VElem_t*        lattice_point =
+                        T::NEED_POINT ?
+                        get_buff<VElem_t>(buff) :
+                        0;
+
+        VElem_t*        mapped = get_buff<VElem_t>(buff);
+        CElem_t*        c      = get_buff<CElem_t>(buff);
+        K_t             k;
+
+        //
+        // Map the vector to the lattice representation space (including rescaling).
+        //
+        AStarLattice::to_lattice_space(dim, scale, transform, vector, mapped);
+
+        init(f, dim, mapped);
+
+        //
+        // Find the closest lattice point (i.e. containing Voronoi cell).
+        //
+        AStarLattice::closest_point(dim, mapped, k, c, buff);
+
+        Hash_t hash_code =
+            T::NEED_HASH ?
+            Hash::hash(dim, c) :
+            0;
+
+        Call<T::KIND>::match(f, dim, hash_code, k, c, lattice_point);
+    }
+
+
+    ///
+    /// Call f for each of the n+1 vertices of the Delaunay cell
+    /// containing the vector.
+    ///
+    template<typename F>
+    inline void delaunay
+    (
+        Dim_t                   dim,
+        Distance_t              scale,
+        const VectorTransform*  transform,
+        const VElem_t*          vector,
+        F&                      f
+    )
+    {
+        typedef Traits<F> T;
+
+        BuffStack       stack(dim, 5);
+        WorkBuff*       buff = stack.buff();
+
+        VElem_t*        lattice_point =
+                        T::NEED_POINT ?
+                        get_buff<VElem_t>(buff) :
+                        0;
+
+        VElem_t*        mapped = get_buff<VElem_t>(buff);
+        CElem_t*        c      = get_buff<CElem_t>(buff);
+        VElem_t*        xmod   = get_buff<VElem_t>(buff);
+        Order_t*        order  = get_buff<Order_t>(buff);
+
+        //
+        // Map the vector to the lattice representation space (including rescaling).
+        //
+        AStarLattice::to_lattice_space(dim, scale, transform, vector, mapped);
+
+        init(f, dim, mapped);
+
+        //
+        // Find the containing Delaunay cell.
+        //
+        AStarLattice::setK0(dim, mapped, xmod, c, order, buff);
+
+        walk_delaunay(dim, c, order, f, lattice_point);
+    }
+
+
+    ///
+    /// Call f for each of the lattice points that form shells around the
+    /// hole nearest to the vector, as given by a probe diff stream
+    /// (see AStarProbes::generate_probe_diffs).
+    ///
+    template<typename F>
+    inline void extended
+    (
+        Dim_t                   dim,
+        Distance_t              scale,
+        const VectorTransform*  transform,
+        const Order_t*          probe_diff_stream,
+        const Order_t*          end,
+        const VElem_t*          vector,
+        F&                      f
+    )
+    {
+        typedef Traits<F> T;
+
+        BuffStack       stack(dim, 7);
+        WorkBuff*       buff = stack.buff();
+
+        VElem_t*        lattice_point =
+                        T::NEED_POINT ?
+                        get_buff<VElem_t>(buff) :
+                        0;
+
+        VElem_t*        mapped         = get_buff<VElem_t>(buff);
+        CElem_t*        c              = get_buff<CElem_t>(buff);
+        VElem_t*        xmod           = get_buff<VElem_t>(buff);
+        Order_t*        order          = get_buff<Order_t>(buff);
+        Hash_t*         ordered_powers = get_buff<Hash_t>(buff);
+
+        //
+        // Map the vector to the lattice representation space (including rescaling).
+        //
+        AStarLattice::to_lattice_space(dim, scale, transform, vector, mapped);
+
+        init(f, dim, mapped);
+
+        //
+        // Find the containing Delaunay cell.
+        //
+        AStarLattice::setK0(dim, mapped, xmod, c, order, buff);
+
+        walk_extended(dim, c, order, ordered_powers, probe_diff_stream, end, f, lattice_point);
+    }
+
+
+    ///
+    /// As per extended, and return the hash code of the lattice point
+    /// nearest to the vector, found from the same decode: the nearest lattice
+    /// point is the Delaunay cell vertex selected by AStarLattice::nearest_vertex.
+    /// The first n+1 probes are the Delaunay cell vertices.
+    ///
+    template<typename F>
+    inline Hash_t extended_nearest
+    (
+        Dim_t                   dim,
+        Distance_t              scale,
+        const VectorTransform*  transform,
+        const Order_t*          probe_diff_stream,
+        const Order_t*          end,
+        const VElem_t*          vector,
+        F&                      f
+    )
+    {
+        typedef Traits<F> T;
+
+        BuffStack       stack(dim, 7);
+        WorkBuff*       buff = stack.buff();
+
+        VElem_t*        lattice_point =
+                        T::NEED_POINT ?
+                        get_buff<VElem_t>(buff) :
+                        0;
+
+        VElem_t*        mapped         = get_buff<VElem_t>(buff);
+        CElem_t*        c              = get_buff<CElem_t>(buff);
+        VElem_t*        xmod           = get_buff<VElem_t>(buff);
+        Order_t*        order          = get_buff<Order_t>(buff);
+        Hash_t*         ordered_powers = get_buff<Hash_t>(buff);
+
+        //
+        // Map the vector to the lattice representation space (including rescaling).
+        //
+        AStarLattice::to_lattice_space(dim, scale, transform, vector, mapped);
+
+        init(f, dim, mapped);
+
+        //
+        // Find the containing Delaunay cell, and the nearest of its vertices.
+        //
+        AStarLattice::setK0(dim, mapped, xmod, c, order, buff);
+
+        const K_t       nearest_k = AStarLattice::nearest_vertex(dim, xmod, order);
+        const Hash_t*   powers    = Hash::powers(dim);
+        Hash_t          nearest   = Hash::hash(dim, c);
+        for (K_t k = 0; k < nearest_k; ++k)
+        {
+            nearest -= powers[order[k]];
+        }
+
+        walk_extended(dim, c, order, ordered_powers, probe_diff_stream, end, f, lattice_point);
+        return nearest;
+    }
+
+
+    ///
+    /// Call f for the fewest probes that are sure to include the hash code
+    /// of every vector within 'radius' of the vector (in the vector space):
+    /// the nearest lattice point if the ball of that radius is inside its
+    /// Voronoi cell, else the n+1 vertices of the Delaunay cell if the
+    /// ball is inside it (the nearest lattice point of any vector in a
+    /// Delaunay cell is one of its vertices). Otherwise, all of the
+    /// extended probes are visited, with no such guarantee.
+    /// Returns the number of probes visited.
+    ///
+    template<typename F>
+    inline size_t adaptive
+    (
+        Dim_t                   dim,
+        Distance_t              scale,
+        const VectorTransform*  transform,
+        const Order_t*          probe_diff_stream,
+        const Order_t*          end,
+        size_t                  num_probes,
+        const VElem_t*          vector,
+        Distance_t              radius,
+        F&                      f
+    )
+    {
+        typedef Traits<F> T;
+
+        BuffStack       stack(dim, 9);
+        WorkBuff*       buff = stack.buff();
+
+        VElem_t*        lattice_point =
+                        T::NEED_POINT ?
+                        get_buff<VElem_t>(buff) :
+                        0;
+
+        VElem_t*        mapped         = get_buff<VElem_t>(buff);
+        CElem_t*        c              = get_buff<CElem_t>(buff);
+        VElem_t*        xmod           = get_buff<VElem_t>(buff);
+        Order_t*        order          = get_buff<Order_t>(buff);
+        Hash_t*         ordered_powers = get_buff<Hash_t>(buff);
+        K_t             k;
+
+        //
+        // Map the vector to the lattice representation space (including rescaling).
+        //
+        AStarLattice::to_lattice_space(dim, scale, transform, vector, mapped);
+
+        init(f, dim, mapped);
+
+        // The radius in the lattice representation space.
+        const VElem_t   r = radius * scale;
+
+        AStarLattice::closest_point(dim, mapped, k, c, buff);
+        if (r <= AStarLattice::cell_margin(dim, mapped, k, c, buff))
+        {
+            Hash_t hash_code =
+                T::NEED_HASH ?
+                Hash::hash(dim, c) :
+                0;
+
+            Call<T::KIND>::match(f, dim, hash_code, k, c, lattice_point);
+            return 1;
+        }
+
+        AStarLattice::setK0(dim, mapped, xmod, c, order, buff);
+        if (r <= AStarLattice::delaunay_margin(dim, xmod, order))
+        {
+            walk_delaunay(dim, c, order, f, lattice_point);
+            return size_t(dim) + 1;
+        }
+
+        walk_extended(dim, c, order, ordered_powers, probe_diff_stream, end, f, lattice_point);
+        return num_probes;
+    }
+}
+
+
+#endif // PROBEWALK__H
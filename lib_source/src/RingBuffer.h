@@ -0,0 +1,158 @@
+/*
+ * A bounded lock-free queue for passing work between threads.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef RINGBUFFER__H
+#define RINGBUFFER__H
+
+#include "common.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+
+///
+/// A bounded multi-producer, multi-consumer lock-free queue
+/// (Dmitry Vyukov's algorithm). Each slot has a sequence number that
+/// tells producers and consumers whose turn it is, so no locks or
+/// unbounded retries are needed.
+///
+/// T must be cheap to copy, e.g., a pointer.
+/// The capacity is rounded up to a power of two.
+///
+template<typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t capacity)
+        : m_mask(round_up_to_power_of_two(capacity) - 1)
+        , m_slots(new Slot[m_mask + 1])
+        , m_head(0)
+        , m_tail(0)
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// Add an item. Returns false (and does nothing) if the queue is full.
+    bool try_push(const T& item)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = m_slots[pos & m_mask];
+            const size_t seq = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.item = item;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Remove an item. Returns false if the queue is empty.
+    bool try_pop(T& item)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = m_slots[pos & m_mask];
+            const size_t seq = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    item = slot.item;
+                    slot.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Add an item, yielding while the queue is full (backpressure).
+    void push(const T& item)
+    {
+        while (!try_push(item))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    /// Remove an item, yielding while the queue is empty.
+    T pop(void)
+    {
+        T item;
+        while (!try_pop(item))
+        {
+            std::this_thread::yield();
+        }
+        return item;
+    }
+
+    inline size_t capacity(void) const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    // Copy and assignment not implemented
+    RingBuffer(const RingBuffer& obj);
+    RingBuffer& operator=(const RingBuffer& obj);
+
+    static size_t round_up_to_power_of_two(size_t n)
+    {
+        size_t result = 2;
+        while (result < n)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T                   item;
+    };
+
+    const size_t            m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+
+    // The head and tail are written by different threads, so they are
+    // kept a cache line apart. This is padding rather than alignas(64),
+    // as a RingBuffer may be allocated with new, which (before C++17)
+    // does not honour over-alignment.
+    std::atomic<size_t>     m_head;
+    char                    m_pad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t>     m_tail;
+};
+
+
+#endif // RINGBUFFER__H
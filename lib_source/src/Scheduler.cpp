@@ -0,0 +1,231 @@
+/*
+ * A work-stealing scheduler for batch operations.
+ *
+ * Author: Barry Drake
+ */
+
+#include "Scheduler.h"
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+WorkStealingDeque::WorkStealingDeque(void)
+    : m_top(0)
+    , m_bottom(0)
+{
+    for (size_t i = 0; i < CAPACITY; ++i)
+    {
+        m_slots[i].begin.store(0, std::memory_order_relaxed);
+        m_slots[i].end.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+void WorkStealingDeque::push(const RowRange& range)
+{
+    const int64_t b = m_bottom.load(std::memory_order_relaxed);
+    const int64_t t = m_top.load(std::memory_order_acquire);
+    if (b - t >= int64_t(CAPACITY))
+    {
+        throw Error_unknown;
+    }
+
+    Slot& slot = m_slots[size_t(b) % CAPACITY];
+    slot.begin.store(range.begin, std::memory_order_relaxed);
+    slot.end.store(range.end, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+
+bool WorkStealingDeque::pop(RowRange& range)
+{
+    const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // Empty
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const Slot& slot = m_slots[size_t(b) % CAPACITY];
+    range.begin = slot.begin.load(std::memory_order_relaxed);
+    range.end   = slot.end.load(std::memory_order_relaxed);
+
+    if (t == b)
+    {
+        // Last entry - race against thieves for it.
+        const bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+
+bool WorkStealingDeque::steal(RowRange& range)
+{
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = m_bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+    {
+        return false;
+    }
+
+    const Slot& slot = m_slots[size_t(t) % CAPACITY];
+    range.begin = slot.begin.load(std::memory_order_relaxed);
+    range.end   = slot.end.load(std::memory_order_relaxed);
+
+    return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+
+namespace
+{
+    ///
+    /// The state shared by the threads of one parallel_for call.
+    ///
+    struct Job
+    {
+        Job(size_t num_rows, size_t num_threads, size_t grain, const std::function<void(size_t, size_t)>& body)
+            : deques(new WorkStealingDeque[num_threads])
+            , num_threads(num_threads)
+            , grain(grain)
+            , body(body)
+            , remaining(num_rows)
+            , failed(false)
+        {}
+
+        std::unique_ptr<WorkStealingDeque[]>        deques;
+        const size_t                                num_threads;
+        const size_t                                grain;
+        const std::function<void(size_t, size_t)>& body;
+        std::atomic<size_t>                         remaining;
+        std::atomic<bool>                           failed;
+        std::exception_ptr                          error;      // written by the first thread to fail
+    };
+
+
+    void work(Job& job, size_t self)
+    {
+        WorkStealingDeque& deque = job.deques[self];
+        size_t victim = self;
+
+        while (job.remaining.load(std::memory_order_acquire) > 0 && !job.failed.load(std::memory_order_relaxed))
+        {
+            RowRange range;
+            if (!deque.pop(range))
+            {
+                // Try to steal, from each other thread in turn.
+                victim = (victim + 1) % job.num_threads;
+                if (victim == self || !job.deques[victim].steal(range))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+            }
+
+            // Keep splitting, leaving the upper halves for thieves.
+            while (range.size() > job.grain)
+            {
+                RowRange upper;
+                upper.begin = range.begin + range.size() / 2;
+                upper.end   = range.end;
+                deque.push(upper);
+                range.end = upper.begin;
+            }
+
+            try
+            {
+                job.body(range.begin, range.end);
+            }
+            catch (...)
+            {
+                bool expected = false;
+                if (job.failed.compare_exchange_strong(expected, true))
+                {
+                    job.error = std::current_exception();
+                }
+            }
+
+            job.remaining.fetch_sub(range.size(), std::memory_order_acq_rel);
+        }
+    }
+}
+
+
+void parallel_for
+(
+    size_t                                      num_rows,
+    size_t                                      num_threads,
+    size_t                                      grain,
+    const std::function<void(size_t, size_t)>& body
+)
+{
+    if (num_rows == 0)
+    {
+        return;
+    }
+    if (num_threads == 0)
+    {
+        num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0)
+        {
+            num_threads = 1;
+        }
+    }
+    if (num_threads == 1)
+    {
+        body(0, num_rows);
+        return;
+    }
+    if (grain == 0)
+    {
+        // Aim for many more ranges than threads, for balancing.
+        grain = num_rows / (num_threads * 64);
+        if (grain == 0)
+        {
+            grain = 1;
+        }
+    }
+
+    Job job(num_rows, num_threads, grain, body);
+
+    RowRange all;
+    all.begin = 0;
+    all.end   = num_rows;
+    job.deques[0].push(all);
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (size_t i = 1; i < num_threads; ++i)
+    {
+        try
+        {
+            threads.push_back(std::thread(work, std::ref(job), i));
+        }
+        catch (...)
+        {
+            // Carry on with the threads we have.
+            break;
+        }
+    }
+    work(job, 0);
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+
+    if (job.error)
+    {
+        std::rethrow_exception(job.error);
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * A work-stealing scheduler for batch operations.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SCHEDULER__H
+#define SCHEDULER__H
+
+#include "common.h"
+#include <atomic>
+#include <functional>
+
+
+///
+/// A range of rows, [begin, end), of a batch.
+///
+struct RowRange
+{
+    size_t begin;
+    size_t end;
+
+    inline size_t size(void) const
+    {
+        return end - begin;
+    }
+};
+
+
+///
+/// A Chase-Lev work-stealing deque of row ranges, with a fixed capacity.
+///
+/// The owning thread pushes and pops at the bottom; any other thread
+/// may steal from the top. Ranges are split in half as they are taken,
+/// so the deque depth is bounded by log2 of the batch size and a fixed
+/// capacity suffices.
+///
+class WorkStealingDeque
+{
+public:
+    static const size_t CAPACITY = 128;
+
+    WorkStealingDeque(void);
+
+    /// Owner only. Throws Error_unknown if the deque is full.
+    void push(const RowRange& range);
+
+    /// Owner only. Returns false if the deque is empty.
+    bool pop(RowRange& range);
+
+    /// Any thread. Returns false if the deque is empty or the
+    /// steal lost a race (in which case the caller may simply retry).
+    bool steal(RowRange& range);
+
+private:
+    // Copy and assignment not implemented
+    WorkStealingDeque(const WorkStealingDeque& obj);
+    WorkStealingDeque& operator=(const WorkStealingDeque& obj);
+
+    // A slot may be read by a thief while the owner rewrites it (the
+    // thief then fails its CAS and discards the value), so the fields
+    // are atomic.
+    struct Slot
+    {
+        std::atomic<size_t> begin;
+        std::atomic<size_t> end;
+    };
+
+    std::atomic<int64_t>    m_top;
+    std::atomic<int64_t>    m_bottom;
+    Slot                    m_slots[CAPACITY];
+};
+
+
+///
+/// Call body(begin, end) over disjoint sub-ranges covering the rows
+/// [0, num_rows), using num_threads threads (including the caller).
+///
+/// Ranges are split in half, down to 'grain' rows, as they are taken
+/// from a thread's deque, and idle threads steal the largest remaining
+/// ranges from the others. This balances the load when the cost per row
+/// is very uneven. A grain of 0 picks a grain from num_rows and
+/// num_threads.
+///
+/// If a call of 'body' throws, no further ranges are started, and the
+/// exception is rethrown in the calling thread once all threads have
+/// stopped.
+///
+void parallel_for
+(
+    size_t                                      num_rows,
+    size_t                                      num_threads,
+    size_t                                      grain,
+    const std::function<void(size_t, size_t)>& body
+);
+
+
+#endif // SCHEDULER__H
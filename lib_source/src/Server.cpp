@@ -0,0 +1,776 @@
+/*
+ * A local query server for an index of vectors.
+ *
+ * Author: Barry Drake
+ */
+
+#include "Server.h"
+#include "ServerProtocol.h"
+#include "Socket.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+using namespace ServerProtocol;
+
+
+/// How often (milliseconds) the accepting thread checks for 'stop'.
+static const int ACCEPT_POLL_MS = 100;
+
+/// How many errors in a row (one poll interval apart) the accepting
+/// thread tolerates on the listening socket before giving up.
+static const int MAX_ACCEPT_ERRORS = 10;
+
+
+///
+/// A probe callable that calls f(hash_code, distance) for each probe, where
+/// distance is from the query to the probe's lattice point, in the vector
+/// space.
+///
+template<typename F>
+class WithDistance
+{
+public:
+    WithDistance(Distance_t scale, F& f)
+        : m_inverse_scale(1.0 / scale)
+        , m_f(f)
+        , m_dim(0)
+        , m_mapped(0)
+    {}
+
+    void init(Dim_t dim, const VElem_t* mapped)
+    {
+        m_dim    = dim;
+        m_mapped = mapped;
+    }
+
+    void operator()(Hash_t hash_code, K_t k, const CElem_t* c)
+    {
+        // The lattice point is (n+1) c + k in the lattice space.
+        const double dimp = m_dim + 1;
+        double       sum  = 0;
+        for (Dim_t i = 0; i <= m_dim; ++i)
+        {
+            const double d = m_mapped[i] - (dimp * c[i] + k);
+            sum += d * d;
+        }
+        m_f(hash_code, VElem_t(std::sqrt(sum) * m_inverse_scale));
+    }
+
+private:
+    const double    m_inverse_scale;
+    F&              m_f;
+    Dim_t           m_dim;
+    const VElem_t*  m_mapped;
+};
+
+template<typename F>
+inline WithDistance<F> with_distance(Distance_t scale, F& f)
+{
+    return WithDistance<F>(scale, f);
+}
+
+
+struct AStarServer::Pending
+{
+    uint32_t                op;
+    uint32_t                k;
+    size_t                  num_vectors;
+    const VElem_t*          vectors;
+    std::vector<uint64_t>*  counts;     // the reply rows
+    std::vector<uint64_t>*  items;      // the reply items
+    Error                   error;
+    bool                    done;
+};
+
+
+AStarServer::AStarServer(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells,
+                         const VElem_t* vectors, size_t num_vectors, const size_t* elems, size_t num_threads)
+    : m_dim(dim)
+    , m_vectors(vectors)
+    , m_num_vectors(num_vectors)
+    , m_num_threads(num_threads)
+    , m_elems(elems, elems ? elems + num_vectors : elems)
+    , m_max_batch(DEFAULT_MAX_BATCH)
+    , m_listen_fd(-1)
+    , m_stopping(false)
+    , m_accept_failed(false)
+    , m_batch_stop(false)
+    , m_num_requests(0)
+    , m_num_batches(0)
+    , m_num_distances(0)
+    , m_num_pruned(0)
+{
+    m_current = _quantise(packing_radius, num_shells);
+}
+
+
+AStarServer::~AStarServer(void)
+{
+    stop();
+}
+
+
+std::shared_ptr<const AStarIndex<size_t> > AStarServer::index(void) const
+{
+    std::shared_ptr<const Quantised> current = _current();
+    return std::shared_ptr<const AStarIndex<size_t> >(current, &current->index);
+}
+
+
+void AStarServer::requantize(Distance_t packing_radius, NumShells_t num_shells)
+{
+    std::lock_guard<std::mutex> lock(m_requantize_mutex);
+    std::shared_ptr<const Quantised> quantised = _quantise(packing_radius, num_shells);
+    std::atomic_store(&m_current, quantised);
+}
+
+
+std::shared_ptr<const AStarServer::Quantised> AStarServer::_quantise(Distance_t packing_radius, NumShells_t num_shells) const
+{
+    std::shared_ptr<Quantised> quantised(std::make_shared<Quantised>(m_dim, packing_radius, num_shells));
+
+    std::vector<size_t> rows(m_num_vectors);
+    for (size_t i = 0; i < m_num_vectors; ++i)
+    {
+        rows[i] = i;
+    }
+    quantised->index.put_batch(m_vectors, m_num_vectors, rows.data(), m_num_threads);
+
+    std::vector<VElem_t>& residuals = quantised->residuals;
+    const AStarNN&        hash      = quantised->hash;
+    residuals.resize(m_num_vectors);
+    parallel_for(m_num_vectors, m_num_threads, 0, [this, &residuals, &hash](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            VElem_t* residual = &residuals[i];
+            auto keep = [residual](Hash_t, VElem_t distance) { *residual = distance; };
+            hash.visit_nearest(m_vectors + i * m_dim, with_distance(hash.scale(), keep));
+        }
+    });
+    quantised->max_residual = residuals.empty() ? 0 : *std::max_element(residuals.begin(), residuals.end());
+    return quantised;
+}
+
+
+void AStarServer::start(const char* socket_path, size_t max_batch)
+{
+    if (running())
+    {
+        throw Error_unknown;
+    }
+    stop();     // the threads of a server that stopped accepting
+
+    m_listen_fd   = Socket::listen_unix(socket_path);
+    m_socket_path = socket_path;
+    m_max_batch   = std::max<size_t>(max_batch, 1);
+    m_stopping    = false;
+    m_batch_stop  = false;
+    m_accept_failed = false;
+
+    m_batch_thread  = std::thread(&AStarServer::_batch_loop, this);
+    m_accept_thread = std::thread(&AStarServer::_accept_loop, this);
+}
+
+
+void AStarServer::stop(void)
+{
+    if (m_listen_fd < 0)
+    {
+        return;
+    }
+
+    // No new connections.
+    m_stopping = true;
+    m_accept_thread.join();
+    Socket::close(m_listen_fd);
+    std::remove(m_socket_path.c_str());
+
+    // End the current connections. Their outstanding requests are
+    // still completed by the batching thread.
+    {
+        std::lock_guard<std::mutex> lock(m_connections_mutex);
+        for (auto it = m_connections.begin(); it != m_connections.end(); ++it)
+        {
+            Socket::shutdown((*it)->fd);
+        }
+    }
+    _reap(true);
+
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        m_batch_stop = true;
+    }
+    m_queue_cv.notify_all();
+    m_batch_thread.join();
+
+    m_listen_fd = -1;
+}
+
+
+void AStarServer::_reap(bool all)
+{
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    auto it = m_connections.begin();
+    while (it != m_connections.end())
+    {
+        Connection& connection = **it;
+        if (all || connection.finished)
+        {
+            connection.thread.join();
+            Socket::close(connection.fd);
+            it = m_connections.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+
+void AStarServer::_accept_loop(void)
+{
+    int num_errors = 0;
+    while (!m_stopping)
+    {
+        int fd;
+        try
+        {
+            fd = Socket::accept(m_listen_fd, ACCEPT_POLL_MS);
+            num_errors = 0;
+        }
+        catch (Error)
+        {
+            // The error may pass (e.g. out of memory); if not, stop
+            // accepting and say so through running().
+            if (++num_errors >= MAX_ACCEPT_ERRORS)
+            {
+                m_accept_failed = true;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_POLL_MS));
+            continue;
+        }
+
+        _reap(false);
+
+        if (fd >= 0)
+        {
+            std::unique_ptr<Connection> connection(new Connection);
+            connection->fd       = fd;
+            connection->finished = false;
+
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            Connection* raw = connection.get();
+            m_connections.push_back(std::move(connection));
+            raw->thread = std::thread(&AStarServer::_serve, this, raw);
+        }
+    }
+}
+
+
+void AStarServer::_serve(Connection* connection)
+{
+    const int   fd  = connection->fd;
+    const Dim_t dim = m_dim;
+
+    std::vector<VElem_t>  vectors;
+    std::vector<uint64_t> hash_counts;
+    std::vector<Hash_t>   hashes;
+    std::vector<uint64_t> counts;
+    std::vector<uint64_t> items;
+
+    try
+    {
+        Request request;
+        while (Socket::read_all(fd, &request, sizeof(request)))
+        {
+            if (request.magic != MAGIC)
+            {
+                break;
+            }
+
+            Response response;
+            response.magic     = MAGIC;
+            response.error     = Error_ok;
+            response.num_rows  = 0;
+            response.num_items = 0;
+
+            const size_t n = size_t(request.num_vectors);
+
+            //
+            // A request we can't read the vectors of ends the connection.
+            //
+            if (request.num_vectors > MAX_VECTORS || (n > 0 && request.dim != dim))
+            {
+                response.error = request.num_vectors > MAX_VECTORS ? Error_insufficient_buffers : Error_invalid_dim;
+                Socket::write_all(fd, &response, sizeof(response));
+                break;
+            }
+
+            vectors.resize(n * dim);
+            if (n > 0 && !Socket::read_all(fd, vectors.data(), vectors.size() * sizeof(VElem_t)))
+            {
+                break;
+            }
+
+            if (request.op == OP_HASH_KNN)
+            {
+                hash_counts.resize(n);
+                if (n > 0 && !Socket::read_all(fd, hash_counts.data(), n * sizeof(uint64_t)))
+                {
+                    break;
+                }
+
+                // Each count is checked as it is added, so that the sum
+                // cannot wrap around (and _hash_knn stays within hashes).
+                uint64_t num_hashes = 0;
+                bool     too_many   = false;
+                for (size_t i = 0; i < n && !too_many; ++i)
+                {
+                    too_many    = hash_counts[i] > MAX_HASHES - num_hashes;
+                    num_hashes += too_many ? 0 : hash_counts[i];
+                }
+                if (too_many || num_hashes > MAX_HASHES)
+                {
+                    response.error = Error_insufficient_buffers;
+                    Socket::write_all(fd, &response, sizeof(response));
+                    break;
+                }
+
+                hashes.resize(size_t(num_hashes));
+                if (num_hashes > 0 && !Socket::read_all(fd, hashes.data(), hashes.size() * sizeof(Hash_t)))
+                {
+                    break;
+                }
+            }
+
+            counts.clear();
+            items.clear();
+            try
+            {
+                std::shared_ptr<const Quantised> current = _current();
+                const AStarIndex<size_t>& index = current->index;
+
+                switch (request.op)
+                {
+                    case OP_INFO:
+                        counts.push_back(INFO_SIZE);
+                        items.resize(INFO_SIZE);
+                        items[INFO_DIM]         = dim;
+                        items[INFO_NUM_PROBES]  = index.num_probes();
+                        items[INFO_NUM_VECTORS] = m_num_vectors;
+                        items[INFO_NUM_HASHES]  = index.num_hashes();
+                        items[INFO_NUM_SHELLS]  = uint64_t(index.num_shells());
+                        {
+                            const Distance_t packing_radius = index.packing_radius();
+                            std::memcpy(&items[INFO_PACKING_RADIUS], &packing_radius, sizeof(packing_radius));
+                        }
+                        break;
+
+                    case OP_NEAREST_HASH:
+                        counts.assign(n, 1);
+                        for (size_t i = 0; i < n; ++i)
+                        {
+                            items.push_back(index.hash(&vectors[i * dim]));
+                        }
+                        break;
+
+                    case OP_EXTENDED_HASH:
+                        counts.assign(n, index.num_probes());
+                        items.reserve(n * index.num_probes());
+                        for (size_t i = 0; i < n; ++i)
+                        {
+                            current->hash.visit_extended(&vectors[i * dim], [&items](Hash_t hash_code)
+                            {
+                                items.push_back(hash_code);
+                            });
+                        }
+                        break;
+
+                    case OP_HASH_KNN:
+                        _hash_knn(*current, vectors.data(), n, request.k, hash_counts.data(), hashes.data(), counts, items);
+                        break;
+
+                    case OP_CANDIDATES:
+                    case OP_KNN:
+                    {
+                        Pending pending;
+                        pending.op          = request.op;
+                        pending.k           = request.k;
+                        pending.num_vectors = n;
+                        pending.vectors     = vectors.data();
+                        pending.counts      = &counts;
+                        pending.items       = &items;
+                        pending.error       = Error_ok;
+                        pending.done        = false;
+
+                        std::unique_lock<std::mutex> lock(m_queue_mutex);
+                        m_queue.push_back(&pending);
+                        m_queue_cv.notify_one();
+                        m_done_cv.wait(lock, [&pending] { return pending.done; });
+
+                        if (pending.error != Error_ok)
+                        {
+                            throw pending.error;
+                        }
+                        break;
+                    }
+
+                    default:
+                        throw Error_unknown;
+                }
+            }
+            catch (Error e)
+            {
+                response.error = e;
+            }
+            catch (const std::bad_alloc&)
+            {
+                response.error = Error_mem_fail;
+            }
+
+            if (response.error != Error_ok)
+            {
+                counts.clear();
+                items.clear();
+            }
+            response.num_rows  = counts.size();
+            response.num_items = items.size() / item_words(request.op);
+
+            Socket::write_all(fd, &response, sizeof(response));
+            Socket::write_all(fd, counts.data(), counts.size() * sizeof(uint64_t));
+            Socket::write_all(fd, items.data(), items.size() * sizeof(uint64_t));
+        }
+    }
+    catch (...)
+    {
+        // A broken connection, or the server is stopping.
+    }
+
+    connection->finished = true;
+}
+
+
+void AStarServer::_batch_loop(void)
+{
+    std::vector<Pending*> batch;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_queue_mutex);
+            m_queue_cv.wait(lock, [this] { return m_batch_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+            {
+                return;
+            }
+
+            //
+            // Coalesce the waiting requests, in arrival order, up to
+            // m_max_batch vectors (but always at least one request).
+            //
+            size_t num_rows = m_queue[0]->num_vectors;
+            size_t taken    = 1;
+            while (taken < m_queue.size() && num_rows + m_queue[taken]->num_vectors <= m_max_batch)
+            {
+                num_rows += m_queue[taken]->num_vectors;
+                ++taken;
+            }
+            batch.assign(m_queue.begin(), m_queue.begin() + taken);
+            m_queue.erase(m_queue.begin(), m_queue.begin() + taken);
+        }
+
+        Error error = Error_ok;
+        try
+        {
+            _run_batch(batch);
+        }
+        catch (Error e)
+        {
+            error = e;
+        }
+        catch (const std::bad_alloc&)
+        {
+            error = Error_mem_fail;
+        }
+        catch (...)
+        {
+            error = Error_unknown;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                batch[i]->error = error;
+                batch[i]->done  = true;
+            }
+        }
+        m_done_cv.notify_all();
+
+        m_num_requests += batch.size();
+        ++m_num_batches;
+    }
+}
+
+
+void AStarServer::_run_batch(const std::vector<Pending*>& batch)
+{
+    const Dim_t dim = m_dim;
+
+    std::shared_ptr<const Quantised> current = _current();
+    const AStarIndex<size_t>& index = current->index;
+
+    //
+    // Gather the query vectors of the batch.
+    //
+    size_t num_rows = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        num_rows += batch[i]->num_vectors;
+    }
+
+    std::vector<VElem_t> gathered;
+    const VElem_t* queries = batch[0]->vectors;
+    if (batch.size() > 1)
+    {
+        gathered.reserve(num_rows * dim);
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            gathered.insert(gathered.end(), batch[i]->vectors, batch[i]->vectors + batch[i]->num_vectors * dim);
+        }
+        queries = gathered.data();
+    }
+
+    //
+    // One batch query for all the rows: count, then fill.
+    //
+    std::vector<size_t> offsets(num_rows + 1);
+    index.count_extended_batch(queries, num_rows, 0, offsets.data(), m_num_threads);
+
+    size_t total = 0;
+    for (size_t row = 0; row < num_rows; ++row)
+    {
+        size_t count = offsets[row];
+        offsets[row] = total;
+        total += count;
+    }
+    offsets[num_rows] = total;
+
+    std::vector<size_t> elems(total);
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    std::vector<std::vector<Bucket> > buckets(num_rows);
+    index.visit_extended_batch(queries, num_rows, 0, [&elems, &fill, &offsets, &buckets](size_t query, Hash_t hash_code, const size_t& elem)
+    {
+        std::vector<Bucket>& query_buckets = buckets[query];
+        if (query_buckets.empty() || query_buckets.back().first != hash_code)
+        {
+            query_buckets.push_back(Bucket(hash_code, fill[query] - offsets[query]));
+        }
+        elems[fill[query]++] = elem;
+    }, m_num_threads);
+
+    //
+    // Scatter the results to the requests.
+    //
+    std::vector<size_t> rows;
+    size_t row = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        Pending& pending = *batch[i];
+        pending.counts->clear();
+        pending.items->clear();
+
+        for (size_t end = row + pending.num_vectors; row < end; ++row)
+        {
+            const size_t* begin_elem = &elems[0] + offsets[row];
+            const size_t* end_elem   = &elems[0] + offsets[row + 1];
+
+            if (pending.op == OP_CANDIDATES)
+            {
+                pending.counts->push_back(end_elem - begin_elem);
+                for (const size_t* e = begin_elem; e < end_elem; ++e)
+                {
+                    pending.items->push_back(_elem(*e));
+                }
+            }
+            else
+            {
+                rows.assign(begin_elem, end_elem);
+                _rank(*current, queries + row * dim, rows, buckets[row], pending.k, *pending.counts, *pending.items);
+            }
+        }
+    }
+}
+
+
+void AStarServer::_hash_knn(const Quantised& quantised, const VElem_t* queries, size_t num_vectors, uint32_t k,
+                            const uint64_t* hash_counts, const Hash_t* hashes, std::vector<uint64_t>& counts, std::vector<uint64_t>& items)
+{
+    const AStarIndex<size_t>& index = quantised.index;
+    const Dim_t dim = m_dim;
+
+    std::vector<size_t> rows;
+    std::vector<Bucket> buckets;
+    for (size_t i = 0; i < num_vectors; ++i)
+    {
+        rows.clear();
+        buckets.clear();
+        for (const Hash_t* end = hashes + hash_counts[i]; hashes < end; ++hashes)
+        {
+            const size_t old_size = rows.size();
+            const size_t count    = index.count_hash(*hashes);
+            if (count)
+            {
+                rows.resize(old_size + count);
+                buckets.push_back(Bucket(*hashes, old_size));
+                KeepElems<size_t> keep(count, &rows[old_size]);
+                index.get_hash(*hashes, &keep);
+            }
+        }
+        _rank(quantised, queries + i * dim, rows, buckets, k, counts, items);
+    }
+}
+
+
+void AStarServer::_rank(const Quantised& quantised, const VElem_t* query, const std::vector<size_t>& rows,
+                        const std::vector<Bucket>& buckets, size_t k,
+                        std::vector<uint64_t>& counts, std::vector<uint64_t>& items)
+{
+    typedef std::pair<Hash_t, VElem_t> ProbeDistance;
+
+    const Dim_t dim = m_dim;
+    k = std::min(k, rows.size());
+
+    //
+    // The buckets, in order of the distance from the query to their
+    // lattice points, so that the k nearest are found sooner. Finding the
+    // distances costs about as much as ranking num_probes candidates, so
+    // is only worth it if there are more candidates than that to prune.
+    // A bucket that is not one of the query's own probes (as may be asked
+    // for by OP_HASH_KNN) has no known distance, UNKNOWN, so is ranked
+    // first and never pruned.
+    //
+    const VElem_t UNKNOWN = -1;
+    std::vector<std::pair<VElem_t, size_t> > order(buckets.size());
+    const bool bounded = k > 0 && rows.size() > k + quantised.hash.num_probes();
+    if (bounded)
+    {
+        std::vector<ProbeDistance> probes;
+        probes.reserve(quantised.hash.num_probes());
+        auto keep = [&probes](Hash_t hash_code, VElem_t distance)
+        {
+            probes.push_back(ProbeDistance(hash_code, distance));
+        };
+        quantised.hash.visit_extended(query, with_distance(quantised.hash.scale(), keep));
+        std::sort(probes.begin(), probes.end());
+
+        for (size_t b = 0; b < buckets.size(); ++b)
+        {
+            auto found = std::lower_bound(probes.begin(), probes.end(), ProbeDistance(buckets[b].first, -HUGE_VAL));
+            order[b].first  = (found != probes.end() && found->first == buckets[b].first) ? found->second : UNKNOWN;
+            order[b].second = b;
+        }
+        std::sort(order.begin(), order.end());
+    }
+    else
+    {
+        for (size_t b = 0; b < buckets.size(); ++b)
+        {
+            order[b] = std::make_pair(VElem_t(0), b);
+        }
+    }
+
+    //
+    // Keep the k nearest in a max heap. Once it is full, a row v of the
+    // bucket of lattice point p can be skipped if | |q - p| - |v - p| |, a
+    // lower bound of |q - v|, is beyond the k-th nearest. A bucket, and so
+    // all the buckets after it, can be skipped if |q - p| less the largest
+    // residual is.
+    //
+    std::vector<std::pair<VElem_t, size_t> > best;
+    best.reserve(k);
+
+    const VElem_t max_residual  = quantised.max_residual;
+    size_t        num_distances = 0;
+    size_t        num_pruned    = 0;
+
+    for (size_t j = 0; j < order.size() && k > 0; ++j)
+    {
+        const size_t  b     = order[j].second;
+        const size_t  begin = buckets[b].second;
+        const size_t  end   = b + 1 < buckets.size() ? buckets[b + 1].second : rows.size();
+        const VElem_t probe = order[j].first;
+
+        bool check_rows = false;
+        if (bounded && best.size() == k && probe != UNKNOWN)
+        {
+            const VElem_t kth = std::sqrt(best.front().first);
+            if (probe - max_residual > kth)
+            {
+                for (; j < order.size(); ++j)
+                {
+                    const size_t pruned_b = order[j].second;
+                    num_pruned += (pruned_b + 1 < buckets.size() ? buckets[pruned_b + 1].second : rows.size()) - buckets[pruned_b].second;
+                }
+                break;
+            }
+            check_rows = probe > kth || max_residual - probe > kth;
+        }
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            const size_t row = rows[i];
+            if (check_rows)
+            {
+                const VElem_t bound = probe - quantised.residuals[row];
+                if (bound * bound > best.front().first)
+                {
+                    ++num_pruned;
+                    continue;
+                }
+            }
+
+            const VElem_t* v = m_vectors + row * dim;
+            VElem_t distance2 = 0;
+            for (Dim_t d = 0; d < dim; ++d)
+            {
+                VElem_t diff = v[d] - query[d];
+                distance2 += diff * diff;
+            }
+            ++num_distances;
+
+            const std::pair<VElem_t, size_t> ranked(distance2, row);
+            if (best.size() < k)
+            {
+                best.push_back(ranked);
+                std::push_heap(best.begin(), best.end());
+            }
+            else if (ranked < best.front())
+            {
+                std::pop_heap(best.begin(), best.end());
+                best.back() = ranked;
+                std::push_heap(best.begin(), best.end());
+            }
+        }
+    }
+    std::sort_heap(best.begin(), best.end());
+
+    m_num_distances += num_distances;
+    m_num_pruned    += num_pruned;
+
+    counts.push_back(k);
+    for (size_t j = 0; j < k; ++j)
+    {
+        VElem_t  distance = std::sqrt(best[j].first);
+        uint64_t word;
+        std::memcpy(&word, &distance, sizeof(word));
+        items.push_back(_elem(best[j].second));
+        items.push_back(word);
+    }
+}
@@ -0,0 +1,233 @@
+/*
+ * A local query server for an index of vectors, over a Unix domain
+ * socket (see ServerProtocol.h for the wire format and AStarClient
+ * for the client side).
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SERVER__H
+#define SERVER__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include "AStarIndex.h"
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+///
+/// An AStarServer holds an index of num_vectors vectors, where the
+/// element of the i-th vector is elems[i] (or i), and serves queries of it.
+///
+/// Each client connection has its own thread. Hash code requests are
+/// answered directly by the connection thread. Candidate and k-NN
+/// requests are handed to a single batching thread, which coalesces all
+/// the requests waiting at the time into one batch query of the index
+/// (see AStarIndex::visit_extended_batch). So the more concurrent the
+/// clients, the larger the batches.
+///
+/// k-NN queries rank the candidates (the elements found by extended
+/// probing) by their true distance to the query, so the vectors must
+/// outlive the server (they may be memory mapped, for example).
+/// The index keeps the distance from each vector to its lattice point
+/// (its residual), so that a candidate whose lower bound on its distance
+/// (by the triangle inequality, from the query's distance to the lattice
+/// point of the candidate's hash code) is beyond the k-th nearest so far
+/// is skipped without reading its vector. The buckets of the probes are
+/// ranked nearest first, so that whole buckets can be skipped.
+///
+/// A server can also be one shard of a larger index (see ShardCoordinator),
+/// answering k-NN queries of given hash codes (OP_HASH_KNN).
+///
+/// As the server holds the vectors, the index can be rebuilt at another
+/// packing radius while the server runs (see requantize).
+///
+class AStarServer
+{
+public:
+    /// The default maximum number of query vectors in one coalesced batch.
+    static const size_t DEFAULT_MAX_BATCH = 1024;
+
+    /// Build the index of the given vectors (stored one after the other)
+    /// using num_threads threads (see AStarIndex::put_batch).
+    ///
+    /// \param[in]  dim             number of dimensions in the lattice quantisation space, n.
+    /// \param[in]  packing_radius  packing radius of the A* lattice.
+    /// \param[in]  num_shells      number of extended shells for extended probes.
+    /// \param[in]  vectors         num_vectors x dim vectors, which must outlive the server.
+    /// \param[in]  num_vectors     number of vectors.
+    /// \param[in]  elems           the element of each vector (copied), or null for 0, 1, 2, ... .
+    /// \param[in]  num_threads     number of threads used for building and for each batch.
+    ///
+    AStarServer(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells,
+                const VElem_t* vectors, size_t num_vectors, const size_t* elems = 0, size_t num_threads = 1);
+
+    /// Stops the server if running.
+    ~AStarServer(void);
+
+    /// Start serving at the given socket path, which is created (or
+    /// replaced). Returns once the server is listening.
+    void start(const char* socket_path, size_t max_batch = DEFAULT_MAX_BATCH);
+
+    /// Stop serving: close all connections, wait for the server
+    /// threads and remove the socket file. Does nothing if not running.
+    void stop(void);
+
+    /// Is the server running. This becomes false if the server stops
+    /// accepting connections after repeated errors on its socket; stop
+    /// (or start) then releases it.
+    inline bool running(void) const
+    {
+        return m_listen_fd >= 0 && !m_accept_failed;
+    }
+
+    /// The index being served (of row numbers), which is kept for as long
+    /// as the returned pointer even if the server is requantized.
+    std::shared_ptr<const AStarIndex<size_t> > index(void) const;
+
+    /// Rebuild the index at a new packing radius and number of shells,
+    /// from the stored vectors, using the server's threads (see
+    /// AStarIndex::put_batch). The current index keeps serving until the
+    /// new one is complete, and is then swapped for it atomically:
+    /// requests already in progress finish with the old index, later
+    /// ones use the new one. Calls are serialised.
+    ///
+    /// Clients cache num_probes when they connect, and shards must keep
+    /// the packing radius of their ShardMap, so these need to reconnect
+    /// (or be rebuilt) after a change.
+    void requantize(Distance_t packing_radius, NumShells_t num_shells);
+
+    /// Number of k-NN candidates whose distance to the query was computed.
+    inline size_t num_distances(void) const
+    {
+        return m_num_distances.load();
+    }
+
+    /// Number of k-NN candidates skipped by their lower bound.
+    inline size_t num_pruned(void) const
+    {
+        return m_num_pruned.load();
+    }
+
+    /// Number of candidate and k-NN requests served (not counting
+    /// OP_HASH_KNN requests, which are answered without batching).
+    inline size_t num_requests(void) const
+    {
+        return m_num_requests.load();
+    }
+
+    /// Number of batches the candidate and k-NN requests were coalesced into.
+    inline size_t num_batches(void) const
+    {
+        return m_num_batches.load();
+    }
+
+private:
+    // Copy and assignment not implemented
+    AStarServer(const AStarServer& obj);
+    AStarServer& operator=(const AStarServer& obj);
+
+    /// A candidate or k-NN request waiting for the batching thread.
+    struct Pending;
+
+    /// The index of the rows at one quantisation.
+    struct Quantised
+    {
+        Quantised(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells)
+            : index(dim, packing_radius, num_shells)
+            , hash(dim, packing_radius, num_shells)
+            , max_residual(0)
+        {}
+
+        AStarIndex<size_t>      index;
+        AStarNN                 hash;
+        std::vector<VElem_t>    residuals;      // of each row, to its lattice point
+        VElem_t                 max_residual;
+    };
+
+    /// Build the index of all the rows.
+    std::shared_ptr<const Quantised> _quantise(Distance_t packing_radius, NumShells_t num_shells) const;
+
+    /// The current index, safe to use for as long as it is held.
+    inline std::shared_ptr<const Quantised> _current(void) const
+    {
+        return std::atomic_load(&m_current);
+    }
+
+    /// A client connection and its thread.
+    struct Connection
+    {
+        int                 fd;
+        std::thread         thread;
+        std::atomic<bool>   finished;
+    };
+
+    void _accept_loop(void);
+    void _serve(Connection* connection);
+    void _batch_loop(void);
+    void _run_batch(const std::vector<Pending*>& batch);
+
+    /// Answer an OP_HASH_KNN request of num_vectors queries, whose
+    /// hash_counts (checked by _serve) sum to the number of hashes.
+    void _hash_knn(const Quantised& quantised, const VElem_t* queries, size_t num_vectors, uint32_t k,
+                   const uint64_t* hash_counts, const Hash_t* hashes, std::vector<uint64_t>& counts, std::vector<uint64_t>& items);
+
+    /// A hash code, and the index of its first candidate row.
+    typedef std::pair<Hash_t, size_t> Bucket;
+
+    /// Append the k rows nearest to the query, of the given candidate rows
+    /// (those of each bucket together, in the order of the buckets), as
+    /// OP_KNN items.
+    void _rank(const Quantised& quantised, const VElem_t* query, const std::vector<size_t>& rows,
+               const std::vector<Bucket>& buckets, size_t k,
+               std::vector<uint64_t>& counts, std::vector<uint64_t>& items);
+
+    /// The element of a row of the index.
+    inline uint64_t _elem(size_t row) const
+    {
+        return m_elems.empty() ? row : m_elems[row];
+    }
+
+    /// Join and discard the finished connections (all of them if 'all').
+    void _reap(bool all);
+
+    const Dim_t             m_dim;
+    const VElem_t*          m_vectors;
+    const size_t            m_num_vectors;
+    const size_t            m_num_threads;
+    std::vector<size_t>     m_elems;        // empty for the identity
+    std::shared_ptr<const Quantised> m_current;     // atomic access only
+    std::mutex              m_requantize_mutex;
+
+    std::string             m_socket_path;
+    size_t                  m_max_batch;
+    int                     m_listen_fd;
+    std::atomic<bool>       m_stopping;
+    std::atomic<bool>       m_accept_failed;
+    std::thread             m_accept_thread;
+    std::thread             m_batch_thread;
+
+    std::mutex              m_connections_mutex;
+    std::list<std::unique_ptr<Connection> > m_connections;
+
+    std::mutex              m_queue_mutex;
+    std::condition_variable m_queue_cv;     // work for the batching thread
+    std::condition_variable m_done_cv;      // finished requests
+    std::vector<Pending*>   m_queue;
+    bool                    m_batch_stop;
+
+    std::atomic<size_t>     m_num_requests;
+    std::atomic<size_t>     m_num_batches;
+    std::atomic<size_t>     m_num_distances;
+    std::atomic<size_t>     m_num_pruned;
+};
+
+
+#endif // SERVER__H
@@ -0,0 +1,96 @@
+/*
+ * The binary protocol between an AStarServer and an AStarClient,
+ * over a Unix domain (stream) socket.
+ *
+ * Each request is a Request header followed by num_vectors query
+ * vectors of dim VElem_t (one after the other). Each reply is a
+ * Response header followed by num_rows row counts (uint64_t) and then
+ * the items of all rows, one after the other.
+ *
+ * The items are 64 bit words, as per the operation:
+ *      OP_INFO             one row of INFO_SIZE words (see InfoWord).
+ *      OP_NEAREST_HASH     one hash code per query.
+ *      OP_EXTENDED_HASH    num_probes hash codes per query.
+ *      OP_CANDIDATES       the elements found by each query.
+ *      OP_KNN              up to k elements per query, nearest first;
+ *                          each item is two words, the element then the
+ *                          distance (a VElem_t).
+ *      OP_HASH_KNN         as per OP_KNN, but the candidates of each query
+ *                          are the elements of the given hash codes (rather
+ *                          than of its extended probes). The vectors of the
+ *                          request are followed by num_vectors hash counts
+ *                          (uint64_t) and then the hash codes of all queries.
+ *
+ * All values are in the native byte order, as both ends are on one host.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SERVERPROTOCOL__H
+#define SERVERPROTOCOL__H
+
+#include "common.h"
+
+
+namespace ServerProtocol
+{
+    /// First word of every header ("ASNN").
+    static const uint32_t MAGIC = 0x4E4E5341;
+
+    /// The most query vectors accepted in one request. A larger request
+    /// is answered with Error_insufficient_buffers, and ends the connection.
+    static const uint64_t MAX_VECTORS = 1 << 20;
+
+    /// The most hash codes accepted in one OP_HASH_KNN request (in all,
+    /// and so in any one hash count), as per MAX_VECTORS.
+    static const uint64_t MAX_HASHES = 1 << 26;
+
+    /// The operations.
+    enum Op
+    {
+        OP_INFO = 1,
+        OP_NEAREST_HASH,
+        OP_EXTENDED_HASH,
+        OP_CANDIDATES,
+        OP_KNN,
+        OP_HASH_KNN
+    };
+
+    /// The words of an OP_INFO reply.
+    enum InfoWord
+    {
+        INFO_DIM,
+        INFO_NUM_PROBES,
+        INFO_NUM_VECTORS,
+        INFO_NUM_HASHES,
+        INFO_PACKING_RADIUS,    // the bits of a Distance_t
+        INFO_NUM_SHELLS,
+        INFO_SIZE
+    };
+
+    struct Request
+    {
+        uint32_t magic;
+        uint32_t op;
+        uint32_t dim;           // must match the server
+        uint32_t k;             // OP_KNN only
+        uint64_t num_vectors;
+    };
+
+    struct Response
+    {
+        uint32_t magic;
+        uint32_t error;         // an Error code
+        uint64_t num_rows;
+        uint64_t num_items;
+    };
+
+    /// The number of 64 bit words per item for an operation.
+    inline size_t item_words(uint32_t op)
+    {
+        return op == OP_KNN || op == OP_HASH_KNN ? 2 : 1;
+    }
+}
+
+
+#endif // SERVERPROTOCOL__H
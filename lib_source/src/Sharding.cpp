@@ -0,0 +1,260 @@
+/*
+ * A sharded index.
+ *
+ * Author: Barry Drake
+ */
+
+#include "Sharding.h"
+#include "Client.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+using namespace ServerProtocol;
+
+
+ShardMap::ShardMap(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor, size_t num_shards)
+    : m_hash(dim, packing_radius, num_shells)
+    , m_coarse_factor(coarse_factor)
+    , m_num_shards(num_shards)
+{
+    if (coarse_factor == 0 || num_shards == 0)
+    {
+        throw Error_unknown;
+    }
+}
+
+
+size_t ShardMap::shard_of(const VElem_t* vector) const
+{
+    BuffStack stack(m_hash.dim(), 6);
+    size_t    shard = 0;
+    m_hash.visit_nearest(vector, [this, &stack, &shard](Hash_t, K_t k, const CElem_t* c)
+    {
+        shard = _shard_of_point(k, c, stack.buff());
+    });
+    return shard;
+}
+
+
+size_t ShardMap::_shard_of_point(K_t k, const CElem_t* c, WorkBuff* buff) const
+{
+    const Dim_t dim = m_hash.dim();
+
+    VElem_t* point    = get_buff<VElem_t>(buff);
+    CElem_t* coarse_c = get_buff<CElem_t>(buff);
+    K_t      coarse_k;
+
+    //
+    // The coarse lattice has a packing radius coarse_factor times larger,
+    // so in the lattice representation space it is just a scaling.
+    //
+    AStarLattice::cvector_k_to_lattice_point_in_lattice_space(dim, c, k, point);
+    const VElem_t inverse = VElem_t(1) / VElem_t(m_coarse_factor);
+    for (Dim_t i = 0; i <= dim; ++i)
+    {
+        point[i] *= inverse;
+    }
+
+    AStarLattice::closest_point(dim, point, coarse_k, coarse_c, buff);
+    const Hash_t coarse_hash = Hash::hash(dim, coarse_c);
+
+    // Spread the coarse cells evenly over the shards.
+    return size_t((((coarse_hash * 0x9E3779B97F4A7C15ULL) >> 32) * m_num_shards) >> 32);
+}
+
+
+ShardCoordinator::ShardCoordinator(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor,
+                                   const std::vector<std::string>& socket_paths)
+    : m_map(dim, packing_radius, num_shells, coarse_factor, socket_paths.size() ? socket_paths.size() : 1)
+    , m_socket_paths(socket_paths)
+    , m_shards(socket_paths.size())
+    , m_requests(socket_paths.size())
+    , m_num_shard_requests(0)
+{
+    if (socket_paths.empty())
+    {
+        throw Error_unknown;
+    }
+    for (size_t s = 0; s < socket_paths.size(); ++s)
+    {
+        m_requests[s].outstanding = false;
+        _connect(s);
+    }
+}
+
+
+void ShardCoordinator::_connect(size_t s)
+{
+    m_shards[s].reset();
+
+    std::unique_ptr<AStarClient> shard(new AStarClient(m_socket_paths[s].c_str()));
+    const AStarNN& hasher = m_map.hasher();
+
+    // The shard's probes must be those of the map, else the hash codes
+    // routed to it would not be those of its buckets.
+    if (shard->dim() != hasher.dim())
+    {
+        throw Error_invalid_dim;
+    }
+    if (shard->packing_radius() != hasher.packing_radius())
+    {
+        throw Error_invalid_packing_radius;
+    }
+    if (shard->num_shells() != NumShells_t(hasher.num_shells()) || shard->num_probes() != hasher.num_probes())
+    {
+        throw Error_invalid_num_shells;
+    }
+    m_shards[s] = std::move(shard);
+}
+
+
+void ShardCoordinator::_recover(size_t failed)
+{
+    for (size_t s = 0; s < m_shards.size(); ++s)
+    {
+        ShardRequest& request = m_requests[s];
+        if (s != failed && !request.outstanding)
+        {
+            continue;
+        }
+        request.outstanding = false;
+        if (s != failed)
+        {
+            try
+            {
+                m_shards[s]->receive();
+                continue;
+            }
+            catch (...)
+            {}
+        }
+        try
+        {
+            _connect(s);
+        }
+        catch (...)
+        {}
+    }
+}
+
+
+ShardCoordinator::~ShardCoordinator(void)
+{}
+
+
+void ShardCoordinator::knn(const VElem_t* queries, size_t num_queries, uint32_t k,
+                           std::vector<size_t>& counts, std::vector<size_t>& elems, std::vector<VElem_t>& distances)
+{
+    const Dim_t  dim        = m_map.hasher().dim();
+    const size_t num_shards = m_shards.size();
+
+    //
+    // Scatter: route the probes of each query to their shards.
+    //
+    for (size_t s = 0; s < num_shards; ++s)
+    {
+        ShardRequest& request = m_requests[s];
+        request.queries.clear();
+        request.vectors.clear();
+        request.hash_counts.clear();
+        request.hashes.clear();
+    }
+
+    for (size_t q = 0; q < num_queries; ++q)
+    {
+        const VElem_t* query = queries + q * dim;
+        m_map.route(query, [this, q, query, dim](size_t shard, Hash_t hash_code)
+        {
+            ShardRequest& request = m_requests[shard];
+            if (request.queries.empty() || request.queries.back() != q)
+            {
+                request.queries.push_back(q);
+                request.vectors.insert(request.vectors.end(), query, query + dim);
+                request.hash_counts.push_back(0);
+            }
+            request.hash_counts.back() += 1;
+            request.hashes.push_back(hash_code);
+        });
+    }
+
+    for (size_t s = 0; s < num_shards; ++s)
+    {
+        ShardRequest& request = m_requests[s];
+        if (!request.queries.empty())
+        {
+            // The hash codes follow the hash counts.
+            request.hash_counts.insert(request.hash_counts.end(), request.hashes.begin(), request.hashes.end());
+            try
+            {
+                if (!m_shards[s])
+                {
+                    _connect(s);
+                }
+                m_shards[s]->send(OP_HASH_KNN, request.vectors.data(), request.queries.size(), k,
+                                  request.hash_counts.data(), request.hash_counts.size());
+            }
+            catch (...)
+            {
+                _recover(s);
+                throw;
+            }
+            request.outstanding = true;
+            m_num_shard_requests += request.queries.size();
+        }
+    }
+
+    //
+    // Gather: the k nearest of each shard, then the k nearest of those.
+    //
+    std::vector<std::vector<std::pair<VElem_t, size_t> > > merged(num_queries);
+    for (size_t s = 0; s < num_shards; ++s)
+    {
+        ShardRequest& request = m_requests[s];
+        if (!request.outstanding)
+        {
+            continue;
+        }
+
+        AStarClient& shard = *m_shards[s];
+        try
+        {
+            shard.receive();
+        }
+        catch (...)
+        {
+            _recover(s);
+            throw;
+        }
+        request.outstanding = false;
+
+        const uint64_t* item = shard.items().data();
+        for (size_t i = 0; i < request.queries.size(); ++i)
+        {
+            std::vector<std::pair<VElem_t, size_t> >& results = merged[request.queries[i]];
+            for (uint64_t j = 0; j < shard.counts()[i]; ++j, item += 2)
+            {
+                VElem_t distance;
+                std::memcpy(&distance, &item[1], sizeof(distance));
+                results.push_back(std::make_pair(distance, size_t(item[0])));
+            }
+        }
+    }
+
+    counts.assign(num_queries, 0);
+    elems.clear();
+    distances.clear();
+    for (size_t q = 0; q < num_queries; ++q)
+    {
+        std::vector<std::pair<VElem_t, size_t> >& results = merged[q];
+        const size_t n = std::min<size_t>(k, results.size());
+        std::partial_sort(results.begin(), results.begin() + n, results.end());
+
+        counts[q] = n;
+        for (size_t j = 0; j < n; ++j)
+        {
+            elems.push_back(results[j].second);
+            distances.push_back(results[j].first);
+        }
+    }
+}
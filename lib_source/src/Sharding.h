@@ -0,0 +1,170 @@
+/*
+ * A sharded index: the elements are spread over a number of shard
+ * servers (see AStarServer) by the cell of a coarse A* lattice, and
+ * queries are scattered to, and gathered from, only the shards that
+ * their probes fall in.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SHARDING__H
+#define SHARDING__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include "AStarLattice.h"
+#include "Hash.h"
+#include "WorkBuff.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class AStarClient;
+
+
+///
+/// A ShardMap assigns each lattice point of the (fine) quantisation
+/// lattice to a shard.
+///
+/// The coarse lattice is the fine one scaled by an integer factor, a
+/// sublattice. A fine lattice point belongs to the shard of the coarse
+/// Voronoi cell it lies in. An element belongs to the shard of its
+/// (fine) hash code, so that all the elements of a hash code are in one
+/// shard, and a query's extended probes, being close together, mostly
+/// fall in one or a few coarse cells, so touch only a few shards.
+///
+class ShardMap
+{
+public:
+    /// \param[in]  dim             number of dimensions in the lattice quantisation space, n.
+    /// \param[in]  packing_radius  packing radius of the (fine) A* lattice.
+    /// \param[in]  num_shells      number of extended shells for extended probes.
+    /// \param[in]  coarse_factor   scale of the coarse lattice relative to the fine one (>= 1).
+    /// \param[in]  num_shards      number of shards (>= 1).
+    ///
+    ShardMap(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor, size_t num_shards);
+
+    /// The shard of the element indexed by the given vector.
+    size_t shard_of(const VElem_t* vector) const;
+
+    /// Call f(shard, hash_code) for each of the extended probes of the
+    /// vector (in the order of AStarNN::extended_probes).
+    template<typename F>
+    void route(const VElem_t* vector, F&& f) const
+    {
+        BuffStack stack(m_hash.dim(), 6);
+        m_hash.visit_extended(vector, [this, &stack, &f](Hash_t hash_code, K_t k, const CElem_t* c)
+        {
+            f(_shard_of_point(k, c, stack.buff()), hash_code);
+        });
+    }
+
+    /// The (fine) quantisation lattice.
+    inline const AStarNN& hasher(void) const
+    {
+        return m_hash;
+    }
+
+    inline size_t coarse_factor(void) const
+    {
+        return m_coarse_factor;
+    }
+
+    inline size_t num_shards(void) const
+    {
+        return m_num_shards;
+    }
+
+private:
+    /// The shard of a fine lattice point, given by its c-vector and k.
+    /// Uses at most 6 work buffers.
+    size_t _shard_of_point(K_t k, const CElem_t* c, WorkBuff* buff) const;
+
+    AStarNN     m_hash;
+    size_t      m_coarse_factor;
+    size_t      m_num_shards;
+};
+
+
+///
+/// A ShardCoordinator answers k-NN queries of a sharded index, where
+/// shard i is served at socket_paths[i] by an AStarServer holding the
+/// elements that the ShardMap puts in shard i.
+///
+/// The coordinator computes the probes of each query, sends each probe
+/// hash code only to the shard that owns it (OP_HASH_KNN), and merges
+/// the k nearest of each shard. The requests to all the shards are sent
+/// before any reply is read, so the shards work in parallel.
+///
+/// A coordinator is not thread safe (as per AStarClient).
+///
+class ShardCoordinator
+{
+public:
+    /// Connect to the shards. The lattice parameters must match the
+    /// ShardMap used to build the shards, and each shard server's
+    /// lattice (else Error_invalid_dim, Error_invalid_packing_radius or
+    /// Error_invalid_num_shells is thrown).
+    ShardCoordinator(Dim_t dim, Distance_t packing_radius, NumShells_t num_shells, size_t coarse_factor,
+                     const std::vector<std::string>& socket_paths);
+
+    ~ShardCoordinator(void);
+
+    /// The ShardMap of the shards.
+    inline const ShardMap& shard_map(void) const
+    {
+        return m_map;
+    }
+
+    /// Find the k nearest elements of the candidates of each of
+    /// num_queries query vectors (stored one after the other).
+    /// On return, counts[i] (<= k) is the number of results of query i,
+    /// and the results of all queries, nearest first, are in elems and
+    /// distances (query i after query i - 1).
+    ///
+    /// If a shard fails, the replies of the other shards are read (or
+    /// their connections remade) before the error is rethrown, so that
+    /// every connection is ready for the next call.
+    void knn(const VElem_t* queries, size_t num_queries, uint32_t k,
+             std::vector<size_t>& counts, std::vector<size_t>& elems, std::vector<VElem_t>& distances);
+
+    /// Total number of shard requests sent by knn, e.g. to measure
+    /// the number of shards touched per query.
+    inline size_t num_shard_requests(void) const
+    {
+        return m_num_shard_requests;
+    }
+
+private:
+    // Copy and assignment not implemented
+    ShardCoordinator(const ShardCoordinator& obj);
+    ShardCoordinator& operator=(const ShardCoordinator& obj);
+
+    /// Connect (or reconnect) to shard s, and check its lattice.
+    void _connect(size_t s);
+
+    /// After a failure of shard 'failed', read the outstanding replies of
+    /// the other shards, reconnecting any that fail, and reconnect the
+    /// failed shard. A shard that cannot be reconnected is left
+    /// disconnected, to be tried again by the next knn.
+    void _recover(size_t failed);
+
+    /// The request being built for one shard.
+    struct ShardRequest
+    {
+        std::vector<size_t>     queries;        // the queries sent to the shard
+        std::vector<VElem_t>    vectors;
+        std::vector<uint64_t>   hash_counts;    // followed by the hash codes
+        std::vector<uint64_t>   hashes;
+        bool                    outstanding;    // sent, but the reply not yet read
+    };
+
+    ShardMap                                    m_map;
+    std::vector<std::string>                    m_socket_paths;
+    std::vector<std::unique_ptr<AStarClient> >  m_shards;
+    std::vector<ShardRequest>                   m_requests;
+    size_t                                      m_num_shard_requests;
+};
+
+
+#endif // SHARDING__H
@@ -0,0 +1,465 @@
+/*
+ * A read-only index held in shared memory.
+ *
+ * Author: Barry Drake
+ */
+
+#include "SharedIndex.h"
+
+using namespace SharedIndexImage;
+
+
+/// The control segment of a named index (named as the index itself).
+/// The image of generation g is in the segment "<name>.<g>".
+struct SharedIndexControl
+{
+    std::atomic<uint64_t>   next_generation;    // the last generation allocated
+    std::atomic<uint64_t>   current;            // the generation readers attach to (0 for none)
+};
+
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+/// How many times a reader retries (yielding in between), if the
+/// generation it is attaching to is replaced under it.
+static const int MAX_ATTACH_ATTEMPTS = 100;
+
+
+/// POSIX shared memory names start with a '/'.
+static std::string segment_name(const char* name)
+{
+    return name[0] == '/' ? std::string(name) : std::string("/") + name;
+}
+
+
+static std::string generation_name(const std::string& name, uint64_t generation)
+{
+    return name + "." + std::to_string(generation);
+}
+
+
+/// Map the control segment of a named index (creating it if writable).
+static SharedIndexControl* map_control(const std::string& name, bool writable)
+{
+    int fd = writable ?
+             shm_open(name.c_str(), O_RDWR | O_CREAT, 0644) :
+             shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        throw Error_io;
+    }
+
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0;
+    if (ok && size_t(info.st_size) < sizeof(SharedIndexControl))
+    {
+        // A new segment is zero filled: no generations yet.
+        ok = writable && ftruncate(fd, sizeof(SharedIndexControl)) == 0;
+    }
+
+    void* mapped = ok ?
+                   mmap(0, sizeof(SharedIndexControl), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0) :
+                   MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        throw Error_io;
+    }
+    return (SharedIndexControl*)mapped;
+}
+
+
+static void unmap_control(const SharedIndexControl* control)
+{
+    munmap((void*)control, sizeof(SharedIndexControl));
+}
+
+
+SharedIndex::Segment SharedIndex::_create_generation(const char* name, size_t size)
+{
+    const std::string   base    = segment_name(name);
+    SharedIndexControl* control = map_control(base, true);
+
+    Segment segment;
+    segment.size       = size;
+    segment.generation = control->next_generation.fetch_add(1) + 1;
+    unmap_control(control);
+
+    segment.fd = shm_open(generation_name(base, segment.generation).c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (segment.fd < 0)
+    {
+        throw Error_io;
+    }
+
+    segment.image = ftruncate(segment.fd, size) == 0 ?
+                    mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0) :
+                    MAP_FAILED;
+    if (segment.image == MAP_FAILED)
+    {
+        close(segment.fd);
+        shm_unlink(generation_name(base, segment.generation).c_str());
+        throw Error_io;
+    }
+    return segment;
+}
+
+
+uint64_t SharedIndex::_commit_generation(const char* name, const Segment& segment)
+{
+    munmap(segment.image, segment.size);
+    close(segment.fd);
+
+    const std::string   base    = segment_name(name);
+    SharedIndexControl* control = map_control(base, true);
+
+    //
+    // Make the new generation current, unless a later one has been
+    // committed meanwhile. The name of the replaced generation is
+    // removed; its memory is freed once the last reader detaches.
+    //
+    uint64_t replaced = control->current.load();
+    while (replaced < segment.generation &&
+           !control->current.compare_exchange_weak(replaced, segment.generation))
+    {}
+    unmap_control(control);
+
+    if (replaced < segment.generation)
+    {
+        if (replaced)
+        {
+            shm_unlink(generation_name(base, replaced).c_str());
+        }
+    }
+    else
+    {
+        shm_unlink(generation_name(base, segment.generation).c_str());
+    }
+    return segment.generation;
+}
+
+
+SharedIndex::Segment SharedIndex::_create_memfd(size_t size)
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+    Segment segment;
+    segment.size       = size;
+    segment.generation = 0;
+    segment.fd         = int(syscall(SYS_memfd_create, "astarnn-index", 2 /* MFD_ALLOW_SEALING */));
+    if (segment.fd < 0)
+    {
+        throw Error_io;
+    }
+
+    segment.image = ftruncate(segment.fd, size) == 0 ?
+                    mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0) :
+                    MAP_FAILED;
+    if (segment.image == MAP_FAILED)
+    {
+        close(segment.fd);
+        throw Error_io;
+    }
+    return segment;
+#else
+    throw Error_io;
+#endif
+}
+
+
+int SharedIndex::_finish_memfd(const Segment& segment)
+{
+    munmap(segment.image, segment.size);
+#ifdef F_ADD_SEALS
+    // No one may change the image from now on.
+    fcntl(segment.fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return segment.fd;
+}
+
+
+void SharedIndex::unlink(const char* name)
+{
+    const std::string base = segment_name(name);
+
+    SharedIndexControl* control = map_control(base, false);
+    uint64_t current = control->current.load();
+    unmap_control(control);
+
+    if (current)
+    {
+        shm_unlink(generation_name(base, current).c_str());
+    }
+    shm_unlink(base.c_str());
+}
+
+
+SharedIndex::SharedIndex(const char* name)
+    : m_name(segment_name(name))
+    , m_generation(0)
+    , m_current(0)
+    , m_control(0)
+    , m_image(0)
+    , m_image_size(0)
+{
+    SharedIndexControl* control = map_control(m_name, false);
+    m_control = control;
+    m_current = &control->current;
+    try
+    {
+        _attach_current();
+    }
+    catch (...)
+    {
+        unmap_control(control);
+        throw;
+    }
+}
+
+
+SharedIndex::SharedIndex(int fd)
+    : m_generation(0)
+    , m_current(0)
+    , m_control(0)
+    , m_image(0)
+    , m_image_size(0)
+{
+    _attach(fd);
+}
+
+
+SharedIndex::~SharedIndex(void)
+{
+    _detach();
+    if (m_control)
+    {
+        unmap_control((SharedIndexControl*)m_control);
+    }
+}
+
+
+bool SharedIndex::stale(void) const
+{
+    return m_current && m_current->load() != m_generation;
+}
+
+
+bool SharedIndex::refresh(void)
+{
+    if (!stale())
+    {
+        return false;
+    }
+
+    // The old image stays mapped until the new one is attached.
+    void*  old_image = m_image;
+    size_t old_size  = m_image_size;
+    _attach_current();
+    munmap(old_image, old_size);
+    return true;
+}
+
+
+void SharedIndex::_attach_current(void)
+{
+    for (int attempt = 0; attempt < MAX_ATTACH_ATTEMPTS; ++attempt)
+    {
+        const uint64_t generation = m_current->load();
+        if (generation == 0)
+        {
+            break;
+        }
+
+        int fd = shm_open(generation_name(m_name, generation).c_str(), O_RDONLY, 0);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+            {
+                // Replaced by a newer generation: let the publisher
+                // finish committing it.
+                sched_yield();
+                continue;
+            }
+            break;
+        }
+
+        try
+        {
+            _attach(fd);
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+        close(fd);
+        m_generation = generation;
+        return;
+    }
+    throw Error_io;
+}
+
+
+void SharedIndex::_attach(int fd)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(Header))
+    {
+        throw Error_io;
+    }
+
+    const size_t size   = size_t(info.st_size);
+    void*        mapped = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        throw Error_io;
+    }
+
+    //
+    // Check that the image is whole before using it.
+    //
+    const char*   base   = (const char*)mapped;
+    const Header* header = (const Header*)base;
+    bool ok = header->magic == MAGIC
+           && header->image_size <= size
+           && header->slot_bits < 48
+           && header->slots_offset + (uint64_t(1) << header->slot_bits) * sizeof(Slot) <= header->image_size
+           && header->elems_offset + header->num_elements * sizeof(uint64_t) <= header->image_size
+           && header->num_orbits > 0 && header->num_orbits < header->image_size
+           && header->orbits_offset + header->num_orbits * sizeof(uint32_t) <= header->image_size;
+
+    std::unique_ptr<AStarNN> hash;
+    if (ok)
+    {
+        try
+        {
+            hash.reset(new AStarNN(header->dim, header->packing_radius, header->num_shells));
+            hash->set_orbits((const uint32_t*)(base + header->orbits_offset), size_t(header->num_orbits));
+        }
+        catch (...)
+        {
+            ok = false;
+        }
+    }
+    if (!ok)
+    {
+        munmap(mapped, size);
+        throw Error_io;
+    }
+
+    m_image      = mapped;
+    m_image_size = size;
+    m_header     = header;
+    m_slots      = (const Slot*)(base + header->slots_offset);
+    m_elems      = (const uint64_t*)(base + header->elems_offset);
+    m_mask       = (uint64_t(1) << header->slot_bits) - 1;
+    m_hash.swap(hash);
+}
+
+
+void SharedIndex::_detach(void)
+{
+    if (m_image)
+    {
+        munmap(m_image, m_image_size);
+        m_image = 0;
+    }
+}
+
+
+#else // _WIN32
+
+
+SharedIndex::Segment SharedIndex::_create_generation(const char* name, size_t size)
+{
+    throw Error_io;
+}
+
+uint64_t SharedIndex::_commit_generation(const char* name, const Segment& segment)
+{
+    throw Error_io;
+}
+
+SharedIndex::Segment SharedIndex::_create_memfd(size_t size)
+{
+    throw Error_io;
+}
+
+int SharedIndex::_finish_memfd(const Segment& segment)
+{
+    throw Error_io;
+}
+
+void SharedIndex::unlink(const char* name)
+{
+    throw Error_io;
+}
+
+SharedIndex::SharedIndex(const char* name)
+{
+    throw Error_io;
+}
+
+SharedIndex::SharedIndex(int fd)
+{
+    throw Error_io;
+}
+
+SharedIndex::~SharedIndex(void)
+{}
+
+bool SharedIndex::stale(void) const
+{
+    return false;
+}
+
+bool SharedIndex::refresh(void)
+{
+    return false;
+}
+
+
+#endif // _WIN32
+
+
+void SharedIndex::get_extended(const VElem_t* vector, IndexCallback<size_t>* callback) const
+{
+    m_hash->visit_extended(vector, [this, callback](Hash_t hash_code)
+    {
+        size_t          count;
+        const uint64_t* elems = find(hash_code, count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            callback->match(hash_code, size_t(elems[i]));
+        }
+    });
+}
+
+
+size_t SharedIndex::count_extended(const VElem_t* vector) const
+{
+    size_t result = 0;
+    m_hash->visit_extended(vector, [this, &result](Hash_t hash_code)
+    {
+        size_t count;
+        find(hash_code, count);
+        result += count;
+    });
+    return result;
+}
+
+
+size_t SharedIndex::count_hash(Hash_t hash_code) const
+{
+    size_t count;
+    find(hash_code, count);
+    return count;
+}
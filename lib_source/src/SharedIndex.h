@@ -0,0 +1,421 @@
+/*
+ * A read-only index held in shared memory, so that many processes can
+ * query one copy of an index.
+ *
+ * An index is frozen into an image: a single block of memory that holds
+ * only offsets (no pointers), so it can be mapped at any address. An
+ * image is published in a named POSIX shared memory segment, or written
+ * to a memfd to be handed to child processes.
+ *
+ * Named images have a generation number. Publishing under the same name
+ * again creates a new segment and then atomically makes it current;
+ * processes already attached to an older generation keep their mapping
+ * (and the memory) until they detach or refresh.
+ *
+ * Only indexes hashed by AStarNN (AStarIndex<T, Alloc, AStarNN>), without
+ * a transform, can be frozen: the image records the lattice parameters and
+ * the orbits walked (see AStarNN::set_orbits), from which a reader
+ * rebuilds the hasher.
+ *
+ * Shared memory is only available on POSIX systems; elsewhere these
+ * functions throw Error_io.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SHAREDINDEX__H
+#define SHAREDINDEX__H
+
+#include "common.h"
+#include "AStarNN.h"
+#include "AStarIndex.h"
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
+
+
+namespace SharedIndexImage
+{
+    /// First word of an image.
+    static const uint64_t MAGIC = 0x3258444E4E534141ULL;    // "AASNNDX2"
+
+    /// The image header, at offset 0.
+    struct Header
+    {
+        uint64_t    magic;
+        uint64_t    image_size;     // bytes
+        Dim_t       dim;
+        NumShells_t num_shells;
+        Distance_t  packing_radius;
+        uint64_t    num_hashes;
+        uint64_t    num_elements;
+        uint64_t    slot_bits;      // the slot table has 2^slot_bits slots
+        uint64_t    slots_offset;   // from the start of the image
+        uint64_t    elems_offset;   // from the start of the image
+        uint64_t    num_orbits;     // the orbits walked by queries (see AStarNN::orbits)
+        uint64_t    orbits_offset;  // from the start of the image, of uint32_t orbits
+    };
+
+    /// A slot of the (open addressing, linear probing) hash table.
+    /// An empty slot has count 0.
+    struct Slot
+    {
+        Hash_t      hash_code;
+        uint64_t    begin;          // index of the first element
+        uint64_t    count;          // number of elements
+    };
+
+    /// The first slot to look in for a hash code.
+    inline uint64_t home_slot(Hash_t hash_code, uint64_t slot_bits)
+    {
+        return slot_bits ? (hash_code * 0x9E3779B97F4A7C15ULL) >> (64 - slot_bits) : 0;
+    }
+
+    /// The number of slot bits for the given number of hash codes
+    /// (the table is kept no more than half full).
+    inline uint64_t slot_bits_for(uint64_t num_hashes)
+    {
+        uint64_t bits = 1;
+        while ((uint64_t(1) << bits) < 2 * num_hashes)
+        {
+            ++bits;
+        }
+        return bits;
+    }
+
+    /// The offset of the orbits, after the elements.
+    inline uint64_t orbits_offset_for(uint64_t num_slots, uint64_t num_elements)
+    {
+        return sizeof(Header) + num_slots * sizeof(Slot) + num_elements * sizeof(uint64_t);
+    }
+
+    /// The size in bytes of the image of the merge of num_indexes (>= 1)
+    /// indexes (see write). Throws if the indexes do not match.
+    template <typename T, typename Alloc>
+    size_t size_of(const AStarIndex<T, Alloc, AStarNN>* const* indexes, size_t num_indexes)
+    {
+        if (num_indexes == 0)
+        {
+            throw Error_unknown;
+        }
+        for (size_t i = 1; i < num_indexes; ++i)
+        {
+            if (indexes[i]->dim() != indexes[0]->dim())
+            {
+                throw Error_invalid_dim;
+            }
+            if (indexes[i]->packing_radius() != indexes[0]->packing_radius())
+            {
+                throw Error_invalid_packing_radius;
+            }
+            if (indexes[i]->num_shells() != indexes[0]->num_shells() || indexes[i]->orbits() != indexes[0]->orbits())
+            {
+                throw Error_invalid_num_shells;
+            }
+        }
+        for (size_t i = 0; i < num_indexes; ++i)
+        {
+            if (indexes[i]->transform())
+            {
+                // The image does not record the transform.
+                throw Error_unknown;
+            }
+        }
+
+        uint64_t num_hashes   = 0;
+        uint64_t num_elements = 0;
+        for (size_t i = 0; i < num_indexes; ++i)
+        {
+            num_hashes   += indexes[i]->num_hashes();
+            num_elements += indexes[i]->num_elements();
+        }
+        const uint64_t num_slots = uint64_t(1) << slot_bits_for(num_hashes);
+        return orbits_offset_for(num_slots, num_elements) + indexes[0]->orbits().size() * sizeof(uint32_t);
+    }
+
+    /// The size in bytes of the image of an index.
+    template <typename T, typename Alloc>
+    size_t size_of(const AStarIndex<T, Alloc, AStarNN>& index)
+    {
+        const AStarIndex<T, Alloc, AStarNN>* indexes = &index;
+        return size_of(&indexes, 1);
+    }
+
+    /// Write the image of the merge of num_indexes indexes (of integer
+    /// elements), which must have the same dimensionality, packing radius
+    /// and number of shells, into the given memory, of size_of(indexes,
+    /// num_indexes) bytes (which checks the indexes). The elements of a hash code are in the order
+    /// of the indexes. This avoids building the merged index (see
+    /// AStarIndex::merge_all) just to freeze it.
+    ///
+    /// The slot table is sized for the total number of hash codes of the
+    /// indexes, so is more than half empty when they share hash codes.
+    template <typename T, typename Alloc>
+    void write(const AStarIndex<T, Alloc, AStarNN>* const* indexes, size_t num_indexes, void* image)
+    {
+        typedef AStarIndex<T, Alloc, AStarNN> Index;
+
+        const Index& first = *indexes[0];
+        uint64_t sum_hashes   = 0;
+        uint64_t num_elements = 0;
+        for (size_t i = 0; i < num_indexes; ++i)
+        {
+            sum_hashes   += indexes[i]->num_hashes();
+            num_elements += indexes[i]->num_elements();
+        }
+
+        char*   base = (char*)image;
+        Header* header = (Header*)base;
+
+        header->magic          = MAGIC;
+        header->image_size     = size_of(indexes, num_indexes);
+        header->dim            = first.dim();
+        header->num_shells     = NumShells_t(first.num_shells());
+        header->packing_radius = first.packing_radius();
+        header->num_elements   = num_elements;
+        header->slot_bits      = slot_bits_for(sum_hashes);
+        header->slots_offset   = sizeof(Header);
+        header->elems_offset   = sizeof(Header) + (uint64_t(1) << header->slot_bits) * sizeof(Slot);
+        header->num_orbits     = first.orbits().size();
+        header->orbits_offset  = orbits_offset_for(uint64_t(1) << header->slot_bits, num_elements);
+
+        std::memcpy(base + header->orbits_offset, first.orbits().data(), header->num_orbits * sizeof(uint32_t));
+
+        Slot*           slots = (Slot*)(base + header->slots_offset);
+        uint64_t*       elems = (uint64_t*)(base + header->elems_offset);
+        const uint64_t  mask  = (uint64_t(1) << header->slot_bits) - 1;
+        const uint64_t  bits  = header->slot_bits;
+        uint64_t        num_hashes = 0;
+
+        std::memset(slots, 0, (mask + 1) * sizeof(Slot));
+
+        // The slot of a hash code, found or claimed.
+        auto slot_of = [slots, mask, bits, &num_hashes](Hash_t hash_code) -> Slot&
+        {
+            uint64_t s = home_slot(hash_code, bits);
+            while (slots[s].count && slots[s].hash_code != hash_code)
+            {
+                s = (s + 1) & mask;
+            }
+            if (!slots[s].count)
+            {
+                slots[s].hash_code = hash_code;
+                num_hashes += 1;
+            }
+            return slots[s];
+        };
+
+        // Count the elements of each hash code, then place the lists one
+        // after the other, then copy the elements, using 'begin' as the
+        // fill position, and finally wind 'begin' back.
+        for (size_t i = 0; i < num_indexes; ++i)
+        {
+            indexes[i]->visit_hashes([&slot_of](Hash_t hash_code, const typename Index::List& list)
+            {
+                slot_of(hash_code).count += list.size();
+            });
+        }
+
+        uint64_t next = 0;
+        for (uint64_t s = 0; s <= mask; ++s)
+        {
+            slots[s].begin = next;
+            next += slots[s].count;
+        }
+
+        for (size_t i = 0; i < num_indexes; ++i)
+        {
+            indexes[i]->visit_hashes([&slot_of, elems](Hash_t hash_code, const typename Index::List& list)
+            {
+                Slot& slot = slot_of(hash_code);
+                auto  end  = list.end();
+                for (auto it(list.begin()); it != end; ++it)
+                {
+                    elems[slot.begin++] = uint64_t(*it);
+                }
+            });
+        }
+
+        for (uint64_t s = 0; s <= mask; ++s)
+        {
+            slots[s].begin -= slots[s].count;
+        }
+        header->num_hashes = num_hashes;
+    }
+
+    /// Write the image of an index (of integer elements) into the given
+    /// memory, of size_of(index) bytes.
+    template <typename T, typename Alloc>
+    void write(const AStarIndex<T, Alloc, AStarNN>& index, void* image)
+    {
+        const AStarIndex<T, Alloc, AStarNN>* indexes = &index;
+        write(&indexes, 1, image);
+    }
+}
+
+
+///
+/// A read-only view of an index image, attached from a named shared
+/// memory segment (the current generation) or from a file descriptor.
+///
+/// Queries are thread safe, except with 'refresh'.
+///
+class SharedIndex
+{
+public:
+    /// Attach to the current generation of the named index.
+    explicit SharedIndex(const char* name);
+
+    /// Attach to the image in the given file (e.g. a memfd, see to_memfd).
+    /// The descriptor is not closed. There are no generations.
+    explicit SharedIndex(int fd);
+
+    /// Detach (unmap the image).
+    ~SharedIndex(void);
+
+    /// Publish an image of the index as the next generation of the named
+    /// index, creating the name as needed. Returns the new generation.
+    template <typename T, typename Alloc>
+    static uint64_t publish(const char* name, const AStarIndex<T, Alloc, AStarNN>& index)
+    {
+        Segment segment = _create_generation(name, SharedIndexImage::size_of(index));
+        SharedIndexImage::write(index, segment.image);
+        return _commit_generation(name, segment);
+    }
+
+    /// Publish an image of the merge of num_indexes indexes (see
+    /// SharedIndexImage::write) as the next generation of the named index.
+    template <typename T, typename Alloc>
+    static uint64_t publish(const char* name, const AStarIndex<T, Alloc, AStarNN>* const* indexes, size_t num_indexes)
+    {
+        Segment segment = _create_generation(name, SharedIndexImage::size_of(indexes, num_indexes));
+        SharedIndexImage::write(indexes, num_indexes, segment.image);
+        return _commit_generation(name, segment);
+    }
+
+    /// Write an image of the index to a new, sealed, anonymous memory
+    /// file (Linux only), returning its file descriptor.
+    template <typename T, typename Alloc>
+    static int to_memfd(const AStarIndex<T, Alloc, AStarNN>& index)
+    {
+        Segment segment = _create_memfd(SharedIndexImage::size_of(index));
+        SharedIndexImage::write(index, segment.image);
+        return _finish_memfd(segment);
+    }
+
+    /// Remove the named index. Attached processes are not affected.
+    static void unlink(const char* name);
+
+    /// The generation attached to (0 if not named).
+    inline uint64_t generation(void) const
+    {
+        return m_generation;
+    }
+
+    /// Has a newer generation been published since attaching.
+    bool stale(void) const;
+
+    /// Attach to the current generation if stale, detaching from the
+    /// old one. Returns true if the generation changed.
+    bool refresh(void);
+
+    /// Get the dimensionality of vectors processed by this index.
+    inline Dim_t dim(void) const
+    {
+        return m_header->dim;
+    }
+
+    /// Number of probe points (hash codes) used by 'get' queries.
+    inline size_t num_probes(void) const
+    {
+        return m_hash->num_probes();
+    }
+
+    /// Get the number of distinct hash codes in the index.
+    inline size_t num_hashes(void) const
+    {
+        return size_t(m_header->num_hashes);
+    }
+
+    /// Get the number of elements in the index.
+    inline size_t num_elements(void) const
+    {
+        return size_t(m_header->num_elements);
+    }
+
+    /// The elements stored with the given hash code: 'count' elements
+    /// starting at the returned pointer (which is null if none).
+    inline const uint64_t* find(Hash_t hash_code, size_t& count) const
+    {
+        uint64_t s = SharedIndexImage::home_slot(hash_code, m_header->slot_bits);
+        for (;;)
+        {
+            const SharedIndexImage::Slot& slot = m_slots[s];
+            if (slot.count == 0)
+            {
+                count = 0;
+                return 0;
+            }
+            if (slot.hash_code == hash_code)
+            {
+                count = size_t(slot.count);
+                return m_elems + slot.begin;
+            }
+            s = (s + 1) & m_mask;
+        }
+    }
+
+    /// Call the given callback for each element found nearby to the
+    /// given vector, using extended A* lattice probing.
+    void get_extended(const VElem_t* vector, IndexCallback<size_t>* callback) const;
+
+    /// How many elements are nearby to the
+    /// given vector, using extended A* lattice probing.
+    size_t count_extended(const VElem_t* vector) const;
+
+    /// How many elements stored with the given hash code.
+    size_t count_hash(Hash_t hash_code) const;
+
+private:
+    // Copy and assignment not implemented
+    SharedIndex(const SharedIndex& obj);
+    SharedIndex& operator=(const SharedIndex& obj);
+
+    /// A writable mapping of a new image.
+    struct Segment
+    {
+        int         fd;
+        void*       image;
+        size_t      size;
+        uint64_t    generation;
+    };
+
+    static Segment  _create_generation(const char* name, size_t size);
+    static uint64_t _commit_generation(const char* name, const Segment& segment);
+    static Segment  _create_memfd(size_t size);
+    static int      _finish_memfd(const Segment& segment);
+
+    /// Attach to the current generation of m_name.
+    void _attach_current(void);
+
+    /// Map and check the image in the file.
+    void _attach(int fd);
+
+    void _detach(void);
+
+    std::string                         m_name;         // empty if attached by descriptor
+    uint64_t                            m_generation;
+    const std::atomic<uint64_t>*        m_current;      // the current generation of m_name
+    void*                               m_control;
+    void*                               m_image;
+    size_t                              m_image_size;
+    const SharedIndexImage::Header*     m_header;
+    const SharedIndexImage::Slot*       m_slots;
+    const uint64_t*                     m_elems;
+    uint64_t                            m_mask;
+    std::unique_ptr<AStarNN>            m_hash;
+};
+
+
+#endif // SHAREDINDEX__H
@@ -0,0 +1,341 @@
+/*
+ * A list of elements with small-size inline storage.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SMALLBUCKET__H
+#define SMALLBUCKET__H
+
+#include "common.h"
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+///
+/// The assumed size of a cache line, in bytes.
+///
+static const size_t CACHE_LINE_SIZE = 64;
+
+
+///
+/// The default number of inline elements for a SmallBucket<T, Alloc>.
+///
+/// This is chosen so that a hash table node holding a hash code and a bucket
+/// (as used by AStarIndex) fills one cache line. The node overhead is
+/// a 'next' pointer and the Hash_t key; the bucket overhead is its size and
+/// capacity fields plus the allocator (when the allocator is not empty).
+/// There is always room for at least one inline element.
+///
+template<typename T, typename Alloc>
+struct SmallBucketInline
+{
+    static const size_t OVERHEAD =
+        sizeof(void*) + sizeof(Hash_t) + 2 * sizeof(uint32_t) +
+        (std::is_empty<Alloc>::value ? 0 : sizeof(Alloc));
+
+    static const size_t value =
+        (CACHE_LINE_SIZE > OVERHEAD + sizeof(T)) ?
+        (CACHE_LINE_SIZE - OVERHEAD) / sizeof(T) :
+        1;
+};
+
+
+///
+/// A list of elements of type T that holds up to N elements inline (in
+/// the bucket object itself) and only spills to memory obtained from the
+/// allocator when more than N elements are stored.
+///
+/// The allocator is held as a base class so that an empty allocator
+/// (such as std::allocator) takes no space.
+///
+/// The number of elements is limited to 2^32 - 1.
+///
+template<typename T, typename Alloc = std::allocator<T>, size_t N = SmallBucketInline<T, Alloc>::value>
+class SmallBucket : private Alloc
+{
+public:
+    typedef T*          iterator;
+    typedef const T*    const_iterator;
+
+    /// The number of elements that can be held inline.
+    static const size_t INLINE_SIZE = N;
+
+    explicit SmallBucket(const Alloc& alloc = Alloc())
+        : Alloc(alloc)
+        , m_size(0)
+        , m_capacity(N)
+    {}
+
+    SmallBucket(const SmallBucket& other)
+        : Alloc(other.get_allocator())
+        , m_size(0)
+        , m_capacity(N)
+    {
+        append(other.begin(), other.size());
+    }
+
+    SmallBucket(SmallBucket&& other)
+        : Alloc(other.get_allocator())
+        , m_size(0)
+        , m_capacity(N)
+    {
+        if (other.is_inline())
+        {
+            T* src = other.data();
+            T* dst = inline_data();
+            for (uint32_t i = 0; i < other.m_size; ++i)
+            {
+                new (dst + i) T(std::move(src[i]));
+                src[i].~T();
+            }
+            m_size = other.m_size;
+        }
+        else
+        {
+            m_heap     = other.m_heap;
+            m_size     = other.m_size;
+            m_capacity = other.m_capacity;
+            other.m_capacity = N;
+        }
+        other.m_size = 0;
+    }
+
+    ~SmallBucket(void)
+    {
+        clear();
+    }
+
+    SmallBucket& operator=(const SmallBucket& other)
+    {
+        if (this != &other)
+        {
+            destroy_elements();
+            append(other.begin(), other.size());
+        }
+        return *this;
+    }
+
+    /// Get a copy of the allocator.
+    inline Alloc get_allocator(void) const
+    {
+        return *this;
+    }
+
+    inline size_t size(void) const
+    {
+        return m_size;
+    }
+
+    inline bool empty(void) const
+    {
+        return m_size == 0;
+    }
+
+    inline size_t capacity(void) const
+    {
+        return m_capacity;
+    }
+
+    /// Are the elements stored inline.
+    inline bool is_inline(void) const
+    {
+        return m_capacity <= N;
+    }
+
+    /// Number of bytes held out of line (zero while inline).
+    inline size_t bytes_allocated(void) const
+    {
+        return is_inline() ? 0 : m_capacity * sizeof(T);
+    }
+
+    inline T* data(void)
+    {
+        return is_inline() ? inline_data() : m_heap;
+    }
+
+    inline const T* data(void) const
+    {
+        return is_inline() ? inline_data() : m_heap;
+    }
+
+    inline iterator begin(void)             { return data(); }
+    inline iterator end(void)               { return data() + m_size; }
+    inline const_iterator begin(void) const { return data(); }
+    inline const_iterator end(void) const   { return data() + m_size; }
+
+    inline T& operator[](size_t i)             { return data()[i]; }
+    inline const T& operator[](size_t i) const { return data()[i]; }
+
+    void push_back(const T& elem)
+    {
+        if (m_size == m_capacity)
+        {
+            grow(m_size + 1);
+        }
+        new (data() + m_size) T(elem);
+        m_size += 1;
+    }
+
+    /// Append num_elements elements from the given array.
+    void append(const T* elems, size_t num_elements)
+    {
+        if (m_size + num_elements > m_capacity)
+        {
+            grow(m_size + num_elements);
+        }
+        T* dst = data() + m_size;
+        for (const T* end = elems + num_elements; elems != end; ++elems, ++dst)
+        {
+            new (dst) T(*elems);
+        }
+        m_size += uint32_t(num_elements);
+    }
+
+    /// Make room for at least min_capacity elements, so that appending
+    /// up to that many does not allocate.
+    void reserve(size_t min_capacity)
+    {
+        if (min_capacity > m_capacity)
+        {
+            if (min_capacity > UINT32_MAX)
+            {
+                throw Error_mem_fail;
+            }
+            relocate(min_capacity);
+        }
+    }
+
+    /// Remove the element at the given position by moving the
+    /// last element into its place. Element order is not preserved.
+    void swap_remove(size_t i)
+    {
+        T* d = data();
+        if (i + 1 < m_size)
+        {
+            d[i] = std::move(d[m_size - 1]);
+        }
+        d[m_size - 1].~T();
+        m_size -= 1;
+    }
+
+    /// Remove all elements and release any out of line memory.
+    void clear(void)
+    {
+        destroy_elements();
+        if (!is_inline())
+        {
+            std::allocator_traits<Alloc>::deallocate(*this, m_heap, m_capacity);
+            m_capacity = N;
+        }
+    }
+
+    /// Release unused capacity, moving the elements back inline if
+    /// they fit. Returns the number of bytes released.
+    size_t shrink_to_fit(void)
+    {
+        if (is_inline() || m_size == m_capacity)
+        {
+            return 0;
+        }
+        const size_t before = bytes_allocated();
+        relocate(m_size);
+        return before - bytes_allocated();
+    }
+
+private:
+    // Used by grow and shrink_to_fit: move elements to new storage with
+    // the given capacity (inline if new_capacity <= N).
+    void relocate(size_t new_capacity)
+    {
+        T*           src          = data();
+        const bool   was_inline   = is_inline();
+        const size_t old_capacity = m_capacity;
+        T*           dst;
+        T*           heap = 0;
+
+        if (new_capacity <= N)
+        {
+            if (was_inline)
+            {
+                return;
+            }
+            dst = inline_data();
+            new_capacity = N;
+        }
+        else
+        {
+            heap = std::allocator_traits<Alloc>::allocate(*this, new_capacity);
+            dst  = heap;
+        }
+
+        // Note that inline_data() overlays m_heap, so the source pointer
+        // must be read (above) before writing any inline element.
+        for (uint32_t i = 0; i < m_size; ++i)
+        {
+            new (dst + i) T(std::move(src[i]));
+            src[i].~T();
+        }
+
+        if (!was_inline)
+        {
+            std::allocator_traits<Alloc>::deallocate(*this, src, old_capacity);
+        }
+        if (heap)
+        {
+            m_heap = heap;
+        }
+        m_capacity = uint32_t(new_capacity);
+    }
+
+    void grow(size_t min_capacity)
+    {
+        if (min_capacity > UINT32_MAX)
+        {
+            throw Error_mem_fail;
+        }
+        size_t new_capacity = size_t(m_capacity) * 2;
+        if (new_capacity < min_capacity)
+        {
+            new_capacity = min_capacity;
+        }
+        if (new_capacity > UINT32_MAX)
+        {
+            new_capacity = UINT32_MAX;
+        }
+        relocate(new_capacity);
+    }
+
+    void destroy_elements(void)
+    {
+        T* d = data();
+        for (uint32_t i = 0; i < m_size; ++i)
+        {
+            d[i].~T();
+        }
+        m_size = 0;
+    }
+
+    inline T* inline_data(void)
+    {
+        return reinterpret_cast<T*>(&m_inline);
+    }
+
+    inline const T* inline_data(void) const
+    {
+        return reinterpret_cast<const T*>(&m_inline);
+    }
+
+    uint32_t m_size;
+    uint32_t m_capacity;
+    union
+    {
+        typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type m_inline;
+        T* m_heap;
+    };
+};
+
+
+#endif // SMALLBUCKET__H
@@ -0,0 +1,214 @@
+/*
+ * Minimal blocking Unix domain socket helpers.
+ *
+ * Author: Barry Drake
+ */
+
+#include "Socket.h"
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+
+/// Fill in a socket address for the path.
+static void make_address(const char* path, sockaddr_un& address)
+{
+    if (std::strlen(path) >= sizeof(address.sun_path))
+    {
+        throw Error_io;
+    }
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path);
+}
+
+
+/// Create an unconnected stream socket.
+static int make_socket(void)
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        throw Error_io;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+
+int Socket::listen_unix(const char* path)
+{
+    sockaddr_un address;
+    make_address(path, address);
+    ::unlink(path);
+
+    int fd = make_socket();
+    if (::bind(fd, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+    {
+        ::close(fd);
+        throw Error_io;
+    }
+    return fd;
+}
+
+
+int Socket::connect_unix(const char* path)
+{
+    sockaddr_un address;
+    make_address(path, address);
+
+    int fd = make_socket();
+    if (::connect(fd, (const sockaddr*)&address, sizeof(address)) != 0)
+    {
+        ::close(fd);
+        throw Error_io;
+    }
+    return fd;
+}
+
+
+int Socket::accept(int listen_fd, int timeout_ms)
+{
+    pollfd p;
+    p.fd      = listen_fd;
+    p.events  = POLLIN;
+    p.revents = 0;
+
+    int ready = ::poll(&p, 1, timeout_ms);
+    if (ready < 0 && errno != EINTR)
+    {
+        throw Error_io;
+    }
+    if (ready <= 0)
+    {
+        return -1;
+    }
+
+    int fd = ::accept(listen_fd, 0, 0);
+    if (fd < 0)
+    {
+        // The client may have given up already; just try again later.
+        return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+
+bool Socket::read_all(int fd, void* data, size_t size)
+{
+    char* cur = (char*)data;
+    char* end = cur + size;
+    while (cur < end)
+    {
+        ssize_t got = ::recv(fd, cur, end - cur, 0);
+        if (got > 0)
+        {
+            cur += got;
+        }
+        else if (got == 0 && cur == (char*)data)
+        {
+            return false;
+        }
+        else if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            throw Error_io;
+        }
+    }
+    return true;
+}
+
+
+void Socket::write_all(int fd, const void* data, size_t size)
+{
+    const char* cur = (const char*)data;
+    const char* end = cur + size;
+    while (cur < end)
+    {
+        ssize_t sent = ::send(fd, cur, end - cur, SEND_FLAGS);
+        if (sent > 0)
+        {
+            cur += sent;
+        }
+        else if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            throw Error_io;
+        }
+    }
+}
+
+
+void Socket::shutdown(int fd)
+{
+    ::shutdown(fd, SHUT_RDWR);
+}
+
+
+void Socket::close(int fd)
+{
+    ::close(fd);
+}
+
+
+#else // _WIN32
+
+
+int Socket::listen_unix(const char* path)
+{
+    throw Error_io;
+}
+
+int Socket::connect_unix(const char* path)
+{
+    throw Error_io;
+}
+
+int Socket::accept(int listen_fd, int timeout_ms)
+{
+    throw Error_io;
+}
+
+bool Socket::read_all(int fd, void* data, size_t size)
+{
+    throw Error_io;
+}
+
+void Socket::write_all(int fd, const void* data, size_t size)
+{
+    throw Error_io;
+}
+
+void Socket::shutdown(int fd)
+{}
+
+void Socket::close(int fd)
+{}
+
+
+#endif // _WIN32
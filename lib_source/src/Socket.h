@@ -0,0 +1,45 @@
+/*
+ * Minimal blocking Unix domain socket helpers, for AStarServer and
+ * AStarClient. Failures are thrown as Error_io.
+ *
+ * These are only available on POSIX systems; elsewhere every
+ * function throws Error_io.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SOCKET__H
+#define SOCKET__H
+
+#include "common.h"
+
+
+namespace Socket
+{
+    /// Create a listening socket at the given path, replacing any
+    /// stale socket file already there.
+    int listen_unix(const char* path);
+
+    /// Connect to the listening socket at the given path.
+    int connect_unix(const char* path);
+
+    /// Accept a connection on a listening socket, waiting no more than
+    /// timeout_ms milliseconds. Returns -1 on timeout.
+    int accept(int listen_fd, int timeout_ms);
+
+    /// Read exactly 'size' bytes. Returns false if the peer closed the
+    /// connection before the first byte (a clean end of requests).
+    bool read_all(int fd, void* data, size_t size);
+
+    /// Write exactly 'size' bytes.
+    void write_all(int fd, const void* data, size_t size);
+
+    /// Stop any blocked reads or writes of the socket (from another thread).
+    void shutdown(int fd);
+
+    /// Close the socket.
+    void close(int fd);
+}
+
+
+#endif // SOCKET__H
@@ -0,0 +1,165 @@
+/*
+ * Nearest lattice point search of sparse vectors in an A* lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#include "SparseAStarNN.h"
+#include "AStarLattice.h"
+#include "Hash.h"
+#include "Scheduler.h"
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+
+SparseAStarNN::SparseAStarNN(Dim_t dim, Distance_t packing_radius)
+    : m_dim(dim)
+    , m_packing_radius(packing_radius)
+    , m_scale(0)
+    , m_sum_powers(0)
+{
+    if (dim <= 0 || dim > (Dim_t(1) << 31))
+    {
+        throw Error_invalid_dim;
+    }
+    if (packing_radius <= 0.0)
+    {
+        throw Error_invalid_packing_radius;
+    }
+    m_scale      = AStarLattice::rho(dim) / packing_radius;
+    m_sum_powers = Hash::sum_powers(dim);
+}
+
+
+K_t SparseAStarNN::nearest_cvector(size_t nnz, const Dim_t* indices, const VElem_t* values,
+                                   CElem_t* c_nonzero, CElem_t& c_zero, CElem_t& c_last) const
+{
+    if (nnz > m_dim)
+    {
+        throw Error_unknown;
+    }
+    std::vector<Dim_t> sorted(indices, indices + nnz);
+    std::sort(sorted.begin(), sorted.end());
+    if (nnz && (sorted.back() >= m_dim || std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()))
+    {
+        throw Error_unknown;
+    }
+
+    //
+    // Map to the lattice space, as AStarLattice::to_lattice_space: the
+    // non-zeros are groups 0 to nnz - 1, the zeros group nnz, and the
+    // last element group nnz + 1.
+    //
+    double sum = 0;
+    for (size_t i = 0; i < nnz; ++i)
+    {
+        sum += values[i];
+    }
+    const double dimpd = m_dim + 1.0;
+    const double v_n   = -sum / sqrt(dimpd);
+    const double t     = (v_n + sum) / m_dim;
+
+    const size_t         num_groups = nnz + 2;
+    std::vector<double>  z(num_groups);
+    std::vector<double>  count(num_groups, 1.0);
+    std::vector<CElem_t> c(num_groups);
+    count[nnz] = double(m_dim - nnz);
+
+    //
+    // As AStarLattice::closest_point, with each group counted as many
+    // times as it has elements.
+    //
+    int64_t sum_c = 0;
+    double  alpha = 0;
+    double  beta  = 0;
+    for (size_t g = 0; g < num_groups; ++g)
+    {
+        const double mapped = (g < nnz) ? m_scale * (values[g] - t) : (g == nnz) ? -m_scale * t : m_scale * v_n;
+        const double y      = mapped / dimpd;
+        c[g]    = round_up<CElem_t>(y);
+        z[g]    = y - c[g];
+        sum_c  += int64_t(count[g]) * c[g];
+        alpha  += count[g] * z[g];
+        beta   += count[g] * z[g] * z[g];
+    }
+
+    // The groups in decreasing order of z, in place of the block sort.
+    std::vector<size_t> order(num_groups);
+    for (size_t g = 0; g < num_groups; ++g)
+    {
+        order[g] = g;
+    }
+    std::sort(order.begin(), order.end(), [&z](size_t a, size_t b) { return z[a] > z[b]; });
+
+    double D    = beta * dimpd - alpha * alpha;
+    size_t best = 0;        // number of groups rounded up
+    for (size_t j = 0; j < num_groups; ++j)
+    {
+        const size_t g = order[j];
+        alpha -= count[g];
+        beta  += count[g] * (1.0 - 2.0 * z[g]);
+
+        const double d = beta * dimpd - alpha * alpha;
+        if (d < D)
+        {
+            D    = d;
+            best = j + 1;
+        }
+    }
+    for (size_t j = 0; j < best; ++j)
+    {
+        const size_t g = order[j];
+        c[g]  += 1;
+        sum_c += int64_t(count[g]);
+    }
+
+    const int64_t dimp = int64_t(m_dim) + 1;
+    const int64_t k    = ((-sum_c % dimp) + dimp) % dimp;  // k = -sum mod dimp
+    const int64_t s_k  = (sum_c + k) / dimp;
+
+    for (size_t i = 0; i < nnz; ++i)
+    {
+        c_nonzero[i] = CElem_t(c[i] - s_k);
+    }
+    c_zero = CElem_t(c[nnz] - s_k);
+    c_last = CElem_t(c[nnz + 1] - s_k);
+    return K_t(k);
+}
+
+
+Hash_t SparseAStarNN::nearest_hash(size_t nnz, const Dim_t* indices, const VElem_t* values) const
+{
+    std::vector<CElem_t> c_nonzero(nnz);
+    CElem_t              c_zero;
+    CElem_t              c_last;
+    nearest_cvector(nnz, indices, values, c_nonzero.data(), c_zero, c_last);
+
+    //
+    // As Hash::hash, where the zeros contribute c_zero times the sum of
+    // the powers of their indices.
+    //
+    Hash_t hash_code    = (Hash_t)c_last * Hash::power(m_dim);
+    Hash_t nonzero_sum  = 0;
+    for (size_t i = 0; i < nnz; ++i)
+    {
+        const Hash_t power = Hash::power(indices[i]);
+        hash_code   += (Hash_t)c_nonzero[i] * power;
+        nonzero_sum += power;
+    }
+    hash_code += (Hash_t)c_zero * (m_sum_powers - nonzero_sum);
+    return hash_code;
+}
+
+
+void SparseAStarNN::nearest_hashes(size_t num_vectors, const size_t* offsets, const Dim_t* indices, const VElem_t* values,
+                                   Hash_t* hashes, size_t num_threads) const
+{
+    parallel_for(num_vectors, num_threads, 0, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            hashes[i] = nearest_hash(offsets[i + 1] - offsets[i], indices + offsets[i], values + offsets[i]);
+        }
+    });
+}
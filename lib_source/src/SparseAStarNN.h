@@ -0,0 +1,82 @@
+/*
+ * Nearest lattice point search of sparse vectors in an A* lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef SPARSEASTARNN__H
+#define SPARSEASTARNN__H
+
+#include "common.h"
+
+
+///
+/// A SparseAStarNN finds the A* lattice points nearest to sparse vectors,
+/// given by the indices and values of their non-zero elements, in time
+/// proportional to nnz log nnz (rather than to the dimension, n).
+///
+/// All the zero elements of a vector map to the same value in the lattice
+/// space, so they round alike and form a single group in the sort of
+/// McKilliam's algorithm (see AStarLattice::closest_point). The nearest
+/// lattice point is found by sorting the nnz + 2 groups instead of
+/// bucketing all n + 1 elements, and its c-vector is given in the same
+/// sparse form: an element for each non-zero, one element shared by all
+/// the zeros, and the last element (of index n).
+///
+/// Indices are 32 bits, so dimensions up to 2^31 can be used, and no
+/// memory of the order of the dimension is needed. The hash codes are the
+/// same as those of AStarNN::nearest_hash for the dense vectors.
+///
+class SparseAStarNN
+{
+public:
+    /// \param[in]  dim             number of dimensions of the vectors, n.
+    /// \param[in]  packing_radius  packing radius of the A* lattice.
+    ///
+    SparseAStarNN(Dim_t dim, Distance_t packing_radius);
+
+    inline Dim_t dim(void) const
+    {
+        return m_dim;
+    }
+
+    inline Distance_t packing_radius(void) const
+    {
+        return m_packing_radius;
+    }
+
+    inline Distance_t scale(void) const
+    {
+        return m_scale;
+    }
+
+    /// Find the lattice point nearest to the sparse vector with the given
+    /// nnz (distinct) indices and values, in any order.
+    ///
+    /// \param[out] c_nonzero   nnz elements of the c-vector, those of the given indices.
+    /// \param[out] c_zero      the element of the c-vector at all the other indices below n.
+    /// \param[out] c_last      the element of the c-vector at index n.
+    /// \return the k value of the lattice point.
+    ///
+    K_t nearest_cvector(size_t nnz, const Dim_t* indices, const VElem_t* values,
+                        CElem_t* c_nonzero, CElem_t& c_zero, CElem_t& c_last) const;
+
+    /// The hash code of the lattice point nearest to the sparse vector.
+    Hash_t nearest_hash(size_t nnz, const Dim_t* indices, const VElem_t* values) const;
+
+    /// The hash codes of the lattice points nearest to num_vectors sparse
+    /// vectors, in compressed sparse row form: vector i has the elements
+    /// offsets[i] to offsets[i + 1] - 1 of indices and values. Uses
+    /// num_threads threads (see parallel_for).
+    void nearest_hashes(size_t num_vectors, const size_t* offsets, const Dim_t* indices, const VElem_t* values,
+                        Hash_t* hashes, size_t num_threads = 1) const;
+
+private:
+    Dim_t           m_dim;
+    Distance_t      m_packing_radius;
+    Distance_t      m_scale;
+    Hash_t          m_sum_powers;   // sum of the hash powers of indices 0 to n - 1
+};
+
+
+#endif // SPARSEASTARNN__H
@@ -0,0 +1,367 @@
+/*
+ * Affine transforms of vectors applied as they are mapped to a lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#include "VectorTransform.h"
+#include "Scheduler.h"
+#include <algorithm>
+#include <math.h>
+#include <mutex>
+
+
+VectorTransform::VectorTransform(bool diagonal, Dim_t input_dim, Dim_t output_dim)
+    : m_diagonal(diagonal)
+    , m_input_dim(input_dim)
+    , m_output_dim(output_dim)
+    , m_offset(input_dim, 0)
+    , m_weights(diagonal ? size_t(input_dim) : size_t(input_dim) * output_dim, 1)
+    , m_bias(output_dim, 0)
+{
+    if (input_dim <= 0 || output_dim <= 0 || output_dim > input_dim)
+    {
+        throw Error_invalid_dim;
+    }
+}
+
+
+VectorTransform VectorTransform::diagonal(Dim_t dim, const VElem_t* offset, const VElem_t* scale)
+{
+    VectorTransform transform(true, dim, dim);
+    if (offset)
+    {
+        transform.m_offset.assign(offset, offset + dim);
+    }
+    if (scale)
+    {
+        transform.m_weights.assign(scale, scale + dim);
+    }
+    transform._set_bias();
+    return transform;
+}
+
+
+VectorTransform VectorTransform::whitening(Dim_t input_dim, Dim_t output_dim, const VElem_t* offset, const VElem_t* matrix)
+{
+    VectorTransform transform(false, input_dim, output_dim);
+    if (offset)
+    {
+        transform.m_offset.assign(offset, offset + input_dim);
+    }
+    transform.m_weights.assign(matrix, matrix + size_t(input_dim) * output_dim);
+    transform._set_bias();
+    return transform;
+}
+
+
+void VectorTransform::_set_bias(void)
+{
+    const size_t n = m_input_dim;
+    for (size_t i = 0; i < size_t(m_output_dim); ++i)
+    {
+        if (m_diagonal)
+        {
+            m_bias[i] = -m_weights[i] * m_offset[i];
+        }
+        else
+        {
+            const VElem_t* w = m_weights.data() + i * n;
+            double sum = 0;
+            for (size_t j = 0; j < n; ++j)
+            {
+                sum += w[j] * m_offset[j];
+            }
+            m_bias[i] = VElem_t(-sum);
+        }
+    }
+}
+
+
+void VectorTransform::apply(const VElem_t* v_in, VElem_t* v_out) const
+{
+    const size_t    n = m_input_dim;
+    const VElem_t*  w = m_weights.data();
+    if (m_diagonal)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            v_out[i] = w[i] * v_in[i] + m_bias[i];
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < size_t(m_output_dim); ++i, w += n)
+        {
+            double sum = m_bias[i];
+            for (size_t j = 0; j < n; ++j)
+            {
+                sum += w[j] * v_in[j];
+            }
+            v_out[i] = VElem_t(sum);
+        }
+    }
+}
+
+
+void VectorTransform::apply(const VElem_t* vectors, size_t num_vectors, VElem_t* out, size_t num_threads) const
+{
+    parallel_for(num_vectors, num_threads, 0, [this, vectors, out](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            apply(vectors + i * m_input_dim, out + i * m_output_dim);
+        }
+    });
+}
+
+
+/// The mean of a sample, summed in parallel.
+static std::vector<double> sample_mean(Dim_t dim, const VElem_t* sample, size_t num_vectors, size_t num_threads)
+{
+    std::mutex          lock;
+    std::vector<double> mean(dim, 0.0);
+
+    parallel_for(num_vectors, num_threads, 0, [&](size_t begin, size_t end)
+    {
+        std::vector<double> sum(dim, 0.0);
+        for (size_t i = begin; i < end; ++i)
+        {
+            const VElem_t* v = sample + i * dim;
+            for (Dim_t j = 0; j < dim; ++j)
+            {
+                sum[j] += v[j];
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (Dim_t j = 0; j < dim; ++j)
+        {
+            mean[j] += sum[j];
+        }
+    });
+
+    for (Dim_t j = 0; j < dim; ++j)
+    {
+        mean[j] /= double(num_vectors);
+    }
+    return mean;
+}
+
+
+VectorTransform VectorTransform::fit_diagonal(Dim_t dim, const VElem_t* sample, size_t num_vectors, size_t num_threads)
+{
+    VectorTransform transform(true, dim, dim);
+    if (num_vectors < 2)
+    {
+        throw Error_unknown;
+    }
+
+    const std::vector<double> mean = sample_mean(dim, sample, num_vectors, num_threads);
+
+    std::mutex          lock;
+    std::vector<double> variance(dim, 0.0);
+
+    parallel_for(num_vectors, num_threads, 0, [&](size_t begin, size_t end)
+    {
+        std::vector<double> sum(dim, 0.0);
+        for (size_t i = begin; i < end; ++i)
+        {
+            const VElem_t* v = sample + i * dim;
+            for (Dim_t j = 0; j < dim; ++j)
+            {
+                const double d = v[j] - mean[j];
+                sum[j] += d * d;
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (Dim_t j = 0; j < dim; ++j)
+        {
+            variance[j] += sum[j];
+        }
+    });
+
+    for (Dim_t j = 0; j < dim; ++j)
+    {
+        const double var = variance[j] / double(num_vectors - 1);
+        transform.m_offset[j]  = VElem_t(mean[j]);
+        transform.m_weights[j] = var > 0 ? VElem_t(1.0 / sqrt(var)) : VElem_t(1);
+    }
+    transform._set_bias();
+    return transform;
+}
+
+
+///
+/// Diagonalise the n x n symmetric matrix a (row major) by cyclic Jacobi
+/// rotations. On return the diagonal of a holds the eigenvalues and the
+/// columns of v (n x n) the matching unit eigenvectors.
+///
+static void jacobi_eigen(size_t n, std::vector<double>& a, std::vector<double>& v)
+{
+    v.assign(n * n, 0.0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        v[i * n + i] = 1.0;
+    }
+
+    double total = 0;
+    for (size_t i = 0; i < n * n; ++i)
+    {
+        total += a[i] * a[i];
+    }
+
+    for (int sweep = 0; sweep < 100; ++sweep)
+    {
+        double off = 0;
+        for (size_t p = 0; p < n; ++p)
+        {
+            for (size_t q = p + 1; q < n; ++q)
+            {
+                off += a[p * n + q] * a[p * n + q];
+            }
+        }
+        if (off <= 1e-30 * total)
+        {
+            return;
+        }
+
+        for (size_t p = 0; p < n; ++p)
+        {
+            for (size_t q = p + 1; q < n; ++q)
+            {
+                const double apq = a[p * n + q];
+                if (apq == 0)
+                {
+                    continue;
+                }
+
+                // The rotation that zeroes a[p][q] (Numerical Recipes, 11.1).
+                const double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                const double t     = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1));
+                const double c     = 1 / sqrt(t * t + 1);
+                const double s     = t * c;
+
+                for (size_t k = 0; k < n; ++k)
+                {
+                    const double akp = a[k * n + p];
+                    const double akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (size_t k = 0; k < n; ++k)
+                {
+                    const double apk = a[p * n + k];
+                    const double aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (size_t k = 0; k < n; ++k)
+                {
+                    const double vkp = v[k * n + p];
+                    const double vkq = v[k * n + q];
+                    v[k * n + p] = c * vkp - s * vkq;
+                    v[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+
+VectorTransform VectorTransform::fit_whitening(Dim_t dim, Dim_t output_dim, const VElem_t* sample, size_t num_vectors,
+                                               double epsilon, size_t num_threads)
+{
+    VectorTransform transform(false, dim, output_dim);
+    if (num_vectors < 2 || !(epsilon >= 0))
+    {
+        throw Error_unknown;
+    }
+
+    const size_t                n    = dim;
+    const std::vector<double>   mean = sample_mean(dim, sample, num_vectors, num_threads);
+
+    //
+    // The covariance, accumulated (upper triangle only) per range of rows
+    // and then summed.
+    //
+    std::mutex          lock;
+    std::vector<double> cov(n * n, 0.0);
+
+    parallel_for(num_vectors, num_threads, 0, [&](size_t begin, size_t end)
+    {
+        std::vector<double> d(n);
+        std::vector<double> sum(n * n, 0.0);
+        for (size_t i = begin; i < end; ++i)
+        {
+            const VElem_t* v = sample + i * n;
+            for (size_t j = 0; j < n; ++j)
+            {
+                d[j] = v[j] - mean[j];
+            }
+            for (size_t j = 0; j < n; ++j)
+            {
+                const double dj  = d[j];
+                double*      row = sum.data() + j * n;
+                for (size_t k = j; k < n; ++k)
+                {
+                    row[k] += dj * d[k];
+                }
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t j = 0; j < n; ++j)
+        {
+            for (size_t k = j; k < n; ++k)
+            {
+                cov[j * n + k] += sum[j * n + k];
+            }
+        }
+    });
+
+    for (size_t j = 0; j < n; ++j)
+    {
+        for (size_t k = j; k < n; ++k)
+        {
+            cov[j * n + k] /= double(num_vectors - 1);
+            cov[k * n + j]  = cov[j * n + k];
+        }
+    }
+
+    std::vector<double> eigenvectors;
+    jacobi_eigen(n, cov, eigenvectors);
+
+    // The principal axes, largest variance first.
+    std::vector<size_t> axes(n);
+    for (size_t j = 0; j < n; ++j)
+    {
+        axes[j] = j;
+    }
+    std::stable_sort(axes.begin(), axes.end(), [&cov, n](size_t a, size_t b)
+    {
+        return cov[a * n + a] > cov[b * n + b];
+    });
+
+    for (size_t i = 0; i < size_t(output_dim); ++i)
+    {
+        const size_t axis     = axes[i];
+        const double variance = std::max(cov[axis * n + axis], 0.0) + epsilon;
+        if (!(variance > 0))
+        {
+            // The sample spans fewer than output_dim dimensions.
+            throw Error_invalid_dim;
+        }
+        const double gain = 1 / sqrt(variance);
+
+        VElem_t* w = transform.m_weights.data() + i * n;
+        for (size_t j = 0; j < n; ++j)
+        {
+            w[j] = VElem_t(eigenvectors[j * n + axis] * gain);
+        }
+    }
+    for (size_t j = 0; j < n; ++j)
+    {
+        transform.m_offset[j] = VElem_t(mean[j]);
+    }
+    transform._set_bias();
+    return transform;
+}
@@ -0,0 +1,134 @@
+/*
+ * Affine transforms of vectors applied as they are mapped to a lattice.
+ *
+ * Author: Barry Drake
+ */
+
+#ifndef VECTORTRANSFORM__H
+#define VECTORTRANSFORM__H
+
+#include "common.h"
+#include <vector>
+
+
+///
+/// A VectorTransform is an affine map, y = W (x - offset), from input
+/// vectors of input_dim() elements to output vectors of output_dim()
+/// elements, which is either
+///     (1) diagonal: y_i = scale_i (x_i - offset_i), e.g. z-scoring, or
+///     (2) whitening: W is a (truncated) PCA whitening matrix, with the
+///         output_dim() <= input_dim() rows of W the principal axes of
+///         the sample, each divided by its standard deviation.
+///
+/// An AStarNN can be given a transform, so that it is applied within the
+/// mapping of each vector to the lattice space (see AStarLattice::to_lattice_space)
+/// rather than as a separate pass over the vectors.
+///
+class VectorTransform
+{
+public:
+    /// A diagonal transform.
+    ///
+    /// \param[in]  dim     number of dimensions of the vectors, n.
+    /// \param[in]  offset  n dimensional offset, or null for zero.
+    /// \param[in]  scale   n dimensional scale, or null for one.
+    ///
+    static VectorTransform diagonal(Dim_t dim, const VElem_t* offset, const VElem_t* scale);
+
+    /// A general (whitening) transform.
+    ///
+    /// \param[in]  input_dim   number of dimensions of the input vectors, n.
+    /// \param[in]  output_dim  number of dimensions of the output vectors, m <= n.
+    /// \param[in]  offset      n dimensional offset (e.g. the mean), or null for zero.
+    /// \param[in]  matrix      m x n matrix W, row major.
+    ///
+    static VectorTransform whitening(Dim_t input_dim, Dim_t output_dim, const VElem_t* offset, const VElem_t* matrix);
+
+    /// Fit a diagonal transform to a sample of num_vectors vectors (stored
+    /// one after the other), that maps the sample to zero mean and unit
+    /// variance in each dimension. A dimension with no variance is not
+    /// scaled. Uses num_threads threads (see parallel_for).
+    static VectorTransform fit_diagonal(Dim_t dim, const VElem_t* sample, size_t num_vectors, size_t num_threads = 1);
+
+    /// Fit a PCA whitening transform to a sample of num_vectors vectors,
+    /// keeping the output_dim principal axes of largest variance. So the
+    /// sample is mapped to zero mean and (up to epsilon) unit covariance.
+    /// epsilon (>= 0) is added to each variance before dividing by its
+    /// square root, to limit the gain of the axes with little variance.
+    /// Uses num_threads threads for the mean and covariance.
+    static VectorTransform fit_whitening(Dim_t dim, Dim_t output_dim, const VElem_t* sample, size_t num_vectors,
+                                         double epsilon = 0, size_t num_threads = 1);
+
+    inline bool is_diagonal(void) const
+    {
+        return m_diagonal;
+    }
+
+    inline Dim_t input_dim(void) const
+    {
+        return m_input_dim;
+    }
+
+    inline Dim_t output_dim(void) const
+    {
+        return m_output_dim;
+    }
+
+    /// The input_dim() dimensional offset.
+    inline const VElem_t* offset(void) const
+    {
+        return m_offset.data();
+    }
+
+    /// The weights: the input_dim() scales of a diagonal transform, or
+    /// the output_dim() x input_dim() matrix W (row major).
+    inline const VElem_t* weights(void) const
+    {
+        return m_weights.data();
+    }
+
+    /// The output_dim() dimensional bias, b = -W offset, so y = W x + b.
+    inline const VElem_t* bias(void) const
+    {
+        return m_bias.data();
+    }
+
+    /// Are the transforms the same (the same kind, dimensions and parameters).
+    inline bool operator==(const VectorTransform& other) const
+    {
+        return m_diagonal == other.m_diagonal && m_input_dim == other.m_input_dim &&
+               m_output_dim == other.m_output_dim && m_offset == other.m_offset && m_weights == other.m_weights;
+    }
+
+    inline bool operator!=(const VectorTransform& other) const
+    {
+        return !(*this == other);
+    }
+
+    /// Transform one vector.
+    ///
+    /// \param[in]  v_in    input_dim() dimensional vector.
+    /// \param[out] v_out   output_dim() dimensional vector (not v_in).
+    ///
+    void apply(const VElem_t* v_in, VElem_t* v_out) const;
+
+    /// Transform num_vectors vectors (stored one after the other), using
+    /// num_threads threads.
+    void apply(const VElem_t* vectors, size_t num_vectors, VElem_t* out, size_t num_threads = 1) const;
+
+private:
+    VectorTransform(bool diagonal, Dim_t input_dim, Dim_t output_dim);
+
+    /// Set the bias from the offset and the weights.
+    void _set_bias(void);
+
+    bool                    m_diagonal;
+    Dim_t                   m_input_dim;
+    Dim_t                   m_output_dim;
+    std::vector<VElem_t>    m_offset;
+    std::vector<VElem_t>    m_weights;
+    std::vector<VElem_t>    m_bias;
+};
+
+
+#endif // VECTORTRANSFORM__H
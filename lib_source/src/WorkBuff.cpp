@@ -5,8 +5,7 @@
  */
 
 #include "WorkBuff.h"
-
-#include <stdlib.h>
+#include "Allocator.h"
 
 
 BuffStack::BuffStack(Dim_t dim, size_t num_buffers)
@@ -18,11 +17,7 @@ BuffStack::BuffStack(Dim_t dim, size_t num_buffers)
 	}
 
 	size_t size = WorkBuff::size(dim);
-	char*  mem  = static_cast<char*>(malloc(size * num_buffers));
-	if (!mem)
-	{
-		throw Error_mem_fail;
-	}
+	char*  mem  = static_cast<char*>(Memory::alloc(size * num_buffers));
 	m_buffers = (WorkBuff*) mem;
 
 	// initize the links
@@ -37,8 +32,5 @@ BuffStack::BuffStack(Dim_t dim, size_t num_buffers)
 
 BuffStack::~BuffStack(void)
 {
-	if (m_buffers)
-	{
-		free(m_buffers);
-	}
+	Memory::free(m_buffers);
 }
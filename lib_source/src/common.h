@@ -34,6 +34,10 @@ typedef __int64          int64_t;
 
 #include <stddef.h>
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
 /*
 // for simple DEBUG
 
@@ -111,6 +115,7 @@ enum Error
     Error_invalid_packing_radius,
 	Error_in_callback,
 	Error_insufficient_buffers,
+	Error_io,
     Error_unknown
 };
 
@@ -127,6 +132,7 @@ inline const char* error_to_string(Error err)
         case Error_invalid_packing_radius: return "Error_invalid_packing_radius";
         case Error_in_callback: return "Error_in_callback";
 		case Error_insufficient_buffers: return "Error_insufficient_buffers";
+		case Error_io: return "Error_io";
         case Error_unknown: return "Error_unknown";
         default: return "<unknown error code>";
     }
@@ -143,6 +149,17 @@ inline void ASSERT(bool expression)
 }
 
 
+/// Hint to the processor that the given address will soon be read.
+inline void prefetch(const void* address)
+{
+#if defined(_MSC_VER)
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+    __builtin_prefetch(address);
+#endif
+}
+
+
 /// Round a double, x, to a T such that round_up(x) = (T)floor(x + 0.5).
 /// Assumes T is an integer type.
 ///